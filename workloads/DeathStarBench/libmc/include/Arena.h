@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdlib>
+#include <vector>
+
+namespace douban {
+namespace mc {
+namespace io {
+
+// Bump allocator for result bytes that must be contiguous but are not in a
+// single DataBlock: values and keys spanning blocks, decompressed values.
+// Everything is released at once by reset(), which keeps the memory for the
+// next command; chunks a burst needed are merged so a steady workload stops
+// allocating altogether.
+class Arena {
+ public:
+  Arena();
+  ~Arena();
+
+  // valid until the next reset()
+  char* allocate(size_t len);
+  void reset();
+  size_t capacity() const;
+
+ protected:
+  struct Chunk {
+    char* data;
+    size_t capacity;
+  };
+  std::vector<Chunk> m_chunks; // the last one is being filled
+  size_t m_used; // bytes used in m_chunks.back()
+
+ private:
+  Arena(const Arena&);
+  Arena& operator=(const Arena&);
+};
+
+} // namespace io
+} // namespace mc
+} // namespace douban
@@ -9,6 +9,7 @@
 #include "Export.h"
 #include "Common.h"
 #include "DataBlock.h"
+#include "Arena.h"
 
 #ifdef MC_USE_SMALL_VECTOR
 #include "llvm/SmallVector.h"
@@ -50,7 +51,9 @@ typedef std::vector<DataBlockSlice> TokenData;
 #endif
 
 void freeTokenData(TokenData& td);
-char* parseTokenData(TokenData& td, size_t reserved);
+// Contiguous bytes of `td`: in place if it is a single slice, otherwise a
+// copy, new[]-ed or (if given) from `arena`.
+char* parseTokenData(TokenData& td, size_t reserved, Arena* arena = NULL);
 void copyTokenData(const TokenData& src, TokenData& dst);
 
 
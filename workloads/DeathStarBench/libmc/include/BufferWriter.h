@@ -23,6 +23,8 @@ class BufferWriter {
   void reserve(size_t n);
   void takeBuffer(const char* const buf, size_t buf_len);
   void takeNumber(int64_t val);
+  // like takeBuffer, but `buf` is new[]-ed and freed on reset()
+  void takeOwnedBuffer(char* buf, size_t buf_len);
   const struct iovec* const getReadPtr(size_t &n);
   void commitRead(size_t nSent);
   void rewind();
@@ -32,7 +34,7 @@ class BufferWriter {
  protected:
   std::vector<struct iovec> m_iovec;
   std::vector<struct iovec> m_originalIovec;
-  std::vector<char*>  m_unsignedStringList;
+  std::vector<char*>  m_unsignedStringList; // also holds owned buffers
 
   // the index of iovec vector we'll read next
   size_t m_readIdx;
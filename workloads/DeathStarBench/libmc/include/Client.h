@@ -66,6 +66,66 @@ DECL_RETRIEVAL_CMD(gets)
            const bool noreply,
            unsigned_result_t** result, size_t* nResults);
 
+  // meta commands, results carry the request index as opaque
+  void destroyMetaResult();
+  err_code_t metaGet(const char* const* keys, const size_t* keyLens, size_t nKeys,
+                     const meta_flags_t metaFlags, const exptime_t exptime,
+                     meta_result_t*** results, size_t* nResults);
+  err_code_t metaSet(const char* const* keys, const size_t* keyLens,
+                     const flags_t* flags, const cas_unique_t* cas_uniques,
+                     const char* const* vals, const size_t* valLens, size_t nItems,
+                     const meta_flags_t metaFlags, const exptime_t exptime,
+                     meta_result_t*** results, size_t* nResults);
+  err_code_t metaDelete(const char* const* keys, const size_t* keyLens,
+                        const cas_unique_t* cas_uniques, size_t nItems,
+                        const meta_flags_t metaFlags,
+                        meta_result_t*** results, size_t* nResults);
+  err_code_t metaArithmetic(const char* const* keys, const size_t* keyLens, size_t nItems,
+                            const uint64_t delta, const uint64_t initial,
+                            const meta_flags_t metaFlags, const exptime_t exptime,
+                            meta_result_t*** results, size_t* nResults);
+
+  // non-blocking commands: submit one, then call processAsync() whenever
+  // asyncFd() is readable or asyncTimeout() ms have passed, until its
+  // callback has run. One command (blocking or not) at a time per Client;
+  // a callback may submit the next one, which ends the current results.
+  // Returns the early error (and never calls back) if nothing was sent.
+  // A NULL callback just drops the results (e.g. noreply commands).
+  err_code_t asyncGet(const char* const* keys, const size_t* keyLens, size_t nKeys,
+                      retrieval_callback_t callback, void* ctx);
+  err_code_t asyncGets(const char* const* keys, const size_t* keyLens, size_t nKeys,
+                       retrieval_callback_t callback, void* ctx);
+#define DECL_ASYNC_STORAGE_CMD(M) \
+  err_code_t M(const char* const* keys, const size_t* keyLens, \
+           const flags_t* flags, const exptime_t exptime, \
+           const cas_unique_t* cas_uniques, const bool noreply, \
+           const char* const* vals, const size_t* valLens, \
+           size_t nItems, message_callback_t callback, void* ctx)
+
+  DECL_ASYNC_STORAGE_CMD(asyncSet);
+  DECL_ASYNC_STORAGE_CMD(asyncAdd);
+  DECL_ASYNC_STORAGE_CMD(asyncReplace);
+  DECL_ASYNC_STORAGE_CMD(asyncAppend);
+  DECL_ASYNC_STORAGE_CMD(asyncPrepend);
+  DECL_ASYNC_STORAGE_CMD(asyncCas);
+#undef DECL_ASYNC_STORAGE_CMD
+  err_code_t asyncDelete(const char* const* keys, const size_t* keyLens,
+                         const bool noreply, size_t nItems,
+                         message_callback_t callback, void* ctx);
+  err_code_t asyncTouch(const char* const* keys, const size_t* keyLens,
+                        const exptime_t exptime, const bool noreply, size_t nItems,
+                        message_callback_t callback, void* ctx);
+
+  // -1 when idle (nothing to wait for), 0: call processAsync() right away
+  int asyncTimeout() const;
+  inline int asyncFd() const {
+    return pollFd();
+  }
+  inline bool asyncPending() const {
+    return m_asyncState == ASYNC_PENDING;
+  }
+  void processAsync();
+
   inline void toggleFlushAllFeature(bool enabled) {
     m_flushAllEnabled = enabled;
   }
@@ -76,13 +136,29 @@ DECL_RETRIEVAL_CMD(gets)
   void collectMessageResult(message_result_t*** results, size_t* nResults);
   void collectBroadcastResult(broadcast_result_t** results, size_t* nHosts, bool isFlushAll=false);
   void collectUnsignedResult(unsigned_result_t** results, size_t* nResults);
+  void collectMetaResult(meta_result_t*** results, size_t* nResults);
 
   std::vector<retrieval_result_t*> m_outRetrievalResultPtrs;
   std::vector<message_result_t*> m_outMessageResultPtrs;
   std::vector<broadcast_result_t> m_outBroadcastResultPtrs;
   std::vector<unsigned_result_t*> m_outUnsignedResultPtrs;
+  std::vector<meta_result_t*> m_outMetaResultPtrs;
 
   bool m_flushAllEnabled;
+
+  enum async_state_t {
+    ASYNC_IDLE,
+    ASYNC_PENDING,
+    ASYNC_COMPLETING,  // the callback is running, results still held
+  };
+  err_code_t startAsync(retrieval_callback_t retrievalCallback,
+                        message_callback_t messageCallback, void* ctx);
+  void endAsync();
+
+  async_state_t m_asyncState;
+  retrieval_callback_t m_retrievalCallback;
+  message_callback_t m_messageCallback;
+  void* m_asyncCtx;
 };
 
 } // namespace mc
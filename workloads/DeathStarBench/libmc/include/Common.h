@@ -18,6 +18,13 @@
 #define MC_DEFAULT_RETRY_TIMEOUT 5
 #define MC_DEFAULT_MAX_RETRIES 0
 
+// Linux keeps one persistent epoll instance per ConnectionPool,
+// other platforms fall back to rebuilding a pollfd array per command.
+#if defined(__linux__)
+#define MC_USE_EPOLL
+#define MC_EPOLL_MAX_EVENTS 64
+#endif
+
 
 #ifdef UIO_MAXIOV
 #define MC_UIO_MAXIOV UIO_MAXIOV
@@ -44,8 +51,16 @@
 #define MC_MSG_MORE 0
 #endif
 
+#ifdef POLLRDHUP
+#define MC_POLLRDHUP POLLRDHUP
+#else
+#define MC_POLLRDHUP 0
+#endif
+
 
 #define MIN_DATABLOCK_CAPACITY 8192
+#define MIN_ARENA_CAPACITY 8192
+#define MAX_ARENA_RETAINED (1 << 20)  // per connection, kept across commands
 #define MIN(A, B) (((A) > (B)) ? (B) : (A))
 #define MAX(A, B) (((A) < (B)) ? (B) : (A))
 #define CSTR(STR) (const_cast<char*>(STR))
@@ -174,6 +189,11 @@ typedef enum {
   // [0-9] // INCR/DECR
   FSM_INCR_DECR_START, // got [0-9]
   FSM_INCR_DECR_REMAINING, // not got "\r\n"
+
+  // <CD>[ <size>][ <flag>]*\r\n
+  // [<data block>\r\n]
+  FSM_META_START, // got "HD", "VA", "EN", "NF", "NS" or "EX"
+  FSM_META_VALUE_REMAINING, // not got <data block> + "\r\n"
 } parser_state_t;
 
 #define IS_END_STATE(st) ((st) == FSM_END or (st) == FSM_ERROR)
@@ -219,6 +239,17 @@ typedef enum {
   // text msg
   DELETE_OP,
 
+  // mg/ms/md/ma <key>[ <datalen>][ <flag>]*\r\n
+  // [<data block>\r\n]
+  // ...
+  // mn\r\n
+  // ->
+  // meta replies, then "MN\r\n"
+  META_GET_OP,
+  META_SET_OP,
+  META_DELETE_OP,
+  META_ARITHMETIC_OP,
+
   STATS_OP,
   FLUSHALL_OP,
   VERSION_OP,
@@ -7,7 +7,7 @@
 #include <queue>
 
 #include "Common.h"
-#include "BufferReader.h"
+#include "Reader.h"
 #include "BufferWriter.h"
 #include "Parser.h"
 #include "Result.h"
@@ -40,6 +40,7 @@ class Connection {
     size_t requestKeyCount();
     void setParserMode(ParserMode md);
     void takeNumber(int64_t val);
+    void takeOwnedBuffer(char* buf, size_t buf_len);
     ssize_t send();
     ssize_t recv(bool peek = false);
     void process(err_code_t& err);
@@ -47,6 +48,8 @@ class Connection {
     types::MessageResultList* getMessageResults();
     types::LineResultList* getLineResults();
     types::UnsignedResultList* getUnsignedResults();
+    types::MetaResultList* getMetaResults();
+    io::Arena& getArena();
 
     std::vector<struct iovec>* getRequestKeys();
 
@@ -60,6 +63,11 @@ class Connection {
 
     size_t m_counter;
 
+    // poll state owned by ConnectionPool::waitPoll
+    short m_pollEvents; // POLLOUT/POLLIN still wanted, 0 if not in flight
+    int64_t m_pollDeadline; // monotonic ms, refreshed on every send/recv
+    bool m_pollRegistered; // socket is in the pool's epoll set
+
  protected:
     int connectPoll(int fd, struct addrinfo* ai_ptr);
 
@@ -72,8 +80,9 @@ class Connection {
     bool m_hasAlias;
     time_t m_deadUntil;
     io::BufferWriter* m_buffer_writer; // for send
-    io::BufferReader* m_buffer_reader; // for recv
+    io::Reader* m_buffer_reader; // for recv
     PacketParser m_parser;
+    io::Arena m_arena; // contiguous copies for results, until reset()
 
     int m_connectTimeout;
     int m_retryTimeout;
@@ -110,6 +119,10 @@ inline const bool Connection::isSent() {
   return m_buffer_writer->isRead();
 }
 
+inline io::Arena& Connection::getArena() {
+  return m_arena;
+}
+
 inline const int Connection::getRetryTimeout() {
   return m_retryTimeout;
 }
@@ -13,6 +13,7 @@ class ConnectionPool {
   ConnectionPool();
   ~ConnectionPool();
   void setHashFunction(hash_function_options_t fn_opt);
+  void setDistribution(distribution_options_t dist_opt);
   int init(const char* const * hosts, const uint32_t* ports, const size_t n,
            const char* const * aliases = NULL);
   int updateServers(const char* const * hosts, const uint32_t* ports, const size_t n,
@@ -35,32 +36,66 @@ class ConnectionPool {
                      const exptime_t exptime, const bool noreply, size_t nItems);
   void dispatchIncrDecr(op_code_t op, const char* key, const size_t keyLen,
                         const uint64_t delta, const bool noreply);
+  void dispatchMeta(op_code_t op, const char* const* keys, const size_t* keyLens,
+                    const flags_t* flags, const cas_unique_t* cas_uniques,
+                    const char* const* vals, const size_t* valLens, size_t nItems,
+                    const meta_flags_t metaFlags, const exptime_t exptime,
+                    const uint64_t delta, const uint64_t initial);
   void broadcastCommand(const char * const cmd, const size_t cmdLen, const bool noreply=false);
 
   err_code_t waitPoll();
 
+  // waitPoll() in non-blocking steps, for an external event loop:
+  // startPoll() sends what it can and fails early like waitPoll(), then
+  // stepPoll() waits at most `maxWait` ms (-1: until the next deadline) and
+  // returns true once every connection is done; pollRetCode() is then what
+  // waitPoll() would have returned. pollFd() (-1 without epoll) turns
+  // readable whenever stepPoll() has work, nextPollTimeout() is how long
+  // a loop may wait for that before calling it anyway.
+  err_code_t startPoll();
+  bool stepPoll(int maxWait);
+  inline err_code_t pollRetCode() const {
+    return m_pollRetCode;
+  }
+  int pollFd() const;
+  int nextPollTimeout() const;
+
   void collectRetrievalResult(std::vector<retrieval_result_t*>& results);
   void collectMessageResult(std::vector<message_result_t*>& results);
   void collectBroadcastResult(std::vector<broadcast_result_t>& results, bool isFlushAll=false);
   void collectUnsignedResult(std::vector<unsigned_result_t*>& results);
+  void collectMetaResult(std::vector<meta_result_t*>& results);
   void reset();
   void setPollTimeout(int timeout);
   void setConnectTimeout(int timeout);
   void setRetryTimeout(int timeout);
   void setMaxRetries(int max_retries);
+  void setCompressThreshold(int threshold);
 
  protected:
-  void markDeadAll(pollfd_t* pollfds, const char* reason);
-  void markDeadConn(Connection* conn, const char* reason, pollfd_t* fd_ptr);
-  void rewindConn(Connection* conn, pollfd_t* fd_ptr);
+  void markDeadAll(const char* reason, bool inFlightOnly = false);
+  void markDeadConn(Connection* conn, const char* reason);
+  void rewindConn(Connection* conn, int64_t now);
+  void watchConn(Connection* conn);
+  void handleEvents(Connection* conn, short revents, int64_t now, err_code_t& ret_code);
+  void finishConn(Connection* conn);
+  char* compressValue(const char* val, size_t& valLen, flags_t& flags);
+  int expireConns(int64_t now, err_code_t& ret_code);
+#ifdef MC_USE_EPOLL
+  int drainEvents(int timeout, int64_t now);
+#endif
 
   uint32_t m_nActiveConn; // wait for poll
   uint32_t m_nInvalidKey;
   std::vector<Connection*> m_activeConns;
+  std::vector<struct iovec> m_metaRequestKeys; // indexed by opaque
   hashkit::KetamaSelector m_connSelector;
   Connection *m_conns;
   size_t m_nConns;
   int m_pollTimeout;
+  size_t m_compressThreshold;
+  int m_epollFd;
+  err_code_t m_pollRetCode;
 };
 
 } // namespace mc
@@ -13,7 +13,9 @@ typedef enum {
   CFG_CONNECT_TIMEOUT,
   CFG_RETRY_TIMEOUT,
   CFG_HASH_FUNCTION,
-  CFG_MAX_RETRIES
+  CFG_MAX_RETRIES,
+  CFG_DISTRIBUTION,
+  CFG_COMPRESS_THRESHOLD  // LZ4-compress values of at least this many bytes, 0: off
 } config_options_t;
 
 
@@ -22,9 +24,17 @@ typedef enum {
   OPT_HASH_FNV1_32,
   OPT_HASH_FNV1A_32,
   OPT_HASH_CRC_32,
+  OPT_HASH_CRC_32C,
+  OPT_HASH_XXH32,
 } hash_function_options_t;
 
 
+typedef enum {
+  OPT_DISTRIBUTION_KETAMA,
+  OPT_DISTRIBUTION_JUMP,
+} distribution_options_t;
+
+
 typedef enum {
   RET_SEND_ERR = -9,
   RET_RECV_ERR = -8,
@@ -43,6 +53,11 @@ typedef int64_t exptime_t;
 typedef uint32_t flags_t;
 typedef uint64_t cas_unique_t;
 
+// Reserved flags_t bit, set on values libmc stored LZ4-compressed (see
+// CFG_COMPRESS_THRESHOLD). Such values are decompressed and the bit is
+// cleared before results are returned, whatever the reading client's config.
+#define MC_FLAG_LZ4_COMPRESSED (1U << 15)
+
 
 typedef struct {
   char* key; // 8B
@@ -91,3 +106,60 @@ typedef struct {
   size_t len;
   enum message_result_type msg_type;  // for flush_all command
 } broadcast_result_t;
+
+
+// meta commands (mg/ms/md/ma), see memcached's doc/protocol.txt
+typedef enum {
+  META_QUIET = 1 << 0,  // q: suppress the common reply (mg: EN, ms/md/ma: HD)
+  META_RETURN_VALUE = 1 << 1,  // v
+  META_RETURN_CAS = 1 << 2,  // c
+  META_RETURN_FLAGS = 1 << 3,  // f
+  META_RETURN_TTL = 1 << 4,  // t
+  META_UPDATE_TTL = 1 << 5,  // T<exptime>, ms always sends it
+  META_VIVIFY = 1 << 6,  // N<exptime>: create on miss, one client gets "W"
+  META_INVALIDATE = 1 << 7,  // I
+  META_COMPARE_CAS = 1 << 8,  // C<cas unique>
+  META_MODE_ADD = 1 << 9,  // ms ME
+  META_MODE_REPLACE = 1 << 10,  // ms MR
+  META_MODE_APPEND = 1 << 11,  // ms MA
+  META_MODE_PREPEND = 1 << 12,  // ms MP
+  META_MODE_DECR = 1 << 13,  // ma MD
+} meta_flag_t;
+
+typedef uint32_t meta_flags_t;
+
+
+enum meta_result_type {
+  META_LIBMC_INVALID = -1,
+  META_HD = 0,  // success, no value
+  META_VA,  // success with value
+  META_EN,  // mg miss
+  META_NF,  // not found
+  META_NS,  // not stored
+  META_EX,  // cas mismatch
+};
+
+
+typedef struct {
+  enum meta_result_type type_;
+  uint32_t opaque;  // index of the request in the caller's arrays
+  char* key;
+  size_t key_len;
+  char* data_block;
+  uint32_t bytes;
+  flags_t flags;
+  cas_unique_t cas_unique;
+  exptime_t ttl;  // -1 if the item never expires
+  uint8_t won;  // W: this client should recache the item
+  uint8_t stale;  // X
+  uint8_t win_sent;  // Z: another client already won
+} meta_result_t;
+
+
+// Completion callbacks of the non-blocking commands (client_async_*). They
+// run inside client_async_process(); `results` and the buffers behind them
+// are reused by the next command, so copy out what has to outlive the call.
+typedef void (*retrieval_callback_t)(void* ctx, err_code_t err,
+                                     retrieval_result_t** results, size_t n_results);
+typedef void (*message_callback_t)(void* ctx, err_code_t err,
+                                   message_result_t** results, size_t n_results);
@@ -29,6 +29,32 @@ static const char kDECR_[] = "decr ";
 
 static const char k_NOREPLY[] = " noreply";
 
+static const char kMG_[] = "mg ";
+static const char kMS_[] = "ms ";
+static const char kMD_[] = "md ";
+static const char kMA_[] = "ma ";
+static const char kMN[] = "mn";
+
+// meta flags, the trailing '_' ones are followed by a number
+static const char k_META_QUIET[] = " q";
+static const char k_META_VALUE[] = " v";
+static const char k_META_CAS[] = " c";
+static const char k_META_FLAGS[] = " f";
+static const char k_META_TTL[] = " t";
+static const char k_META_INVALIDATE[] = " I";
+static const char k_META_OPAQUE_[] = " O";
+static const char k_META_SET_TTL_[] = " T";
+static const char k_META_VIVIFY_[] = " N";
+static const char k_META_COMPARE_CAS_[] = " C";
+static const char k_META_CLIENT_FLAGS_[] = " F";
+static const char k_META_DELTA_[] = " D";
+static const char k_META_INITIAL_[] = " J";
+static const char k_META_MODE_ADD[] = " ME";
+static const char k_META_MODE_REPLACE[] = " MR";
+static const char k_META_MODE_APPEND[] = " MA";
+static const char k_META_MODE_PREPEND[] = " MP";
+static const char k_META_MODE_DECR[] = " MD";
+
 static const char kVERSION[] = "version";
 static const char kSTATS[] = "stats";
 static const char kFLUSHALL[] = "flush_all";
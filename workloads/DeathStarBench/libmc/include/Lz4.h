@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstdlib>
+
+namespace douban {
+namespace mc {
+namespace lz4 {
+
+// A small, dependency-free implementation of the LZ4 block format
+// (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md), used to
+// compress values on the wire. The output of compress() can be decoded by
+// any LZ4 implementation, e.g. LZ4_decompress_safe().
+
+size_t compressBound(size_t srcLen);
+
+// Returns the compressed size, or 0 if it does not fit in `dstCap`.
+size_t compress(const char* src, size_t srcLen, char* dst, size_t dstCap);
+
+// `dstLen` must be the exact decompressed size. Returns false on malformed
+// input instead of reading or writing out of bounds.
+bool decompress(const char* src, size_t srcLen, char* dst, size_t dstLen);
+
+
+// Stored value layout: 4-byte little-endian original length, then one LZ4
+// block.
+static const size_t kValueHeaderSize = 4;
+
+// Returns a new[]-ed packed value, or NULL if compressing does not make
+// `val` smaller.
+char* packValue(const char* val, size_t valLen, size_t& packedLen);
+
+// Returns a new[]-ed original value, or NULL if `data` is not a valid
+// packed value.
+char* unpackValue(const char* data, size_t dataLen, size_t& valLen);
+
+// The same in two steps, to decode into memory the caller provides: the
+// original length from the header (false if `data` cannot be a packed
+// value), then the value itself into `dst` of exactly that length.
+bool unpackedSize(const char* data, size_t dataLen, size_t& valLen);
+bool unpackValueInto(const char* data, size_t dataLen, char* dst, size_t valLen);
+
+} // namespace lz4
+} // namespace mc
+} // namespace douban
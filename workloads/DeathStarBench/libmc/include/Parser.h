@@ -4,7 +4,7 @@
 #include <queue>
 
 #include "Common.h"
-#include "BufferReader.h"
+#include "Reader.h"
 #include "Result.h"
 
 
@@ -21,9 +21,9 @@ typedef enum {
 class PacketParser {
  public:
   PacketParser();
-  explicit PacketParser(io::BufferReader* reader);
+  explicit PacketParser(io::Reader* reader);
   ~PacketParser();
-  void setBufferReader(io::BufferReader* reader);
+  void setBufferReader(io::Reader* reader);
   void setMode(ParserMode md);
   void addRequestKey(const char* const key, const size_t len);
   std::vector<struct iovec>* getRequestKeys();
@@ -37,16 +37,19 @@ class PacketParser {
   types::MessageResultList* getMessageResults();
   types::LineResultList* getLineResults();
   types::UnsignedResultList* getUnsignedResults();
+  types::MetaResultList* getMetaResults();
 
  protected:
   int start_state(err_code_t& err);
   bool canEndParse();
   void processMessageResult(message_result_type tp);
   void processLineResult(err_code_t& err);
+  void processMetaResult(enum meta_result_type tp, err_code_t& err);
+  void processMetaLine(err_code_t& err);
 
 
   std::vector<struct iovec> m_requestKeys;
-  io::BufferReader* m_buffer_reader;
+  io::Reader* m_buffer_reader;
   parser_state_t m_state;
   ParserMode m_mode;
   size_t m_expectedResultCount;
@@ -56,6 +59,7 @@ class PacketParser {
   types::MessageResultList m_messageResults;
   types::LineResultList m_lineResults;
   types::UnsignedResultList m_unsignedResults;
+  types::MetaResultList m_metaResults;
 
   // mt means Member-Tmp-variable
   types::RetrievalResult* mt_kvPtr;
@@ -0,0 +1,26 @@
+#pragma once
+
+#ifdef MC_USE_RING_BUFFER
+#include "RingBufferReader.h"
+#else
+#include "BufferReader.h"
+#endif
+
+namespace douban {
+namespace mc {
+namespace io {
+
+// The reader a Connection receives into and the token type results keep.
+// With MC_USE_RING_BUFFER every key and value is contiguous in the receive
+// buffer and reaches the caller without a copy.
+#ifdef MC_USE_RING_BUFFER
+typedef RingBufferReader Reader;
+typedef RingSlice ReaderToken;
+#else
+typedef BufferReader Reader;
+typedef TokenData ReaderToken;
+#endif
+
+} // namespace io
+} // namespace mc
+} // namespace douban
@@ -2,7 +2,7 @@
 
 #include <vector>
 #include "Export.h"
-#include "BufferReader.h"
+#include "Reader.h"
 #ifdef MC_USE_SMALL_VECTOR
 #include "llvm/SmallVector.h"
 #endif
@@ -18,14 +18,16 @@ class RetrievalResult {
   RetrievalResult(const RetrievalResult& other);
   ~RetrievalResult();
 
-  douban::mc::io::TokenData key; // 24B
-  douban::mc::io::TokenData data_block; // 24B
+  douban::mc::io::ReaderToken key;
+  douban::mc::io::ReaderToken data_block;
   cas_unique_t cas_unique; // 8B
   uint32_t bytesRemain; // 4B. bytes remain to read, complete data if this is 0
   uint32_t bytes; // 4B
   flags_t flags; // 4B
   uint8_t key_len; // 1B
-  retrieval_result_t* inner();
+  // Copies needed to make key/value contiguous come from `arena` and stay
+  // valid until it is reset.
+  retrieval_result_t* inner(douban::mc::io::Arena& arena);
  protected:
   retrieval_result_t m_inner;
 };
@@ -39,7 +41,7 @@ class LineResult {
   LineResult();
   LineResult(const LineResult& other);
   ~LineResult();
-  douban::mc::io::TokenData line;
+  douban::mc::io::ReaderToken line;
   size_t line_len;
   char* inner(size_t& n);
  protected:
@@ -47,6 +49,19 @@ class LineResult {
 };
 
 
+class MetaResult {
+ public:
+  MetaResult();
+  MetaResult(const MetaResult& other);
+  ~MetaResult();
+
+  meta_result_t header; // filled from the reply line, data_block aside
+  douban::mc::io::ReaderToken data_block;
+  uint32_t bytesRemain; // like RetrievalResult::bytesRemain, for "VA" only
+  meta_result_t* inner(douban::mc::io::Arena& arena); // like RetrievalResult::inner
+};
+
+
 #ifdef MC_USE_SMALL_VECTOR
 typedef llvm::SmallVector<types::RetrievalResult, 100> RetrievalResultList;
 #else
@@ -55,6 +70,7 @@ typedef std::vector<types::RetrievalResult> RetrievalResultList;
 typedef std::vector<message_result_t> MessageResultList;
 typedef std::vector<types::LineResult> LineResultList;
 typedef std::vector<unsigned_result_t> UnsignedResultList;
+typedef std::vector<types::MetaResult> MetaResultList;
 
 
 } // namespace types
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <stdint.h>
+#include <cassert>
+#include <cstring>
+
+#include "Export.h"
+#include "Common.h"
+#include "Arena.h"
+
+namespace douban {
+namespace mc {
+namespace io {
+
+class RingBufferReader;
+
+
+// A token inside a RingBufferReader. It is addressed by absolute stream
+// position instead of pointer, so it stays valid when the buffer grows or
+// compacts. A token is always contiguous: size() counts its pieces like
+// TokenData's does, 0 or 1.
+struct RingSlice {
+  RingSlice() : reader(NULL), pos(0), len(0) {}
+
+  void clear() {
+    reader = NULL;
+    pos = 0;
+    len = 0;
+  }
+  bool empty() const { return reader == NULL; }
+  size_t size() const { return reader == NULL ? 0 : 1; }
+
+  RingBufferReader* reader;
+  uint64_t pos;
+  size_t len;
+};
+
+// Same contract as the TokenData functions of BufferReader.h. Tokens are
+// released all at once by RingBufferReader::reset(), so freeTokenData() has
+// nothing to do, and parseTokenData() never copies.
+void freeTokenData(RingSlice& td);
+char* parseTokenData(RingSlice& td, size_t reserved, Arena* arena = NULL);
+void copyTokenData(const RingSlice& src, RingSlice& dst);
+
+
+// Alternative to BufferReader that keeps received bytes in one contiguous,
+// growable buffer used as a ring: the reader chases the writer, and consumed
+// space is reclaimed by sliding the unread (or retained) tail back to the
+// front instead of wrapping around. Every token and value is therefore
+// contiguous and can be handed out without copying through `at()`.
+//
+// Tokens read by readUntil() and readBytes() are retained until reset(),
+// the way a TokenData holds a reference on its DataBlocks.
+class RingBufferReader {
+ public:
+  RingBufferReader();
+  ~RingBufferReader();
+  void reset();
+
+  // Make at least `len` contiguous bytes writable; returns how many are.
+  size_t prepareWriteBlock(size_t len);
+
+  char* getWritePtr();
+  void commitWrite(size_t len);
+  void write(const char* ptr, size_t len);
+
+  size_t capacity();
+  size_t size();
+  size_t readLeft();
+
+  const char peek(err_code_t& err, size_t offset) const;
+
+  size_t readUntil(err_code_t& err, char value, RingSlice& slice);
+  size_t skipUntil(err_code_t& err, char value);
+  void readUnsigned(err_code_t& err, uint64_t& value);
+  void readBytes(err_code_t& err, size_t len, RingSlice& slice);
+  void expectBytes(err_code_t& err, const char* str, size_t str_size);
+  void skipBytes(err_code_t& err, size_t str_size);
+  void setNextPreferedDataBlockSize(size_t n);
+  size_t getNextPreferedDataBlockSize();
+
+  // Keep the bytes of `slice` (and everything after it) across later
+  // writes until releaseAll() or reset() is called.
+  void retain(const RingSlice& slice);
+  void releaseAll();
+  size_t nBytesRetained();
+
+  // NOTE: the pointer is only valid until the next prepareWriteBlock/write.
+  const char* at(const RingSlice& slice) const;
+
+ protected:
+  void relocate(size_t len);
+  const char* find(char value) const;
+
+  char* m_data;
+  size_t m_capacity;
+  uint64_t m_base;       // stream position of m_data[0]
+  uint64_t m_readPos;    // stream position of the next unread byte
+  uint64_t m_writePos;   // stream position one past the last written byte
+  uint64_t m_retainPos;  // lowest retained stream position, if m_retaining
+  bool m_retaining;
+  size_t m_nextPreferedDataBlockSize;
+  size_t m_peakSize;     // most bytes held since the last reset
+};
+
+
+inline size_t RingBufferReader::readLeft() {
+  return static_cast<size_t>(m_writePos - m_readPos);
+}
+
+
+inline const char* RingBufferReader::at(const RingSlice& slice) const {
+  assert(slice.pos >= m_base && slice.pos + slice.len <= m_writePos);
+  return m_data + (slice.pos - m_base);
+}
+
+} // namespace io
+} // namespace mc
+} // namespace douban
@@ -3,8 +3,15 @@
 #include <stdint.h>
 #include <cstddef>
 #include <cstdio>
+#include <cstring>
 #include "rapidjson/itoa.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define MC_MAX_KEY_LENGTH 250
 
 namespace douban {
@@ -17,10 +24,47 @@ inline int int64ToCharArray(int64_t n, char s[]) {
   return static_cast<int>(end - s);
 }
 
+// Return a pointer to the first `c` in [begin, end), or `end` if absent.
+// Protocol lines are short, so the vector loop is inlined here rather than
+// paying for a call into libc memchr on every token.
+inline const char* findChar(const char* begin, const char* end, char c) {
+#if defined(__AVX2__)
+  const __m256i needle32 = _mm256_set1_epi8(c);
+  while (end - begin >= 32) {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    unsigned mask = static_cast<unsigned>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle32)));
+    if (mask != 0) {
+      return begin + __builtin_ctz(mask);
+    }
+    begin += 32;
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i needle16 = _mm_set1_epi8(c);
+  while (end - begin >= 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    unsigned mask = static_cast<unsigned>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle16)));
+    if (mask != 0) {
+      return begin + __builtin_ctz(mask);
+    }
+    begin += 16;
+  }
+#endif
+  for (; begin < end; ++begin) {
+    if (*begin == c) {
+      return begin;
+    }
+  }
+  return end;
+}
+
 // credit to The New Page of Injections Book:
 // Memcached Injections @ blackhat2014 [pdf](http://t.cn/RP0J10Z)
 bool isValidKey(const char* key, const size_t keylen);
 void fprintBuffer(std::FILE* file, const char *data_buffer_, const unsigned int length);
+int64_t monotonicMillis();
 
 } // namespace utility
 } // namespace mc
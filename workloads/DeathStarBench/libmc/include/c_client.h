@@ -62,6 +62,63 @@ extern "C" {
                   unsigned_result_t** results, size_t* n_results);
   void client_destroy_unsigned_result(void* client);
 
+  err_code_t client_meta_get(void* client, const char* const* keys, const size_t* key_lens,
+                             size_t n_keys, const meta_flags_t meta_flags,
+                             const exptime_t exptime,
+                             meta_result_t*** results, size_t* n_results);
+  err_code_t client_meta_set(void* client, const char* const* keys, const size_t* key_lens,
+                             const flags_t* flags, const cas_unique_t* cas_uniques,
+                             const char* const* vals, const size_t* val_lens,
+                             size_t n_items, const meta_flags_t meta_flags,
+                             const exptime_t exptime,
+                             meta_result_t*** results, size_t* n_results);
+  err_code_t client_meta_delete(void* client, const char* const* keys, const size_t* key_lens,
+                                const cas_unique_t* cas_uniques, size_t n_items,
+                                const meta_flags_t meta_flags,
+                                meta_result_t*** results, size_t* n_results);
+  err_code_t client_meta_arithmetic(void* client, const char* const* keys,
+                                    const size_t* key_lens, size_t n_items,
+                                    const uint64_t delta, const uint64_t initial,
+                                    const meta_flags_t meta_flags, const exptime_t exptime,
+                                    meta_result_t*** results, size_t* n_results);
+  void client_destroy_meta_result(void* client);
+
+  // Non-blocking commands. Submit one, then call client_async_process()
+  // whenever client_async_fd() is readable or client_async_timeout() ms
+  // (-1: nothing in flight) have passed; the callback runs from there.
+  // One command at a time per client, a callback may submit the next.
+#define DECL_ASYNC_RETRIEVAL_CMD(M) \
+  err_code_t client_async_##M(void* client, const char* const* keys, const size_t* key_lens, \
+                              size_t n_keys, retrieval_callback_t callback, void* ctx)
+  DECL_ASYNC_RETRIEVAL_CMD(get);
+  DECL_ASYNC_RETRIEVAL_CMD(gets);
+#undef DECL_ASYNC_RETRIEVAL_CMD
+
+#define DECL_ASYNC_STORAGE_CMD(M) \
+  err_code_t client_async_##M(void* client, const char* const* keys, const size_t* key_lens, \
+               const flags_t* flags, const exptime_t exptime, \
+               const cas_unique_t* cas_uniques, const bool noreply, \
+               const char* const* vals, const size_t* val_lens, \
+               size_t n_items, message_callback_t callback, void* ctx)
+  DECL_ASYNC_STORAGE_CMD(set);
+  DECL_ASYNC_STORAGE_CMD(add);
+  DECL_ASYNC_STORAGE_CMD(replace);
+  DECL_ASYNC_STORAGE_CMD(append);
+  DECL_ASYNC_STORAGE_CMD(prepend);
+  DECL_ASYNC_STORAGE_CMD(cas);
+#undef DECL_ASYNC_STORAGE_CMD
+
+  err_code_t client_async_delete(void* client, const char* const* keys, const size_t* key_lens,
+                                 const bool noreply, size_t n_items,
+                                 message_callback_t callback, void* ctx);
+  err_code_t client_async_touch(void* client, const char* const* keys, const size_t* key_lens,
+                                const exptime_t exptime, const bool noreply, size_t n_items,
+                                message_callback_t callback, void* ctx);
+  int client_async_fd(void* client);
+  int client_async_timeout(void* client);
+  bool client_async_pending(void* client);
+  void client_async_process(void* client);
+
   err_code_t client_stats(void* client, broadcast_result_t** results, size_t* n_servers);
   void client_toggle_flush_all_feature(void* client, bool enabled);
   err_code_t client_flush_all(void* client, broadcast_result_t** results, size_t* n_servers);
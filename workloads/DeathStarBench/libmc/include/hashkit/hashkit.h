@@ -12,6 +12,9 @@ uint32_t hash_md5(const char *key, size_t key_length);
 uint32_t hash_fnv1_32(const char *key, size_t key_length);
 uint32_t hash_fnv1a_32(const char *key, size_t key_length);
 uint32_t hash_crc_32(const char *key, size_t key_length);
+// CRC-32C (Castagnoli); uses the SSE4.2 crc32 instruction when available
+uint32_t hash_crc_32c(const char *key, size_t key_length);
+uint32_t hash_xxh32(const char *key, size_t key_length);
 
 } // namespace hashkit
 } // namespace mc
@@ -24,10 +24,22 @@ typedef struct  continuum_item_s {
 } continuum_item_t;
 
 
+typedef enum {
+  DISTRIBUTION_KETAMA,
+  DISTRIBUTION_JUMP
+} distribution_t;
+
+
+// Jump consistent hash (Lamping & Veach): maps `key` to a bucket in
+// [0, nBuckets) with no lookup table at all.
+int32_t jump_consistent_hash(uint64_t key, int32_t nBuckets);
+
+
 class KetamaSelector {
  public:
   KetamaSelector();
   void setHashFunction(hash_function_t fn);
+  void setDistribution(distribution_t distribution);
   void enableFailover();
   void disableFailover();
 
@@ -38,12 +50,26 @@ class KetamaSelector {
   douban::mc::Connection* getConn(const char* key, size_t key_len, bool check_alive = true);
 
  protected:
-  std::vector<continuum_item_t>::iterator getServerIt(const char* key, size_t key_len,
-                                                      bool check_alive);
+  // index into m_conns, or -1
+  int getServerIdx(const char* key, size_t key_len, bool check_alive);
+  size_t searchContinuum(uint32_t hash_value) const;
+  void buildEytzinger(size_t& sortedIdx, size_t k);
+  uint32_t hashKey(const char* key, size_t key_len);
+
+  // The continuum is kept as parallel arrays (struct of arrays) so the
+  // search only ever touches the 4-byte points. m_points/m_pointConns are
+  // in sorted order (used when walking the ring on failover);
+  // m_eytzinger holds the same points in BFS (Eytzinger) layout, 1-indexed,
+  // with m_eytzingerRank mapping each slot back to its sorted position.
+  std::vector<uint32_t> m_points;
+  std::vector<uint32_t> m_pointConns;
+  std::vector<uint32_t> m_eytzinger;
+  std::vector<uint32_t> m_eytzingerRank;
 
-  std::vector<continuum_item_t> m_continuum;
+  douban::mc::Connection* m_conns;
   size_t m_nServers;
   bool m_useFailover;
+  distribution_t m_distribution;
   hash_function_t m_hashFunction;
   static const size_t s_pointerPerHash;
   static const size_t s_pointerPerServer;
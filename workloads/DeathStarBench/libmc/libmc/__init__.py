@@ -8,11 +8,18 @@ from ._client import (
     MC_POLL_TIMEOUT,
     MC_CONNECT_TIMEOUT,
     MC_RETRY_TIMEOUT,
+    MC_DISTRIBUTION,
+    MC_COMPRESS_THRESHOLD,
 
     MC_HASH_MD5,
     MC_HASH_FNV1_32,
     MC_HASH_FNV1A_32,
     MC_HASH_CRC_32,
+    MC_HASH_CRC_32C,
+    MC_HASH_XXH32,
+
+    MC_DISTRIBUTION_KETAMA,
+    MC_DISTRIBUTION_JUMP,
 
     MC_RETURN_SEND_ERR,
     MC_RETURN_RECV_ERR,
@@ -45,9 +52,12 @@ __all__ = [
     'Client', 'ThreadUnsafe', '__VERSION__', 'encode_value', 'decode_value',
 
     'MC_DEFAULT_EXPTIME', 'MC_POLL_TIMEOUT', 'MC_CONNECT_TIMEOUT',
-    'MC_RETRY_TIMEOUT',
+    'MC_RETRY_TIMEOUT', 'MC_DISTRIBUTION', 'MC_COMPRESS_THRESHOLD',
 
     'MC_HASH_MD5', 'MC_HASH_FNV1_32', 'MC_HASH_FNV1A_32', 'MC_HASH_CRC_32',
+    'MC_HASH_CRC_32C', 'MC_HASH_XXH32',
+
+    'MC_DISTRIBUTION_KETAMA', 'MC_DISTRIBUTION_JUMP',
 
     'MC_RETURN_SEND_ERR', 'MC_RETURN_RECV_ERR', 'MC_RETURN_CONN_POLL_ERR',
     'MC_RETURN_POLL_TIMEOUT_ERR', 'MC_RETURN_POLL_ERR',
@@ -53,12 +53,20 @@ cdef extern from "Export.h":
         CFG_RETRY_TIMEOUT
         CFG_HASH_FUNCTION
         CFG_MAX_RETRIES
+        CFG_DISTRIBUTION
+        CFG_COMPRESS_THRESHOLD
 
     ctypedef enum hash_function_options_t:
         OPT_HASH_MD5
         OPT_HASH_FNV1_32
         OPT_HASH_FNV1A_32
         OPT_HASH_CRC_32
+        OPT_HASH_CRC_32C
+        OPT_HASH_XXH32
+
+    ctypedef enum distribution_options_t:
+        OPT_DISTRIBUTION_KETAMA
+        OPT_DISTRIBUTION_JUMP
 
     ctypedef int64_t exptime_t
     ctypedef uint32_t flags_t
@@ -230,12 +238,20 @@ MC_POLL_TIMEOUT = PyInt_FromLong(CFG_POLL_TIMEOUT)
 MC_CONNECT_TIMEOUT = PyInt_FromLong(CFG_CONNECT_TIMEOUT)
 MC_RETRY_TIMEOUT = PyInt_FromLong(CFG_RETRY_TIMEOUT)
 MC_MAX_RETRIES = PyInt_FromLong(CFG_MAX_RETRIES)
+MC_DISTRIBUTION = PyInt_FromLong(CFG_DISTRIBUTION)
+MC_COMPRESS_THRESHOLD = PyInt_FromLong(CFG_COMPRESS_THRESHOLD)
 
 
 MC_HASH_MD5 = PyInt_FromLong(OPT_HASH_MD5)
 MC_HASH_FNV1_32 = PyInt_FromLong(OPT_HASH_FNV1_32)
 MC_HASH_FNV1A_32 = PyInt_FromLong(OPT_HASH_FNV1A_32)
 MC_HASH_CRC_32 = PyInt_FromLong(OPT_HASH_CRC_32)
+MC_HASH_CRC_32C = PyInt_FromLong(OPT_HASH_CRC_32C)
+MC_HASH_XXH32 = PyInt_FromLong(OPT_HASH_XXH32)
+
+
+MC_DISTRIBUTION_KETAMA = PyInt_FromLong(OPT_DISTRIBUTION_KETAMA)
+MC_DISTRIBUTION_JUMP = PyInt_FromLong(OPT_DISTRIBUTION_JUMP)
 
 
 MC_RETURN_SEND_ERR = PyInt_FromLong(RET_SEND_ERR)
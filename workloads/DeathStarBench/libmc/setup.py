@@ -20,6 +20,7 @@ COMPILER_FLAGS = [
     "-fno-rtti",
     "-Wall",
     "-DMC_USE_SMALL_VECTOR",
+    "-DMC_USE_RING_BUFFER",
     "-O3",
     "-DNDEBUG",
 ]
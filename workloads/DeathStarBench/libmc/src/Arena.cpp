@@ -0,0 +1,64 @@
+#include <algorithm>
+
+#include "Arena.h"
+#include "Common.h"
+
+namespace douban {
+namespace mc {
+namespace io {
+
+Arena::Arena() : m_used(0) {
+}
+
+
+Arena::~Arena() {
+  for (std::vector<Chunk>::iterator it = m_chunks.begin(); it != m_chunks.end(); ++it) {
+    delete[] it->data;
+  }
+}
+
+
+char* Arena::allocate(size_t len) {
+  if (m_chunks.empty() || m_chunks.back().capacity - m_used < len) {
+    size_t lastCapacity = m_chunks.empty() ? 0 : m_chunks.back().capacity;
+    Chunk chunk;
+    chunk.capacity = std::max(std::max(len, lastCapacity * 2), (size_t)MIN_ARENA_CAPACITY);
+    chunk.data = new char[chunk.capacity];
+    m_chunks.push_back(chunk);
+    m_used = 0;
+  }
+  char* ptr = m_chunks.back().data + m_used;
+  m_used += len;
+  return ptr;
+}
+
+
+void Arena::reset() {
+  m_used = 0;
+  if (m_chunks.size() <= 1 && capacity() <= MAX_ARENA_RETAINED) {
+    return;
+  }
+  // merge, so next time everything fits in one chunk
+  size_t total = std::min(capacity(), (size_t)MAX_ARENA_RETAINED);
+  for (std::vector<Chunk>::iterator it = m_chunks.begin(); it != m_chunks.end(); ++it) {
+    delete[] it->data;
+  }
+  m_chunks.clear();
+  Chunk chunk;
+  chunk.capacity = total;
+  chunk.data = new char[total];
+  m_chunks.push_back(chunk);
+}
+
+
+size_t Arena::capacity() const {
+  size_t total = 0;
+  for (std::vector<Chunk>::const_iterator it = m_chunks.begin(); it != m_chunks.end(); ++it) {
+    total += it->capacity;
+  }
+  return total;
+}
+
+} // namespace io
+} // namespace mc
+} // namespace douban
@@ -449,7 +449,7 @@ void freeTokenData(TokenData& td) {
   }
 }
 
-char* parseTokenData(TokenData& td, size_t reserved) {
+char* parseTokenData(TokenData& td, size_t reserved, Arena* arena) {
   if (reserved == 0) {
     return NULL;
   }
@@ -459,7 +459,7 @@ char* parseTokenData(TokenData& td, size_t reserved) {
     return it->iterator->at(it->offset);
   }
 
-  char* ptr = new char[reserved];
+  char* ptr = arena != NULL ? arena->allocate(reserved) : new char[reserved];
   size_t pos = 0;
   for (TokenData::const_iterator it = td.begin(); it != td.end(); ++it) {
     if (pos + it->size > reserved) {
@@ -57,6 +57,12 @@ void BufferWriter::takeNumber(int64_t val) {
 }
 
 
+void BufferWriter::takeOwnedBuffer(char* buf, size_t buf_len) {
+  m_unsignedStringList.push_back(buf);
+  takeBuffer(buf, buf_len);
+}
+
+
 const struct iovec* const BufferWriter::getReadPtr(size_t &n) {
   n = m_msgIovlen;
   if (n > 0) {
@@ -8,7 +8,9 @@
 namespace douban {
 namespace mc {
 
-Client::Client(): m_flushAllEnabled(false) {
+Client::Client()
+  : m_flushAllEnabled(false), m_asyncState(ASYNC_IDLE), m_retrievalCallback(NULL),
+    m_messageCallback(NULL), m_asyncCtx(NULL) {
 }
 
 
@@ -33,6 +35,12 @@ void Client::config(config_options_t opt, int val) {
     case CFG_MAX_RETRIES:
       setMaxRetries(val);
       break;
+    case CFG_DISTRIBUTION:
+      ConnectionPool::setDistribution(static_cast<distribution_options_t>(val));
+      break;
+    case CFG_COMPRESS_THRESHOLD:
+      setCompressThreshold(val);
+      break;
     default:
       break;
   }
@@ -125,6 +133,134 @@ err_code_t Client::_delete(const char* const* keys, const size_t* keyLens,
 }
 
 
+#define IMPL_ASYNC_RETRIEVAL_CMD(M, O) \
+err_code_t Client::M(const char* const* keys, const size_t* keyLens, size_t nKeys, \
+                     retrieval_callback_t callback, void* ctx) { \
+  if (m_asyncState == ASYNC_PENDING) { \
+    return RET_PROGRAMMING_ERR; \
+  } \
+  endAsync(); \
+  dispatchRetrieval((O), keys, keyLens, nKeys); \
+  return startAsync(callback, NULL, ctx); \
+}
+
+IMPL_ASYNC_RETRIEVAL_CMD(asyncGet, GET_OP)
+IMPL_ASYNC_RETRIEVAL_CMD(asyncGets, GETS_OP)
+#undef IMPL_ASYNC_RETRIEVAL_CMD
+
+
+#define IMPL_ASYNC_STORAGE_CMD(M, O) \
+err_code_t Client::M(const char* const* keys, const size_t* keyLens, \
+                 const flags_t* flags, const exptime_t exptime, \
+                 const cas_unique_t* cas_uniques, const bool noreply, \
+                 const char* const* vals, const size_t* valLens, \
+                 size_t nItems, message_callback_t callback, void* ctx) { \
+  if (m_asyncState == ASYNC_PENDING) { \
+    return RET_PROGRAMMING_ERR; \
+  } \
+  endAsync(); \
+  dispatchStorage((O), keys, keyLens, flags, exptime, cas_uniques, noreply, vals, \
+                  valLens, nItems); \
+  return startAsync(NULL, callback, ctx); \
+}
+
+IMPL_ASYNC_STORAGE_CMD(asyncSet, SET_OP)
+IMPL_ASYNC_STORAGE_CMD(asyncAdd, ADD_OP)
+IMPL_ASYNC_STORAGE_CMD(asyncReplace, REPLACE_OP)
+IMPL_ASYNC_STORAGE_CMD(asyncAppend, APPEND_OP)
+IMPL_ASYNC_STORAGE_CMD(asyncPrepend, PREPEND_OP)
+IMPL_ASYNC_STORAGE_CMD(asyncCas, CAS_OP)
+#undef IMPL_ASYNC_STORAGE_CMD
+
+
+err_code_t Client::asyncDelete(const char* const* keys, const size_t* keyLens,
+                               const bool noreply, size_t nItems,
+                               message_callback_t callback, void* ctx) {
+  if (m_asyncState == ASYNC_PENDING) {
+    return RET_PROGRAMMING_ERR;
+  }
+  endAsync();
+  dispatchDeletion(keys, keyLens, noreply, nItems);
+  return startAsync(NULL, callback, ctx);
+}
+
+
+err_code_t Client::asyncTouch(const char* const* keys, const size_t* keyLens,
+                              const exptime_t exptime, const bool noreply, size_t nItems,
+                              message_callback_t callback, void* ctx) {
+  if (m_asyncState == ASYNC_PENDING) {
+    return RET_PROGRAMMING_ERR;
+  }
+  endAsync();
+  dispatchTouch(keys, keyLens, exptime, noreply, nItems);
+  return startAsync(NULL, callback, ctx);
+}
+
+
+err_code_t Client::startAsync(retrieval_callback_t retrievalCallback,
+                              message_callback_t messageCallback, void* ctx) {
+  err_code_t rv = startPoll();
+  if (rv != RET_OK) {
+    ConnectionPool::reset();
+    return rv;
+  }
+  m_asyncState = ASYNC_PENDING;
+  m_retrievalCallback = retrievalCallback;
+  m_messageCallback = messageCallback;
+  m_asyncCtx = ctx;
+  return RET_OK;
+}
+
+
+void Client::endAsync() {
+  if (m_asyncState == ASYNC_IDLE) {
+    return;
+  }
+  ConnectionPool::reset();
+  m_outRetrievalResultPtrs.clear();
+  m_outMessageResultPtrs.clear();
+  m_asyncState = ASYNC_IDLE;
+}
+
+
+int Client::asyncTimeout() const {
+  if (m_asyncState != ASYNC_PENDING) {
+    return -1;
+  }
+  return nextPollTimeout();
+}
+
+
+void Client::processAsync() {
+  if (m_asyncState != ASYNC_PENDING) {
+    // nothing in flight, but keep the poll fd from staying readable
+    stepPoll(0);
+    return;
+  }
+  if (!stepPoll(0)) {
+    return;
+  }
+
+  m_asyncState = ASYNC_COMPLETING;
+  err_code_t rv = pollRetCode();
+  if (m_retrievalCallback != NULL) {
+    retrieval_result_t** results = NULL;
+    size_t nResults = 0;
+    collectRetrievalResult(&results, &nResults);
+    m_retrievalCallback(m_asyncCtx, rv, results, nResults);
+  } else if (m_messageCallback != NULL) {
+    message_result_t** results = NULL;
+    size_t nResults = 0;
+    collectMessageResult(&results, &nResults);
+    m_messageCallback(m_asyncCtx, rv, results, nResults);
+  }
+  // unless the callback already moved on to the next command
+  if (m_asyncState == ASYNC_COMPLETING) {
+    endAsync();
+  }
+}
+
+
 void Client::collectBroadcastResult(broadcast_result_t** results, size_t* nHosts, bool isFlushAll) {
   assert(m_outBroadcastResultPtrs.empty());
   *nHosts = m_nConns;
@@ -154,7 +290,7 @@ err_code_t Client::version(broadcast_result_t** results, size_t* nHosts) {
 err_code_t Client::quit() {
   broadcastCommand(keywords::kQUIT, 4, true);
   err_code_t rv = waitPoll();
-  markDeadAll(NULL, keywords::kCONN_QUIT);
+  markDeadAll(keywords::kCONN_QUIT);
   return rv;
 }
 
@@ -229,6 +365,73 @@ void Client::destroyUnsignedResult() {
 }
 
 
+void Client::collectMetaResult(meta_result_t*** results, size_t* nResults) {
+  assert(m_outMetaResultPtrs.empty());
+  ConnectionPool::collectMetaResult(m_outMetaResultPtrs);
+  *nResults = m_outMetaResultPtrs.size();
+
+  if (*nResults == 0) {
+    *results = NULL;
+  } else {
+    *results = &m_outMetaResultPtrs.front();
+  }
+}
+
+
+void Client::destroyMetaResult() {
+  ConnectionPool::reset();
+  m_outMetaResultPtrs.clear();
+}
+
+
+err_code_t Client::metaGet(const char* const* keys, const size_t* keyLens, size_t nKeys,
+                           const meta_flags_t metaFlags, const exptime_t exptime,
+                           meta_result_t*** results, size_t* nResults) {
+  dispatchMeta(META_GET_OP, keys, keyLens, NULL, NULL, NULL, NULL, nKeys,
+               metaFlags, exptime, 0, 0);
+  err_code_t rv = waitPoll();
+  collectMetaResult(results, nResults);
+  return rv;
+}
+
+
+err_code_t Client::metaSet(const char* const* keys, const size_t* keyLens,
+                           const flags_t* flags, const cas_unique_t* cas_uniques,
+                           const char* const* vals, const size_t* valLens, size_t nItems,
+                           const meta_flags_t metaFlags, const exptime_t exptime,
+                           meta_result_t*** results, size_t* nResults) {
+  dispatchMeta(META_SET_OP, keys, keyLens, flags, cas_uniques, vals, valLens, nItems,
+               metaFlags, exptime, 0, 0);
+  err_code_t rv = waitPoll();
+  collectMetaResult(results, nResults);
+  return rv;
+}
+
+
+err_code_t Client::metaDelete(const char* const* keys, const size_t* keyLens,
+                              const cas_unique_t* cas_uniques, size_t nItems,
+                              const meta_flags_t metaFlags,
+                              meta_result_t*** results, size_t* nResults) {
+  dispatchMeta(META_DELETE_OP, keys, keyLens, NULL, cas_uniques, NULL, NULL, nItems,
+               metaFlags, 0, 0, 0);
+  err_code_t rv = waitPoll();
+  collectMetaResult(results, nResults);
+  return rv;
+}
+
+
+err_code_t Client::metaArithmetic(const char* const* keys, const size_t* keyLens, size_t nItems,
+                                  const uint64_t delta, const uint64_t initial,
+                                  const meta_flags_t metaFlags, const exptime_t exptime,
+                                  meta_result_t*** results, size_t* nResults) {
+  dispatchMeta(META_ARITHMETIC_OP, keys, keyLens, NULL, NULL, NULL, NULL, nItems,
+               metaFlags, exptime, delta, initial);
+  err_code_t rv = waitPoll();
+  collectMetaResult(results, nResults);
+  return rv;
+}
+
+
 void Client::_sleep(uint32_t seconds) {
   usleep(seconds * 1000000);
 }
@@ -14,13 +14,14 @@
 #include "Keywords.h"
 
 using douban::mc::io::BufferWriter;
-using douban::mc::io::BufferReader;
+using douban::mc::io::Reader;
 
 namespace douban {
 namespace mc {
 
 Connection::Connection()
-    : m_counter(0), m_port(0), m_socketFd(-1),
+    : m_counter(0), m_pollEvents(0), m_pollDeadline(0), m_pollRegistered(false),
+      m_port(0), m_socketFd(-1),
       m_alive(false), m_hasAlias(false), m_deadUntil(0),
       m_connectTimeout(MC_DEFAULT_CONNECT_TIMEOUT),
       m_retryTimeout(MC_DEFAULT_RETRY_TIMEOUT),
@@ -28,7 +29,7 @@ Connection::Connection()
   m_name[0] = '\0';
   m_host[0] = '\0';
   m_buffer_writer = new BufferWriter();
-  m_buffer_reader = new BufferReader();
+  m_buffer_reader = new Reader();
   m_parser.setBufferReader(m_buffer_reader);
 }
 
@@ -158,8 +159,9 @@ int Connection::connectPoll(int fd, struct addrinfo* ai_ptr) {
 void Connection::close() {
   if (m_socketFd > 0) {
     m_alive = false;
-    ::close(m_socketFd);
+    ::close(m_socketFd); // also drops it from any epoll set
     m_socketFd = -1;
+    m_pollRegistered = false;
   }
 }
 
@@ -215,6 +217,10 @@ void Connection::takeBuffer(const char* const buf, size_t buf_len) {
   m_buffer_writer->takeBuffer(buf, buf_len);
 }
 
+void Connection::takeOwnedBuffer(char* buf, size_t buf_len) {
+  m_buffer_writer->takeOwnedBuffer(buf, buf_len);
+}
+
 void Connection::addRequestKey(const char* const key, const size_t len) {
   m_parser.addRequestKey(key, len);
 }
@@ -297,14 +303,20 @@ types::UnsignedResultList* Connection::getUnsignedResults() {
   return m_parser.getUnsignedResults();
 }
 
+types::MetaResultList* Connection::getMetaResults() {
+  return m_parser.getMetaResults();
+}
+
 std::vector<struct iovec>* Connection::getRequestKeys() {
   return m_parser.getRequestKeys();
 }
 
 void Connection::reset() {
   m_counter = 0;
+  m_pollEvents = 0;
   m_retires = 0;
   m_parser.reset();
+  m_arena.reset();
   m_buffer_reader->reset();
   m_buffer_writer->reset(); // flush data dispatched but not sent
 }
@@ -1,6 +1,7 @@
 #include <sys/socket.h>
 #include <poll.h>
 #include <errno.h>
+#include <unistd.h>
 #include <stdlib.h>
 #include <list>
 #include <vector>
@@ -9,8 +10,13 @@
 #include "ConnectionPool.h"
 #include "Utility.h"
 #include "Keywords.h"
+#include "Lz4.h"
 #include "Parser.h"
 
+#ifdef MC_USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 using std::vector;
 
 using douban::mc::keywords::kCRLF;
@@ -26,12 +32,20 @@ namespace mc {
 
 ConnectionPool::ConnectionPool()
   : m_nActiveConn(0), m_nInvalidKey(0), m_conns(NULL), m_nConns(0),
-    m_pollTimeout(MC_DEFAULT_POLL_TIMEOUT) {
+    m_pollTimeout(MC_DEFAULT_POLL_TIMEOUT), m_compressThreshold(0), m_epollFd(-1),
+    m_pollRetCode(RET_OK) {
+#ifdef MC_USE_EPOLL
+  m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+  log_err_if(m_epollFd == -1, "epoll_create1 failed");
+#endif
 }
 
 
 ConnectionPool::~ConnectionPool() {
   delete[] m_conns;
+  if (m_epollFd != -1) {
+    ::close(m_epollFd);
+  }
 }
 
 
@@ -49,6 +63,27 @@ void ConnectionPool::setHashFunction(hash_function_options_t fn_opt) {
     case OPT_HASH_CRC_32:
       m_connSelector.setHashFunction(&douban::mc::hashkit::hash_crc_32);
       break;
+    case OPT_HASH_CRC_32C:
+      m_connSelector.setHashFunction(&douban::mc::hashkit::hash_crc_32c);
+      break;
+    case OPT_HASH_XXH32:
+      m_connSelector.setHashFunction(&douban::mc::hashkit::hash_xxh32);
+      break;
+    default:
+      NOT_REACHED();
+      break;
+  }
+}
+
+
+void ConnectionPool::setDistribution(distribution_options_t dist_opt) {
+  switch (dist_opt) {
+    case OPT_DISTRIBUTION_KETAMA:
+      m_connSelector.setDistribution(douban::mc::hashkit::DISTRIBUTION_KETAMA);
+      break;
+    case OPT_DISTRIBUTION_JUMP:
+      m_connSelector.setDistribution(douban::mc::hashkit::DISTRIBUTION_JUMP);
+      break;
     default:
       NOT_REACHED();
       break;
@@ -169,13 +204,21 @@ void ConnectionPool::dispatchStorage(op_code_t op,
         break;
     }
 
+    // appending to a compressed value would corrupt it
+    size_t valLen = valLens[i];
+    flags_t flag = flags[i];
+    char* packed = NULL;
+    if (op != APPEND_OP && op != PREPEND_OP) {
+      packed = compressValue(vals[i], valLen, flag);
+    }
+
     conn->takeBuffer(keys[i], keyLens[i]);
     conn->takeBuffer(kSPACE, 1);
-    conn->takeNumber(flags[i]);
+    conn->takeNumber(flag);
     conn->takeBuffer(kSPACE, 1);
     conn->takeNumber(exptime);
     conn->takeBuffer(kSPACE, 1);
-    conn->takeNumber(valLens[i]);
+    conn->takeNumber(valLen);
     if (op == CAS_OP) {
       conn->takeBuffer(kSPACE, 1);
       conn->takeNumber(cas_uniques[i]);
@@ -187,7 +230,11 @@ void ConnectionPool::dispatchStorage(op_code_t op,
     }
     ++conn->m_counter;
     conn->takeBuffer(kCRLF, 2);
-    conn->takeBuffer(vals[i], valLens[i]);
+    if (packed != NULL) {
+      conn->takeOwnedBuffer(packed, valLen);
+    } else {
+      conn->takeBuffer(vals[i], valLen);
+    }
     conn->takeBuffer(kCRLF, 2);
   }
 
@@ -380,6 +427,150 @@ void ConnectionPool::dispatchIncrDecr(op_code_t op, const char* key, const size_
 }
 
 
+void ConnectionPool::dispatchMeta(op_code_t op, const char* const* keys,
+                                  const size_t* keyLens, const flags_t* flags,
+                                  const cas_unique_t* cas_uniques,
+                                  const char* const* vals, const size_t* valLens,
+                                  size_t nItems, const meta_flags_t metaFlags,
+                                  const exptime_t exptime, const uint64_t delta,
+                                  const uint64_t initial) {
+  // Every command carries its index as opaque, so replies can be matched
+  // even when quiet mode drops some of them. Each connection ends its
+  // pipeline with "mn", whose "MN" marks the end of the replies.
+  m_metaRequestKeys.resize(nItems);
+  size_t i = 0, idx = 0;
+  for (; i < nItems; ++i) {
+    struct iovec iov = {const_cast<char*>(keys[i]), keyLens[i]};
+    m_metaRequestKeys[i] = iov;
+    if (!utility::isValidKey(keys[i], keyLens[i])) {
+      ++m_nInvalidKey;
+      continue;
+    }
+    Connection* conn = m_connSelector.getConn(keys[i], keyLens[i]);
+    if (conn == NULL) {
+      continue;
+    }
+
+    size_t valLen = 0;
+    flags_t flag = 0;
+    char* packed = NULL;
+    if (op == META_SET_OP) {
+      valLen = valLens[i];
+      flag = flags != NULL ? flags[i] : 0;
+      if (!(metaFlags & (META_MODE_APPEND | META_MODE_PREPEND))) {
+        packed = compressValue(vals[i], valLen, flag);
+      }
+    }
+
+    switch (op) {
+      case META_GET_OP:
+        conn->takeBuffer(keywords::kMG_, 3);
+        conn->takeBuffer(keys[i], keyLens[i]);
+        break;
+      case META_SET_OP:
+        conn->takeBuffer(keywords::kMS_, 3);
+        conn->takeBuffer(keys[i], keyLens[i]);
+        conn->takeBuffer(kSPACE, 1);
+        conn->takeNumber(valLen);
+        conn->takeBuffer(keywords::k_META_SET_TTL_, 2);
+        conn->takeNumber(exptime);
+        if (flags != NULL || packed != NULL) {
+          conn->takeBuffer(keywords::k_META_CLIENT_FLAGS_, 2);
+          conn->takeNumber(flag);
+        }
+        if (metaFlags & META_MODE_ADD) {
+          conn->takeBuffer(keywords::k_META_MODE_ADD, 3);
+        } else if (metaFlags & META_MODE_REPLACE) {
+          conn->takeBuffer(keywords::k_META_MODE_REPLACE, 3);
+        } else if (metaFlags & META_MODE_APPEND) {
+          conn->takeBuffer(keywords::k_META_MODE_APPEND, 3);
+        } else if (metaFlags & META_MODE_PREPEND) {
+          conn->takeBuffer(keywords::k_META_MODE_PREPEND, 3);
+        }
+        break;
+      case META_DELETE_OP:
+        conn->takeBuffer(keywords::kMD_, 3);
+        conn->takeBuffer(keys[i], keyLens[i]);
+        break;
+      case META_ARITHMETIC_OP:
+        conn->takeBuffer(keywords::kMA_, 3);
+        conn->takeBuffer(keys[i], keyLens[i]);
+        conn->takeBuffer(keywords::k_META_DELTA_, 2);
+        conn->takeNumber(static_cast<int64_t>(delta));
+        if (metaFlags & META_VIVIFY) {
+          conn->takeBuffer(keywords::k_META_INITIAL_, 2);
+          conn->takeNumber(static_cast<int64_t>(initial));
+        }
+        if (metaFlags & META_MODE_DECR) {
+          conn->takeBuffer(keywords::k_META_MODE_DECR, 3);
+        }
+        break;
+      default:
+        NOT_REACHED();
+        break;
+    }
+
+    if (metaFlags & META_RETURN_VALUE) {
+      conn->takeBuffer(keywords::k_META_VALUE, 2);
+    }
+    if (metaFlags & META_RETURN_CAS) {
+      conn->takeBuffer(keywords::k_META_CAS, 2);
+    }
+    // flags are always fetched with the value to spot compressed ones
+    if ((metaFlags & (META_RETURN_FLAGS | META_RETURN_VALUE)) && op == META_GET_OP) {
+      conn->takeBuffer(keywords::k_META_FLAGS, 2);
+    }
+    if (metaFlags & META_RETURN_TTL) {
+      conn->takeBuffer(keywords::k_META_TTL, 2);
+    }
+    if ((metaFlags & META_UPDATE_TTL) && op != META_SET_OP) {
+      conn->takeBuffer(keywords::k_META_SET_TTL_, 2);
+      conn->takeNumber(exptime);
+    }
+    if ((metaFlags & META_VIVIFY) &&
+        (op == META_GET_OP || op == META_ARITHMETIC_OP)) {
+      conn->takeBuffer(keywords::k_META_VIVIFY_, 2);
+      conn->takeNumber(exptime);
+    }
+    if ((metaFlags & META_INVALIDATE) &&
+        (op == META_SET_OP || op == META_DELETE_OP)) {
+      conn->takeBuffer(keywords::k_META_INVALIDATE, 2);
+    }
+    if ((metaFlags & META_COMPARE_CAS) && cas_uniques != NULL) {
+      conn->takeBuffer(keywords::k_META_COMPARE_CAS_, 2);
+      conn->takeNumber(static_cast<int64_t>(cas_uniques[i]));
+    }
+    if (metaFlags & META_QUIET) {
+      conn->takeBuffer(keywords::k_META_QUIET, 2);
+    }
+    conn->takeBuffer(keywords::k_META_OPAQUE_, 2);
+    conn->takeNumber(static_cast<int64_t>(i));
+    conn->takeBuffer(kCRLF, 2);
+    if (op == META_SET_OP) {
+      if (packed != NULL) {
+        conn->takeOwnedBuffer(packed, valLen);
+      } else {
+        conn->takeBuffer(vals[i], valLen);
+      }
+      conn->takeBuffer(kCRLF, 2);
+    }
+    ++conn->m_counter;
+  }
+
+  for (idx = 0; idx < m_nConns; idx++) {
+    Connection* conn = m_conns + idx;
+    if (conn->m_counter > 0) {
+      conn->takeBuffer(keywords::kMN, 2);
+      conn->takeBuffer(kCRLF, 2);
+      conn->setParserMode(MODE_END_STATE);
+      ++m_nActiveConn;
+      m_activeConns.push_back(conn);
+      conn->getMetaResults()->reserve(conn->m_counter);
+    }
+  }
+}
+
+
 void ConnectionPool::broadcastCommand(const char * const cmd, const size_t cmdLen, const bool noreply) {
   for (size_t idx = 0; idx < m_nConns; ++idx) {
     Connection* conn = m_conns + idx;
@@ -399,7 +590,24 @@ void ConnectionPool::broadcastCommand(const char * const cmd, const size_t cmdLe
   }
 }
 
+static inline bool wouldBlock() {
+  return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+
 err_code_t ConnectionPool::waitPoll() {
+  err_code_t ret_code = startPoll();
+  if (ret_code != RET_OK) {
+    return ret_code;
+  }
+  while (!stepPoll(-1)) {
+  }
+  return m_pollRetCode;
+}
+
+
+err_code_t ConnectionPool::startPoll() {
+  m_pollRetCode = RET_OK;
   if (m_nActiveConn == 0) {
     if (m_nInvalidKey > 0) {
       return RET_INVALID_KEY_ERR;
@@ -408,147 +616,275 @@ err_code_t ConnectionPool::waitPoll() {
       return RET_MC_SERVER_ERR;
     }
   }
-  nfds_t n_fds = m_nActiveConn;
+
+  int64_t now = utility::monotonicMillis();
+  for (std::vector<Connection*>::iterator it = m_activeConns.begin();
+       it != m_activeConns.end(); ++it) {
+    Connection* conn = *it;
+    conn->m_pollEvents = POLLOUT | POLLIN;
+    conn->m_pollDeadline = now + m_pollTimeout;
+    watchConn(conn);
+  }
+
+#ifdef MC_USE_EPOLL
+  // Sockets stay registered (edge-triggered) across commands, so
+  // readiness that changed while idle (e.g. the server closing the
+  // connection) is still queued. Drain it before sending anything.
+  drainEvents(0, now);
+  // An idle socket is writable but will not see a new POLLOUT edge,
+  // so send eagerly and only wait if the socket buffer fills up.
+  for (std::vector<Connection*>::iterator it = m_activeConns.begin();
+       it != m_activeConns.end(); ++it) {
+    if ((*it)->m_pollEvents & POLLOUT) {
+      handleEvents(*it, POLLOUT, now, m_pollRetCode);
+    }
+  }
+#endif
+  return RET_OK;
+}
+
+
+bool ConnectionPool::stepPoll(int maxWait) {
+  if (m_nActiveConn == 0) {
+#ifdef MC_USE_EPOLL
+    // idle, only keep the epoll fd from staying readable
+    drainEvents(0, utility::monotonicMillis());
+#endif
+    return true;
+  }
+  int64_t now = utility::monotonicMillis();
+  int timeout = expireConns(now, m_pollRetCode);
+  if (m_nActiveConn == 0) {
+    return true;
+  }
+  if (maxWait >= 0 && maxWait < timeout) {
+    timeout = maxWait;
+  }
+
+#ifdef MC_USE_EPOLL
+  if (drainEvents(timeout, now) == -1) {
+    markDeadAll(keywords::kPOLL_ERROR, true);
+    m_pollRetCode = RET_POLL_ERR;
+    return true;
+  }
+#else
+  nfds_t n_fds = m_activeConns.size();
   pollfd_t pollfds[n_fds];
+  for (nfds_t fd_idx = 0; fd_idx < n_fds; fd_idx++) {
+    Connection* conn = m_activeConns[fd_idx];
+    // poll ignores negative fds, i.e. connections no longer in flight
+    pollfds[fd_idx].fd = conn->m_pollEvents ? conn->socketFd() : -1;
+    pollfds[fd_idx].events = conn->m_pollEvents;
+    pollfds[fd_idx].revents = 0;
+  }
+  int rv = poll(pollfds, n_fds, timeout);
+  if (rv == -1) {
+    if (errno == EINTR) {
+      return false;
+    }
+    markDeadAll(keywords::kPOLL_ERROR, true);
+    m_pollRetCode = RET_POLL_ERR;
+    return true;
+  }
+  now = utility::monotonicMillis();
+  for (nfds_t fd_idx = 0; fd_idx < n_fds; fd_idx++) {
+    if (pollfds[fd_idx].revents) {
+      handleEvents(m_activeConns[fd_idx], pollfds[fd_idx].revents, now, m_pollRetCode);
+    }
+  }
+#endif
+  return m_nActiveConn == 0;
+}
 
-  Connection* fd2conn[n_fds];
 
-  pollfd_t* pollfd_ptr = NULL;
-  nfds_t fd_idx = 0;
+#ifdef MC_USE_EPOLL
+int ConnectionPool::drainEvents(int timeout, int64_t now) {
+  struct epoll_event events[MC_EPOLL_MAX_EVENTS];
+  int rv = epoll_wait(m_epollFd, events, MC_EPOLL_MAX_EVENTS, timeout);
+  if (rv == -1) {
+    // EINTR: nothing happened, the caller comes back
+    return errno == EINTR ? 0 : -1;
+  }
+  if (timeout != 0) {
+    now = utility::monotonicMillis();
+  }
+  for (int i = 0; i < rv; i++) {
+    handleEvents(static_cast<Connection*>(events[i].data.ptr),
+                 static_cast<short>(events[i].events), now, m_pollRetCode);
+  }
+  return rv;
+}
+#endif
 
-  for (std::vector<Connection*>::iterator it = m_activeConns.begin(); it != m_activeConns.end();
-       ++it, ++fd_idx) {
-    Connection* conn = *it;
-    pollfd_ptr = &pollfds[fd_idx];
-    pollfd_ptr->fd = conn->socketFd();
-    pollfd_ptr->events = POLLOUT | POLLIN;
-    fd2conn[fd_idx] = conn;
-  }
-
-  err_code_t ret_code = RET_OK;
-  while (m_nActiveConn) {
-    int rv = poll(pollfds, n_fds, m_pollTimeout);
-    if (rv == -1) {
-      markDeadAll(pollfds, keywords::kPOLL_ERROR);
-      ret_code = RET_POLL_ERR;
-      break;
-    } else if (rv == 0) {
-      log_warn("poll timeout. (m_nActiveConn: %d)", m_nActiveConn);
-      // NOTE: MUST reset all active TCP connections after timeout.
-      markDeadAll(pollfds, keywords::kPOLL_TIMEOUT_ERROR);
-      ret_code = RET_POLL_TIMEOUT_ERR;
-      break;
+
+int ConnectionPool::pollFd() const {
+  return m_epollFd;
+}
+
+
+int ConnectionPool::nextPollTimeout() const {
+  if (m_nActiveConn == 0) {
+    return 0;
+  }
+  int64_t now = utility::monotonicMillis();
+  int64_t nextDeadline = now + m_pollTimeout;
+  for (std::vector<Connection*>::const_iterator it = m_activeConns.begin();
+       it != m_activeConns.end(); ++it) {
+    if ((*it)->m_pollEvents && (*it)->m_pollDeadline < nextDeadline) {
+      nextDeadline = (*it)->m_pollDeadline;
+    }
+  }
+  return nextDeadline > now ? static_cast<int>(nextDeadline - now) : 0;
+}
+
+
+void ConnectionPool::handleEvents(Connection* conn, short revents, int64_t now,
+                                  err_code_t& ret_code) {
+  if (conn->m_pollEvents == 0) {
+    // not part of the current command, or already done with it
+    if (revents & (POLLERR | POLLHUP | MC_POLLRDHUP)) {
+      conn->markDead(keywords::kCONN_POLL_ERROR);
+    }
+    return;
+  }
+
+  if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+    markDeadConn(conn, keywords::kCONN_POLL_ERROR);
+    if (conn->tryReconnect()) {
+      rewindConn(conn, now);
     } else {
-      err_code_t err;
-      for (fd_idx = 0; fd_idx < n_fds; fd_idx++) {
-        pollfd_ptr = &pollfds[fd_idx];
-        Connection* conn = fd2conn[fd_idx];
-
-        if (pollfd_ptr->revents & (POLLERR | POLLHUP | POLLNVAL)) {
-          markDeadConn(conn, keywords::kCONN_POLL_ERROR, pollfd_ptr);
-          if (conn->tryReconnect()) {
-            rewindConn(conn, pollfd_ptr);
-          } else {
-            ret_code = RET_CONN_POLL_ERR;
-            --m_nActiveConn;
-          }
-          goto next_fd;
-        }
+      ret_code = RET_CONN_POLL_ERR;
+      --m_nActiveConn;
+    }
+    return;
+  }
+  revents &= conn->m_pollEvents;
+
+  // first recv before send
+  if (revents & POLLIN && !conn->isSent()) {
+    ssize_t nRecv = conn->recv(true);
+    if (nRecv == -1 && wouldBlock()) {
+      // stale edge from the previous command
+    } else if (nRecv == -1 || nRecv == 0) {
+      markDeadConn(conn, keywords::kRECV_ERROR);
+      if (conn->tryReconnect(false)) {
+        conn->m_pollEvents = POLLOUT;
+        watchConn(conn);
+      } else {
+        ret_code = RET_RECV_ERR;
+        --m_nActiveConn;
+      }
+      return;
+    } else {
+      // if we recv some data before we sent (normally impossible)
+      conn->m_pollEvents &= ~POLLIN;
+    }
+    revents &= ~POLLIN;
+  }
 
-        // first recv before send
-        if (pollfd_ptr->revents & POLLIN && !conn->isSent()) {
-          ssize_t nRecv = conn->recv(true);
-          if (nRecv == -1 || nRecv == 0) {
-            markDeadConn(conn, keywords::kRECV_ERROR, pollfd_ptr);
-            if (conn->tryReconnect(false)) {
-              pollfd_ptr->fd = conn->socketFd();
-              pollfd_ptr->events = POLLOUT;
-            } else {
-              ret_code = RET_RECV_ERR;
-              --m_nActiveConn;
-            }
-            goto next_fd;
-          } else {
-            // if we recv some data before we sent (normally impossible)
-            pollfd_ptr->events &= ~POLLIN;
-          }
+  // send
+  if (revents & POLLOUT) {
+    // keep sending until done or the socket buffer is full
+    for (;;) {
+      ssize_t nToSend = conn->send();
+      if (nToSend == -1) {
+        if (wouldBlock()) {
+          break;
         }
-
-        // send
-        if (pollfd_ptr->revents & POLLOUT) {
-          // POLLOUT send
-          ssize_t nToSend = conn->send();
-          if (nToSend == -1) {
-            markDeadConn(conn, keywords::kSEND_ERROR, pollfd_ptr);
-            if (conn->tryReconnect()) {
-              rewindConn(conn, pollfd_ptr);
-            } else {
-              ret_code = RET_SEND_ERR;
-              --m_nActiveConn;
-            }
-            goto next_fd;
-          } else {
-            // start to recv if any data is sent
-            pollfd_ptr->events |= POLLIN;
-
-            if (nToSend == 0) {
-              // log_debug("[%d] all sent", pollfd_ptr->fd);
-              pollfd_ptr->events &= ~POLLOUT;
-              if (conn->m_counter == 0) {
-                // just send, no recv for noreply
-                --m_nActiveConn;
-              }
-            }
-          }
+        markDeadConn(conn, keywords::kSEND_ERROR);
+        if (conn->tryReconnect()) {
+          rewindConn(conn, now);
+        } else {
+          ret_code = RET_SEND_ERR;
+          --m_nActiveConn;
+        }
+        return;
+      }
+      // start to recv if any data is sent
+      conn->m_pollEvents |= POLLIN;
+      conn->m_pollDeadline = now + m_pollTimeout;
+
+      if (nToSend == 0) {
+        conn->m_pollEvents &= ~POLLOUT;
+        if (conn->m_counter == 0) {
+          // just send, no recv for noreply
+          finishConn(conn);
+          return;
         }
+        break;
+      }
+    }
+  }
 
-        // recv
-        if (pollfd_ptr->revents & POLLIN) {
-          // POLLIN recv
-          ssize_t nRecv = conn->recv();
-          if (nRecv == -1 || nRecv == 0) {
-            markDeadConn(conn, keywords::kRECV_ERROR, pollfd_ptr);
-            if (conn->tryReconnect()) {
-              rewindConn(conn, pollfd_ptr);
-            } else {
-              ret_code = RET_RECV_ERR;
-              --m_nActiveConn;
-            }
-            goto next_fd;
-          }
-
-          conn->process(err);
-          switch (err) {
-            case RET_OK:
-              pollfd_ptr->events &= ~POLLIN;
-              --m_nActiveConn;
-              break;
-            case RET_INCOMPLETE_BUFFER_ERR:
-              break;
-            case RET_PROGRAMMING_ERR:
-              markDeadConn(conn, keywords::kPROGRAMMING_ERROR, pollfd_ptr);
-              ret_code = RET_PROGRAMMING_ERR;
-              --m_nActiveConn;
-              goto next_fd;
-              break;
-            case RET_MC_SERVER_ERR:
-              // soft server error
-              markDeadConn(conn, keywords::kSERVER_ERROR, pollfd_ptr);
-              ret_code = RET_MC_SERVER_ERR;
-              --m_nActiveConn;
-              goto next_fd;
-              break;
-            default:
-              NOT_REACHED();
-              break;
-          }
+  // recv
+  if (revents & POLLIN) {
+    // keep reading until the response is complete or the socket is drained
+    for (;;) {
+      ssize_t nRecv = conn->recv();
+      if (nRecv == -1 && wouldBlock()) {
+        break;
+      }
+      if (nRecv == -1 || nRecv == 0) {
+        markDeadConn(conn, keywords::kRECV_ERROR);
+        if (conn->tryReconnect()) {
+          rewindConn(conn, now);
+        } else {
+          ret_code = RET_RECV_ERR;
+          --m_nActiveConn;
         }
+        return;
+      }
+      conn->m_pollDeadline = now + m_pollTimeout;
+
+      err_code_t err;
+      conn->process(err);
+      switch (err) {
+        case RET_OK:
+          finishConn(conn);
+          return;
+        case RET_INCOMPLETE_BUFFER_ERR:
+          break;
+        case RET_PROGRAMMING_ERR:
+          markDeadConn(conn, keywords::kPROGRAMMING_ERROR);
+          ret_code = RET_PROGRAMMING_ERR;
+          --m_nActiveConn;
+          return;
+        case RET_MC_SERVER_ERR:
+          // soft server error
+          markDeadConn(conn, keywords::kSERVER_ERROR);
+          ret_code = RET_MC_SERVER_ERR;
+          --m_nActiveConn;
+          return;
+        default:
+          NOT_REACHED();
+          break;
+      }
+    }
+  }
+}
+
 
-next_fd: {}
-      } // end for
+// Resets connections that made no progress within m_pollTimeout and returns
+// the poll timeout until the next deadline of those still in flight.
+int ConnectionPool::expireConns(int64_t now, err_code_t& ret_code) {
+  int64_t nextDeadline = now + m_pollTimeout;
+  for (std::vector<Connection*>::iterator it = m_activeConns.begin();
+       it != m_activeConns.end(); ++it) {
+    Connection* conn = *it;
+    if (conn->m_pollEvents == 0) {
+      continue;
+    }
+    if (conn->m_pollDeadline <= now) {
+      log_warn("poll timeout. (m_nActiveConn: %d)", m_nActiveConn);
+      // NOTE: MUST reset TCP connections after timeout.
+      markDeadConn(conn, keywords::kPOLL_TIMEOUT_ERROR);
+      ret_code = RET_POLL_TIMEOUT_ERR;
+      --m_nActiveConn;
+    } else if (conn->m_pollDeadline < nextDeadline) {
+      nextDeadline = conn->m_pollDeadline;
     }
   }
-  return ret_code;
+  return static_cast<int>(nextDeadline - now);
 }
 
 
@@ -564,7 +900,7 @@ void ConnectionPool::collectRetrievalResult(std::vector<retrieval_result_t*>& re
         // of one retrieval result is not complete yet.
         continue;
       }
-      results.push_back(r1.inner());
+      results.push_back(r1.inner((*it)->getArena()));
     }
   }
 }
@@ -635,6 +971,26 @@ void ConnectionPool::collectUnsignedResult(std::vector<unsigned_result_t*>& resu
 }
 
 
+void ConnectionPool::collectMetaResult(std::vector<meta_result_t*>& results) {
+  for (std::vector<Connection*>::iterator it = m_activeConns.begin();
+       it != m_activeConns.end(); ++it) {
+    types::MetaResultList* rst = (*it)->getMetaResults();
+
+    for (types::MetaResultList::iterator it2 = rst->begin(); it2 != rst->end(); ++it2) {
+      types::MetaResult& r1 = *it2;
+      if (r1.bytesRemain > 0 || r1.header.opaque >= m_metaRequestKeys.size()) {
+        continue;
+      }
+      meta_result_t* inner = r1.inner((*it)->getArena());
+      const struct iovec& iov = m_metaRequestKeys[inner->opaque];
+      inner->key = static_cast<char*>(iov.iov_base);
+      inner->key_len = iov.iov_len;
+      results.push_back(inner);
+    }
+  }
+}
+
+
 void ConnectionPool::reset() {
   for (std::vector<Connection*>::iterator it = m_activeConns.begin();
        it != m_activeConns.end(); ++it) {
@@ -643,6 +999,7 @@ void ConnectionPool::reset() {
   m_nActiveConn = 0;
   m_nInvalidKey = 0;
   m_activeConns.clear();
+  m_metaRequestKeys.clear();
 }
 
 
@@ -667,6 +1024,27 @@ void ConnectionPool::setRetryTimeout(int timeout) {
 }
 
 
+void ConnectionPool::setCompressThreshold(int threshold) {
+  m_compressThreshold = threshold > 0 ? static_cast<size_t>(threshold) : 0;
+}
+
+
+// Returns the LZ4-packed copy of a value worth compressing (and updates
+// valLen and flags to match), or NULL to send the value as is.
+char* ConnectionPool::compressValue(const char* val, size_t& valLen, flags_t& flags) {
+  if (m_compressThreshold == 0 || valLen < m_compressThreshold) {
+    return NULL;
+  }
+  size_t packedLen = 0;
+  char* packed = lz4::packValue(val, valLen, packedLen);
+  if (packed != NULL) {
+    valLen = packedLen;
+    flags |= MC_FLAG_LZ4_COMPRESSED;
+  }
+  return packed;
+}
+
+
 void ConnectionPool::setMaxRetries(int max_retries) {
   for (size_t idx = 0; idx < m_nConns; ++idx) {
     Connection* conn = m_conns + idx;
@@ -675,35 +1053,52 @@ void ConnectionPool::setMaxRetries(int max_retries) {
 }
 
 
-void ConnectionPool::markDeadAll(pollfd_t* pollfds, const char* reason) {
-  nfds_t fd_idx = 0;
+void ConnectionPool::markDeadAll(const char* reason, bool inFlightOnly) {
   for (std::vector<Connection*>::iterator it = m_activeConns.begin();
-      it != m_activeConns.end();
-      ++it, ++fd_idx) {
+      it != m_activeConns.end(); ++it) {
     Connection* conn = *it;
-    if (pollfds == NULL) {
+    if (!inFlightOnly || conn->m_pollEvents) {
       conn->markDead(reason);
-    } else {
-      pollfd_t* pollfd_ptr = &pollfds[fd_idx];
-      if (pollfd_ptr->events & (POLLOUT | POLLIN)) {
-        conn->markDead(reason);
-      }
+      conn->m_pollEvents = 0;
     }
   }
 }
 
 
-void ConnectionPool::markDeadConn(Connection* conn, const char* reason, pollfd_t* fd_ptr) {
+void ConnectionPool::markDeadConn(Connection* conn, const char* reason) {
   conn->markDead(reason);
-  fd_ptr->events &= ~POLLOUT & ~POLLIN;
-  fd_ptr->fd = conn->socketFd();
+  conn->m_pollEvents = 0;
+}
+
+
+void ConnectionPool::finishConn(Connection* conn) {
+  conn->m_pollEvents = 0;
+  --m_nActiveConn;
 }
 
 
-void ConnectionPool::rewindConn(Connection* conn, pollfd_t* fd_ptr) {
+void ConnectionPool::rewindConn(Connection* conn, int64_t now) {
   conn->rewind();
-  fd_ptr->fd = conn->socketFd();
-  fd_ptr->events = POLLOUT;
+  conn->m_pollEvents = POLLOUT;
+  conn->m_pollDeadline = now + m_pollTimeout;
+  watchConn(conn);
+}
+
+
+void ConnectionPool::watchConn(Connection* conn) {
+#ifdef MC_USE_EPOLL
+  if (conn->m_pollRegistered || conn->socketFd() == -1) {
+    return;
+  }
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  ev.data.ptr = conn;
+  if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, conn->socketFd(), &ev) == 0) {
+    conn->m_pollRegistered = true;
+  } else {
+    log_err("epoll_ctl add failed for %s", conn->name());
+  }
+#endif
 }
 
 
@@ -2,6 +2,7 @@
 
 #include "DataBlock.h"
 #include "Common.h"
+#include "Utility.h"
 
 namespace douban {
 namespace mc {
@@ -91,8 +92,7 @@ size_t DataBlock::getWriteLeft() {
 
 
 size_t DataBlock::find(char c, size_t since) {
-  char *p = std::find(m_data + since, m_data + m_size, c);
-  return p - m_data;
+  return utility::findChar(m_data + since, m_data + m_size, c) - m_data;
 }
 
 
@@ -1,3 +1,7 @@
+#include <cstring>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
 #include "hashkit/hashkit.h"
 
 
@@ -87,6 +91,63 @@ uint32_t hash_crc_32(const char* key, size_t key_length) {
 }
 
 
+
+static uint32_t crc32ctab[256];
+
+static bool init_crc32ctab() {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int j = 0; j < 8; j++) {
+      crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+    }
+    crc32ctab[i] = crc;
+  }
+  return true;
+}
+
+static uint32_t crc_32c_sw(const uint8_t* key, size_t key_length) {
+  static const bool initialized = init_crc32ctab();
+  (void)initialized;
+  uint32_t crc = ~0;
+  for (size_t i = 0; i < key_length; i++) {
+    crc = (crc >> 8) ^ crc32ctab[(crc ^ key[i]) & 0xff];
+  }
+  return ~crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc_32c_hw(const uint8_t* key, size_t key_length) {
+  uint64_t crc = 0xffffffff;
+  while (key_length >= 8) {
+    uint64_t word;
+    std::memcpy(&word, key, 8);
+    crc = _mm_crc32_u64(crc, word);
+    key += 8;
+    key_length -= 8;
+  }
+  uint32_t crc32 = static_cast<uint32_t>(crc);
+  while (key_length > 0) {
+    crc32 = _mm_crc32_u8(crc32, *key);
+    ++key;
+    --key_length;
+  }
+  return ~crc32;
+}
+#endif
+
+uint32_t hash_crc_32c(const char* key, size_t key_length) {
+  const uint8_t* unsigned_key = reinterpret_cast<const uint8_t*>(key);
+#if defined(__x86_64__)
+  static const bool has_sse42 = __builtin_cpu_supports("sse4.2");
+  if (has_sse42) {
+    return crc_32c_hw(unsigned_key, key_length);
+  }
+#endif
+  return crc_32c_sw(unsigned_key, key_length);
+}
+
+
 } // namespace hashkit
 } // namespace mc
 } // namespace douban
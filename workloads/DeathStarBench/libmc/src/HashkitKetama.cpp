@@ -15,8 +15,21 @@ const size_t KetamaSelector::s_pointerPerHash = 1;
 const size_t KetamaSelector::s_pointerPerServer = 100;
 const hash_function_t KetamaSelector::s_defaultHashFunction = &hash_md5;
 
+int32_t jump_consistent_hash(uint64_t key, int32_t nBuckets) {
+  int64_t b = -1, j = 0;
+  while (j < nBuckets) {
+    b = j;
+    key = key * 2862933555777941757ULL + 1;
+    j = static_cast<int64_t>((b + 1) * (static_cast<double>(1LL << 31) /
+                                        static_cast<double>((key >> 33) + 1)));
+  }
+  return static_cast<int32_t>(b);
+}
+
+
 KetamaSelector::KetamaSelector()
-  :m_nServers(0), m_useFailover(false), m_hashFunction(NULL)
+  :m_conns(NULL), m_nServers(0), m_useFailover(false), m_distribution(DISTRIBUTION_KETAMA),
+   m_hashFunction(NULL)
 #ifndef NDEBUG
   , m_sorted(false)
 #endif
@@ -27,6 +40,10 @@ void KetamaSelector::setHashFunction(hash_function_t fn) {
   m_hashFunction = fn;
 }
 
+void KetamaSelector::setDistribution(distribution_t distribution) {
+  m_distribution = distribution;
+}
+
 void KetamaSelector::enableFailover() {
   m_useFailover = true;
 }
@@ -36,11 +53,17 @@ void KetamaSelector::disableFailover() {
 }
 
 void KetamaSelector::reset() {
-  m_continuum.clear();
+  m_points.clear();
+  m_pointConns.clear();
+  m_eytzinger.clear();
+  m_eytzingerRank.clear();
+  m_conns = NULL;
   m_nServers = 0;
 }
 
 void KetamaSelector::addServers(Connection* conns, size_t nConns) {
+  std::vector<continuum_item_t> continuum;
+  continuum.reserve(nConns * s_pointerPerServer / s_pointerPerHash);
 
   // from: libmemcached/libmemcached/hosts.cc +303
   char sort_host[MC_NI_MAXHOST + 1 + MC_NI_MAXSERV + 1 + MC_NI_MAXSERV]= "";
@@ -67,98 +90,136 @@ void KetamaSelector::addServers(Connection* conns, size_t nConns) {
       item.hash_value = hash_md5(sort_host, sort_host_len);
       item.conn_idx = i;
       item.conn = conn;
-      m_continuum.push_back(item);
+      continuum.push_back(item);
     }
   }
 
+  m_conns = conns;
   m_nServers = nConns;
 
-  std::sort(m_continuum.begin(), m_continuum.end(), continuum_item_t::compare);
+  std::sort(continuum.begin(), continuum.end(), continuum_item_t::compare);
+
+  size_t nPoints = continuum.size();
+  m_points.resize(nPoints);
+  m_pointConns.resize(nPoints);
+  for (size_t i = 0; i < nPoints; i++) {
+    m_points[i] = continuum[i].hash_value;
+    m_pointConns[i] = static_cast<uint32_t>(continuum[i].conn_idx);
+  }
+
+  m_eytzinger.assign(nPoints + 1, 0);
+  m_eytzingerRank.assign(nPoints + 1, 0);
+  size_t sortedIdx = 0;
+  buildEytzinger(sortedIdx, 1);
 #ifndef NDEBUG
   m_sorted = true;
 #endif
 }
 
 
-std::vector<continuum_item_t>::iterator KetamaSelector::getServerIt(const char* key, size_t key_len,
-                                                                    bool check_alive) {
-#ifndef NDEBUG
-  if (!m_sorted) {
-    return m_continuum.end();
+// In-order walk of the implicit tree (children of k are 2k and 2k+1)
+// assigns the sorted points to their BFS slots.
+void KetamaSelector::buildEytzinger(size_t& sortedIdx, size_t k) {
+  if (k > m_points.size()) {
+    return;
   }
-#endif
-  std::vector<continuum_item_t>::iterator it = m_continuum.end();
-  switch (m_nServers) {
-    case 0:
-      return m_continuum.end();
-      break;
-    case 1:
-      it = m_continuum.begin();
-      break;
-    default:
-      continuum_item_t target_item;
-
-      if (m_hashFunction == NULL) {
-        m_hashFunction = s_defaultHashFunction;
-        log_warn("hash function is not specified, use hash_md5");
-      }
-      target_item.hash_value = m_hashFunction(key, key_len);
-      target_item.conn_idx = 0;
-      target_item.conn = NULL;
-      it = std::lower_bound(m_continuum.begin(), m_continuum.end(), target_item,
-                            continuum_item_t::compare);
-      break;
+  buildEytzinger(sortedIdx, 2 * k);
+  m_eytzinger[k] = m_points[sortedIdx];
+  m_eytzingerRank[k] = static_cast<uint32_t>(sortedIdx);
+  ++sortedIdx;
+  buildEytzinger(sortedIdx, 2 * k + 1);
+}
+
+
+// Sorted index of the first point >= hash_value, wrapping to 0 past the
+// end; same answer as std::lower_bound over m_points, but the descent is
+// branch-free and each level's cache line is prefetched four levels ahead.
+size_t KetamaSelector::searchContinuum(uint32_t hash_value) const {
+  const uint32_t* tree = m_eytzinger.data();
+  const size_t n = m_points.size();
+  size_t k = 1;
+  while (k <= n) {
+    __builtin_prefetch(tree + 16 * k);
+    k = 2 * k + (tree[k] < hash_value);
+  }
+  // strip the trailing right turns (and the last left turn) to get back
+  // to the node where the search last went left
+  k >>= __builtin_ffsll(~static_cast<long long>(k));
+  if (k == 0) {
+    return 0;
   }
+  return m_eytzingerRank[k];
+}
+
 
-  if (it == m_continuum.end()) {
-    it = m_continuum.begin();
+uint32_t KetamaSelector::hashKey(const char* key, size_t key_len) {
+  if (m_hashFunction == NULL) {
+    m_hashFunction = s_defaultHashFunction;
+    log_warn("hash function is not specified, use hash_md5");
   }
-  Connection* origin_conn = it->conn;
+  return m_hashFunction(key, key_len);
+}
+
 
-  bool is_alive = true;
-  if (check_alive && origin_conn != NULL) {
-     is_alive = origin_conn->tryReconnect(false);
+int KetamaSelector::getServerIdx(const char* key, size_t key_len, bool check_alive) {
+#ifndef NDEBUG
+  if (!m_sorted) {
+    return -1;
+  }
+#endif
+  if (m_nServers == 0) {
+    return -1;
   }
 
-  if (!is_alive) {
-    if (m_useFailover) {
-      size_t max_iter = m_continuum.size();
-      do {
-        ++it;
-        if (it == m_continuum.end()) {
-          it = m_continuum.begin();
-        }
-        if (it->conn != origin_conn && it->conn->tryReconnect(false)) {
-          break;
-        }
-      } while (--max_iter);
-      if (max_iter == 0) {
-        log_warn("no server is avaliable(alive) for key: \"%.*s\"", static_cast<int>(key_len), key);
-        return m_continuum.end();
-      }
+  size_t pos = 0;  // sorted continuum position (ketama) or server index (jump)
+  size_t conn_idx = 0;
+  if (m_nServers > 1) {
+    uint32_t hash_value = hashKey(key, key_len);
+    if (m_distribution == DISTRIBUTION_JUMP) {
+      pos = static_cast<size_t>(jump_consistent_hash(hash_value,
+                                                     static_cast<int32_t>(m_nServers)));
     } else {
-      return m_continuum.end();
+      pos = searchContinuum(hash_value);
     }
   }
+  conn_idx = m_distribution == DISTRIBUTION_JUMP ? pos : m_pointConns[pos];
+
+  if (!check_alive || m_conns[conn_idx].tryReconnect(false)) {
+    return static_cast<int>(conn_idx);
+  }
+  if (!m_useFailover) {
+    return -1;
+  }
 
-  return it;
+  // walk forward on the ring (or the server list for jump hashing) to the
+  // next alive server
+  size_t origin_idx = conn_idx;
+  size_t ring_size = m_distribution == DISTRIBUTION_JUMP ? m_nServers : m_points.size();
+  size_t max_iter = ring_size;
+  do {
+    if (++pos == ring_size) {
+      pos = 0;
+    }
+    conn_idx = m_distribution == DISTRIBUTION_JUMP ? pos : m_pointConns[pos];
+    if (conn_idx != origin_idx && m_conns[conn_idx].tryReconnect(false)) {
+      return static_cast<int>(conn_idx);
+    }
+  } while (--max_iter);
+  log_warn("no server is avaliable(alive) for key: \"%.*s\"", static_cast<int>(key_len), key);
+  return -1;
 }
 
 
 int KetamaSelector::getServer(const char* key, size_t key_len, bool check_alive) {
-  std::vector<continuum_item_t>::iterator it = getServerIt(key, key_len, check_alive);
-  if (it == m_continuum.end()) {
-    return -1;
-  }
-  return static_cast<int>(it->conn_idx);
+  return getServerIdx(key, key_len, check_alive);
 }
 
 Connection* KetamaSelector::getConn(const char* key, size_t key_len, bool check_alive) {
-  std::vector<continuum_item_t>::iterator it = getServerIt(key, key_len, check_alive);
-  if (it == m_continuum.end()) {
+  int idx = getServerIdx(key, key_len, check_alive);
+  if (idx < 0) {
     return NULL;
   }
-  return it->conn;
+  return &m_conns[idx];
 }
 
 
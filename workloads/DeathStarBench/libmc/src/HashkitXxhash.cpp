@@ -0,0 +1,78 @@
+#include <cstring>
+#include "hashkit/hashkit.h"
+
+// https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md (XXH32, seed 0)
+
+namespace douban {
+namespace mc {
+namespace hashkit {
+
+static const uint32_t XXH_PRIME32_1 = 0x9E3779B1U;
+static const uint32_t XXH_PRIME32_2 = 0x85EBCA77U;
+static const uint32_t XXH_PRIME32_3 = 0xC2B2AE3DU;
+static const uint32_t XXH_PRIME32_4 = 0x27D4EB2FU;
+static const uint32_t XXH_PRIME32_5 = 0x165667B1U;
+
+static inline uint32_t xxh_rotl32(uint32_t x, int r) {
+  return (x << r) | (x >> (32 - r));
+}
+
+static inline uint32_t xxh_read32(const uint8_t* p) {
+  uint32_t val;
+  std::memcpy(&val, p, sizeof(val));  // little-endian hosts only
+  return val;
+}
+
+static inline uint32_t xxh_round(uint32_t acc, uint32_t input) {
+  acc += input * XXH_PRIME32_2;
+  acc = xxh_rotl32(acc, 13);
+  return acc * XXH_PRIME32_1;
+}
+
+uint32_t hash_xxh32(const char *key, size_t key_length) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(key);
+  const uint8_t* const end = p + key_length;
+  uint32_t h32;
+
+  if (key_length >= 16) {
+    const uint8_t* const limit = end - 16;
+    uint32_t v1 = XXH_PRIME32_1 + XXH_PRIME32_2;
+    uint32_t v2 = XXH_PRIME32_2;
+    uint32_t v3 = 0;
+    uint32_t v4 = 0 - XXH_PRIME32_1;
+    do {
+      v1 = xxh_round(v1, xxh_read32(p));
+      v2 = xxh_round(v2, xxh_read32(p + 4));
+      v3 = xxh_round(v3, xxh_read32(p + 8));
+      v4 = xxh_round(v4, xxh_read32(p + 12));
+      p += 16;
+    } while (p <= limit);
+    h32 = xxh_rotl32(v1, 1) + xxh_rotl32(v2, 7) + xxh_rotl32(v3, 12) + xxh_rotl32(v4, 18);
+  } else {
+    h32 = XXH_PRIME32_5;
+  }
+
+  h32 += static_cast<uint32_t>(key_length);
+
+  while (p + 4 <= end) {
+    h32 += xxh_read32(p) * XXH_PRIME32_3;
+    h32 = xxh_rotl32(h32, 17) * XXH_PRIME32_4;
+    p += 4;
+  }
+  while (p < end) {
+    h32 += (*p) * XXH_PRIME32_5;
+    h32 = xxh_rotl32(h32, 11) * XXH_PRIME32_1;
+    p++;
+  }
+
+  h32 ^= h32 >> 15;
+  h32 *= XXH_PRIME32_2;
+  h32 ^= h32 >> 13;
+  h32 *= XXH_PRIME32_3;
+  h32 ^= h32 >> 16;
+  return h32;
+}
+
+} // namespace hashkit
+} // namespace mc
+} // namespace douban
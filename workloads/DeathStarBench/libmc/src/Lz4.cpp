@@ -0,0 +1,252 @@
+#include <cstring>
+
+#include "Lz4.h"
+
+namespace douban {
+namespace mc {
+namespace lz4 {
+
+static const size_t kMinMatch = 4;
+static const size_t kLastLiterals = 5;  // the block must end with literals
+static const size_t kMFLimit = 12;  // no match may start in the last 12 bytes
+static const size_t kMaxOffset = 65535;
+static const int kHashLog = 12;
+static const uint32_t kMaxValueSize = 0x7fffffff;
+
+
+static inline uint32_t read32(const char* p) {
+  uint32_t val;
+  std::memcpy(&val, p, sizeof(val));
+  return val;
+}
+
+
+static inline uint32_t hashSequence(uint32_t sequence) {
+  return (sequence * 2654435761U) >> (32 - kHashLog);
+}
+
+
+static inline char* writeLength(char* op, size_t len) {
+  while (len >= 255) {
+    *op++ = static_cast<char>(255);
+    len -= 255;
+  }
+  *op++ = static_cast<char>(len);
+  return op;
+}
+
+
+size_t compressBound(size_t srcLen) {
+  return srcLen + srcLen / 255 + 16;
+}
+
+
+size_t compress(const char* src, size_t srcLen, char* dst, size_t dstCap) {
+  uint32_t table[1 << kHashLog];
+  std::memset(table, 0, sizeof table);
+
+  char* op = dst;
+  char* const oend = dst + dstCap;
+  size_t ip = 0, anchor = 0;
+
+  if (srcLen > kMFLimit) {
+    const size_t mflimit = srcLen - kMFLimit;
+    const size_t matchlimit = srcLen - kLastLiterals;
+    while (ip < mflimit) {
+      uint32_t sequence = read32(src + ip);
+      uint32_t h = hashSequence(sequence);
+      size_t ref = table[h];
+      table[h] = static_cast<uint32_t>(ip);
+      if (ref >= ip || ip - ref > kMaxOffset || read32(src + ref) != sequence) {
+        // skip faster through data that does not compress
+        ip += 1 + ((ip - anchor) >> 6);
+        continue;
+      }
+
+      size_t matchLen = kMinMatch;
+      while (ip + matchLen < matchlimit && src[ref + matchLen] == src[ip + matchLen]) {
+        ++matchLen;
+      }
+
+      size_t litLen = ip - anchor;
+      if (static_cast<size_t>(oend - op) < 1 + litLen / 255 + 1 + litLen + 2 +
+                                           (matchLen - kMinMatch) / 255 + 1) {
+        return 0;
+      }
+      char* token = op++;
+      if (litLen >= 15) {
+        *token = static_cast<char>(15 << 4);
+        op = writeLength(op, litLen - 15);
+      } else {
+        *token = static_cast<char>(litLen << 4);
+      }
+      std::memcpy(op, src + anchor, litLen);
+      op += litLen;
+
+      size_t offset = ip - ref;
+      *op++ = static_cast<char>(offset & 0xff);
+      *op++ = static_cast<char>(offset >> 8);
+
+      size_t ml = matchLen - kMinMatch;
+      if (ml >= 15) {
+        *token = static_cast<char>(*token | 15);
+        op = writeLength(op, ml - 15);
+      } else {
+        *token = static_cast<char>(*token | ml);
+      }
+
+      ip += matchLen;
+      anchor = ip;
+    }
+  }
+
+  size_t litLen = srcLen - anchor;
+  if (static_cast<size_t>(oend - op) < 1 + litLen / 255 + 1 + litLen) {
+    return 0;
+  }
+  char* token = op++;
+  if (litLen >= 15) {
+    *token = static_cast<char>(15 << 4);
+    op = writeLength(op, litLen - 15);
+  } else {
+    *token = static_cast<char>(litLen << 4);
+  }
+  std::memcpy(op, src + anchor, litLen);
+  op += litLen;
+  return static_cast<size_t>(op - dst);
+}
+
+
+static inline bool readLength(const uint8_t* src, size_t srcLen, size_t& ip, size_t& len) {
+  uint8_t b;
+  do {
+    if (ip >= srcLen) {
+      return false;
+    }
+    b = src[ip++];
+    len += b;
+  } while (b == 255);
+  return true;
+}
+
+
+bool decompress(const char* src_, size_t srcLen, char* dst, size_t dstLen) {
+  const uint8_t* src = reinterpret_cast<const uint8_t*>(src_);
+  size_t ip = 0, op = 0;
+  while (ip < srcLen) {
+    uint8_t token = src[ip++];
+
+    size_t litLen = token >> 4;
+    if (litLen == 15 && !readLength(src, srcLen, ip, litLen)) {
+      return false;
+    }
+    if (litLen > srcLen - ip || litLen > dstLen - op) {
+      return false;
+    }
+    std::memcpy(dst + op, src + ip, litLen);
+    ip += litLen;
+    op += litLen;
+    if (ip == srcLen) {
+      // the last sequence has literals only
+      return op == dstLen;
+    }
+
+    if (srcLen - ip < 2) {
+      return false;
+    }
+    size_t offset = src[ip] | (static_cast<size_t>(src[ip + 1]) << 8);
+    ip += 2;
+    if (offset == 0 || offset > op) {
+      return false;
+    }
+
+    size_t matchLen = token & 15;
+    if (matchLen == 15 && !readLength(src, srcLen, ip, matchLen)) {
+      return false;
+    }
+    matchLen += kMinMatch;
+    if (matchLen > dstLen - op) {
+      return false;
+    }
+    char* match = dst + op - offset;
+    if (offset >= matchLen) {
+      std::memcpy(dst + op, match, matchLen);
+    } else {
+      // overlapping copy repeats the last `offset` bytes
+      for (size_t i = 0; i < matchLen; ++i) {
+        dst[op + i] = match[i];
+      }
+    }
+    op += matchLen;
+  }
+  return false;
+}
+
+
+char* packValue(const char* val, size_t valLen, size_t& packedLen) {
+  packedLen = 0;
+  if (valLen <= kValueHeaderSize + 1 || valLen > kMaxValueSize) {
+    return NULL;
+  }
+  // anything not smaller than the original is not worth storing
+  size_t cap = valLen - 1;
+  char* packed = new char[cap];
+  size_t n = compress(val, valLen, packed + kValueHeaderSize, cap - kValueHeaderSize);
+  if (n == 0) {
+    delete[] packed;
+    return NULL;
+  }
+  uint32_t len = static_cast<uint32_t>(valLen);
+  for (size_t i = 0; i < kValueHeaderSize; ++i) {
+    packed[i] = static_cast<char>((len >> (8 * i)) & 0xff);
+  }
+  packedLen = kValueHeaderSize + n;
+  return packed;
+}
+
+
+char* unpackValue(const char* data, size_t dataLen, size_t& valLen) {
+  size_t len = 0;
+  valLen = 0;
+  if (!unpackedSize(data, dataLen, len)) {
+    return NULL;
+  }
+  char* val = new char[len == 0 ? 1 : len];
+  if (!unpackValueInto(data, dataLen, val, len)) {
+    delete[] val;
+    return NULL;
+  }
+  valLen = len;
+  return val;
+}
+
+
+bool unpackedSize(const char* data, size_t dataLen, size_t& valLen) {
+  valLen = 0;
+  if (dataLen < kValueHeaderSize + 1) {
+    return false;
+  }
+  const uint8_t* header = reinterpret_cast<const uint8_t*>(data);
+  uint32_t len = 0;
+  for (size_t i = 0; i < kValueHeaderSize; ++i) {
+    len |= static_cast<uint32_t>(header[i]) << (8 * i);
+  }
+  if (len > kMaxValueSize) {
+    return false;
+  }
+  // the LZ4 ratio is bounded by 255, anything larger is corrupt
+  if (len / 255 > dataLen) {
+    return false;
+  }
+  valLen = len;
+  return true;
+}
+
+
+bool unpackValueInto(const char* data, size_t dataLen, char* dst, size_t valLen) {
+  return decompress(data + kValueHeaderSize, dataLen - kValueHeaderSize, dst, valLen);
+}
+
+} // namespace lz4
+} // namespace mc
+} // namespace douban
@@ -2,17 +2,18 @@
 #include "Keywords.h"
 
 
-using douban::mc::io::BufferReader;
-using douban::mc::io::TokenData;
+using douban::mc::io::Reader;
+using douban::mc::io::ReaderToken;
 using douban::mc::io::parseTokenData;
 using douban::mc::io::freeTokenData;
 using douban::mc::types::RetrievalResult;
 using douban::mc::types::LineResult;
+using douban::mc::types::MetaResult;
 
 namespace douban {
 namespace mc {
 
-PacketParser::PacketParser(BufferReader* reader)
+PacketParser::PacketParser(Reader* reader)
   : m_buffer_reader(NULL), m_state(FSM_START), m_mode(MODE_UNDEFINED),
     m_expectedResultCount(0), m_requestKeyIdx(0), mt_kvPtr(NULL) {
   m_buffer_reader = reader;
@@ -64,7 +65,103 @@ void PacketParser::processLineResult(err_code_t& err) {
 }
 
 
-void PacketParser::setBufferReader(BufferReader* reader) {
+static uint64_t parseUnsigned(const char* p, const char* end) {
+  uint64_t value = 0ULL;
+  for (; p < end && '0' <= *p && *p <= '9'; ++p) {
+    value = value * 10ULL + (*p - '0');
+  }
+  return value;
+}
+
+
+void PacketParser::processMetaResult(enum meta_result_type tp, err_code_t& err) {
+  // the 2-char return code, the rest of the line is left for FSM_META_START
+  m_buffer_reader->skipBytes(err, 2);
+  if (err != RET_OK) {
+    return;
+  }
+  m_metaResults.push_back(MetaResult());
+  m_metaResults.back().header.type_ = tp;
+  m_state = FSM_META_START;
+}
+
+
+void PacketParser::processMetaLine(err_code_t& err) {
+  // "[ <size>][ <flag>]*\r\n", flags may come in any order
+  err = RET_OK;
+  ReaderToken line_td;
+  size_t n = m_buffer_reader->readUntil(err, '\n', line_td);
+  if (err != RET_OK) {
+    return;
+  }
+  m_buffer_reader->skipBytes(err, 1); // '\n'
+  assert(err == RET_OK);
+
+  MetaResult* r = &m_metaResults.back();
+  meta_result_t* header = &r->header;
+  char* line = parseTokenData(line_td, n);
+  const char* p = line;
+  const char* end = line + (n > 0 ? n - 1 : 0); // -1 to ignore '\r'
+  bool expectSize = (header->type_ == META_VA);
+
+  while (p < end) {
+    if (*p == ' ') {
+      ++p;
+      continue;
+    }
+    const char* tokEnd = p;
+    while (tokEnd < end && *tokEnd != ' ') {
+      ++tokEnd;
+    }
+    if (expectSize) {
+      header->bytes = static_cast<uint32_t>(parseUnsigned(p, tokEnd));
+      expectSize = false;
+    } else {
+      switch (*p) {
+        case 'O':
+          header->opaque = static_cast<uint32_t>(parseUnsigned(p + 1, tokEnd));
+          break;
+        case 'c':
+          header->cas_unique = parseUnsigned(p + 1, tokEnd);
+          break;
+        case 'f':
+          header->flags = static_cast<flags_t>(parseUnsigned(p + 1, tokEnd));
+          break;
+        case 't':
+          header->ttl = (p + 1 < tokEnd && p[1] == '-') ?
+              -1 : static_cast<exptime_t>(parseUnsigned(p + 1, tokEnd));
+          break;
+        case 'W':
+          header->won = 1;
+          break;
+        case 'X':
+          header->stale = 1;
+          break;
+        case 'Z':
+          header->win_sent = 1;
+          break;
+        default:
+          break;
+      }
+    }
+    p = tokEnd;
+  }
+
+  if (line_td.size() > 1) {
+    delete[] line;
+  }
+  freeTokenData(line_td);
+
+  if (header->type_ == META_VA) {
+    r->bytesRemain = header->bytes + 1; // non-zero even for an empty value
+    m_state = FSM_META_VALUE_REMAINING;
+  } else {
+    m_state = FSM_START;
+  }
+}
+
+
+void PacketParser::setBufferReader(Reader* reader) {
   m_buffer_reader = reader;
 }
 
@@ -233,6 +330,36 @@ void PacketParser::process_packets(err_code_t& err) {
         }
         break;
 
+      case FSM_META_START:
+        {
+          processMetaLine(err);
+          if (err != RET_OK) {
+            return;
+          }
+        }
+        break;
+      case FSM_META_VALUE_REMAINING: // not got <data block> + "\r\n"
+        {
+          MetaResult* r = &m_metaResults.back();
+          if (r->bytesRemain > 0) {
+            r->data_block.clear();
+            if (r->header.bytes > 0) {
+              if (m_buffer_reader->readLeft() < r->header.bytes + 2) {
+                m_buffer_reader->setNextPreferedDataBlockSize(
+                    r->header.bytes + 2 - m_buffer_reader->readLeft());
+              }
+              m_buffer_reader->readBytes(err, r->header.bytes, r->data_block);
+              if (err != RET_OK) {
+                return;
+              }
+            }
+            r->bytesRemain = 0;
+          }
+          SKIP_BYTES(2); // "\r\n"
+          m_state = FSM_START;
+        }
+        break;
+
       case FSM_VER_START:
         {
           processLineResult(err);
@@ -293,10 +420,19 @@ int PacketParser::start_state(err_code_t& err) {
           return 0;
         }
         if (c2 == 'A') {
-          // VALUE
-          EXPECT_BYTES("VALUE ", 6);
-          m_retrievalResults.push_back(types::RetrievalResult());
-          m_state = FSM_GET_START;
+          const char c3 = m_buffer_reader->peek(err, 2);
+          if (err != RET_OK) {
+            return 0;
+          }
+          if (c3 == 'L') {
+            // VALUE
+            EXPECT_BYTES("VALUE ", 6);
+            m_retrievalResults.push_back(types::RetrievalResult());
+            m_state = FSM_GET_START;
+          } else {
+            // VA
+            processMetaResult(META_VA, err);
+          }
         } else if (c2 == 'E') {
           // VERSION
           EXPECT_BYTES("VERSION ", 8);
@@ -314,7 +450,7 @@ int PacketParser::start_state(err_code_t& err) {
         if (c2 == 'R') {
           // ERROR
           // client side(programmer) should be blame for this error
-          TokenData err_td;
+          ReaderToken err_td;
           size_t n = m_buffer_reader->readUntil(err, '\n', err_td);
           if (err != RET_OK) {
             return 0;
@@ -329,14 +465,26 @@ int PacketParser::start_state(err_code_t& err) {
           freeTokenData(err_td);
           err = RET_PROGRAMMING_ERR;
           m_state = FSM_ERROR;
-        } else if (c2 == 'N') {
-          // END
-          EXPECT_BYTES("END\r\n", 5);
-          m_state = FSM_END;
-        } else if (c2 == 'X') {
-          // EXISTS
-          EXPECT_BYTES("EXISTS\r\n", 8);
-          processMessageResult(MSG_EXISTS);
+        } else if (c2 == 'N' || c2 == 'X') {
+          const char c3 = m_buffer_reader->peek(err, 2);
+          if (err != RET_OK) {
+            return 0;
+          }
+          if (c2 == 'N' && c3 == 'D') {
+            // END
+            EXPECT_BYTES("END\r\n", 5);
+            m_state = FSM_END;
+          } else if (c2 == 'N') {
+            // EN
+            processMetaResult(META_EN, err);
+          } else if (c3 == 'I') {
+            // EXISTS
+            EXPECT_BYTES("EXISTS\r\n", 8);
+            processMessageResult(MSG_EXISTS);
+          } else {
+            // EX
+            processMetaResult(META_EX, err);
+          }
         }
       }
       break;
@@ -371,7 +519,7 @@ int PacketParser::start_state(err_code_t& err) {
           }
         } else {
           // SERVER_ERROR
-          TokenData err_td;
+          ReaderToken err_td;
           size_t n = m_buffer_reader->readUntil(err, '\n', err_td);
           if (err != RET_OK) {
             return 0;
@@ -398,6 +546,20 @@ int PacketParser::start_state(err_code_t& err) {
       break;
     case 'N':
       {
+        const char c2 = m_buffer_reader->peek(err, 1);
+        if (err != RET_OK) {
+          return 0;
+        }
+        if (c2 == 'F') {
+          // NF
+          processMetaResult(META_NF, err);
+          break;
+        } else if (c2 == 'S') {
+          // NS
+          processMetaResult(META_NS, err);
+          break;
+        }
+
         const char c5 = m_buffer_reader->peek(err, 4);
         if (err != RET_OK) {
           return 0;
@@ -414,6 +576,19 @@ int PacketParser::start_state(err_code_t& err) {
         }
       }
       break;
+    case 'H':
+      {
+        // HD
+        processMetaResult(META_HD, err);
+      }
+      break;
+    case 'M':
+      {
+        // MN
+        EXPECT_BYTES("MN\r\n", 4);
+        m_state = FSM_END;
+      }
+      break;
     case 'T':
       {
         // TOUCHED
@@ -425,7 +600,7 @@ int PacketParser::start_state(err_code_t& err) {
       {
         // CLIENT_ERROR
         // client side(programmer) should be blame for this error
-        TokenData err_td;
+        ReaderToken err_td;
         size_t n = m_buffer_reader->readUntil(err, '\n', err_td);
         if (err != RET_OK) {
           return 0;
@@ -475,6 +650,7 @@ void PacketParser::reset() {
   m_messageResults.clear();
   m_lineResults.clear();
   m_unsignedResults.clear();
+  m_metaResults.clear();
 
   m_state = FSM_START;
   m_mode = MODE_UNDEFINED;
@@ -488,6 +664,7 @@ void PacketParser::rewind() {
   m_messageResults.clear();
   m_lineResults.clear();
   m_unsignedResults.clear();
+  m_metaResults.clear();
 
   m_state = FSM_START;
   m_requestKeyIdx = 0;
@@ -513,5 +690,10 @@ types::UnsignedResultList* PacketParser::getUnsignedResults() {
   return &m_unsignedResults;
 }
 
+
+types::MetaResultList* PacketParser::getMetaResults() {
+  return &m_metaResults;
+}
+
 } // namespace mc
 } // namespace douban
@@ -1,11 +1,39 @@
+#include <cstring>
+
 #include "Result.h"
 #include "Common.h"
+#include "Lz4.h"
 
 namespace douban {
 namespace mc {
 namespace types {
 
 
+// Decompresses a value libmc stored compressed into `arena` (and fixes up
+// bytes/flags). Returns NULL if `data` is not compressed.
+static char* unpackDataBlock(const char* data, uint32_t& bytes, flags_t& flags,
+                             io::Arena& arena) {
+  if (!(flags & MC_FLAG_LZ4_COMPRESSED) || data == NULL) {
+    return NULL;
+  }
+  size_t valLen = 0;
+  char* val = NULL;
+  if (lz4::unpackedSize(data, bytes, valLen)) {
+    val = arena.allocate(valLen);
+    if (!lz4::unpackValueInto(data, bytes, val, valLen)) {
+      val = NULL;
+    }
+  }
+  if (val == NULL) {
+    log_warn("failed to decompress a value of %u bytes, return it as is", bytes);
+    return NULL;
+  }
+  bytes = static_cast<uint32_t>(valLen);
+  flags &= ~MC_FLAG_LZ4_COMPRESSED;
+  return val;
+}
+
+
 RetrievalResult::RetrievalResult() {
   this->cas_unique = 0;
   this->bytes = 0;
@@ -31,22 +59,21 @@ RetrievalResult::RetrievalResult(const RetrievalResult& other) {
 
 
 RetrievalResult::~RetrievalResult() {
-  if (key.size() > 1) { // copy happened
-    delete[] m_inner.key;
-  }
-  if (data_block.size() > 1) {
-    delete[] m_inner.data_block;
-  }
+  // copies, if any, live in the connection's arena
   freeTokenData(key);
   freeTokenData(data_block);
 }
 
-retrieval_result_t* RetrievalResult::inner() {
+retrieval_result_t* RetrievalResult::inner(io::Arena& arena) {
   if (m_inner.key == NULL) {
-    m_inner.key = parseTokenData(this->key, this->key_len);
+    m_inner.key = parseTokenData(this->key, this->key_len, &arena);
   }
   if (m_inner.data_block == NULL) {
-    m_inner.data_block = parseTokenData(this->data_block, this->bytes);
+    m_inner.data_block = parseTokenData(this->data_block, this->bytes, &arena);
+    char* unpacked = unpackDataBlock(m_inner.data_block, this->bytes, this->flags, arena);
+    if (unpacked != NULL) {
+      m_inner.data_block = unpacked;
+    }
   }
   m_inner.cas_unique = this->cas_unique; // 8B
   m_inner.bytes = this->bytes; // 4B
@@ -84,6 +111,39 @@ char* LineResult::inner(size_t& n) {
 }
 
 
+MetaResult::MetaResult() {
+  std::memset(&header, 0, sizeof header);
+  header.type_ = META_LIBMC_INVALID;
+  header.ttl = -1;
+  this->bytesRemain = 0;
+}
+
+
+MetaResult::MetaResult(const MetaResult& other) {
+  this->header = other.header;
+  this->header.data_block = NULL;
+  copyTokenData(other.data_block, this->data_block);
+  this->bytesRemain = other.bytesRemain;
+}
+
+
+MetaResult::~MetaResult() {
+  freeTokenData(data_block);
+}
+
+
+meta_result_t* MetaResult::inner(io::Arena& arena) {
+  if (header.data_block == NULL) {
+    header.data_block = parseTokenData(this->data_block, header.bytes, &arena);
+    char* unpacked = unpackDataBlock(header.data_block, header.bytes, header.flags, arena);
+    if (unpacked != NULL) {
+      header.data_block = unpacked;
+    }
+  }
+  return &header;
+}
+
+
 void delete_broadcast_result(broadcast_result_t* ptr) {
   if (ptr->lines) {
     delete[] ptr->lines;
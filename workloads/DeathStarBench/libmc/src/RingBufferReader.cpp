@@ -0,0 +1,291 @@
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+
+#include "Export.h"
+#include "DataBlock.h"
+#include "RingBufferReader.h"
+#include "Utility.h"
+
+namespace douban {
+namespace mc {
+namespace io {
+
+RingBufferReader::RingBufferReader()
+  :m_data(NULL), m_capacity(0), m_base(0), m_readPos(0), m_writePos(0),
+   m_retainPos(0), m_retaining(false), m_nextPreferedDataBlockSize(0),
+   m_peakSize(0) {
+}
+
+
+RingBufferReader::~RingBufferReader() {
+  delete[] m_data;
+}
+
+
+void RingBufferReader::reset() {
+  // Every token read so far goes with it. The buffer is kept for the next
+  // reply, as reallocating (and faulting in) a large one on every request
+  // costs more than parsing it, unless this reply used under a quarter.
+  if (m_capacity > DataBlock::minCapacity() && m_peakSize < m_capacity / 4) {
+    delete[] m_data;
+    m_data = NULL;
+    m_capacity = 0;
+  }
+  m_base = m_readPos = m_writePos = m_retainPos = 0;
+  m_peakSize = 0;
+  m_retaining = false;
+}
+
+
+void RingBufferReader::relocate(size_t len) {
+  uint64_t keepPos = m_retaining ? m_retainPos : m_readPos;
+  size_t nLive = static_cast<size_t>(m_writePos - keepPos);
+  size_t nDrop = static_cast<size_t>(keepPos - m_base);
+
+  if (m_data != NULL && nLive + len <= m_capacity) {
+    // slide the live tail back to the front
+    if (nLive > 0) {
+      std::memmove(m_data, m_data + nDrop, nLive);
+    }
+  } else {
+    size_t newCapacity = std::max(m_capacity * 2, DataBlock::minCapacity());
+    newCapacity = std::max(newCapacity, nLive + len);
+    char* newData = new char[newCapacity];
+    if (nLive > 0) {
+      std::memcpy(newData, m_data + nDrop, nLive);
+    }
+    delete[] m_data;
+    m_data = newData;
+    m_capacity = newCapacity;
+  }
+  m_base = keepPos;
+}
+
+
+size_t RingBufferReader::prepareWriteBlock(size_t len) {
+  size_t writeLeft = m_capacity - static_cast<size_t>(m_writePos - m_base);
+  if (m_data == NULL || writeLeft < len) {
+    relocate(len);
+    writeLeft = m_capacity - static_cast<size_t>(m_writePos - m_base);
+  }
+  assert(writeLeft >= len);
+  return writeLeft;
+}
+
+
+char* RingBufferReader::getWritePtr() {
+  if (m_data == NULL) {
+    return NULL;
+  }
+  return m_data + (m_writePos - m_base);
+}
+
+
+void RingBufferReader::commitWrite(size_t len) {
+  assert(static_cast<size_t>(m_writePos - m_base) + len <= m_capacity);
+  m_writePos += len;
+  m_peakSize = std::max(m_peakSize, static_cast<size_t>(m_writePos - m_base));
+}
+
+
+void RingBufferReader::write(const char* ptr, size_t len) {
+  this->prepareWriteBlock(len);
+  std::memcpy(this->getWritePtr(), ptr, len);
+  this->commitWrite(len);
+}
+
+
+size_t RingBufferReader::capacity() {
+  return m_capacity;
+}
+
+
+size_t RingBufferReader::size() {
+  return static_cast<size_t>(m_writePos - m_base);
+}
+
+
+const char RingBufferReader::peek(err_code_t& err, size_t offset) const {
+  err = RET_OK;
+  if (m_readPos + offset >= m_writePos) {
+    err = RET_INCOMPLETE_BUFFER_ERR;
+    return '\0';
+  }
+  return m_data[m_readPos - m_base + offset];
+}
+
+
+// The first `value` among the unread bytes, NULL if there is none.
+const char* RingBufferReader::find(char value) const {
+  if (m_readPos == m_writePos) {
+    return NULL;
+  }
+  const char* begin = m_data + (m_readPos - m_base);
+  const char* end = m_data + (m_writePos - m_base);
+  const char* p = utility::findChar(begin, end, value);
+  return p == end ? NULL : p;
+}
+
+
+size_t RingBufferReader::readUntil(err_code_t& err, char value, RingSlice& slice) {
+  err = RET_OK;
+  const char* p = find(value);
+  if (p == NULL) {
+    err = RET_INCOMPLETE_BUFFER_ERR;
+    return 0;
+  }
+  slice.reader = this;
+  slice.pos = m_readPos;
+  slice.len = static_cast<size_t>(p - (m_data + (m_readPos - m_base)));
+  retain(slice);
+  m_readPos += slice.len;
+  return slice.len;
+}
+
+
+size_t RingBufferReader::skipUntil(err_code_t& err, char value) {
+  err = RET_OK;
+  const char* p = find(value);
+  if (p == NULL) {
+    err = RET_INCOMPLETE_BUFFER_ERR;
+    return 0;
+  }
+  size_t n = static_cast<size_t>(p - (m_data + (m_readPos - m_base)));
+  m_readPos += n;
+  return n;
+}
+
+
+void RingBufferReader::readUnsigned(err_code_t& err, uint64_t& value) {
+  err = RET_OK;
+  value = 0ULL;
+  if (readLeft() < 2) {
+    err = RET_INCOMPLETE_BUFFER_ERR;
+    return;
+  }
+
+  const char* begin = m_data + (m_readPos - m_base);
+  const char* end = m_data + (m_writePos - m_base);
+  const char* p = begin;
+  while (p < end && '0' <= *p && *p <= '9') {
+    ++p;
+  }
+
+  if (p == begin) {
+    err = RET_PROGRAMMING_ERR;
+    return;
+  }
+
+  if (p == end) {
+    err = RET_INCOMPLETE_BUFFER_ERR;
+    return;
+  }
+
+  for (const char* q = begin; q < p; ++q) {
+    value = value * 10ULL + (*q - '0');
+  }
+  m_readPos += static_cast<size_t>(p - begin);
+}
+
+
+void RingBufferReader::readBytes(err_code_t& err, size_t len, RingSlice& slice) {
+  err = RET_OK;
+  if (len > readLeft()) {
+    err = RET_INCOMPLETE_BUFFER_ERR;
+    return;
+  }
+  slice.reader = this;
+  slice.pos = m_readPos;
+  slice.len = len;
+  retain(slice);
+  m_readPos += len;
+}
+
+
+void RingBufferReader::expectBytes(err_code_t& err, const char* str, size_t len) {
+  assert(len > 0);
+  err = RET_OK;
+  if (len > readLeft()) {
+    err = RET_INCOMPLETE_BUFFER_ERR;
+    return;
+  }
+  if (std::memcmp(m_data + (m_readPos - m_base), str, len) != 0) {
+    err = RET_PROGRAMMING_ERR;
+    return;
+  }
+  m_readPos += len;
+}
+
+
+void RingBufferReader::skipBytes(err_code_t& err, size_t len) {
+  assert(len > 0);
+  err = RET_OK;
+  if (len > readLeft()) {
+    err = RET_INCOMPLETE_BUFFER_ERR;
+    return;
+  }
+  m_readPos += len;
+}
+
+
+size_t RingBufferReader::getNextPreferedDataBlockSize() {
+  size_t tmp = m_nextPreferedDataBlockSize == 0 ?
+      DataBlock::minCapacity() :
+      m_nextPreferedDataBlockSize;
+  m_nextPreferedDataBlockSize = DataBlock::minCapacity();
+  return tmp;
+}
+
+
+void RingBufferReader::setNextPreferedDataBlockSize(size_t n) {
+  m_nextPreferedDataBlockSize = n;
+}
+
+
+void RingBufferReader::retain(const RingSlice& slice) {
+  assert(slice.pos >= m_base);
+  if (!m_retaining || slice.pos < m_retainPos) {
+    m_retainPos = slice.pos;
+    m_retaining = true;
+  }
+}
+
+
+void RingBufferReader::releaseAll() {
+  m_retaining = false;
+}
+
+
+size_t RingBufferReader::nBytesRetained() {
+  if (!m_retaining) {
+    return 0;
+  }
+  return static_cast<size_t>(m_writePos - m_retainPos);
+}
+
+
+void freeTokenData(RingSlice& td) {
+}
+
+
+char* parseTokenData(RingSlice& td, size_t reserved, Arena* arena) {
+  if (reserved == 0) {
+    return NULL;
+  }
+  assert(td.reader != NULL && td.len == reserved);
+  return const_cast<char*>(td.reader->at(td));
+}
+
+
+void copyTokenData(const RingSlice& src, RingSlice& dst) {
+  if (src.empty()) {
+    return;
+  }
+  assert(dst.empty());
+  dst = src;
+}
+
+} // namespace io
+} // namespace mc
+} // namespace douban
@@ -137,6 +137,119 @@ void client_destroy_unsigned_result(void* client) {
   return c->destroyUnsignedResult();
 }
 
+err_code_t client_meta_get(void* client, const char* const* keys, const size_t* key_lens,
+                           size_t n_keys, const meta_flags_t meta_flags,
+                           const exptime_t exptime,
+                           meta_result_t*** results, size_t* n_results) {
+  douban::mc::Client* c = static_cast<Client*>(client);
+  return c->metaGet(keys, key_lens, n_keys, meta_flags, exptime, results, n_results);
+}
+
+err_code_t client_meta_set(void* client, const char* const* keys, const size_t* key_lens,
+                           const flags_t* flags, const cas_unique_t* cas_uniques,
+                           const char* const* vals, const size_t* val_lens,
+                           size_t n_items, const meta_flags_t meta_flags,
+                           const exptime_t exptime,
+                           meta_result_t*** results, size_t* n_results) {
+  douban::mc::Client* c = static_cast<Client*>(client);
+  return c->metaSet(keys, key_lens, flags, cas_uniques, vals, val_lens, n_items,
+                    meta_flags, exptime, results, n_results);
+}
+
+err_code_t client_meta_delete(void* client, const char* const* keys, const size_t* key_lens,
+                              const cas_unique_t* cas_uniques, size_t n_items,
+                              const meta_flags_t meta_flags,
+                              meta_result_t*** results, size_t* n_results) {
+  douban::mc::Client* c = static_cast<Client*>(client);
+  return c->metaDelete(keys, key_lens, cas_uniques, n_items, meta_flags, results, n_results);
+}
+
+err_code_t client_meta_arithmetic(void* client, const char* const* keys,
+                                  const size_t* key_lens, size_t n_items,
+                                  const uint64_t delta, const uint64_t initial,
+                                  const meta_flags_t meta_flags, const exptime_t exptime,
+                                  meta_result_t*** results, size_t* n_results) {
+  douban::mc::Client* c = static_cast<Client*>(client);
+  return c->metaArithmetic(keys, key_lens, n_items, delta, initial, meta_flags, exptime,
+                           results, n_results);
+}
+
+void client_destroy_meta_result(void* client) {
+  douban::mc::Client* c = static_cast<Client*>(client);
+  return c->destroyMetaResult();
+}
+
+
+#define IMPL_ASYNC_RETRIEVAL_CMD(M, N) \
+err_code_t client_async_##M(void* client, const char* const* keys, const size_t* key_lens, \
+                            size_t n_keys, retrieval_callback_t callback, void* ctx) { \
+  douban::mc::Client* c = static_cast<Client*>(client); \
+  return c->N(keys, key_lens, n_keys, callback, ctx); \
+}
+IMPL_ASYNC_RETRIEVAL_CMD(get, asyncGet)
+IMPL_ASYNC_RETRIEVAL_CMD(gets, asyncGets)
+#undef IMPL_ASYNC_RETRIEVAL_CMD
+
+
+#define IMPL_ASYNC_STORAGE_CMD(M, N) \
+err_code_t client_async_##M(void* client, const char* const* keys, const size_t* key_lens, \
+               const flags_t* flags, const exptime_t exptime, \
+               const cas_unique_t* cas_uniques, const bool noreply, \
+               const char* const* vals, const size_t* val_lens, \
+               size_t n_items, message_callback_t callback, void* ctx) { \
+  douban::mc::Client* c = static_cast<Client*>(client); \
+  return c->N(keys, key_lens, flags, exptime, cas_uniques, \
+              noreply, vals, val_lens, n_items, callback, ctx); \
+}
+
+IMPL_ASYNC_STORAGE_CMD(set, asyncSet)
+IMPL_ASYNC_STORAGE_CMD(add, asyncAdd)
+IMPL_ASYNC_STORAGE_CMD(replace, asyncReplace)
+IMPL_ASYNC_STORAGE_CMD(append, asyncAppend)
+IMPL_ASYNC_STORAGE_CMD(prepend, asyncPrepend)
+IMPL_ASYNC_STORAGE_CMD(cas, asyncCas)
+#undef IMPL_ASYNC_STORAGE_CMD
+
+
+err_code_t client_async_delete(void* client, const char* const* keys, const size_t* key_lens,
+                               const bool noreply, size_t n_items,
+                               message_callback_t callback, void* ctx) {
+  douban::mc::Client* c = static_cast<Client*>(client);
+  return c->asyncDelete(keys, key_lens, noreply, n_items, callback, ctx);
+}
+
+
+err_code_t client_async_touch(void* client, const char* const* keys, const size_t* key_lens,
+                              const exptime_t exptime, const bool noreply, size_t n_items,
+                              message_callback_t callback, void* ctx) {
+  douban::mc::Client* c = static_cast<Client*>(client);
+  return c->asyncTouch(keys, key_lens, exptime, noreply, n_items, callback, ctx);
+}
+
+
+int client_async_fd(void* client) {
+  douban::mc::Client* c = static_cast<Client*>(client);
+  return c->asyncFd();
+}
+
+
+int client_async_timeout(void* client) {
+  douban::mc::Client* c = static_cast<Client*>(client);
+  return c->asyncTimeout();
+}
+
+
+bool client_async_pending(void* client) {
+  douban::mc::Client* c = static_cast<Client*>(client);
+  return c->asyncPending();
+}
+
+
+void client_async_process(void* client) {
+  douban::mc::Client* c = static_cast<Client*>(client);
+  return c->processAsync();
+}
+
 err_code_t client_stats(void* client, broadcast_result_t** results, size_t* n_servers) {
   douban::mc::Client* c = static_cast<Client*>(client);
   return c->stats(results, n_servers);
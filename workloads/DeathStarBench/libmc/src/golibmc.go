@@ -33,6 +33,8 @@ const (
 	HashFNV1_32
 	HashFNV1a32
 	HashCRC32
+	HashCRC32C
+	HashXXH32
 )
 
 // This is the size of the connectionOpener request chan (Client.openerCh).
@@ -47,6 +49,8 @@ var hashFunctionMapping = map[int]C.hash_function_options_t{
 	HashFNV1_32: C.OPT_HASH_FNV1_32,
 	HashFNV1a32: C.OPT_HASH_FNV1A_32,
 	HashCRC32:   C.OPT_HASH_CRC_32,
+	HashCRC32C:  C.OPT_HASH_CRC_32C,
+	HashXXH32:   C.OPT_HASH_XXH32,
 }
 
 // Credits to:
@@ -196,7 +200,7 @@ default: False
 prefix: The key prefix. default: ''
 
 hashFunc: hashing function for keys. possible values:
-HashMD5, HashFNV1_32, HashFNV1a32, HashCRC32
+HashMD5, HashFNV1_32, HashFNV1a32, HashCRC32, HashCRC32C, HashXXH32
 NOTE: fnv1_32, fnv1a_32, crc_32 implementations
 in libmc are per each spec, but they're not compatible
 with corresponding implementions in libmemcached.
@@ -1,7 +1,15 @@
 // make profile_client && valgrind --tool=callgrind ./tests/profile_client && qcachegrind callgrind.out.9109
 #include <time.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <cstring>
+#include <string>
 #include "Common.h"
 #include "Client.h"
+#include "BufferReader.h"
+#include "RingBufferReader.h"
+#include "Parser.h"
+#include "hashkit/ketama.h"
 #include "test_common.h"
 
 #ifndef __MACH__
@@ -14,6 +22,10 @@
 using douban::mc::Client;
 using douban::mc::tests::newClient;
 using douban::mc::tests::gen_random;
+using douban::mc::io::BufferReader;
+using douban::mc::io::RingBufferReader;
+using douban::mc::io::RingSlice;
+using douban::mc::io::TokenData;
 
 
 static double getCPUTime() {
@@ -32,6 +44,14 @@ static double getCPUTime() {
   return static_cast<double>(ts.tv_sec) + 1e-9 * static_cast<double>(ts.tv_nsec);
 }
 
+static double getRUsageCPUTime(long* nvcsw) {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  *nvcsw = ru.ru_nvcsw;
+  return static_cast<double>(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) +
+    1e-6 * static_cast<double>(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+}
+
 void set_(Client* client, const char* const* keys, const size_t* key_lens,
           const flags_t* flags, const char* const* vals, const size_t* val_len, size_t n = 1) {
 
@@ -97,6 +117,249 @@ DEFINE_PROFILE_SET_GET_MULTI(10, 1000, 1000)
 DEFINE_PROFILE_SET_GET_MULTI(100, 100, 1000)
 
 
+// NITEM round trips of one key each, i.e. how a timeline read of NITEM
+// posts behaves without multi-get. Compare with profile_set_get_multi_*.
+#define DEFINE_PROFILE_SET_GET_SEQUENTIAL(NITEM, VAL_LEN, N) \
+void profile_set_get_sequential_##NITEM##VAL_LEN(Client* client, const char* const * keys, \
+                                                 const size_t* key_lens, const char* const * vals) { \
+  size_t val_lens[(NITEM)]; \
+  flags_t flags[(NITEM)]; \
+  for (int i = 0; i < (NITEM); i++) { \
+    val_lens[i] = (VAL_LEN); \
+    flags[i] = 0; \
+  } \
+  \
+  set_(client, keys, key_lens, flags, vals, val_lens, (NITEM)); \
+  for (int i = 0; i < (N); i++) { \
+    for (int j = 0; j < (NITEM); j++) { \
+      get_(client, keys + j, key_lens + j, 1); \
+    } \
+  } \
+}
+
+DEFINE_PROFILE_SET_GET_SEQUENTIAL(10, 1000, 1000)
+
+
+// Multi-get fanned out over every server of a 16-server client. Reports
+// user+sys CPU and voluntary context switches per op; for exact syscall
+// counts run it under `strace -c -f`.
+void profile_multi_server_get(Client* client, const char* const * keys,
+                              const size_t* key_lens, const char* const * vals,
+                              int n_items, size_t val_len, int n_loop) {
+  size_t* val_lens = new size_t[n_items];
+  flags_t* flags = new flags_t[n_items];
+  for (int i = 0; i < n_items; i++) {
+    val_lens[i] = val_len;
+    flags[i] = 0;
+  }
+  set_(client, keys, key_lens, flags, vals, val_lens, n_items);
+
+  long nvcsw0, nvcsw1;
+  double wall0 = getCPUTime();
+  double cpu0 = getRUsageCPUTime(&nvcsw0);
+  for (int i = 0; i < n_loop; i++) {
+    get_(client, keys, key_lens, n_items);
+  }
+  double cpu1 = getRUsageCPUTime(&nvcsw1);
+  double wall1 = getCPUTime();
+  fprintf(stderr, "multi-get %d keys x %zu B over 16 servers: "
+          "%.1f us wall/op, %.1f us cpu/op, %.2f ctx switches/op\n",
+          n_items, val_len, 1e6 * (wall1 - wall0) / n_loop,
+          1e6 * (cpu1 - cpu0) / n_loop, static_cast<double>(nvcsw1 - nvcsw0) / n_loop);
+
+  delete[] val_lens;
+  delete[] flags;
+}
+
+
+// Move the next recv()-sized chunk of `wire` into the reader, sized the way
+// Connection::recv asks for it.
+template <class Reader>
+static void feedChunk(Reader& reader, const std::string& wire, size_t& pos) {
+  size_t n = reader.prepareWriteBlock(reader.getNextPreferedDataBlockSize());
+  n = std::min(n, wire.size() - pos);
+  memcpy(reader.getWritePtr(), wire.data() + pos, n);
+  reader.commitWrite(n);
+  pos += n;
+}
+
+
+// Decode one "VALUE" response like PacketParser: parse the header out of the
+// first chunk, hint the size of the rest, then materialize key and value.
+// No network involved, so this isolates the reader itself.
+static size_t decode_with_buffer_reader(BufferReader& reader, const std::string& wire) {
+  err_code_t err;
+  size_t pos = 0;
+  uint64_t flags, bytes;
+  TokenData key, value;
+  feedChunk(reader, wire, pos);
+  reader.skipBytes(err, 6);
+  size_t key_len = reader.readUntil(err, ' ', key);
+  reader.skipBytes(err, 1);
+  reader.readUnsigned(err, flags);
+  reader.skipBytes(err, 1);
+  reader.readUnsigned(err, bytes);
+  reader.skipBytes(err, 2);
+  while (reader.readLeft() < bytes + 7) {
+    reader.setNextPreferedDataBlockSize(bytes + 7 - reader.readLeft());
+    feedChunk(reader, wire, pos);
+  }
+  reader.readBytes(err, bytes, value);
+  char* k = douban::mc::io::parseTokenData(key, key_len);
+  char* v = douban::mc::io::parseTokenData(value, bytes);
+  size_t check = k[0] + v[bytes - 1];
+  if (key.size() > 1) {
+    delete[] k;
+  }
+  if (value.size() > 1) {
+    delete[] v;
+  }
+  douban::mc::io::freeTokenData(key);
+  douban::mc::io::freeTokenData(value);
+  reader.skipBytes(err, 7);
+  reader.reset();
+  return check;
+}
+
+
+static size_t decode_with_ring_buffer_reader(RingBufferReader& reader, const std::string& wire) {
+  err_code_t err;
+  size_t pos = 0;
+  uint64_t flags, bytes;
+  RingSlice key, value;
+  feedChunk(reader, wire, pos);
+  reader.skipBytes(err, 6);
+  reader.readUntil(err, ' ', key);
+  reader.skipBytes(err, 1);
+  reader.readUnsigned(err, flags);
+  reader.skipBytes(err, 1);
+  reader.readUnsigned(err, bytes);
+  reader.skipBytes(err, 2);
+  while (reader.readLeft() < bytes + 7) {
+    reader.setNextPreferedDataBlockSize(bytes + 7 - reader.readLeft());
+    feedChunk(reader, wire, pos);
+  }
+  reader.readBytes(err, bytes, value);
+  size_t check = reader.at(key)[0] + reader.at(value)[bytes - 1];
+  reader.skipBytes(err, 7);
+  reader.reset();
+  return check;
+}
+
+
+void profile_readers(const char* val, size_t val_len, int n_loop) {
+  std::string wire = "VALUE test_profile_key 0 ";
+  char num[32];
+  wire.append(num, snprintf(num, sizeof num, "%zu", val_len));
+  wire.append("\r\n");
+  wire.append(val, val_len);
+  wire.append("\r\nEND\r\n");
+
+  size_t check = 0;
+  BufferReader br;
+  double t0 = getCPUTime();
+  for (int i = 0; i < n_loop; i++) {
+    check += decode_with_buffer_reader(br, wire);
+  }
+  double t1 = getCPUTime();
+  RingBufferReader rbr;
+  for (int i = 0; i < n_loop; i++) {
+    check += decode_with_ring_buffer_reader(rbr, wire);
+  }
+  double t2 = getCPUTime();
+  fprintf(stderr, "decode %zu B value: BufferReader %.3f us/op, "
+          "RingBufferReader %.3f us/op (%zu)\n", val_len,
+          1e6 * (t1 - t0) / n_loop, 1e6 * (t2 - t1) / n_loop, check);
+}
+
+
+// A get of `n_vals` values through PacketParser and the io::Reader this
+// build receives into (see MC_USE_RING_BUFFER), up to the results' inner().
+void profile_parser(const char* val, size_t val_len, int n_vals, int n_loop) {
+  using douban::mc::PacketParser;
+  std::string wire;
+  char line[64];
+  for (int i = 0; i < n_vals; i++) {
+    wire.append(line, snprintf(line, sizeof line, "VALUE test_profile_key_%d 0 %zu\r\n",
+                               i, val_len));
+    wire.append(val, val_len);
+    wire.append("\r\n");
+  }
+  wire.append("END\r\n");
+
+  size_t check = 0;
+  douban::mc::io::Reader reader;
+  douban::mc::io::Arena arena;
+  PacketParser parser(&reader);
+  double t0 = getCPUTime();
+  for (int i = 0; i < n_loop; i++) {
+    err_code_t err;
+    size_t pos = 0;
+    parser.setMode(douban::mc::MODE_END_STATE);
+    do {
+      feedChunk(reader, wire, pos);
+      parser.process_packets(err);
+    } while (err == RET_INCOMPLETE_BUFFER_ERR);
+    douban::mc::types::RetrievalResultList* results = parser.getRetrievalResults();
+    for (size_t j = 0; j < results->size(); j++) {
+      retrieval_result_t* r = (*results)[j].inner(arena);
+      check += r->key[0] + r->data_block[r->bytes - 1];
+    }
+    parser.reset();
+    arena.reset();
+    reader.reset();
+  }
+  double t1 = getCPUTime();
+  fprintf(stderr, "parse %d x %zu B values: %.3f us/op (%zu)\n", n_vals, val_len,
+          1e6 * (t1 - t0) / n_loop, check);
+}
+
+
+// Pure key -> server lookup cost; connections are never opened.
+void profile_selector(size_t n_servers, const char* const * keys, const size_t* key_lens,
+                      size_t n_keys, int n_loop) {
+  using douban::mc::Connection;
+  using douban::mc::hashkit::KetamaSelector;
+  static const struct {
+    const char* name;
+    douban::mc::hashkit::hash_function_t fn;
+  } hashes[] = {
+    {"md5", &douban::mc::hashkit::hash_md5},
+    {"crc_32", &douban::mc::hashkit::hash_crc_32},
+    {"crc_32c", &douban::mc::hashkit::hash_crc_32c},
+    {"xxh32", &douban::mc::hashkit::hash_xxh32},
+  };
+
+  Connection* conns = new Connection[n_servers];
+  char host[32];
+  for (size_t i = 0; i < n_servers; i++) {
+    snprintf(host, sizeof host, "10.0.%zu.%zu", i / 256, i % 256);
+    conns[i].init(host, 11211);
+  }
+  for (size_t h = 0; h < sizeof hashes / sizeof hashes[0]; h++) {
+    double us[2];
+    size_t check = 0;
+    for (int jump = 0; jump < 2; jump++) {
+      KetamaSelector ks;
+      ks.setHashFunction(hashes[h].fn);
+      ks.setDistribution(jump ? douban::mc::hashkit::DISTRIBUTION_JUMP :
+                         douban::mc::hashkit::DISTRIBUTION_KETAMA);
+      ks.addServers(conns, n_servers);
+      double t0 = getCPUTime();
+      for (int i = 0; i < n_loop; i++) {
+        for (size_t k = 0; k < n_keys; k++) {
+          check += static_cast<size_t>(ks.getServer(keys[k], key_lens[k], false));
+        }
+      }
+      us[jump] = 1e6 * (getCPUTime() - t0) / (n_loop * n_keys);
+    }
+    fprintf(stderr, "select among %zu servers with %s: ketama %.4f us/op, "
+            "jump %.4f us/op (%zu)\n", n_servers, hashes[h].name, us[0], us[1], check);
+  }
+  delete[] conns;
+}
+
+
 static const int N_ITEMS = 1000;
 static const int KEY_MAX = 200;
 static const int VAL_MAX = 1000000;
@@ -141,8 +404,25 @@ int main() {
   TIMEIT(profile_set_get_1000000(client, key, key_len, val));
   TIMEIT(profile_set_get_multi_10100(client, keys, key_lens, vals));
   TIMEIT(profile_set_get_multi_101000(client, keys, key_lens, vals));
+  TIMEIT(profile_set_get_sequential_101000(client, keys, key_lens, vals));
   TIMEIT(profile_set_get_multi_100100(client, keys, key_lens, vals));
 
+  profile_readers(val, 100, 1000000);
+  profile_readers(val, 65536, 10000);
+  profile_parser(val, 100, 20, 100000);
+  profile_parser(val, 65536, 20, 1000);
+
+  profile_selector(4, keys, key_lens, N_ITEMS, 2000);
+  profile_selector(64, keys, key_lens, N_ITEMS, 2000);
+  profile_selector(1024, keys, key_lens, N_ITEMS, 2000);
+
+  Client* client16 = newClient(16);
+  if (client16 != NULL) {
+    profile_multi_server_get(client16, keys, key_lens, vals, 16, 100, 10000);
+    profile_multi_server_get(client16, keys, key_lens, vals, 100, 100, 10000);
+    delete client16;
+  }
+
   for (int i = 0; i < N_ITEMS; i++) {
     delete[] keys[i];
     delete[] vals[i];
@@ -4,9 +4,12 @@
 #include <cstring>
 #include "gtest/gtest.h"
 
+using douban::mc::io::Arena;
 using douban::mc::io::BufferReader;
 using douban::mc::io::DataBlock;
 using douban::mc::io::TokenData;
+using douban::mc::io::freeTokenData;
+using douban::mc::io::parseTokenData;
 
 #define ASSERT_N_STREQ(S1, S2, N) do {ASSERT_TRUE(0 == std::strncmp((S1), (S2), (N)));} while (0)
 
@@ -495,6 +498,65 @@ TEST(test_buffer, read_bytes) {
 }
 
 
+TEST(test_buffer, parse_token_data_arena) {
+  err_code_t err;
+  DataBlock::setMinCapacity(5);
+  BufferReader reader;
+  Arena arena;
+  TokenData td;
+  reader.write(CSTR("12345"), 5);
+  reader.write(CSTR("67890"), 5);
+
+  // a single slice is handed out in place
+  reader.readBytes(err, 3, td);
+  ASSERT_EQ(err, RET_OK);
+  char* p = parseTokenData(td, 3, &arena);
+  ASSERT_EQ(p, td.front().iterator->at(0));
+  ASSERT_EQ(arena.capacity(), 0);
+  freeTokenData(td);
+  td.clear();
+
+  // across blocks it is copied into the arena
+  reader.readBytes(err, 5, td);
+  ASSERT_EQ(err, RET_OK);
+  ASSERT_EQ(td.size(), 2);
+  p = parseTokenData(td, 5, &arena);
+  ASSERT_N_STREQ(p, "45678", 5);
+  ASSERT_EQ(arena.capacity(), MIN_ARENA_CAPACITY);
+  freeTokenData(td);
+  DataBlock::setMinCapacity(MIN_DATABLOCK_CAPACITY);
+}
+
+
+TEST(test_buffer, arena) {
+  Arena arena;
+  char* a = arena.allocate(100);
+  char* b = arena.allocate(100);
+  ASSERT_EQ(b, a + 100);
+  std::memset(a, 'a', 100);
+
+  // a new chunk leaves earlier allocations alone
+  char* c = arena.allocate(MIN_ARENA_CAPACITY);
+  std::memset(c, 'c', MIN_ARENA_CAPACITY);
+  ASSERT_EQ(a[99], 'a');
+  ASSERT_EQ(arena.capacity(), 3 * MIN_ARENA_CAPACITY);
+
+  // after reset the same burst fits in the merged chunk
+  arena.reset();
+  ASSERT_EQ(arena.capacity(), 3 * MIN_ARENA_CAPACITY);
+  a = arena.allocate(200);
+  c = arena.allocate(MIN_ARENA_CAPACITY);
+  ASSERT_EQ(c, a + 200);
+  arena.reset();
+  ASSERT_EQ(arena.capacity(), 3 * MIN_ARENA_CAPACITY);
+
+  // but a huge one is not kept around
+  arena.allocate(2 * MAX_ARENA_RETAINED);
+  arena.reset();
+  ASSERT_EQ(arena.capacity(), MAX_ARENA_RETAINED);
+}
+
+
 TEST(test_buffer, fuzzy) {
   err_code_t err;
   DataBlock::setMinCapacity(5);
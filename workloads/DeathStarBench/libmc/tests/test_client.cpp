@@ -2,7 +2,11 @@
 #include "Result.h"
 #include "test_common.h"
 
+#include <poll.h>
+#include <algorithm>
 #include <cstring>
+#include <string>
+#include <vector>
 #include "gtest/gtest.h"
 
 using douban::mc::Client;
@@ -425,3 +429,243 @@ TEST(client, update_server) {
     ASSERT_EQ(rv, -3);
   }
 }
+
+
+TEST(test_client, test_meta) {
+  Client* client = newClient(2);
+  if (client == NULL) {
+    hint();
+  } else {
+    meta_result_t **results = NULL;
+    size_t nResults = 0;
+    const char* keys[] = {"meta_foo", "meta_bar", "meta_counter"};
+    size_t key_lens[] = {8, 8, 12};
+    const char* vals[] = {"value of foo", "value of bar"};
+    size_t val_lens[] = {12, 12};
+    flags_t flags[] = {3, 4};
+
+    client->metaDelete(keys, key_lens, NULL, 3, META_QUIET, &results, &nResults);
+    client->destroyMetaResult();
+
+    // quiet set only reports failures
+    client->metaSet(keys, key_lens, flags, NULL, vals, val_lens, 2,
+                    META_QUIET, 0, &results, &nResults);
+    ASSERT_EQ(nResults, 0);
+    client->destroyMetaResult();
+
+    // add mode does not overwrite
+    client->metaSet(keys, key_lens, flags, NULL, vals, val_lens, 1,
+                    META_MODE_ADD, 0, &results, &nResults);
+    ASSERT_EQ(nResults, 1);
+    ASSERT_EQ(results[0]->type_, META_NS);
+    client->destroyMetaResult();
+
+    // quiet get only reports hits, matched back by opaque
+    client->metaGet(keys, key_lens, 3,
+                    META_QUIET | META_RETURN_VALUE | META_RETURN_FLAGS | META_RETURN_CAS,
+                    0, &results, &nResults);
+    ASSERT_EQ(nResults, 2);
+    for (size_t i = 0; i < nResults; i++) {
+      uint32_t idx = results[i]->opaque;
+      ASSERT_LT(idx, 2);
+      ASSERT_EQ(results[i]->type_, META_VA);
+      ASSERT_N_STREQ(results[i]->key, keys[idx], key_lens[idx]);
+      ASSERT_EQ(results[i]->bytes, val_lens[idx]);
+      ASSERT_N_STREQ(results[i]->data_block, vals[idx], val_lens[idx]);
+      ASSERT_EQ(results[i]->flags, flags[idx]);
+      ASSERT_NE(results[i]->cas_unique, 0);
+    }
+    client->destroyMetaResult();
+
+    // vivify: the first caller creates the counter, the second increments it
+    for (uint64_t expected = 1; expected <= 2; expected++) {
+      client->metaArithmetic(keys + 2, key_lens + 2, 1, 1, 1,
+                             META_VIVIFY | META_RETURN_VALUE, 60, &results, &nResults);
+      ASSERT_EQ(nResults, 1);
+      ASSERT_EQ(results[0]->type_, META_VA);
+      ASSERT_EQ(strtoull(std::string(results[0]->data_block, results[0]->bytes).c_str(),
+                         NULL, 10), expected);
+      client->destroyMetaResult();
+    }
+
+    client->metaDelete(keys, key_lens, NULL, 3, 0, &results, &nResults);
+    ASSERT_EQ(nResults, 3);
+    for (size_t i = 0; i < nResults; i++) {
+      ASSERT_EQ(results[i]->type_, META_HD);
+    }
+    client->destroyMetaResult();
+    delete client;
+  }
+}
+
+
+TEST(test_client, test_compress) {
+  DataBlock::setMinCapacity(64);  // values span several data blocks
+  Client* client = newClient(1);
+  Client* reader = newClient(1);
+  if (client == NULL || reader == NULL) {
+    hint();
+  } else {
+    client->config(CFG_COMPRESS_THRESHOLD, 100);
+
+    std::string big;
+    for (int i = 0; i < 100; i++) {
+      big += "{\"post_id\": 1000" + std::to_string(i) + ", \"text\": \"hello world\"}";
+    }
+    const char* keys[] = {"compress_big", "compress_small"};
+    size_t key_lens[] = {12, 14};
+    const char* vals[] = {big.data(), "short value"};
+    size_t val_lens[] = {big.size(), 11};
+    flags_t flags[] = {7, 8};
+
+    message_result_t **m_results = NULL;
+    retrieval_result_t **r_results = NULL;
+    meta_result_t **meta_results = NULL;
+    size_t nResults = 0;
+    client->set(keys, key_lens, flags, 0, NULL, 0, vals, val_lens, 2, &m_results, &nResults);
+    ASSERT_EQ(nResults, 2);
+    client->destroyMessageResult();
+
+    // values come back as they were set, whether or not the reader
+    // compresses itself
+    Client* clients[] = {client, reader};
+    for (int c = 0; c < 2; c++) {
+      clients[c]->get(keys, key_lens, 2, &r_results, &nResults);
+      ASSERT_EQ(nResults, 2);
+      for (size_t i = 0; i < nResults; i++) {
+        size_t idx = r_results[i]->key_len == key_lens[0] ? 0 : 1;
+        ASSERT_EQ(r_results[i]->bytes, val_lens[idx]);
+        ASSERT_N_STREQ(r_results[i]->data_block, vals[idx], val_lens[idx]);
+        ASSERT_EQ(r_results[i]->flags, flags[idx]);
+      }
+      clients[c]->destroyRetrievalResult();
+    }
+
+    // only the big one is stored compressed
+    reader->metaGet(keys, key_lens, 2, META_RETURN_VALUE, 0, &meta_results, &nResults);
+    ASSERT_EQ(nResults, 2);
+    for (size_t i = 0; i < nResults; i++) {
+      uint32_t idx = meta_results[i]->opaque;
+      ASSERT_EQ(meta_results[i]->bytes, val_lens[idx]);
+      ASSERT_N_STREQ(meta_results[i]->data_block, vals[idx], val_lens[idx]);
+      ASSERT_EQ(meta_results[i]->flags, flags[idx]);
+    }
+    reader->destroyMetaResult();
+
+    client->metaSet(keys, key_lens, NULL, NULL, vals, val_lens, 1, 0, 0,
+                    &meta_results, &nResults);
+    client->destroyMetaResult();
+    reader->get(keys, key_lens, 1, &r_results, &nResults);
+    ASSERT_EQ(nResults, 1);
+    ASSERT_EQ(r_results[0]->bytes, val_lens[0]);
+    ASSERT_N_STREQ(r_results[0]->data_block, vals[0], val_lens[0]);
+    ASSERT_EQ(r_results[0]->flags, 0);
+    reader->destroyRetrievalResult();
+
+    client->_delete(keys, key_lens, 0, 2, &m_results, &nResults);
+    client->destroyMessageResult();
+  }
+  delete client;
+  delete reader;
+  DataBlock::setMinCapacity(MIN_DATABLOCK_CAPACITY);
+}
+
+
+struct AsyncState {
+  Client* client;
+  int nCallbacks;
+  err_code_t err;
+  std::vector<std::string> values;
+};
+
+
+static void onAsyncGet(void* ctx, err_code_t err, retrieval_result_t** results,
+                       size_t nResults) {
+  AsyncState* state = static_cast<AsyncState*>(ctx);
+  state->nCallbacks++;
+  state->err = err;
+  for (size_t i = 0; i < nResults; i++) {
+    state->values.push_back(std::string(results[i]->data_block, results[i]->bytes));
+  }
+  std::sort(state->values.begin(), state->values.end());
+}
+
+
+static void onAsyncSet(void* ctx, err_code_t err, message_result_t** results,
+                       size_t nResults) {
+  AsyncState* state = static_cast<AsyncState*>(ctx);
+  state->nCallbacks++;
+  state->err = err;
+  ASSERT_EQ(nResults, 2);
+  for (size_t i = 0; i < nResults; i++) {
+    ASSERT_EQ(results[i]->type_, MSG_STORED);
+  }
+  // chain the next command from the callback
+  const char* keys[] = {"async_foo", "async_bar"};
+  size_t key_lens[] = {9, 9};
+  ASSERT_EQ(state->client->asyncGet(keys, key_lens, 2, &onAsyncGet, ctx), RET_OK);
+}
+
+
+static void runAsync(Client* client) {
+  // what an external event loop does
+  struct pollfd pfd;
+  pfd.fd = client->asyncFd();
+  pfd.events = POLLIN;
+  while (client->asyncPending()) {
+    poll(&pfd, 1, client->asyncTimeout());
+    client->processAsync();
+  }
+}
+
+
+TEST(test_client, test_async) {
+  Client* client = newClient(4);
+  if (client == NULL) {
+    hint();
+    return;
+  }
+  ASSERT_NE(client->asyncFd(), -1);
+  ASSERT_EQ(client->asyncTimeout(), -1);
+
+  AsyncState state = {client, 0, RET_OK, {}};
+  const char* keys[] = {"async_foo", "async_bar"};
+  size_t key_lens[] = {9, 9};
+  const char* vals[] = {"foo_value", "bar_value"};
+  size_t val_lens[] = {9, 9};
+  flags_t flags[] = {0, 0};
+  ASSERT_EQ(client->asyncSet(keys, key_lens, flags, 0, NULL, false, vals, val_lens, 2,
+                             &onAsyncSet, &state), RET_OK);
+  ASSERT_TRUE(client->asyncPending());
+  ASSERT_EQ(client->asyncGet(keys, key_lens, 2, &onAsyncGet, &state), RET_PROGRAMMING_ERR);
+  runAsync(client);
+  ASSERT_EQ(state.nCallbacks, 2);
+  ASSERT_EQ(state.err, RET_OK);
+  ASSERT_EQ(state.values.size(), 2);
+  ASSERT_EQ(state.values[0], "bar_value");
+  ASSERT_EQ(state.values[1], "foo_value");
+  ASSERT_EQ(client->asyncTimeout(), -1);
+
+  // nothing sent: the error is returned and there is no callback
+  const char* bad_keys[] = {"async bad"};
+  size_t bad_key_lens[] = {9};
+  ASSERT_EQ(client->asyncGet(bad_keys, bad_key_lens, 1, &onAsyncGet, &state),
+            RET_INVALID_KEY_ERR);
+  ASSERT_FALSE(client->asyncPending());
+
+  // blocking and non-blocking commands mix on the same client
+  retrieval_result_t **r_results = NULL;
+  size_t nResults = 0;
+  client->get(keys, key_lens, 2, &r_results, &nResults);
+  ASSERT_EQ(nResults, 2);
+  client->destroyRetrievalResult();
+
+  state.values.clear();
+  ASSERT_EQ(client->asyncDelete(keys, key_lens, true, 2, NULL, NULL), RET_OK);
+  runAsync(client);
+  ASSERT_EQ(client->asyncGet(keys, key_lens, 2, &onAsyncGet, &state), RET_OK);
+  runAsync(client);
+  ASSERT_EQ(state.nCallbacks, 3);
+  ASSERT_TRUE(state.values.empty());
+  delete client;
+}
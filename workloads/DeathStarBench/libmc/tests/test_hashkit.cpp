@@ -19,6 +19,7 @@ using douban::mc::tests::get_resource_path;
 
 
 static const char UTF8_ZHONG[] = "\xe4\xb8\xad";  // "中" in UTF-8
+static const char FOX[] = "The quick brown fox jumps over the lazy dog";
 
 
 void test_md5_hexdigest(const char key[], size_t key_len, char hexdigest[33]) {
@@ -94,6 +95,30 @@ TEST(hashkit, crc_32) {
 }
 
 
+TEST(hashkit, crc_32c) {
+  // CRC-32C check value plus a few more from a bitwise reference implementation
+  ASSERT_EQ(douban::mc::hashkit::hash_crc_32c("", 0U), 0U);
+  ASSERT_EQ(douban::mc::hashkit::hash_crc_32c("123456789", 9U), 0xe3069283U);
+  ASSERT_EQ(douban::mc::hashkit::hash_crc_32c("123456", 6U), 0x41357186U);
+  ASSERT_EQ(douban::mc::hashkit::hash_crc_32c("abcdef", 6U), 0x53bceff1U);
+  ASSERT_EQ(douban::mc::hashkit::hash_crc_32c(UTF8_ZHONG, 3U), 0x6846d959U);
+  ASSERT_EQ(douban::mc::hashkit::hash_crc_32c(FOX, sizeof(FOX) - 1), 0x22620404U);
+}
+
+
+TEST(hashkit, xxh32) {
+  // test data are generated using python xxhash:
+  // xxhash.xxh32(b"abcdef").intdigest()
+  ASSERT_EQ(douban::mc::hashkit::hash_xxh32("", 0U), 0x02cc5d05U);
+  ASSERT_EQ(douban::mc::hashkit::hash_xxh32("a", 1U), 0x550d7456U);
+  ASSERT_EQ(douban::mc::hashkit::hash_xxh32("abc", 3U), 0x32d153ffU);
+  ASSERT_EQ(douban::mc::hashkit::hash_xxh32("123456", 6U), 0xb7014066U);
+  ASSERT_EQ(douban::mc::hashkit::hash_xxh32("abcdef", 6U), 0x8b7cd587U);
+  ASSERT_EQ(douban::mc::hashkit::hash_xxh32(UTF8_ZHONG, 3U), 0x53fde05bU);
+  ASSERT_EQ(douban::mc::hashkit::hash_xxh32(FOX, sizeof(FOX) - 1), 0xe85ea4deU);
+}
+
+
 TEST(hashkit, mass) {
   std::string keys_path = get_resource_path("keys.txt");
   std::string keys_crc_32_path = get_resource_path("keys_crc_32.txt");
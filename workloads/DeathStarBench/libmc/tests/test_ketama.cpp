@@ -14,6 +14,7 @@ using std::getline;
 using std::ifstream;
 using std::stringstream;
 using douban::mc::hashkit::KetamaSelector;
+using douban::mc::hashkit::jump_consistent_hash;
 using douban::mc::tests::get_resource_path;
 using douban::mc::Connection;
 
@@ -77,3 +78,42 @@ TEST(test_ketama, servers) {
   valid_key_pool(ks, get_resource_path("key_pool_idx.csv").c_str());
   delete[] conns;
 }
+
+
+TEST(test_ketama, jump_consistent_hash) {
+  ASSERT_EQ(jump_consistent_hash(0, 1), 0);
+  ASSERT_EQ(jump_consistent_hash(1, 10), 6);
+  ASSERT_EQ(jump_consistent_hash(0xdeadbeef, 1000), 285);
+  ASSERT_EQ(jump_consistent_hash(123456789, 64), 34);
+  ASSERT_EQ(jump_consistent_hash(0xffffffff, 4), 2);
+
+  // growing the cluster by one only ever moves keys onto the new bucket
+  for (uint64_t key = 0; key < 10000; key++) {
+    for (int32_t n = 1; n < 32; n++) {
+      int32_t before = jump_consistent_hash(key, n);
+      int32_t after = jump_consistent_hash(key, n + 1);
+      ASSERT_TRUE(after == before || after == n);
+    }
+  }
+}
+
+
+TEST(test_ketama, jump_distribution) {
+  string csv_path = get_resource_path("server_port.csv");
+  size_t nServers = wc(csv_path.c_str());
+  Connection* conns = new Connection[nServers];
+  KetamaSelector ks;
+  ks.setHashFunction(&douban::mc::hashkit::hash_xxh32);
+  ks.setDistribution(douban::mc::hashkit::DISTRIBUTION_JUMP);
+  load_servers(ks, conns, nServers, csv_path.c_str());
+
+  char key[32];
+  for (int i = 0; i < 1000; i++) {
+    int key_len = snprintf(key, sizeof(key), "key_%d", i);
+    int32_t expected = jump_consistent_hash(douban::mc::hashkit::hash_xxh32(key, key_len),
+                                            static_cast<int32_t>(nServers));
+    ASSERT_EQ(ks.getServer(key, key_len, false), expected);
+    ASSERT_EQ(ks.getConn(key, key_len, false), &conns[expected]);
+  }
+  delete[] conns;
+}
@@ -0,0 +1,96 @@
+#include <cstring>
+#include <string>
+#include "Export.h"
+#include "Lz4.h"
+#include "gtest/gtest.h"
+
+namespace lz4 = douban::mc::lz4;
+
+
+static std::string roundTrip(const std::string& input) {
+  std::string compressed(lz4::compressBound(input.size()), '\0');
+  size_t n = lz4::compress(input.data(), input.size(), &compressed[0], compressed.size());
+  EXPECT_GT(n, 0U);
+  std::string output(input.size(), '\0');
+  EXPECT_TRUE(lz4::decompress(compressed.data(), n, &output[0], output.size()));
+  return output;
+}
+
+
+TEST(test_lz4, round_trip) {
+  ASSERT_EQ(roundTrip(""), "");
+  ASSERT_EQ(roundTrip("a"), "a");
+  ASSERT_EQ(roundTrip("hello world, hello"), "hello world, hello");
+
+  std::string repeated(100000, 'x');
+  ASSERT_EQ(roundTrip(repeated), repeated);
+
+  std::string json;
+  for (int i = 0; i < 500; i++) {
+    json += "{\"user_id\": " + std::to_string(i * 7919) + ", \"text\": \"lorem ipsum\"},";
+  }
+  ASSERT_EQ(roundTrip(json), json);
+
+  // incompressible input, long literal runs
+  std::string random(70000, '\0');
+  uint32_t x = 2463534242U;
+  for (size_t i = 0; i < random.size(); i++) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    random[i] = static_cast<char>(x);
+  }
+  ASSERT_EQ(roundTrip(random), random);
+}
+
+
+TEST(test_lz4, known_block) {
+  // produced by the reference implementation (LZ4_compress_default)
+  const char block[] = "\x1f\x61\x01\x00\x27\x50\x61\x61\x61\x61\x61";
+  char out[64];
+  ASSERT_TRUE(lz4::decompress(block, sizeof(block) - 1, out, 64));
+  ASSERT_EQ(std::string(out, 64), std::string(64, 'a'));
+
+  const char block2[] = "\x6f\x68\x65\x6c\x6c\x6f\x20\x06\x00\x01\x50\x6c\x6c\x6f\x21\x21";
+  const char expected2[] = "hello hello hello hello hello!!";
+  ASSERT_TRUE(lz4::decompress(block2, sizeof(block2) - 1, out, sizeof(expected2) - 1));
+  ASSERT_EQ(std::string(out, sizeof(expected2) - 1), expected2);
+}
+
+
+TEST(test_lz4, malformed) {
+  std::string input(1000, 'y');
+  std::string compressed(lz4::compressBound(input.size()), '\0');
+  size_t n = lz4::compress(input.data(), input.size(), &compressed[0], compressed.size());
+  ASSERT_LT(n, 100U);
+  char out[1000];
+
+  // wrong size, truncated input, offset pointing before the output
+  ASSERT_FALSE(lz4::decompress(compressed.data(), n, out, 999));
+  for (size_t len = 0; len < n; len++) {
+    ASSERT_FALSE(lz4::decompress(compressed.data(), len, out, 1000));
+  }
+  const char bad_offset[] = "\x10\x61\x05\x00\x50\x61\x61\x61\x61\x61";
+  ASSERT_FALSE(lz4::decompress(bad_offset, sizeof(bad_offset) - 1, out, 10));
+  ASSERT_EQ(lz4::compress(input.data(), input.size(), &compressed[0], 10), 0U);
+}
+
+
+TEST(test_lz4, pack_value) {
+  size_t packedLen = 0, valLen = 0;
+  ASSERT_TRUE(lz4::packValue("tiny", 4, packedLen) == NULL);
+
+  std::string input(4096, 'z');
+  char* packed = lz4::packValue(input.data(), input.size(), packedLen);
+  ASSERT_TRUE(packed != NULL);
+  ASSERT_LT(packedLen, 64U);
+  char* val = lz4::unpackValue(packed, packedLen, valLen);
+  ASSERT_TRUE(val != NULL);
+  ASSERT_EQ(std::string(val, valLen), input);
+  delete[] val;
+
+  // a header claiming an absurd size is rejected before allocating
+  packed[3] = 0x70;
+  ASSERT_TRUE(lz4::unpackValue(packed, packedLen, valLen) == NULL);
+  delete[] packed;
+}
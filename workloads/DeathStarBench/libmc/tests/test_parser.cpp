@@ -1,22 +1,24 @@
 #include "Common.h"
 #include "Result.h"
-#include "BufferReader.h"
+#include "DataBlock.h"
+#include "Reader.h"
 #include "Parser.h"
 #include <cstring>
 #include "gtest/gtest.h"
 
 using douban::mc::types::RetrievalResult;
+using douban::mc::types::MetaResult;
 
-using douban::mc::io::BufferReader;
+using douban::mc::io::Arena;
+using douban::mc::io::Reader;
 using douban::mc::io::DataBlock;
-using douban::mc::io::TokenData;
 using douban::mc::PacketParser;
 
 
 
 TEST(test_parser, empty_result) {
   err_code_t err;
-  BufferReader reader;
+  Reader reader;
   PacketParser parser;
   parser.setMode(douban::mc::MODE_END_STATE);
   parser.setBufferReader(&reader);
@@ -42,7 +44,7 @@ TEST(test_parser, empty_result) {
 TEST(test_parser, multi_results) {
   err_code_t err;
   DataBlock::setMinCapacity(10);
-  BufferReader reader;
+  Reader reader;
   PacketParser parser;
   parser.setMode(douban::mc::MODE_END_STATE);
   parser.setBufferReader(&reader);
@@ -69,6 +71,7 @@ TEST(test_parser, multi_results) {
   }
   RetrievalResult* res = NULL;
   retrieval_result_t* innerRes;
+  Arena arena;
   ASSERT_EQ(parser.getRetrievalResults()->size(), 3);
 
   char keys[][4] = {"foo", "baz", "bar"};
@@ -77,7 +80,7 @@ TEST(test_parser, multi_results) {
 
   for (i = 0; i < 3; i++) {
     res = &((*parser.getRetrievalResults())[i]);
-    innerRes = res->inner();
+    innerRes = res->inner(arena);
 
     size_t len_key = 3;
     ASSERT_N_STREQ(innerRes->key, keys[i], len_key);
@@ -89,4 +92,65 @@ TEST(test_parser, multi_results) {
   }
 }
 
+
+
+TEST(test_parser, meta_results) {
+  err_code_t err;
+  DataBlock::setMinCapacity(10);
+  Reader reader;
+  PacketParser parser;
+  parser.setMode(douban::mc::MODE_END_STATE);
+  parser.setBufferReader(&reader);
+  size_t i = 0;
+
+  // mg hit with value, mg vivified miss, quiet replies left out, ms, md
+  char input_buffer[][100] = {
+      "V", "A 5 f3 c7", "7 t-1 O0", "\r\nhel", "lo\r", "\n",
+      "VA 0 W O", "1\r\n\r\n",
+      "E", "N O3\r\n",
+      "H", "D c9 O4\r\n", "N", "S O5\r\n", "EX O6\r\n", "NF O7\r\n",
+      "M", "N\r\n"
+  };
+  size_t n_input = 18;
+
+  while (true) {
+    if (i < n_input) {
+      ASSERT_NO_THROW(reader.write(input_buffer[i], strlen(input_buffer[i])));
+      ++i;
+    }
+    parser.process_packets(err);
+    if (err == RET_INCOMPLETE_BUFFER_ERR) {
+      continue;
+    }
+    break;
+  }
+  ASSERT_EQ(err, RET_OK);
+  ASSERT_EQ(parser.getMetaResults()->size(), 7);
+  Arena arena;
+
+  enum meta_result_type types[] = {META_VA, META_VA, META_EN, META_HD,
+                                   META_NS, META_EX, META_NF};
+  uint32_t opaques[] = {0, 1, 3, 4, 5, 6, 7};
+  for (i = 0; i < 7; i++) {
+    meta_result_t* r = (*parser.getMetaResults())[i].inner(arena);
+    ASSERT_EQ(r->type_, types[i]);
+    ASSERT_EQ(r->opaque, opaques[i]);
+  }
+
+  meta_result_t* r = (*parser.getMetaResults())[0].inner(arena);
+  ASSERT_EQ(r->bytes, 5);
+  ASSERT_N_STREQ(r->data_block, "hello", 5);
+  ASSERT_EQ(r->flags, 3);
+  ASSERT_EQ(r->cas_unique, 77);
+  ASSERT_EQ(r->ttl, -1);
+  ASSERT_EQ(r->won, 0);
+
+  r = (*parser.getMetaResults())[1].inner(arena);
+  ASSERT_EQ(r->bytes, 0);
+  ASSERT_EQ(r->won, 1);
+
+  r = (*parser.getMetaResults())[3].inner(arena);
+  ASSERT_EQ(r->cas_unique, 9);
+}
+
 // TODO test MODE_COUNTING
@@ -0,0 +1,203 @@
+#include "Common.h"
+#include "Export.h"
+#include "DataBlock.h"
+#include "RingBufferReader.h"
+#include "Utility.h"
+#include <cstring>
+#include <string>
+#include "gtest/gtest.h"
+
+using douban::mc::io::DataBlock;
+using douban::mc::io::RingBufferReader;
+using douban::mc::io::RingSlice;
+using douban::mc::io::copyTokenData;
+using douban::mc::io::freeTokenData;
+using douban::mc::io::parseTokenData;
+using douban::mc::utility::findChar;
+
+#define ASSERT_N_STREQ(S1, S2, N) do {ASSERT_TRUE(0 == std::strncmp((S1), (S2), (N)));} while (0)
+
+
+TEST(test_ring_buffer, find_char) {
+  std::string s(200, 'x');
+  const char* begin = s.data();
+  const char* end = s.data() + s.size();
+  ASSERT_EQ(findChar(begin, end, '\n'), end);
+  ASSERT_EQ(findChar(begin, begin, 'x'), begin);
+
+  // hit every lane of the 32/16-byte loops and the scalar tail
+  for (size_t i = 0; i < s.size(); i++) {
+    s[i] = '\n';
+    ASSERT_EQ(findChar(begin, end, '\n') - begin, i);
+    ASSERT_EQ(findChar(begin + i, end, '\n') - begin, i);
+    if (i > 0) {
+      ASSERT_EQ(findChar(begin, begin + i, '\n'), begin + i);
+    }
+    s[i] = 'x';
+  }
+}
+
+
+TEST(test_ring_buffer, peek_empty) {
+  err_code_t err = RET_OK;
+  RingBufferReader reader;
+  reader.peek(err, 0);
+  ASSERT_EQ(err, RET_INCOMPLETE_BUFFER_ERR);
+
+  RingSlice slice;
+  reader.readUntil(err, '\n', slice);
+  ASSERT_EQ(err, RET_INCOMPLETE_BUFFER_ERR);
+}
+
+
+TEST(test_ring_buffer, read_line) {
+  err_code_t err;
+  uint64_t val;
+  RingSlice slice;
+  RingBufferReader reader;
+  reader.write(CSTR("VALUE fo"), 8);
+
+  ASSERT_EQ(reader.readUntil(err, ' ', slice), 5);
+  ASSERT_EQ(err, RET_OK);
+  ASSERT_N_STREQ(reader.at(slice), "VALUE", 5);
+  reader.skipBytes(err, 1);
+  ASSERT_EQ(err, RET_OK);
+
+  reader.readUntil(err, ' ', slice);
+  ASSERT_EQ(err, RET_INCOMPLETE_BUFFER_ERR);
+  reader.write(CSTR("o 10 24\r\n"), 9);
+  ASSERT_EQ(reader.readUntil(err, ' ', slice), 3);
+  ASSERT_EQ(err, RET_OK);
+  ASSERT_N_STREQ(reader.at(slice), "foo", 3);
+  reader.skipBytes(err, 1);
+
+  reader.readUnsigned(err, val);
+  ASSERT_EQ(err, RET_OK);
+  ASSERT_EQ(val, 10);
+  reader.expectBytes(err, CSTR(" "), 1);
+  ASSERT_EQ(err, RET_OK);
+  reader.readUnsigned(err, val);
+  ASSERT_EQ(err, RET_OK);
+  ASSERT_EQ(val, 24);
+  reader.expectBytes(err, CSTR("\n"), 1);
+  ASSERT_EQ(err, RET_PROGRAMMING_ERR);
+  ASSERT_EQ(reader.skipUntil(err, '\n'), 1);
+  ASSERT_EQ(reader.peek(err, 0), '\n');
+  ASSERT_EQ(reader.readLeft(), 1);
+}
+
+
+TEST(test_ring_buffer, read_unsigned_incomplete) {
+  err_code_t err;
+  uint64_t val;
+  RingBufferReader reader;
+  reader.write(CSTR("12"), 2);
+  reader.readUnsigned(err, val);
+  ASSERT_EQ(err, RET_INCOMPLETE_BUFFER_ERR);
+  reader.write(CSTR("3 "), 2);
+  reader.readUnsigned(err, val);
+  ASSERT_EQ(err, RET_OK);
+  ASSERT_EQ(val, 123);
+  reader.readUnsigned(err, val);
+  ASSERT_EQ(err, RET_INCOMPLETE_BUFFER_ERR);
+  reader.write(CSTR("x"), 1);
+  reader.readUnsigned(err, val);
+  ASSERT_EQ(err, RET_PROGRAMMING_ERR);
+}
+
+
+TEST(test_ring_buffer, value_across_writes) {
+  // a value spanning several recv()s still comes out in one piece
+  err_code_t err;
+  DataBlock::setMinCapacity(16);
+  RingBufferReader reader;
+  std::string value;
+  for (int i = 0; i < 100; i++) {
+    value.push_back('a' + i % 26);
+  }
+  for (size_t i = 0; i < value.size(); i += 7) {
+    size_t n = std::min<size_t>(7, value.size() - i);
+    reader.write(value.data() + i, n);
+  }
+
+  RingSlice slice;
+  reader.readBytes(err, value.size() + 1, slice);
+  ASSERT_EQ(err, RET_INCOMPLETE_BUFFER_ERR);
+  reader.readBytes(err, value.size(), slice);
+  ASSERT_EQ(err, RET_OK);
+  ASSERT_EQ(slice.len, value.size());
+  ASSERT_EQ(slice.size(), 1);
+  ASSERT_N_STREQ(reader.at(slice), value.data(), value.size());
+  ASSERT_EQ(reader.readLeft(), 0);
+  DataBlock::setMinCapacity(MIN_DATABLOCK_CAPACITY);
+}
+
+
+TEST(test_ring_buffer, compact) {
+  // consumed bytes are reclaimed instead of growing the buffer
+  err_code_t err;
+  DataBlock::setMinCapacity(16);
+  RingBufferReader reader;
+  for (int i = 0; i < 100; i++) {
+    reader.write(CSTR("0123456789\r\n"), 12);
+    reader.skipUntil(err, '\n');
+    ASSERT_EQ(err, RET_OK);
+    reader.skipBytes(err, 1);
+  }
+  ASSERT_EQ(reader.capacity(), 16);
+  ASSERT_EQ(reader.readLeft(), 0);
+  DataBlock::setMinCapacity(MIN_DATABLOCK_CAPACITY);
+}
+
+
+TEST(test_ring_buffer, retain) {
+  // tokens keep their bytes across the relocations of later writes
+  err_code_t err;
+  DataBlock::setMinCapacity(16);
+  RingBufferReader reader;
+  RingSlice key, other;
+  reader.write(CSTR("foo bar "), 8);
+  reader.readUntil(err, ' ', key);
+  reader.skipBytes(err, 1);
+  reader.readUntil(err, ' ', other);
+  reader.skipBytes(err, 1);
+
+  for (int i = 0; i < 10; i++) {
+    reader.write(CSTR("0123456789"), 10);
+    reader.skipBytes(err, 10);
+  }
+  ASSERT_N_STREQ(reader.at(key), "foo", 3);
+  ASSERT_N_STREQ(reader.at(other), "bar", 3);
+  ASSERT_EQ(reader.nBytesRetained(), 108);
+  ASSERT_N_STREQ(parseTokenData(key, 3), "foo", 3);
+
+  RingSlice copy;
+  copyTokenData(key, copy);
+  ASSERT_EQ(reader.at(copy), reader.at(key));
+  freeTokenData(copy);
+
+  reader.releaseAll();
+  ASSERT_EQ(reader.nBytesRetained(), 0);
+  reader.write(CSTR("0123456789"), 10);
+  reader.skipBytes(err, 10);
+
+  // kept for a reply as large, dropped after a much smaller one
+  size_t capacity = reader.capacity();
+  ASSERT_GT(capacity, 16);
+  reader.reset();
+  ASSERT_EQ(reader.capacity(), capacity);
+  reader.write(CSTR("0123456789"), 10);
+  reader.reset();
+  ASSERT_EQ(reader.capacity(), 0);
+  DataBlock::setMinCapacity(MIN_DATABLOCK_CAPACITY);
+}
+
+
+TEST(test_ring_buffer, skip_does_not_retain) {
+  err_code_t err;
+  RingBufferReader reader;
+  reader.write(CSTR("END\r\n"), 5);
+  ASSERT_EQ(reader.skipUntil(err, '\n'), 4);
+  ASSERT_EQ(err, RET_OK);
+  ASSERT_EQ(reader.nBytesRetained(), 0);
+}
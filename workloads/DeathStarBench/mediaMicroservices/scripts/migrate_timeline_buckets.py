@@ -0,0 +1,73 @@
+import argparse
+
+import pymongo
+from bson.int64 import Int64
+
+# Converts single-document review lists {<owner>, reviews: [newest, ...]} into
+# the bucketed collection the services use (see src/TimelineBuckets.h):
+# {<owner>, bucket_seq, count, reviews: [newest, ...]} with bucket 0 holding
+# the oldest entries and every bucket but the newest one full. Buckets are
+# replaced by (<owner>, bucket_seq), so rerunning it is harmless. Run it
+# before the bucketed services take writes; the source is left in place
+# unless --drop-source is given.
+
+# name -> (database, source collection, owner key, array key)
+TIMELINES = {
+  "movie-review": ("movie-review", "movie-review", "movie_id", "reviews"),
+  "user-review": ("user-review", "user-review", "user_id", "reviews"),
+}
+
+parser = argparse.ArgumentParser()
+
+parser.add_argument("-a", "--addr", action="store", dest="addr", type=str, default="localhost")
+parser.add_argument("-p", "--port", action="store", dest="port", type=int, default=27017)
+parser.add_argument("-t", "--timeline", action="store", nargs='+', dest="timelines", type=str,
+                    choices=sorted(TIMELINES), default=sorted(TIMELINES))
+parser.add_argument("-b", "--bucket-size", action="store", dest="bucket_size", type=int, default=128)
+parser.add_argument("--batch", action="store", dest="batch", type=int, default=1000)
+parser.add_argument("--drop-source", action="store_true", dest="drop_source")
+
+args = parser.parse_args()
+
+client = pymongo.MongoClient(args.addr, args.port)
+
+for name in args.timelines:
+  db_name, source_name, owner_key, array_key = TIMELINES[name]
+  db = client[db_name]
+  source = db[source_name]
+  dest = db[source_name + "-bucket"]
+  dest.create_index([(owner_key, pymongo.ASCENDING), ("bucket_seq", pymongo.ASCENDING)],
+                    unique=True)
+
+  num_owners = 0
+  num_entries = 0
+  num_buckets = 0
+  requests = []
+  for doc in source.find({}, {"_id": False}):
+    owner = doc[owner_key]
+    oldest_first = doc.get(array_key, [])[::-1]
+    seq = 0
+    for begin in range(0, len(oldest_first), args.bucket_size):
+      entries = oldest_first[begin:begin + args.bucket_size][::-1]
+      requests.append(pymongo.ReplaceOne(
+          {owner_key: owner, "bucket_seq": Int64(seq)},
+          {owner_key: owner, "bucket_seq": Int64(seq), "count": len(entries), array_key: entries},
+          upsert=True))
+      seq += 1
+    # buckets left over from an earlier run with a smaller bucket size
+    requests.append(pymongo.DeleteMany({owner_key: owner, "bucket_seq": {"$gte": Int64(seq)}}))
+    num_owners += 1
+    num_entries += len(oldest_first)
+    num_buckets += seq
+    if len(requests) >= args.batch:
+      dest.bulk_write(requests, ordered=False)
+      requests = []
+      print("Migrated", num_owners, name, "documents")
+  if requests:
+    dest.bulk_write(requests, ordered=False)
+  print("Migrated", num_owners, name, "documents,", num_entries, "entries into",
+        num_buckets, "buckets")
+
+  if args.drop_source:
+    source.drop()
+    print("Dropped", db_name + "." + source_name)
@@ -12,6 +12,7 @@
 #include "../ThriftClient.h"
 #include "../logger.h"
 #include "../tracing.h"
+#include "../utils_mongodb.h"
 
 namespace media_service {
 
@@ -49,14 +50,7 @@ void CastInfoHandler::WriteCastInfo(
     const std::string &intro,
     const std::map<std::string, std::string> &carrier) {
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "WriteCastInfo",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("WriteCastInfo", carrier, req_id);
 
   bson_t *new_doc = bson_new();
   BSON_APPEND_INT64(new_doc, "cast_info_id", cast_info_id);
@@ -64,30 +58,14 @@ void CastInfoHandler::WriteCastInfo(
   BSON_APPEND_BOOL(new_doc, "gender", gender);
   BSON_APPEND_UTF8(new_doc, "intro", intro.c_str());
 
-  mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-      _mongodb_client_pool);
-  if (!mongodb_client) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-    se.message = "Failed to pop a client from MongoDB pool";
-    throw se;
-  }
-  auto collection = mongoc_client_get_collection(
-      mongodb_client, "cast-info", "cast-info");
-  if (!collection) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-    se.message = "Failed to create collection cast-info from DB cast-info";
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-    throw se;
-  }
+  MongoClientLease mongodb_client(_mongodb_client_pool);
+  auto collection = mongodb_client.Collection("cast-info", "cast-info");
 
   bson_error_t error;
-  auto insert_span = opentracing::Tracer::Global()->StartSpan(
-      "MongoInsertCastInfo", { opentracing::ChildOf(&span->context()) });
+  auto insert_span = span.StartSpan("MongoInsertCastInfo");
   bool plotinsert = mongoc_collection_insert_one (
       collection, new_doc, nullptr, nullptr, &error);
-  insert_span->Finish();
+  insert_span.Finish();
   if (!plotinsert) {
     LOG(error) << "Error: Failed to insert cast-info to MongoDB: "
                << error.message;
@@ -95,16 +73,13 @@ void CastInfoHandler::WriteCastInfo(
     se.errorCode = ErrorCode::SE_MONGODB_ERROR;
     se.message = error.message;
     bson_destroy(new_doc);
-    mongoc_collection_destroy(collection);
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
     throw se;
   }
 
   bson_destroy(new_doc);
-  mongoc_collection_destroy(collection);
-  mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+  mongodb_client.Release();
 
-  span->Finish();
+  span.Finish();
 }
 
 void CastInfoHandler::ReadCastInfo(
@@ -114,14 +89,7 @@ void CastInfoHandler::ReadCastInfo(
     const std::map<std::string, std::string> &carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "ReadCastInfo",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("ReadCastInfo", carrier, req_id);
 
   if (cast_info_ids.empty()) {
     return;
@@ -144,25 +112,23 @@ void CastInfoHandler::ReadCastInfo(
     throw se;
   }
 
-  bool found;
-  std::string return_value;
-  uint32_t flags;
-  auto get_span = opentracing::Tracer::Global()->StartSpan(
-      "MmcMgetCastInfo", { opentracing::ChildOf(&span->context()) });
+  std::vector<std::string> keys;
+  keys.reserve(cast_info_ids.size());
   for (auto &cast_info_id : cast_info_ids) {
-    std::string key_str = std::to_string(cast_info_id);
-    bool success = mc_client->Get(key_str, &found, &return_value, &flags);
-    if (!success) {
-      _mc_client_pool->Push(mc_client);
-      LOG(error) << "Cannot get components of request " << req_id;
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-      se.message =  "Cannot get components of request " + std::to_string(req_id);
-      throw se;
-    }
-    if (!found) continue;
+    keys.emplace_back(std::to_string(cast_info_id));
+  }
+  std::map<std::string, std::string> return_values;
+  auto get_span = span.StartSpan("MmcMgetCastInfo");
+  bool success = mc_client->MultiGet(keys, &return_values);
+  if (!success) {
+    // a failed read is a miss for every cast info, MongoDB still has them
+    LOG_EVERY_MS(warning, 1000) << "Cannot get cast info of request " << req_id
+                                << " from memcached, reading MongoDB";
+    return_values.clear();
+  }
+  for (auto &it : return_values) {
     CastInfo new_cast_info;
-    json cast_info_json = json::parse(return_value);
+    json cast_info_json = json::parse(it.second);
     new_cast_info.cast_info_id = cast_info_json["cast_info_id"];
     new_cast_info.gender = cast_info_json["gender"];
     new_cast_info.name = cast_info_json["name"];
@@ -170,7 +136,7 @@ void CastInfoHandler::ReadCastInfo(
     return_map.insert(std::make_pair(new_cast_info.cast_info_id, new_cast_info));
     cast_info_ids_not_cached.erase(new_cast_info.cast_info_id);
   }
-  get_span->Finish();
+  get_span.Finish();
   _mc_client_pool->Push(mc_client);
 
   // std::vector<std::future<void>> set_futures;
@@ -194,30 +160,14 @@ void CastInfoHandler::ReadCastInfo(
     bson_append_array_end(&query_child, &query_cast_info_id_list);
     bson_append_document_end(query, &query_child);
 
-    mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-        _mongodb_client_pool);
-    if (!mongodb_client) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to pop a client from MongoDB pool";
-      throw se;
-    }
-    auto collection = mongoc_client_get_collection(
-        mongodb_client, "cast-info", "cast-info");
-    if (!collection) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to create collection user from DB user";
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-      throw se;
-    }
+    MongoClientLease mongodb_client(_mongodb_client_pool);
+    auto collection = mongodb_client.Collection("cast-info", "cast-info");
 
     mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
         collection, query, nullptr, nullptr);
     const bson_t *doc;
 
-    auto find_span = opentracing::Tracer::Global()->StartSpan(
-        "MongoFindCastInfo", {opentracing::ChildOf(&span->context())});
+    auto find_span = span.StartSpan("MongoFindCastInfo");
 
     while (true) {
       bool found = mongoc_cursor_next(cursor, &doc);
@@ -237,14 +187,12 @@ void CastInfoHandler::ReadCastInfo(
       return_map.insert({new_cast_info.cast_info_id, new_cast_info});
       bson_free(cast_info_json_char);
     }
-    find_span->Finish();
+    find_span.Finish();
     bson_error_t error;
     if (mongoc_cursor_error(cursor, &error)) {
       LOG(warning) << error.message;
       bson_destroy(query);
       mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
       ServiceException se;
       se.errorCode = ErrorCode::SE_MONGODB_ERROR;
       se.message = error.message;
@@ -252,8 +200,7 @@ void CastInfoHandler::ReadCastInfo(
     }
     bson_destroy(query);
     mongoc_cursor_destroy(cursor);
-    mongoc_collection_destroy(collection);
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+    mongodb_client.Release();
 
     // Upload cast-info to memcached
     // set_futures.emplace_back(std::async(std::launch::async, [&]() {
@@ -265,16 +212,16 @@ void CastInfoHandler::ReadCastInfo(
         se.message = "Failed to pop a client from memcached pool";
         throw se;
       }
-      auto set_span = opentracing::Tracer::Global()->StartSpan(
-          "MmcSetCastInfo", {opentracing::ChildOf(&span->context())});
+      auto set_span = span.StartSpan("MmcSetCastInfo");
+      std::map<std::string, std::string> set_items;
       for (auto & it : cast_info_json_map) {
-        std::string id_str = std::to_string(it.first);
-        if (!mc_client->Set(id_str, it.second, 0, 0)) {
-          LOG(warning) << "Failed to set post to Memcached";
-        }
+        set_items.emplace(std::to_string(it.first), std::move(it.second));
+      }
+      if (!mc_client->MultiSet(set_items, 0, 0)) {
+        LOG_EVERY_MS(warning, 1000) << "Failed to set cast-info to Memcached";
       }
       _mc_client_pool->Push(mc_client);
-      set_span->Finish();
+      set_span.Finish();
     // }));
   }
 
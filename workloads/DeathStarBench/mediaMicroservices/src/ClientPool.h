@@ -9,10 +9,10 @@
 #include <string>
 #include <atomic>
 
-#include <boost/filesystem.hpp>
-
 #include "logger.h"
 #include "FaasWorker.h"
+#include "LatencyStats.h"
+#include "probes.h"
 
 namespace media_service {
 
@@ -35,6 +35,10 @@ class ClientPool {
   void Push(TClient *, int);
   void Remove(TClient *);
 
+  // False when the clients invoke through the FaasWorker, which runs one
+  // invoke at a time: a FanOut of calls on this pool gains nothing.
+  bool CallsOverlap() const { return _calls_overlap; }
+
   struct RpcTrace {
     uint64_t start_timestamp;
     uint32_t duration;
@@ -43,16 +47,26 @@ class ClientPool {
   };
   static_assert(sizeof(RpcTrace) == 16, "Unexpected size of RpcTrace");
 
+  // Times the call as the stage `method_name` of the request the thread is
+  // serving (see LatencyStats.h), fires the stage probes for it and, with
+  // ENABLE_RPC_TRACE=1, records it in the pool's RPC trace.
   class RpcTraceGuard {
    public:
-    RpcTraceGuard(RpcTrace* rpc_trace, std::atomic<int64_t>* onfly_rpcs)
-        : _rpc_trace(rpc_trace), _onfly_rpcs(onfly_rpcs) {
+    RpcTraceGuard(const char* method_name, RpcTrace* rpc_trace,
+                  std::atomic<int64_t>* onfly_rpcs)
+        : _req_id(probes_detail::current_req_id),
+          _method(probes_detail::current_method), _stage(method_name),
+          _timer(GetLatencyHistogram(_method, _stage)),
+          _rpc_trace(rpc_trace), _onfly_rpcs(onfly_rpcs) {
+      PROBE3(stage__start, _req_id, _method, _stage);
       if (rpc_trace != nullptr) {
         rpc_trace->start_timestamp = current_timestamp();
       }
     }
 
     ~RpcTraceGuard() {
+      _timer.Stop();
+      PROBE3(stage__done, _req_id, _method, _stage);
       if (_rpc_trace != nullptr) {
         uint64_t duration = current_timestamp() - _rpc_trace->start_timestamp;
         _rpc_trace->duration = static_cast<uint32_t>(duration);
@@ -72,13 +86,17 @@ class ClientPool {
         std::chrono::high_resolution_clock::now().time_since_epoch()).count();
     }
 
+    int64_t _req_id;
+    const char* _method;
+    const char* _stage;
+    StageTimer _timer;
     RpcTrace* _rpc_trace;
     std::atomic<int64_t>* _onfly_rpcs;
   };
 
   std::unique_ptr<RpcTraceGuard> StartRpcTrace(const char* method_name, TClient* client) {
     if (!_enable_rpc_trace) {
-      return std::make_unique<RpcTraceGuard>(nullptr, nullptr);
+      return std::make_unique<RpcTraceGuard>(method_name, nullptr, nullptr);
     }
     RpcTrace* rpc_trace;
     {
@@ -100,7 +118,7 @@ class ClientPool {
     }
     rpc_trace->client_id = client->GetClientId();
     rpc_trace->status = 0;
-    return std::make_unique<RpcTraceGuard>(rpc_trace, &_onfly_rpcs);
+    return std::make_unique<RpcTraceGuard>(method_name, rpc_trace, &_onfly_rpcs);
   }
 
  private:
@@ -118,6 +136,7 @@ class ClientPool {
 
   std::string _service_http_path;
   FaasWorker* _faas_worker;
+  bool _calls_overlap;
 
   std::string _src_service;
   std::string _dst_service;
@@ -191,6 +210,10 @@ ClientPool<TClient>::ClientPool(const std::string &client_type,
   _client_type = client_type;
   _service_http_path = service_http_path;
   _faas_worker = faas_worker;
+  // the switch ThriftClient takes to call over sockets instead
+  const char* force_normal_client = getenv("THRIFT_FORCE_NORMAL_CLIENT");
+  _calls_overlap = faas_worker == nullptr ||
+      (force_normal_client != nullptr && atoi(force_normal_client) == 1);
 
   LOG(info) << "Max pool size: " << max_pool_size;
 
@@ -221,6 +244,8 @@ ClientPool<TClient>::~ClientPool() {
 
 template<class TClient>
 TClient * ClientPool<TClient>::Pop() {
+  PROBE2(pool__pop__start, probes_detail::current_req_id,
+         _client_type.c_str());
   TClient * client = nullptr;
   std::unique_lock<std::mutex> cv_lock(_mtx); {
     while (_pool.size() == 0) {
@@ -234,6 +259,8 @@ TClient * ClientPool<TClient>::Pop() {
           break;
         } catch (...) {
           cv_lock.unlock();
+          PROBE3(pool__pop__done, probes_detail::current_req_id,
+                 _client_type.c_str(), client);
           return nullptr;
         }
       } else {
@@ -242,8 +269,10 @@ TClient * ClientPool<TClient>::Pop() {
         bool wait_success = _cv.wait_until(cv_lock, wait_time,
             [this] { return _pool.size() > 0; });
         if (!wait_success) {
-          LOG(warning) << "ClientPool pop timeout";
+          LOG_EVERY_MS(warning, 1000) << "ClientPool pop timeout";
           cv_lock.unlock();
+          PROBE3(pool__pop__done, probes_detail::current_req_id,
+                 _client_type.c_str(), client);
           return nullptr;
         }
       }
@@ -265,11 +294,15 @@ TClient * ClientPool<TClient>::Pop() {
       throw;
     }    
   }
+  PROBE3(pool__pop__done, probes_detail::current_req_id,
+         _client_type.c_str(), client);
   return client;
 }
 
 template<class TClient>
 void ClientPool<TClient>::Push(TClient *client) {
+  PROBE3(pool__push, probes_detail::current_req_id, _client_type.c_str(),
+         client);
   std::unique_lock<std::mutex> cv_lock(_mtx);
   client->KeepAlive();
   _pool.push_back(client);
@@ -279,6 +312,8 @@ void ClientPool<TClient>::Push(TClient *client) {
 
 template<class TClient>
 void ClientPool<TClient>::Push(TClient *client, int timeout_ms) {
+  PROBE3(pool__push, probes_detail::current_req_id, _client_type.c_str(),
+         client);
   std::unique_lock<std::mutex> cv_lock(_mtx);
   client->KeepAlive(timeout_ms);
   _pool.push_back(client);
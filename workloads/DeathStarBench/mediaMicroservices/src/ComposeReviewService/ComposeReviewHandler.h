@@ -54,6 +54,10 @@ class ComposeReviewHandler : public ComposeReviewServiceIf {
   ClientPool<ThriftClient<MovieReviewServiceClient>>
       *_movie_review_client_pool;
   void _ComposeAndUpload(int64_t, const std::map<std::string, std::string> &);
+  // Stores one component under "<req_id>:<name>" and returns how many of the
+  // request's components are stored. The upload that stores the last one
+  // composes the review and sends it to the next tier.
+  uint64_t _UploadComponent(int64_t, const std::string &, const std::string &);
 };
 
 ComposeReviewHandler::ComposeReviewHandler(
@@ -71,7 +75,7 @@ ComposeReviewHandler::ComposeReviewHandler(
 }
 
 void ComposeReviewHandler::_ComposeAndUpload(
-    int64_t req_id, const std::map<std::string, std::string> &writer_text_map) {
+    int64_t req_id, const std::map<std::string, std::string> &carrier) {
 
   std::string key_unique_id = std::to_string(req_id) + ":review_id";
   std::string key_movie_id = std::to_string(req_id) + ":movie_id";
@@ -79,12 +83,12 @@ void ComposeReviewHandler::_ComposeAndUpload(
   std::string key_text = std::to_string(req_id) + ":text";
   std::string key_rating = std::to_string(req_id) + ":rating";
 
-  const char* keys[NUM_COMPONENTS] = {
-      key_unique_id.c_str(),
-      key_movie_id.c_str(),
-      key_user_id.c_str(),
-      key_text.c_str(),
-      key_rating.c_str()
+  std::vector<std::string> keys = {
+      key_unique_id,
+      key_movie_id,
+      key_user_id,
+      key_text,
+      key_rating
   };
 
   // Compose a review from the components obtained from memcached
@@ -97,29 +101,29 @@ void ComposeReviewHandler::_ComposeAndUpload(
   }
 
   Review new_review;
-  bool found;
-  std::string return_value;
-  uint32_t flags;
-  for (int i = 0; i < NUM_COMPONENTS; i++) {
-    bool success = mc_client->Get(keys[i], &found, &return_value, &flags);
-    if (!success) {
-      _mc_client_pool->Push(mc_client);
-      LOG(error) << "Cannot get components of request " << req_id;
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-      se.message =  "Cannot get components of request " + std::to_string(req_id);
-      throw se;
-    }
-    if (!found) continue;
-    if (keys[i] == key_unique_id) {
+  std::map<std::string, std::string> return_values;
+  SpanStage get_stage(req_id, probes_detail::current_method, "MmcMgetComponents");
+  bool success = mc_client->MultiGet(keys, &return_values);
+  get_stage.Stop();
+  if (!success) {
+    _mc_client_pool->Push(mc_client);
+    LOG(error) << "Cannot get components of request " << req_id;
+    ServiceException se;
+    se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
+    se.message =  "Cannot get components of request " + std::to_string(req_id);
+    throw se;
+  }
+  for (auto &it : return_values) {
+    const std::string &return_value = it.second;
+    if (it.first == key_unique_id) {
       new_review.review_id = std::stoul(return_value);
-    } else if (keys[i] == key_movie_id) {
+    } else if (it.first == key_movie_id) {
       new_review.movie_id = return_value;
-    } else if (keys[i] == key_text) {
+    } else if (it.first == key_text) {
       new_review.text = return_value;
-    } else if (keys[i] == key_user_id) {
+    } else if (it.first == key_user_id) {
       new_review.user_id = std::stoul(return_value);
-    } else if (keys[i] == key_rating) {
+    } else if (it.first == key_rating) {
       new_review.rating = std::stoi(return_value);
     }
   }
@@ -142,12 +146,16 @@ void ComposeReviewHandler::_ComposeAndUpload(
       throw se;
     }
     auto review_storage_client = review_storage_client_wrapper->GetClient();
-    try {
-      review_storage_client->StoreReview(req_id, new_review, writer_text_map);
-    } catch (...) {
-      _review_storage_client_pool->Remove(review_storage_client_wrapper);
-      LOG(error) << "Failed to upload review to review-storage-service";
-      throw;
+    {
+      auto rpc_trace_guard = _review_storage_client_pool->StartRpcTrace("StoreReview", review_storage_client_wrapper);
+      try {
+        review_storage_client->StoreReview(req_id, new_review, carrier);
+      } catch (...) {
+        rpc_trace_guard->set_status(1);
+        _review_storage_client_pool->Remove(review_storage_client_wrapper);
+        LOG(error) << "Failed to upload review to review-storage-service";
+        throw;
+      }
     }
     _review_storage_client_pool->Push(review_storage_client_wrapper);
   // });
@@ -161,13 +169,17 @@ void ComposeReviewHandler::_ComposeAndUpload(
       throw se;
     }
     auto user_review_client = user_review_client_wrapper->GetClient();
-    try {
-      user_review_client->UploadUserReview(req_id, new_review.user_id,
-          new_review.review_id, new_review.timestamp, writer_text_map);
-    } catch (...) {
-      _user_review_client_pool->Remove(user_review_client_wrapper);
-      LOG(error) << "Failed to upload review to user-review-service";
-      throw;
+    {
+      auto rpc_trace_guard = _user_review_client_pool->StartRpcTrace("UploadUserReview", user_review_client_wrapper);
+      try {
+        user_review_client->UploadUserReview(req_id, new_review.user_id,
+            new_review.review_id, new_review.timestamp, carrier);
+      } catch (...) {
+        rpc_trace_guard->set_status(1);
+        _user_review_client_pool->Remove(user_review_client_wrapper);
+        LOG(error) << "Failed to upload review to user-review-service";
+        throw;
+      }
     }
     _user_review_client_pool->Push(user_review_client_wrapper);
   // });
@@ -181,13 +193,17 @@ void ComposeReviewHandler::_ComposeAndUpload(
       throw se;
     }
     auto movie_review_client = movie_review_client_wrapper->GetClient();
-    try {
-      movie_review_client->UploadMovieReview(req_id, new_review.movie_id,
-          new_review.review_id, new_review.timestamp, writer_text_map);
-    } catch (...) {
-      _movie_review_client_pool->Remove(movie_review_client_wrapper);
-      LOG(error) << "Failed to upload review to movie-review-service";
-      throw;
+    {
+      auto rpc_trace_guard = _movie_review_client_pool->StartRpcTrace("UploadMovieReview", movie_review_client_wrapper);
+      try {
+        movie_review_client->UploadMovieReview(req_id, new_review.movie_id,
+            new_review.review_id, new_review.timestamp, carrier);
+      } catch (...) {
+        rpc_trace_guard->set_status(1);
+        _movie_review_client_pool->Remove(movie_review_client_wrapper);
+        LOG(error) << "Failed to upload review to movie-review-service";
+        throw;
+      }
     }
     _movie_review_client_pool->Push(movie_review_client_wrapper);
   // });
@@ -201,21 +217,8 @@ void ComposeReviewHandler::_ComposeAndUpload(
   // }
 }
 
-void ComposeReviewHandler::UploadMovieId(
-    int64_t req_id,
-    const std::string &movie_id,
-    const std::map<std::string, std::string> & carrier) {
-
-  // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UploadMovieId",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
-
+uint64_t ComposeReviewHandler::_UploadComponent(
+    int64_t req_id, const std::string &name, const std::string &value) {
   std::string key_counter = std::to_string(req_id) + ":counter";
   auto mc_client = _mc_client_pool->Pop();
   if (!mc_client) {
@@ -225,161 +228,78 @@ void ComposeReviewHandler::UploadMovieId(
     throw se;
   }
 
-  bool stored, found;
-  uint32_t flags;
-  // Initialize the counter to 0 if there it is not in the memcached
-  bool success = mc_client->Add(key_counter, "0", 0, MMC_EXP_TIME, &stored);
-
-  // error if it cannot be stored
+  // Store the component to memcached
+  bool stored;
+  std::string key_component = std::to_string(req_id) + ":" + name;
+  SpanStage add_stage(req_id, probes_detail::current_method, "MmcAddComponent");
+  bool success = mc_client->Add(key_component, value, 0, MMC_EXP_TIME, &stored);
+  add_stage.Stop();
   if (!success) {
     _mc_client_pool->Push(mc_client);
-    LOG(error) << "Failed to initilize the counter for request " << req_id;
+    LOG(error) << "Cannot store " << name << " of request " << req_id;
     ServiceException se;
     se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-    se.message = "Failed to initilize the counter for request " + std::to_string(req_id);
+    se.message = "Cannot store " + name + " of request " +
+        std::to_string(req_id);
     throw se;
   }
+  if (!stored) {
+    // Another thread has uploaded the component, which is an unexpected
+    // behaviour.
+    LOG(warning) << name << " of request " << req_id
+                 << " has already been stored";
+  }
 
-  // Store movie_id to memcached
+  // The counter is created by the first component to arrive, there is no
+  // separate "add 0". A duplicate must not count, it only reads the counter
+  // (adding 0), which also reads a counter no one has created yet as 0.
+  uint64_t delta = stored ? 1 : 0;
   uint64_t counter_value;
-  std::string key_movie_id = std::to_string(req_id) + ":movie_id";
-  success = mc_client->Add(key_movie_id, movie_id, 0, MMC_EXP_TIME, &stored);
+  SpanStage incr_stage(req_id, probes_detail::current_method, "MmcIncrCounter");
+  success = mc_client->IncrOrInit(key_counter, delta, delta, MMC_EXP_TIME,
+                                  &counter_value);
+  incr_stage.Stop();
+  _mc_client_pool->Push(mc_client);
   if (!success) {
-    _mc_client_pool->Push(mc_client);
-    LOG(error) << "Cannot store movie_id of request " << req_id;
+    LOG(error) << "Cannot increment and get the counter of request "
+               << req_id;
     ServiceException se;
     se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-    se.message = "Cannot store movie_id of request " + std::to_string(req_id);
+    se.message = "Cannot increment and get the counter of request " +
+        std::to_string(req_id);
     throw se;
-  } else if (!stored) {
-    // Another thread has uploaded movie_id, which is an unexpected behaviour.
-    LOG(warning) << "movie_id of request " << req_id
-                 << " has already been stored";
-    std::string counter_value_str;
-    success = mc_client->Get(key_counter, &found, &counter_value_str, &flags);
-    if (!success || !found) {
-      _mc_client_pool->Push(mc_client);
-      LOG(error) << "Cannot get the counter of request " << req_id;
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-      se.message = "Cannot get the counter of request " + std::to_string(req_id);
-      throw se;
-    }
-    counter_value = std::stoul(counter_value_str);
-  } else {
-    // Atomically increment and get the counter value
-    success = mc_client->Incr(key_counter, 1, &counter_value);
-    if (!success) {
-      _mc_client_pool->Push(mc_client);
-      LOG(error) << "Cannot increment and get the counter of request "
-          << req_id;
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-      se.message =  "Cannot increment and get the counter of request " + std::to_string(req_id);
-      throw se;
-    }
   }
-  LOG(debug) << "req_id " << req_id
-      << " caching movie_id to Memcached finished";
-  _mc_client_pool->Push(mc_client);
-
-  // If this thread is the last one uploading the review components,
-  // it is in charge of compose the request and upload to the microservices in
-  // the next tier.
-  if (counter_value == NUM_COMPONENTS) {
-    _ComposeAndUpload(req_id, writer_text_map);
-  }
-  span->Finish();
+  LOG(debug) << "req_id " << req_id << " caching " << name
+             << " to Memcached finished";
+  return counter_value;
 }
 
-void ComposeReviewHandler::UploadUserId(
-    int64_t req_id, int64_t user_id,
+void ComposeReviewHandler::UploadMovieId(
+    int64_t req_id,
+    const std::string &movie_id,
     const std::map<std::string, std::string> & carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UploadUserId",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("UploadMovieId", carrier, req_id);
 
-  std::string key_counter = std::to_string(req_id) + ":counter";
-  auto mc_client = _mc_client_pool->Pop();
-  if (!mc_client) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-    se.message = "Failed to pop a client from memcached pool";
-    throw se;
+  if (_UploadComponent(req_id, "movie_id", movie_id) == NUM_COMPONENTS) {
+    _ComposeAndUpload(req_id, span.carrier());
   }
+  span.Finish();
+}
 
-  bool stored, found;
-  uint32_t flags;
-  // Initialize the counter to 0 if there it is not in the memcached
-  bool success = mc_client->Add(key_counter, "0", 0, MMC_EXP_TIME, &stored);
-
-  // error if it cannot be stored
-  if (!success) {
-    _mc_client_pool->Push(mc_client);
-    LOG(error) << "Failed to initilize the counter for request " << req_id;
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-    se.message = "Failed to initilize the counter for request " + std::to_string(req_id);
-    throw se;
-  }
+void ComposeReviewHandler::UploadUserId(
+    int64_t req_id, int64_t user_id,
+    const std::map<std::string, std::string> & carrier) {
 
-  // Store user_id to memcached
-  uint64_t counter_value;
-  std::string key_user_id = std::to_string(req_id) + ":user_id";
-  std::string user_id_str = std::to_string(user_id);
-  success = mc_client->Add(key_user_id, user_id_str, 0, MMC_EXP_TIME, &stored);
-  if (!success) {
-    _mc_client_pool->Push(mc_client);
-    LOG(error) << "Cannot store user_id of request " << req_id;
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-    se.message = "Cannot store user_id of request " + std::to_string(req_id);
-    throw se;
-  } else if (!stored) {
-    // Another thread has uploaded user_id, which is an unexpected behaviour.
-    LOG(warning) << "user_id of request " << req_id
-                 << " has already been stored";
-    std::string counter_value_str;
-    success = mc_client->Get(key_counter, &found, &counter_value_str, &flags);
-    if (!success || !found) {
-      _mc_client_pool->Push(mc_client);
-      LOG(error) << "Cannot get the counter of request " << req_id;
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-      se.message = "Cannot get the counter of request " + std::to_string(req_id);
-      throw se;
-    }
-    counter_value = std::stoul(counter_value_str);
-  } else {
-    // Atomically increment and get the counter value
-    success = mc_client->Incr(key_counter, 1, &counter_value);
-    if (!success) {
-      _mc_client_pool->Push(mc_client);
-      LOG(error) << "Cannot increment and get the counter of request "
-          << req_id;
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-      se.message =  "Cannot increment and get the counter of request " + std::to_string(req_id);
-      throw se;
-    }
-  }
-  LOG(debug) << "req_id " << req_id << "caching user to Memcached finished";
-  _mc_client_pool->Push(mc_client);
+  // Initialize a span
+  RequestSpan span("UploadUserId", carrier, req_id);
 
-  // If this thread is the last one uploading the review components,
-  // it is in charge of compose the request and upload to the microservices in
-  // the next tier.
-  if (counter_value == NUM_COMPONENTS) {
-    _ComposeAndUpload(req_id, writer_text_map);
+  if (_UploadComponent(req_id, "user_id", std::to_string(user_id)) ==
+      NUM_COMPONENTS) {
+    _ComposeAndUpload(req_id, span.carrier());
   }
-  span->Finish();
+  span.Finish();
 }
 
 void ComposeReviewHandler::UploadUniqueId(
@@ -387,91 +307,13 @@ void ComposeReviewHandler::UploadUniqueId(
     const std::map<std::string, std::string> & carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UploadUniqueId",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
-
-  std::string key_counter = std::to_string(req_id) + ":counter";
-  auto mc_client = _mc_client_pool->Pop();
-  if (!mc_client) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-    se.message = "Failed to pop a client from memcached pool";
-    throw se;
-  }
-
-  bool stored, found;
-  uint32_t flags;
-  // Initialize the counter to 0 if there it is not in the memcached
-  bool success = mc_client->Add(key_counter, "0", 0, MMC_EXP_TIME, &stored);
+  RequestSpan span("UploadUniqueId", carrier, req_id);
 
-  // error if it cannot be stored
-  if (!success) {
-    _mc_client_pool->Push(mc_client);
-    LOG(error) << "Failed to initilize the counter for request " << req_id;
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-    se.message = "Failed to initilize the counter for request " + std::to_string(req_id);
-    throw se;
+  if (_UploadComponent(req_id, "review_id", std::to_string(review_id)) ==
+      NUM_COMPONENTS) {
+    _ComposeAndUpload(req_id, span.carrier());
   }
-
-  // Store review_id to memcached
-  uint64_t counter_value;
-  std::string key_unique_id = std::to_string(req_id) + ":review_id";
-  std::string unique_id_str = std::to_string(review_id);
-  success = mc_client->Add(key_unique_id, unique_id_str, 0, MMC_EXP_TIME, &stored);
-  if (!success) {
-    _mc_client_pool->Push(mc_client);
-    LOG(error) << "Cannot store review_id of request " << req_id;
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-    se.message = "Cannot store review_id of request " + std::to_string(req_id);
-    throw se;
-  } else if (!stored) {
-    // Another thread has uploaded review_id, which is an unexpected behaviour.
-    LOG(warning) << "review_id of request " << req_id
-                 << " has already been stored";
-    std::string counter_value_str;
-    success = mc_client->Get(key_counter, &found, &counter_value_str, &flags);
-    if (!success || !found) {
-      _mc_client_pool->Push(mc_client);
-      LOG(error) << "Cannot get the counter of request " << req_id;
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-      se.message = "Cannot get the counter of request " + std::to_string(req_id);
-      throw se;
-    }
-    counter_value = std::stoul(counter_value_str);
-  } else {
-    // Atomically increment and get the counter value
-    success = mc_client->Incr(key_counter, 1, &counter_value);
-    if (!success) {
-      _mc_client_pool->Push(mc_client);
-      LOG(error) << "Cannot increment and get the counter of request "
-          << req_id;
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-      se.message =  "Cannot increment and get the counter of request " + std::to_string(req_id);
-      throw se;
-    }
-  }
-  LOG(debug) << "req_id " << req_id
-             << " caching review_id to Memcached finished";
-
-  _mc_client_pool->Push(mc_client);
-
-  // If this thread is the last one uploading the review components,
-  // it is in charge of compose the request and upload to the microservices in
-  // the next tier.
-  if (counter_value == NUM_COMPONENTS) {
-    _ComposeAndUpload(req_id, writer_text_map);
-  }
-  span->Finish();
+  span.Finish();
 }
 
 void ComposeReviewHandler::UploadText(
@@ -480,177 +322,25 @@ void ComposeReviewHandler::UploadText(
     const std::map<std::string, std::string> & carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UploadText",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
-
-  std::string key_counter = std::to_string(req_id) + ":counter";
-  auto mc_client = _mc_client_pool->Pop();
-  if (!mc_client) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-    se.message = "Failed to pop a client from memcached pool";
-    throw se;
-  }
+  RequestSpan span("UploadText", carrier, req_id);
 
-  bool stored, found;
-  uint32_t flags;
-  // Initialize the counter to 0 if there it is not in the memcached
-  bool success = mc_client->Add(key_counter, "0", 0, MMC_EXP_TIME, &stored);
-
-  // error if it cannot be stored
-  if (!success) {
-    _mc_client_pool->Push(mc_client);
-    LOG(error) << "Failed to initilize the counter for request " << req_id;
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-    se.message = "Failed to initilize the counter for request " + std::to_string(req_id);
-    throw se;
+  if (_UploadComponent(req_id, "text", text) == NUM_COMPONENTS) {
+    _ComposeAndUpload(req_id, span.carrier());
   }
-
-  // Store text to memcached
-  uint64_t counter_value;
-  std::string key_text = std::to_string(req_id) + ":text";
-  success = mc_client->Add(key_text, text, 0, MMC_EXP_TIME, &stored);
-  if (!success) {
-    _mc_client_pool->Push(mc_client);
-    LOG(error) << "Cannot store text of request " << req_id;
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-    se.message = "Cannot store text of request " + std::to_string(req_id);
-    throw se;
-  } else if (!stored) {
-    // Another thread has uploaded text, which is an unexpected behaviour.
-    LOG(warning) << "text of request " << req_id
-                 << " has already been stored";
-    std::string counter_value_str;
-    success = mc_client->Get(key_counter, &found, &counter_value_str, &flags);
-    if (!success || !found) {
-      _mc_client_pool->Push(mc_client);
-      LOG(error) << "Cannot get the counter of request " << req_id;
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-      se.message = "Cannot get the counter of request " + std::to_string(req_id);
-      throw se;
-    }
-    counter_value = std::stoul(counter_value_str);
-  } else {
-    // Atomically increment and get the counter value
-    success = mc_client->Incr(key_counter, 1, &counter_value);
-    if (!success) {
-      _mc_client_pool->Push(mc_client);
-      LOG(error) << "Cannot increment and get the counter of request "
-          << req_id;
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-      se.message =  "Cannot increment and get the counter of request " + std::to_string(req_id);
-      throw se;
-    }
-  }
-  LOG(debug) << "req_id " << req_id << "caching text to Memcached finished";
-  _mc_client_pool->Push(mc_client);
-
-  // If this thread is the last one uploading the review components,
-  // it is in charge of compose the request and upload to the microservices in
-  // the next tier.
-  if (counter_value == NUM_COMPONENTS) {
-    _ComposeAndUpload(req_id, writer_text_map);
-  }
-  span->Finish();
+  span.Finish();
 }
 
 void ComposeReviewHandler::UploadRating(
     int64_t req_id, int32_t rating, const std::map<std::string, std::string> & carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UploadRating",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
-
-  std::string key_counter = std::to_string(req_id) + ":counter";
-  auto mc_client = _mc_client_pool->Pop();
-  if (!mc_client) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-    se.message = "Failed to pop a client from memcached pool";
-    throw se;
-  }
-
-  bool stored, found;
-  uint32_t flags;
-  // Initialize the counter to 0 if there it is not in the memcached
-  bool success = mc_client->Add(key_counter, "0", 0, MMC_EXP_TIME, &stored);
-
-  // error if it cannot be stored
-  if (!success) {
-    _mc_client_pool->Push(mc_client);
-    LOG(error) << "Failed to initilize the counter for request " << req_id;
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-    se.message = "Failed to initilize the counter for request " + std::to_string(req_id);
-    throw se;
-  }
-
-  // Store rating to memcached
-  uint64_t counter_value;
-  std::string key_rating = std::to_string(req_id) + ":rating";
-  std::string rating_str = std::to_string(rating);
-  success = mc_client->Add(key_rating, rating_str, 0, MMC_EXP_TIME, &stored);
-  if (!success) {
-    _mc_client_pool->Push(mc_client);
-    LOG(error) << "Cannot store rating of request " << req_id;
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-    se.message = "Cannot store rating of request " + std::to_string(req_id);
-    throw se;
-  } else if (!stored) {
-    // Another thread has uploaded rating, which is an unexpected behaviour.
-    LOG(warning) << "rating of request " << req_id
-                 << " has already been stored";
-    std::string counter_value_str;
-    success = mc_client->Get(key_counter, &found, &counter_value_str, &flags);
-    if (!success || !found) {
-      _mc_client_pool->Push(mc_client);
-      LOG(error) << "Cannot get the counter of request " << req_id;
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-      se.message = "Cannot get the counter of request " + std::to_string(req_id);
-      throw se;
-    }
-    counter_value = std::stoul(counter_value_str);
-  } else {
-    // Atomically increment and get the counter value
-    success = mc_client->Incr(key_counter, 1, &counter_value);
-    if (!success) {
-      _mc_client_pool->Push(mc_client);
-      LOG(error) << "Cannot increment and get the counter of request "
-          << req_id;
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-      se.message =  "Cannot increment and get the counter of request " + std::to_string(req_id);
-      throw se;
-    }
-  }
-  LOG(debug) << "req_id " << req_id << " caching rating to Memcached finished";
-  _mc_client_pool->Push(mc_client);
+  RequestSpan span("UploadRating", carrier, req_id);
 
-  // If this thread is the last one uploading the review components,
-  // it is in charge of compose the request and upload to the microservices in
-  // the next tier.
-  if (counter_value == NUM_COMPONENTS) {
-    _ComposeAndUpload(req_id, writer_text_map);
+  if (_UploadComponent(req_id, "rating", std::to_string(rating)) ==
+      NUM_COMPONENTS) {
+    _ComposeAndUpload(req_id, span.carrier());
   }
-  span->Finish();
+  span.Finish();
 }
 
 } // namespace media_service
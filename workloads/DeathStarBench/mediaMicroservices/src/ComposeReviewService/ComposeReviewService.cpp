@@ -20,6 +20,8 @@ int faas_init() {
 
   std::string mc_addr = config_json["compose-review-memcached"]["addr"];
   int mc_port = config_json["compose-review-memcached"]["port"];
+  MCClient::SharedConnections() =
+      config_json["compose-review-memcached"].value("shared_connections", 0);
   mc_client_pool = new ClientPool<MCClient>("compose-review-memcached", mc_addr, mc_port, 1, 128, 1000);
 
     return 0;
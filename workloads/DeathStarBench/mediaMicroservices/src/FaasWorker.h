@@ -1,9 +1,13 @@
 #ifndef SOCIAL_NETWORK_MICROSERVICES_FAAS_WORKER_H
 #define SOCIAL_NETWORK_MICROSERVICES_FAAS_WORKER_H
 
+#include <cstdint>
+#include <cstring>
 #include <memory>
+#include <mutex>
 
 #include "./faas/worker_v1_interface.h"
+#include "probes.h"
 
 #include <thrift/TProcessor.h>
 #include <thrift/transport/TVirtualTransport.h>
@@ -37,6 +41,82 @@ public:
             fprintf(stderr, "Processor is not set!\n");
             return false;
         }
+        int64_t req_id = 0;
+        char method[kMaxProbeMethodLength + 1] = "";
+        PeekCall(input, input_length, &req_id, method);
+        PROBE2(faas__process__start, req_id, method);
+        bool ok = ProcessInput(input, input_length);
+        PROBE3(faas__process__done, req_id, method, ok);
+        return ok;
+    }
+
+    template<class ClientType>
+    std::shared_ptr<ClientType> CreateClient(const std::string& func_name) {
+        std::shared_ptr<apache::thrift::transport::TTransport> transport(
+            new ClientTransport(this, func_name));
+        return std::make_shared<ClientType>(client_protocol_factory_->getProtocol(transport));
+    }
+
+private:
+    static constexpr size_t kMaxProbeMethodLength = 63;
+
+    // Reads the method name of a Thrift binary call and its field 1, the
+    // req_id of every method of the services, for the probes. Leaves them
+    // empty and 0 on input it cannot read; a longer name is cut short.
+    static void PeekCall(const char* input, size_t input_length,
+                         int64_t* req_id, char* method) {
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(input);
+        const uint8_t* end = data + input_length;
+        auto read_i32 = [&data, end](int32_t* value) {
+            if (end - data < 4) {
+                return false;
+            }
+            *value = static_cast<int32_t>(
+                (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) |
+                (uint32_t(data[2]) << 8) | uint32_t(data[3]));
+            data += 4;
+            return true;
+        };
+        // "strict" header: version and type, name, seqid; old header: name,
+        // type byte, seqid
+        int32_t word;
+        if (!read_i32(&word)) {
+            return;
+        }
+        bool strict = word < 0;
+        int32_t name_length = word;
+        if (strict && !read_i32(&name_length)) {
+            return;
+        }
+        if (name_length < 0 || end - data < name_length + (strict ? 0 : 1)) {
+            return;
+        }
+        size_t copy_length = static_cast<size_t>(name_length);
+        if (copy_length > kMaxProbeMethodLength) {
+            copy_length = kMaxProbeMethodLength;
+        }
+        memcpy(method, data, copy_length);
+        method[copy_length] = '\0';
+        data += name_length + (strict ? 0 : 1);
+        int32_t seqid;
+        if (!read_i32(&seqid)) {
+            return;
+        }
+        // the args struct: field type T_I64, field id 1, value
+        if (end - data < 11 || data[0] != apache::thrift::protocol::T_I64 ||
+            data[1] != 0 || data[2] != 1) {
+            return;
+        }
+        data += 3;
+        int32_t high;
+        int32_t low;
+        read_i32(&high);
+        read_i32(&low);
+        *req_id = static_cast<int64_t>(
+            (uint64_t(uint32_t(high)) << 32) | uint32_t(low));
+    }
+
+    bool ProcessInput(const char* input, size_t input_length) {
         in_transport_->resetBuffer(reinterpret_cast<uint8_t*>(const_cast<char*>(input)),
                                    static_cast<uint32_t>(input_length));
         try {
@@ -52,14 +132,6 @@ public:
         return true;
     }
 
-    template<class ClientType>
-    std::shared_ptr<ClientType> CreateClient(const std::string& func_name) {
-        std::shared_ptr<apache::thrift::transport::TTransport> transport(
-            new ClientTransport(this, func_name));
-        return std::make_shared<ClientType>(client_protocol_factory_->getProtocol(transport));
-    }
-
-private:
     class WorkerOutputTransport : public apache::thrift::transport::TVirtualTransport<WorkerOutputTransport> {
     public:
         explicit WorkerOutputTransport(FaasWorker* parent) : parent_(parent) {}
@@ -91,22 +163,30 @@ private:
             return in_buf_.readAll(buf, len);
         }
 
+        // invoke_func_fn is not thread-safe for one worker. FanOut keeps
+        // calls through a worker inline (ClientPool::CallsOverlap()), and
+        // any other thread that flushes here is serialized with the worker's
+        // own; the output is copied before the next call reuses its buffer.
         void flush() override {
             uint8_t* data;
             uint32_t data_length;
             out_buf_.getBuffer(&data, &data_length);
-            const char* output;
-            size_t output_length;
-            if (parent_->invoke_func_fn_(parent_->caller_context_, func_name_.c_str(),
-                                         reinterpret_cast<const char*>(data),
-                                         static_cast<size_t>(data_length),
-                                         &output, &output_length) != 0) {
-                throw apache::thrift::transport::TTransportException(
-                    apache::thrift::transport::TTransportException::UNKNOWN, "invoke_func call failed");
+            {
+                std::lock_guard<std::mutex> lock(parent_->invoke_mutex_);
+                const char* output;
+                size_t output_length;
+                if (parent_->invoke_func_fn_(parent_->caller_context_, func_name_.c_str(),
+                                             reinterpret_cast<const char*>(data),
+                                             static_cast<size_t>(data_length),
+                                             &output, &output_length) != 0) {
+                    throw apache::thrift::transport::TTransportException(
+                        apache::thrift::transport::TTransportException::UNKNOWN, "invoke_func call failed");
+                }
+                in_buf_.resetBuffer(reinterpret_cast<uint8_t*>(const_cast<char*>(output)),
+                                    static_cast<uint32_t>(output_length),
+                                    apache::thrift::transport::TMemoryBuffer::COPY);
             }
             out_buf_.resetBuffer();
-            in_buf_.resetBuffer(reinterpret_cast<uint8_t*>(const_cast<char*>(output)),
-                                static_cast<uint32_t>(output_length));
         }
 
     private:
@@ -119,6 +199,7 @@ private:
     void* caller_context_;
     faas_invoke_func_fn_t invoke_func_fn_;
     faas_append_output_fn_t append_output_fn_;
+    std::mutex invoke_mutex_;
 
     std::shared_ptr<apache::thrift::TProcessor> processor_;
     std::shared_ptr<apache::thrift::transport::TMemoryBuffer> in_transport_;
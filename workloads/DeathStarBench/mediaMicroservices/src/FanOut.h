@@ -0,0 +1,227 @@
+#ifndef MEDIA_MICROSERVICES_FANOUT_H
+#define MEDIA_MICROSERVICES_FANOUT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "logger.h"
+#include "probes.h"
+
+namespace media_service {
+
+namespace fan_out_detail {
+
+struct Group;
+
+struct Task {
+  std::function<void()> fn;
+  std::atomic<bool> claimed{false};
+  std::exception_ptr error;
+  int64_t req_id;
+  const char *method;
+  Group *group;
+};
+
+// The tasks of one FanOut, counted down as they finish
+struct Group {
+  std::mutex mutex;
+  std::condition_variable cv;
+  int num_running = 0;
+};
+
+// Runs `task` unless another thread already claimed it.
+bool RunTask(Task *task) {
+  if (task->claimed.exchange(true)) {
+    return false;
+  }
+  int64_t saved_req_id = probes_detail::current_req_id;
+  const char *saved_method = probes_detail::current_method;
+  probes_detail::current_req_id = task->req_id;
+  probes_detail::current_method = task->method;
+  try {
+    task->fn();
+  } catch (...) {
+    task->error = std::current_exception();
+  }
+  probes_detail::current_req_id = saved_req_id;
+  probes_detail::current_method = saved_method;
+  std::lock_guard<std::mutex> lock(task->group->mutex);
+  if (--task->group->num_running == 0) {
+    task->group->cv.notify_all();
+  }
+  return true;
+}
+
+} // namespace fan_out_detail
+
+// Fixed set of threads shared by every handler of the process, with a
+// bounded queue. Not started unless SetUpFanOut() asks for threads.
+class FanOutExecutor {
+ public:
+  static FanOutExecutor *Get() { return _instance; }
+
+  // Queues `task`, false if the queue is full.
+  bool TrySubmit(std::shared_ptr<fan_out_detail::Task> task);
+
+ private:
+  friend void SetUpFanOut(int, int);
+
+  FanOutExecutor(int num_threads, int max_queued);
+  void WorkerLoop();
+
+  static FanOutExecutor *_instance;
+
+  size_t _max_queued;
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::deque<std::shared_ptr<fan_out_detail::Task>> _queue;
+};
+
+FanOutExecutor *FanOutExecutor::_instance = nullptr;
+
+FanOutExecutor::FanOutExecutor(int num_threads, int max_queued)
+    : _max_queued(max_queued) {
+  for (int i = 0; i < num_threads; i++) {
+    std::thread(&FanOutExecutor::WorkerLoop, this).detach();
+  }
+}
+
+bool FanOutExecutor::TrySubmit(std::shared_ptr<fan_out_detail::Task> task) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_queue.size() >= _max_queued) {
+      return false;
+    }
+    _queue.emplace_back(std::move(task));
+  }
+  _cv.notify_one();
+  return true;
+}
+
+void FanOutExecutor::WorkerLoop() {
+  while (true) {
+    std::shared_ptr<fan_out_detail::Task> task;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _cv.wait(lock, [this] { return !_queue.empty(); });
+      task = std::move(_queue.front());
+      _queue.pop_front();
+    }
+    fan_out_detail::RunTask(task.get());
+  }
+}
+
+// Starts the executor with `num_threads` threads (0 leaves fan-out off) and
+// room for `max_queued` waiting tasks. Call once from the service's init.
+void SetUpFanOut(int num_threads, int max_queued) {
+  if (num_threads <= 0 || FanOutExecutor::_instance != nullptr) {
+    return;
+  }
+  if (max_queued <= 0) {
+    max_queued = 4 * num_threads;
+  }
+  LOG(info) << "Fan-out executor: " << num_threads << " threads, "
+            << max_queued << " queued tasks";
+  FanOutExecutor::_instance = new FanOutExecutor(num_threads, max_queued);
+}
+
+// Independent downstream calls of one request, run in parallel:
+//
+//   FanOut fan_out;
+//   fan_out.Add([&] { ...call the first service... });
+//   fan_out.Add([&] { ...call the second service... });
+//   fan_out.Join();
+//
+// Tasks go to the FanOutExecutor. Without one, Add() runs the task right
+// away on the calling thread and lets its exception through, exactly like
+// the sequential code. When the queue is full or no executor thread has
+// picked a task up by the time the caller gets to Join(), the caller runs it
+// itself, so nested or saturated fan-outs cannot deadlock. Each task holds
+// its own pooled client for the call.
+//
+// A FaasWorker runs one invoke at a time, so calls on a pool that invokes
+// through it cannot overlap: fan-outs of such calls are built with
+// `parallel` false (see ClientPool::CallsOverlap()) and run inline.
+// fanout_threads therefore only speeds up socket-mode pools
+// (THRIFT_FORCE_NORMAL_CLIENT=1) and MongoDB/Redis work; under FaaS it is a
+// no-op for RPC fan-outs.
+class FanOut {
+ public:
+  explicit FanOut(bool parallel = true)
+      : _executor(parallel ? FanOutExecutor::Get() : nullptr) {}
+  ~FanOut();
+
+  FanOut(const FanOut &) = delete;
+  FanOut &operator=(const FanOut &) = delete;
+
+  template<class Fn>
+  void Add(Fn &&fn);
+
+  // Waits for every task added so far and rethrows the exception of the
+  // first one that failed, in the order they were added.
+  void Join();
+
+ private:
+  void Wait() noexcept;
+
+  FanOutExecutor *_executor;
+  fan_out_detail::Group _group;
+  std::vector<std::shared_ptr<fan_out_detail::Task>> _tasks;
+};
+
+template<class Fn>
+void FanOut::Add(Fn &&fn) {
+  if (_executor == nullptr) {
+    fn();
+    return;
+  }
+  auto task = std::make_shared<fan_out_detail::Task>();
+  task->fn = std::forward<Fn>(fn);
+  task->req_id = probes_detail::current_req_id;
+  task->method = probes_detail::current_method;
+  task->group = &_group;
+  {
+    std::lock_guard<std::mutex> lock(_group.mutex);
+    _group.num_running++;
+  }
+  _tasks.push_back(task);
+  if (!_executor->TrySubmit(task)) {
+    fan_out_detail::RunTask(task.get());
+  }
+}
+
+void FanOut::Wait() noexcept {
+  // Run what the executor has not started yet, in order
+  for (auto &task : _tasks) {
+    fan_out_detail::RunTask(task.get());
+  }
+  std::unique_lock<std::mutex> lock(_group.mutex);
+  _group.cv.wait(lock, [this] { return _group.num_running == 0; });
+}
+
+void FanOut::Join() {
+  Wait();
+  auto tasks = std::move(_tasks);
+  _tasks.clear();
+  for (auto &task : tasks) {
+    if (task->error) {
+      std::rethrow_exception(task->error);
+    }
+  }
+}
+
+FanOut::~FanOut() {
+  // Tasks hold references into the caller's frame, never leave them running
+  Wait();
+}
+
+} // namespace media_service
+
+#endif //MEDIA_MICROSERVICES_FANOUT_H
@@ -1,10 +1,17 @@
 #ifndef MEDIA_MICROSERVICES_MCCLIENT_H
 #define MEDIA_MICROSERVICES_MCCLIENT_H
 
+#include <chrono>
+#include <map>
 #include <string>
+#include <thread>
+#include <vector>
+
+#include <opentracing/string_view.h>
 
 #include "logger.h"
 #include "GenericClient.h"
+#include "SharedMCClient.h"
 #include "../libmc/include/c_client.h"
 
 namespace media_service {
@@ -25,13 +32,67 @@ class MCClient : public GenericClient {
   void KeepAlive(int timeout_ms) override ;
   bool IsConnected() override ;
 
+  // Values of at least this many bytes are stored LZ4-compressed by libmc
+  // (0, the default, turns it off). Read by Connect(), so set it before the
+  // client pool is created. Compressed values are read back transparently.
+  static int& CompressThreshold();
+
+  // Connections to each server shared by all MCClients of the process, which
+  // then only hold a handle on a SharedMCClient (0, the default, gives every
+  // MCClient its own). Read by Connect(), like CompressThreshold().
+  static int& SharedConnections();
+
   bool Get(const std::string& key, bool* found, std::string* value, uint32_t* flags);
+  // Zero-copy Get: `value` points into this client's receive buffer (or a
+  // buffer of its own with shared connections) and stays valid until the
+  // next call on this MCClient, i.e. use it before pushing the client back.
+  bool Get(const std::string& key, bool* found, opentracing::string_view* value,
+           uint32_t* flags);
   bool Set(const std::string& key, const std::string& value, uint32_t flags, int64_t exptime);
+  bool MultiGet(const std::vector<std::string>& keys, std::map<std::string, std::string>* values);
+  bool MultiSet(const std::map<std::string, std::string>& items, uint32_t flags, int64_t exptime);
   bool Add(const std::string& key, const std::string& value, uint32_t flags, int64_t exptime, bool* stored);
   bool Incr(const std::string& key, uint64_t delta, uint64_t* value);
+  bool IncrOrInit(const std::string& key, uint64_t delta, uint64_t initial,
+                  int64_t exptime, uint64_t* value);
+  // Get that leases a missing key to one caller (won), which should read the
+  // database and Set() the key. Other callers of a missing key wait for that
+  // Set() for a few ms, then get found == won == false and read the
+  // database without refilling.
+  bool GetOrLease(const std::string& key, int64_t lease_ttl, bool* found,
+                  std::string* value, uint32_t* flags, bool* won);
   bool Delete(const std::string& key);
 
  private:
+  class LeasedClient;
+
+  void ReleaseResults();
+
+  void* _client;
+  SharedMCClient* _shared;
+  bool _results_held;  // the results behind the last string_view Get
+  std::string _view_buffer;
+};
+
+// The libmc client an operation runs on: this MCClient's own, or an idle
+// lane of its SharedMCClient for the duration of the operation. Starting an
+// operation ends the views handed out by the previous one.
+class MCClient::LeasedClient {
+ public:
+  explicit LeasedClient(MCClient* mc_client)
+      : _shared(mc_client->_shared),
+        _client(_shared != nullptr ? _shared->AcquireLane() : mc_client->_client) {
+    mc_client->ReleaseResults();
+  }
+  ~LeasedClient() {
+    if (_shared != nullptr) {
+      _shared->ReleaseLane(_client);
+    }
+  }
+  void* get() const { return _client; }
+
+ private:
+  SharedMCClient* _shared;
   void* _client;
 };
 
@@ -41,30 +102,50 @@ MCClient::MCClient(const std::string &addr, int port,
   _port = port;
   _client_id = client_id;
   _client = nullptr;
+  _shared = nullptr;
+  _results_held = false;
 }
 
 MCClient::~MCClient() {
   Disconnect();
 }
 
+int& MCClient::CompressThreshold() {
+  static int threshold = 0;
+  return threshold;
+}
+
+int& MCClient::SharedConnections() {
+  static int num_connections = 0;
+  return num_connections;
+}
+
 void MCClient::Connect() {
+  if (!IsConnected() && SharedConnections() > 0) {
+    _shared = SharedMCClient::Attach(_addr, _port, SharedConnections(), CompressThreshold());
+  }
   if (!IsConnected()) {
     _client = client_create();
     const char* host = _addr.c_str();
     uint32_t port = _port;
     client_init(_client, &host, &port, 1, nullptr, 0);
+    if (CompressThreshold() > 0) {
+      client_config(_client, CFG_COMPRESS_THRESHOLD, CompressThreshold());
+    }
   }
 }
 
 void MCClient::Disconnect() {
-  if (IsConnected()) {
+  ReleaseResults();
+  if (_client != nullptr) {
     client_destroy(_client);
     _client = nullptr;
   }
+  _shared = nullptr;
 }
 
 bool MCClient::IsConnected() {
-  return _client != nullptr;
+  return _client != nullptr || _shared != nullptr;
 }
 
 void MCClient::KeepAlive() {
@@ -76,11 +157,15 @@ void MCClient::KeepAlive(int timeout_ms) {
 }
 
 bool MCClient::Get(const std::string& key, bool* found, std::string* value, uint32_t* flags) {
+  if (_shared != nullptr) {
+    return _shared->Get(key, found, value, flags);
+  }
   const char* key_ptr = key.data();
   const size_t key_len = key.size();
   retrieval_result_t** results = nullptr;
   size_t n_results = 0;
-  err_code_t err = client_get(_client, &key_ptr, &key_len, 1, &results, &n_results);
+  LeasedClient client(this);
+  err_code_t err = client_get(client.get(), &key_ptr, &key_len, 1, &results, &n_results);
   bool ret = true;
   if (err != RET_OK) {
     ret = false;
@@ -93,10 +178,49 @@ bool MCClient::Get(const std::string& key, bool* found, std::string* value, uint
       *flags = results[0]->flags;
     }
   }
-  client_destroy_retrieval_result(_client);
+  client_destroy_retrieval_result(client.get());
   return ret;
 }
 
+bool MCClient::Get(const std::string& key, bool* found, opentracing::string_view* value,
+                   uint32_t* flags) {
+  if (_shared != nullptr) {
+    // the lane goes back to other callers, so this one has to copy
+    if (!_shared->Get(key, found, &_view_buffer, flags)) {
+      return false;
+    }
+    *value = *found ? opentracing::string_view(_view_buffer) : opentracing::string_view();
+    return true;
+  }
+  const char* key_ptr = key.data();
+  const size_t key_len = key.size();
+  retrieval_result_t** results = nullptr;
+  size_t n_results = 0;
+  LeasedClient client(this);
+  err_code_t err = client_get(client.get(), &key_ptr, &key_len, 1, &results, &n_results);
+  if (err != RET_OK) {
+    client_destroy_retrieval_result(client.get());
+    return false;
+  }
+  *found = n_results > 0;
+  if (*found) {
+    *value = opentracing::string_view(results[0]->data_block, results[0]->bytes);
+    *flags = results[0]->flags;
+  } else {
+    *value = opentracing::string_view();
+  }
+  // kept until the next operation, see ReleaseResults()
+  _results_held = true;
+  return true;
+}
+
+void MCClient::ReleaseResults() {
+  if (_results_held) {
+    client_destroy_retrieval_result(_client);
+    _results_held = false;
+  }
+}
+
 bool MCClient::Set(const std::string& key, const std::string& value, uint32_t flags, int64_t exptime) {
   const char* key_ptr = key.data();
   const size_t key_len = key.size();
@@ -104,7 +228,8 @@ bool MCClient::Set(const std::string& key, const std::string& value, uint32_t fl
   const size_t value_len = value.size();
   message_result_t** results = nullptr;
   size_t n_results = 0;
-  err_code_t err = client_set(_client, &key_ptr, &key_len, &flags, exptime, nullptr, false,
+  LeasedClient client(this);
+  err_code_t err = client_set(client.get(), &key_ptr, &key_len, &flags, exptime, nullptr, false,
                               &value_ptr, &value_len, 1, &results, &n_results);
   bool ret = true;
   if (err != RET_OK || n_results == 0) {
@@ -112,7 +237,78 @@ bool MCClient::Set(const std::string& key, const std::string& value, uint32_t fl
   } else {
     if (results[0]->type_ != MSG_STORED) ret = false;
   }
-  client_destroy_message_result(_client);
+  client_destroy_message_result(client.get());
+  return ret;
+}
+
+bool MCClient::MultiGet(const std::vector<std::string>& keys,
+                        std::map<std::string, std::string>* values) {
+  // A single client_get over all keys lets libmc batch them into one
+  // "get k1 k2 ..." per server and poll all servers in parallel.
+  size_t n_keys = keys.size();
+  if (n_keys == 0) {
+    return true;
+  }
+  std::vector<const char*> key_ptrs(n_keys);
+  std::vector<size_t> key_lens(n_keys);
+  for (size_t i = 0; i < n_keys; i++) {
+    key_ptrs[i] = keys[i].data();
+    key_lens[i] = keys[i].size();
+  }
+  retrieval_result_t** results = nullptr;
+  size_t n_results = 0;
+  LeasedClient client(this);
+  err_code_t err = client_get(client.get(), key_ptrs.data(), key_lens.data(), n_keys,
+                              &results, &n_results);
+  bool ret = true;
+  if (err != RET_OK) {
+    ret = false;
+  } else {
+    for (size_t i = 0; i < n_results; i++) {
+      values->emplace(std::string(results[i]->key, results[i]->key_len),
+                      std::string(results[i]->data_block, results[i]->bytes));
+    }
+  }
+  client_destroy_retrieval_result(client.get());
+  return ret;
+}
+
+bool MCClient::MultiSet(const std::map<std::string, std::string>& items,
+                        uint32_t flags, int64_t exptime) {
+  size_t n_items = items.size();
+  if (n_items == 0) {
+    return true;
+  }
+  std::vector<const char*> key_ptrs;
+  std::vector<size_t> key_lens;
+  std::vector<const char*> value_ptrs;
+  std::vector<size_t> value_lens;
+  key_ptrs.reserve(n_items);
+  key_lens.reserve(n_items);
+  value_ptrs.reserve(n_items);
+  value_lens.reserve(n_items);
+  for (auto &item : items) {
+    key_ptrs.push_back(item.first.data());
+    key_lens.push_back(item.first.size());
+    value_ptrs.push_back(item.second.data());
+    value_lens.push_back(item.second.size());
+  }
+  std::vector<flags_t> flags_list(n_items, flags);
+  message_result_t** results = nullptr;
+  size_t n_results = 0;
+  LeasedClient client(this);
+  err_code_t err = client_set(client.get(), key_ptrs.data(), key_lens.data(), flags_list.data(),
+                              exptime, nullptr, false, value_ptrs.data(), value_lens.data(),
+                              n_items, &results, &n_results);
+  bool ret = true;
+  if (err != RET_OK || n_results != n_items) {
+    ret = false;
+  } else {
+    for (size_t i = 0; i < n_results; i++) {
+      if (results[i]->type_ != MSG_STORED) ret = false;
+    }
+  }
+  client_destroy_message_result(client.get());
   return ret;
 }
 
@@ -123,7 +319,8 @@ bool MCClient::Add(const std::string& key, const std::string& value, uint32_t fl
   const size_t value_len = value.size();
   message_result_t** results = nullptr;
   size_t n_results = 0;
-  err_code_t err = client_add(_client, &key_ptr, &key_len, &flags, exptime, nullptr, false,
+  LeasedClient client(this);
+  err_code_t err = client_add(client.get(), &key_ptr, &key_len, &flags, exptime, nullptr, false,
                               &value_ptr, &value_len, 1, &results, &n_results);
   bool ret = true;
   if (err != RET_OK || n_results == 0) {
@@ -137,7 +334,7 @@ bool MCClient::Add(const std::string& key, const std::string& value, uint32_t fl
       ret = false;
     }
   }
-  client_destroy_message_result(_client);
+  client_destroy_message_result(client.get());
   return ret;
 }
 
@@ -146,14 +343,15 @@ bool MCClient::Incr(const std::string& key, uint64_t delta, uint64_t* value) {
   const size_t key_len = key.size();
   unsigned_result_t* results = nullptr;
   size_t n_results = 0;
-  err_code_t err = client_incr(_client, key_ptr, key_len, delta, false, &results, &n_results);
+  LeasedClient client(this);
+  err_code_t err = client_incr(client.get(), key_ptr, key_len, delta, false, &results, &n_results);
   bool ret = true;
   if (err != RET_OK || n_results == 0) {
     ret = false;
   } else {
     *value = results->value;
   }
-  client_destroy_message_result(_client);
+  client_destroy_message_result(client.get());
   return ret;
 }
 
@@ -162,17 +360,77 @@ bool MCClient::Delete(const std::string& key) {
   const size_t key_len = key.size();
   message_result_t** results = nullptr;
   size_t n_results = 0;
-  err_code_t err = client_delete(_client, &key_ptr, &key_len, false, 1, &results, &n_results);
+  LeasedClient client(this);
+  err_code_t err = client_delete(client.get(), &key_ptr, &key_len, false, 1, &results, &n_results);
   bool ret = true;
   if (err != RET_OK || n_results == 0) {
     ret = false;
   } else if (results[0]->type_ != MSG_DELETED && results[0]->type_ != MSG_NOT_FOUND) {
     ret = false;
   }
-  client_destroy_retrieval_result(_client);
+  client_destroy_retrieval_result(client.get());
   return ret;
 }
 
+bool MCClient::IncrOrInit(const std::string& key, uint64_t delta, uint64_t initial,
+                          int64_t exptime, uint64_t* value) {
+  // Meta arithmetic with vivify: a missing counter is created as initial
+  // (without applying delta) in the same round trip.
+  const char* key_ptr = key.data();
+  const size_t key_len = key.size();
+  meta_result_t** results = nullptr;
+  size_t n_results = 0;
+  LeasedClient client(this);
+  err_code_t err = client_meta_arithmetic(client.get(), &key_ptr, &key_len, 1, delta, initial,
+                                          META_VIVIFY | META_RETURN_VALUE, exptime,
+                                          &results, &n_results);
+  bool ret = true;
+  if (err != RET_OK || n_results == 0 || results[0]->type_ != META_VA) {
+    ret = false;
+  } else {
+    *value = std::stoull(std::string(results[0]->data_block, results[0]->bytes));
+  }
+  client_destroy_meta_result(client.get());
+  return ret;
+}
+
+bool MCClient::GetOrLease(const std::string& key, int64_t lease_ttl, bool* found,
+                          std::string* value, uint32_t* flags, bool* won) {
+  // Meta get with vivify-on-miss: a miss creates an empty placeholder for
+  // lease_ttl seconds and only the first caller gets won == true, so only
+  // one request refills the key from the database. The others wait a little
+  // for that refill before they give up and read the database themselves.
+  const int kLeaseWaitAttempts = 10;
+  const int kLeaseWaitUs = 500;
+  const char* key_ptr = key.data();
+  const size_t key_len = key.size();
+  for (int attempt = 0;; attempt++) {
+    meta_result_t** results = nullptr;
+    size_t n_results = 0;
+    {
+      LeasedClient client(this);
+      err_code_t err = client_meta_get(client.get(), &key_ptr, &key_len, 1,
+                                       META_RETURN_VALUE | META_RETURN_FLAGS | META_VIVIFY,
+                                       lease_ttl, &results, &n_results);
+      if (err != RET_OK || n_results == 0) {
+        client_destroy_meta_result(client.get());
+        return false;
+      }
+      *won = results[0]->won;
+      *found = results[0]->type_ == META_VA && !results[0]->won && !results[0]->win_sent;
+      if (*found) {
+        value->assign(results[0]->data_block, results[0]->bytes);
+        *flags = results[0]->flags;
+      }
+      client_destroy_meta_result(client.get());
+    }
+    if (*found || *won || attempt == kLeaseWaitAttempts) {
+      return true;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(kLeaseWaitUs));
+  }
+}
+
 } // media_service
 
 #endif //MEDIA_MICROSERVICES_MCCLIENT_H
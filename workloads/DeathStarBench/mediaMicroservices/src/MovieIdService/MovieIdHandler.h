@@ -15,10 +15,14 @@
 #include "../ThriftClient.h"
 #include "../logger.h"
 #include "../tracing.h"
+#include "../utils_mongodb.h"
 
 
 namespace media_service {
 
+// Seconds a request that missed has to refill a movie id before another may
+#define MOVIE_ID_LEASE_TTL 3
+
 static const std::string base64_chars = 
              "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
              "abcdefghijklmnopqrstuvwxyz"
@@ -113,14 +117,7 @@ void MovieIdHandler::UploadMovieId(
     const std::map<std::string, std::string> & carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UploadMovieId",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("UploadMovieId", carrier, req_id);
 
   auto mc_client = _mc_client_pool->Pop();
   if (!mc_client) {
@@ -134,12 +131,13 @@ void MovieIdHandler::UploadMovieId(
   uint32_t memcached_flags;
   // Look for the movie id from memcached
 
-  auto get_span = opentracing::Tracer::Global()->StartSpan(
-      "MmcGetMovieId", { opentracing::ChildOf(&span->context()) });
+  auto get_span = span.StartSpan("MmcGetMovieId");
   
-  bool found;
+  bool found, won;
   std::string movie_id_mmc;
-  bool success = mc_client->Get(base64_encode(title), &found, &movie_id_mmc, &memcached_flags);
+  // on a miss only the request that wins the lease refills the movie id
+  bool success = mc_client->GetOrLease(base64_encode(title), MOVIE_ID_LEASE_TTL,
+                                       &found, &movie_id_mmc, &memcached_flags, &won);
 
   if (!success) {
     _mc_client_pool->Push(mc_client);
@@ -149,7 +147,7 @@ void MovieIdHandler::UploadMovieId(
     LOG(error) << "Failed to get movie_id from memcached";
     throw se;
   }
-  get_span->Finish();
+  get_span.Finish();
   _mc_client_pool->Push(mc_client);
   std::string movie_id_str;
 
@@ -162,35 +160,18 @@ void MovieIdHandler::UploadMovieId(
 
     // If not cached in memcached
   else {
-    mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-        _mongodb_client_pool);
-    if (!mongodb_client) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to pop a client from MongoDB pool";
-      throw se;
-    }
-    auto collection = mongoc_client_get_collection(
-        mongodb_client, "movie-id", "movie-id");
-
-    if (!collection) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to create collection user from DB movie-id";
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-      throw se;
-    }
+    MongoClientLease mongodb_client(_mongodb_client_pool);
+    auto collection = mongodb_client.Collection("movie-id", "movie-id");
 
     bson_t *query = bson_new();
     BSON_APPEND_UTF8(query, "title", title.c_str());
 
-    auto find_span = opentracing::Tracer::Global()->StartSpan(
-        "MongoFindMovieId", { opentracing::ChildOf(&span->context()) });
+    auto find_span = span.StartSpan("MongoFindMovieId");
     mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
         collection, query, nullptr, nullptr);
     const bson_t *doc;
     bool found = mongoc_cursor_next(cursor, &doc);
-    find_span->Finish();
+    find_span.Finish();
 
     if (found) {
       bson_iter_t iter;
@@ -201,8 +182,6 @@ void MovieIdHandler::UploadMovieId(
         LOG(error) << "Attribute movie_id is not find in MongoDB";
         bson_destroy(query);
         mongoc_cursor_destroy(cursor);
-        mongoc_collection_destroy(collection);
-        mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
         ServiceException se;
         se.errorCode = ErrorCode::SE_THRIFT_HANDLER_ERROR;
         se.message = "Attribute movie_id is not find in MongoDB";
@@ -212,8 +191,6 @@ void MovieIdHandler::UploadMovieId(
       LOG(error) << "Movie " << title << " is not found in MongoDB";
       bson_destroy(query);
       mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
       ServiceException se;
       se.errorCode = ErrorCode::SE_THRIFT_HANDLER_ERROR;
       se.message = "Movie " + title + " is not found in MongoDB";
@@ -221,14 +198,14 @@ void MovieIdHandler::UploadMovieId(
     }
     bson_destroy(query);
     mongoc_cursor_destroy(cursor);
-    mongoc_collection_destroy(collection);
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+    mongodb_client.Release();
   }
   
   // std::future<void> set_future;
   // std::future<void> movie_id_future;
   // std::future<void> rating_future;
   // set_future = std::async(std::launch::async, [&]() {
+  if (won) {
     mc_client = _mc_client_pool->Pop();
     if (!mc_client) {
       ServiceException se;
@@ -236,15 +213,15 @@ void MovieIdHandler::UploadMovieId(
       se.message = "Failed to pop a client from memcached pool";
       throw se;
     }
-    auto set_span = opentracing::Tracer::Global()->StartSpan(
-        "MmcSetMovieId", { opentracing::ChildOf(&span->context()) });
+    auto set_span = span.StartSpan("MmcSetMovieId");
     // Upload the movie id to memcached
     success = mc_client->Set(base64_encode(title), movie_id_str, 0, 0);
-    set_span->Finish();
+    set_span.Finish();
     if (!success) {
-      LOG(warning) << "Failed to set movie_id to Memcached";
+      LOG_EVERY_MS(warning, 1000) << "Failed to set movie_id to Memcached";
     }
     _mc_client_pool->Push(mc_client);
+  }
   // });
 
   // movie_id_future = std::async(std::launch::async, [&]() {
@@ -256,12 +233,16 @@ void MovieIdHandler::UploadMovieId(
       throw se;
     }
     auto compose_client = compose_client_wrapper->GetClient();
-    try {
-      compose_client->UploadMovieId(req_id, movie_id_str, writer_text_map);
-    } catch (...) {
-      _compose_client_pool->Remove(compose_client_wrapper);
-      LOG(error) << "Failed to upload movie_id to compose-review-service";
-      throw;
+    {
+      auto rpc_trace_guard = _compose_client_pool->StartRpcTrace("UploadMovieId", compose_client_wrapper);
+      try {
+        compose_client->UploadMovieId(req_id, movie_id_str, span.carrier());
+      } catch (...) {
+        rpc_trace_guard->set_status(1);
+        _compose_client_pool->Remove(compose_client_wrapper);
+        LOG(error) << "Failed to upload movie_id to compose-review-service";
+        throw;
+      }
     }
     _compose_client_pool->Push(compose_client_wrapper);
   // });
@@ -275,12 +256,16 @@ void MovieIdHandler::UploadMovieId(
       throw se;
     }
     auto rating_client = rating_client_wrapper->GetClient();
-    try {
-      rating_client->UploadRating(req_id, movie_id_str, rating, writer_text_map);
-    } catch (...) {
-      _rating_client_pool->Remove(rating_client_wrapper);
-      LOG(error) << "Failed to upload rating to rating-service";
-      throw;
+    {
+      auto rpc_trace_guard = _rating_client_pool->StartRpcTrace("UploadRating", rating_client_wrapper);
+      try {
+        rating_client->UploadRating(req_id, movie_id_str, rating, span.carrier());
+      } catch (...) {
+        rpc_trace_guard->set_status(1);
+        _rating_client_pool->Remove(rating_client_wrapper);
+        LOG(error) << "Failed to upload rating to rating-service";
+        throw;
+      }
     }
     _rating_client_pool->Push(rating_client_wrapper);
   // });
@@ -293,7 +278,7 @@ void MovieIdHandler::UploadMovieId(
   //   throw;
   // }
 
-  span->Finish();
+  span.Finish();
 }
 
 void MovieIdHandler::RegisterMovieId (
@@ -303,44 +288,21 @@ void MovieIdHandler::RegisterMovieId (
     const std::map<std::string, std::string> & carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "RegisterMovieId",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
-
-  mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-      _mongodb_client_pool);
-  if (!mongodb_client) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-    se.message = "Failed to pop a client from MongoDB pool";
-    throw se;
-  }
-  auto collection = mongoc_client_get_collection(
-      mongodb_client, "movie-id", "movie-id");
-  if (!collection) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-    se.message = "Failed to create collection movie_id from DB movie-id";
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-    throw se;
-  }
+  RequestSpan span("RegisterMovieId", carrier, req_id);
+
+  MongoClientLease mongodb_client(_mongodb_client_pool);
+  auto collection = mongodb_client.Collection("movie-id", "movie-id");
 
   // Check if the username has existed in the database
   bson_t *query = bson_new();
   BSON_APPEND_UTF8(query, "title", title.c_str());
 
-  auto find_span = opentracing::Tracer::Global()->StartSpan(
-      "MongoFindMovie", { opentracing::ChildOf(&span->context()) });
+  auto find_span = span.StartSpan("MongoFindMovie");
   mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
       collection, query, nullptr, nullptr);
   const bson_t *doc;
   bool found = mongoc_cursor_next(cursor, &doc);
-  find_span->Finish();
+  find_span.Finish();
 
   if (found) {
     LOG(warning) << "Movie "<< title << " already existed in MongoDB";
@@ -348,8 +310,6 @@ void MovieIdHandler::RegisterMovieId (
     se.errorCode = ErrorCode::SE_THRIFT_HANDLER_ERROR;
     se.message = "Movie " + title + " already existed in MongoDB";
     mongoc_cursor_destroy(cursor);
-    mongoc_collection_destroy(collection);
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
     throw se;
   } else {
     bson_t *new_doc = bson_new();
@@ -357,11 +317,10 @@ void MovieIdHandler::RegisterMovieId (
     BSON_APPEND_UTF8(new_doc, "movie_id", movie_id.c_str());
     bson_error_t error;
 
-    auto insert_span = opentracing::Tracer::Global()->StartSpan(
-        "MongoInsertMovie", { opentracing::ChildOf(&span->context()) });
+    auto insert_span = span.StartSpan("MongoInsertMovie");
     bool plotinsert = mongoc_collection_insert_one (
         collection, new_doc, nullptr, nullptr, &error);
-    insert_span->Finish();
+    insert_span.Finish();
 
     if (!plotinsert) {
       LOG(error) << "Failed to insert movie_id of " << title
@@ -371,17 +330,14 @@ void MovieIdHandler::RegisterMovieId (
       se.message = error.message;
       bson_destroy(new_doc);
       mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
       throw se;
     }
     bson_destroy(new_doc);
   }
   mongoc_cursor_destroy(cursor);
-  mongoc_collection_destroy(collection);
-  mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+  mongodb_client.Release();
 
-  span->Finish();
+  span.Finish();
 }
 } // namespace media_service
 
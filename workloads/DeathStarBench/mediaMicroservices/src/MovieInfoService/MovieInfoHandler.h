@@ -12,6 +12,7 @@
 #include "../logger.h"
 #include "../tracing.h"
 #include "../ClientPool.h"
+#include "../utils_mongodb.h"
 
 namespace media_service {
 using json = nlohmann::json;
@@ -62,14 +63,7 @@ void MovieInfoHandler::WriteMovieInfo(
     int32_t num_rating,
     const std::map<std::string, std::string> &carrier) {
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "WriteMovieInfo",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("WriteMovieInfo", carrier, req_id);
 
   bson_t *new_doc = bson_new();
   BSON_APPEND_UTF8(new_doc, "movie_id", movie_id.c_str());
@@ -125,29 +119,13 @@ void MovieInfoHandler::WriteMovieInfo(
   }
   bson_append_array_end(new_doc, &video_id_list);
 
-  mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-      _mongodb_client_pool);
-  if (!mongodb_client) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-    se.message = "Failed to pop a client from MongoDB pool";
-    throw se;
-  }
-  auto collection = mongoc_client_get_collection(
-      mongodb_client, "movie-info", "movie-info");
-  if (!collection) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-    se.message = "Failed to create collection movie-info from DB movie-info";
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-    throw se;
-  }
+  MongoClientLease mongodb_client(_mongodb_client_pool);
+  auto collection = mongodb_client.Collection("movie-info", "movie-info");
   bson_error_t error;
-  auto insert_span = opentracing::Tracer::Global()->StartSpan(
-      "MongoInsertMovieInfo", { opentracing::ChildOf(&span->context()) });
+  auto insert_span = span.StartSpan("MongoInsertMovieInfo");
   bool plotinsert = mongoc_collection_insert_one (
       collection, new_doc, nullptr, nullptr, &error);
-  insert_span->Finish();
+  insert_span.Finish();
   if (!plotinsert) {
     LOG(error) << "Error: Failed to insert movie-info to MongoDB: "
                << error.message;
@@ -155,16 +133,13 @@ void MovieInfoHandler::WriteMovieInfo(
     se.errorCode = ErrorCode::SE_MONGODB_ERROR;
     se.message = error.message;
     bson_destroy(new_doc);
-    mongoc_collection_destroy(collection);
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
     throw se;
   }
 
   bson_destroy(new_doc);
-  mongoc_collection_destroy(collection);
-  mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+  mongodb_client.Release();
 
-  span->Finish();
+  span.Finish();
 }
 
 void MovieInfoHandler::ReadMovieInfo(
@@ -174,14 +149,7 @@ void MovieInfoHandler::ReadMovieInfo(
     const std::map<std::string, std::string> &carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "ReadMovieInfo",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("ReadMovieInfo", carrier, req_id);
   
   auto mc_client = _mc_client_pool->Pop();
   if (!mc_client) {
@@ -192,9 +160,8 @@ void MovieInfoHandler::ReadMovieInfo(
   }
 
   uint32_t memcached_flags;
-  auto get_span = opentracing::Tracer::Global()->StartSpan(
-      "MmcGetMovieInfo", { opentracing::ChildOf(&span->context()) });
-  std::string movie_info_mmc;
+  auto get_span = span.StartSpan("MmcGetMovieInfo");
+  opentracing::string_view movie_info_mmc;
   bool found;
   bool success = mc_client->Get(movie_id, &found, &movie_info_mmc, &memcached_flags);
   if (!success) {
@@ -204,12 +171,24 @@ void MovieInfoHandler::ReadMovieInfo(
     se.message = "Failed to get movie_info from memcached";
     throw se;
   }
+  // movie_info_mmc points into mc_client's buffer: parse before pushing it back
+  json movie_info_json;
+  if (found) {
+    movie_info_json = json::parse(
+        movie_info_mmc.data(), movie_info_mmc.data() + movie_info_mmc.size(),
+        nullptr, false);
+  }
   _mc_client_pool->Push(mc_client);
-  get_span->Finish();
+  get_span.Finish();
 
+  if (found && movie_info_json.is_discarded()) {
+    ServiceException se;
+    se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
+    se.message = "Failed to parse movie_info from memcached";
+    throw se;
+  }
   if (found) {
     LOG(debug) << "Get movie-info " << movie_id << " cache hit from Memcached";
-    json movie_info_json = json::parse(movie_info_mmc);
     _return.movie_id = movie_info_json["movie_id"];
     _return.title = movie_info_json["title"];
     _return.avg_rating = movie_info_json["avg_rating"];
@@ -233,41 +212,23 @@ void MovieInfoHandler::ReadMovieInfo(
     }
   } else {
     // If not cached in memcached
-    mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-        _mongodb_client_pool);
-    if (!mongodb_client) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to pop a client from MongoDB pool";
-      throw se;
-    }
+    MongoClientLease mongodb_client(_mongodb_client_pool);
 
-    auto collection = mongoc_client_get_collection(
-        mongodb_client, "movie-info", "movie-info");
-    if (!collection) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to create collection user from DB user";
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-      throw se;
-    }
+    auto collection = mongodb_client.Collection("movie-info", "movie-info");
     bson_t *query = bson_new();
     BSON_APPEND_UTF8(query, "movie_id", movie_id.c_str());
-    auto find_span = opentracing::Tracer::Global()->StartSpan(
-        "MongoFindMovieInfo", { opentracing::ChildOf(&span->context()) });
+    auto find_span = span.StartSpan("MongoFindMovieInfo");
     mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
         collection, query, nullptr, nullptr);
     const bson_t *doc;
     bool found = mongoc_cursor_next(cursor, &doc);
-    find_span->Finish();
+    find_span.Finish();
     if (!found) {
       bson_error_t error;
       if (mongoc_cursor_error (cursor, &error)) {
         LOG(warning) << error.message;
         bson_destroy(query);
         mongoc_cursor_destroy(cursor);
-        mongoc_collection_destroy(collection);
-        mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
         ServiceException se;
         se.errorCode = ErrorCode::SE_MONGODB_ERROR;
         se.message = error.message;
@@ -276,8 +237,6 @@ void MovieInfoHandler::ReadMovieInfo(
         LOG(warning) << "Movie_id: " << movie_id << " doesn't exist in MongoDB";
         bson_destroy(query);
         mongoc_cursor_destroy(cursor);
-        mongoc_collection_destroy(collection);
-        mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
         ServiceException se;
         se.errorCode = ErrorCode::SE_THRIFT_HANDLER_ERROR;
         se.message = "Movie_id: " + movie_id + " doesn't exist in MongoDB";
@@ -310,8 +269,7 @@ void MovieInfoHandler::ReadMovieInfo(
       }
       bson_destroy(query);
       mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+      mongodb_client.Release();
 
       // upload movie-info to memcached
       auto mc_client = _mc_client_pool->Pop();
@@ -321,19 +279,18 @@ void MovieInfoHandler::ReadMovieInfo(
         se.message = "Failed to pop a client from memcached pool";
         throw se;
       }
-      auto set_span = opentracing::Tracer::Global()->StartSpan(
-          "MmcSetMovieInfo", { opentracing::ChildOf(&span->context()) });
+      auto set_span = span.StartSpan("MmcSetMovieInfo");
       
       bool success = mc_client->Set(movie_id, movie_info_json_char, 0, 0);
       if (!success) {
-        LOG(warning) << "Failed to set movie_info to Memcached";
+        LOG_EVERY_MS(warning, 1000) << "Failed to set movie_info to Memcached";
       }
-      set_span->Finish();
+      set_span.Finish();
       bson_free(movie_info_json_char);
       _mc_client_pool->Push(mc_client);
     }
   }
-  span->Finish();
+  span.Finish();
 }
 
 void MovieInfoHandler::UpdateRating(
@@ -341,41 +298,19 @@ void MovieInfoHandler::UpdateRating(
     int32_t sum_uncommitted_rating, int32_t num_uncommitted_rating,
     const std::map<std::string, std::string> & carrier) {
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UpdateRating",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("UpdateRating", carrier, req_id);
 
   bson_t *query = bson_new();
   BSON_APPEND_UTF8(query, "movie_id", movie_id.c_str());
 
-  mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-      _mongodb_client_pool);
-  if (!mongodb_client) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-    se.message = "Failed to pop a client from MongoDB pool";
-    throw se;
-  }
-  auto collection = mongoc_client_get_collection(
-      mongodb_client, "social-graph", "social-graph");
-  if (!collection) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-    se.message = "Failed to create collection social_graph from MongoDB";
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-    throw se;
-  }
-  auto find_span = opentracing::Tracer::Global()->StartSpan(
-      "MongoFindMovieInfo", {opentracing::ChildOf(&span->context())});
+  MongoClientLease mongodb_client(_mongodb_client_pool);
+  auto collection = mongodb_client.Collection("social-graph", "social-graph");
+  auto find_span = span.StartSpan("MongoFindMovieInfo");
   mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
       collection, query, nullptr, nullptr);
   const bson_t *doc;
   bool found = mongoc_cursor_next(cursor, &doc);
+  find_span.Finish();
   if (found) {
     bson_iter_t iter_0;
     bson_iter_t iter_1;
@@ -398,8 +333,7 @@ void MovieInfoHandler::UpdateRating(
           "num_rating", BCON_INT32(num_rating), "}");
       bson_error_t error;
       bson_t reply;
-      auto update_span = opentracing::Tracer::Global()->StartSpan(
-          "MongoUpdateRating", {opentracing::ChildOf(&span->context())});
+      auto update_span = span.StartSpan("MongoUpdateRating");
       bool updated = mongoc_collection_find_and_modify(
           collection,
           query,
@@ -420,16 +354,16 @@ void MovieInfoHandler::UpdateRating(
             " to MongoDB: " + error.message;
         bson_destroy(&reply);
         bson_destroy(update);
-        mongoc_collection_destroy(collection);
-        mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
         throw se;
       }
-      update_span->Finish();
+      update_span.Finish();
     }
   }
+  bson_destroy(query);
+  mongoc_cursor_destroy(cursor);
+  mongodb_client.Release();
 
-  auto delete_span = opentracing::Tracer::Global()->StartSpan(
-      "MmcDelete", {opentracing::ChildOf(&span->context())});
+  auto delete_span = span.StartSpan("MmcDelete");
   auto mc_client = _mc_client_pool->Pop();
   if (!mc_client) {
     ServiceException se;
@@ -438,9 +372,9 @@ void MovieInfoHandler::UpdateRating(
     throw se;
   }
   bool success = mc_client->Delete(movie_id);
-  delete_span->Finish();
+  delete_span.Finish();
 
-  span->Finish();
+  span.Finish();
 }
 
 } // namespace media_service
@@ -22,6 +22,10 @@ int faas_init() {
 
   std::string mc_addr = config_json["movie-info-memcached"]["addr"];
   int mc_port = config_json["movie-info-memcached"]["port"];
+  MCClient::CompressThreshold() =
+      config_json["movie-info-memcached"].value("compress_threshold", 0);
+  MCClient::SharedConnections() =
+      config_json["movie-info-memcached"].value("shared_connections", 0);
   mc_client_pool = new ClientPool<MCClient>("movie-info-memcached", mc_addr, mc_port, 1, 128, 1000);
   mongodb_client_pool =
       init_mongodb_client_pool(config_json, "movie-info", MONGODB_POOL_MAX_SIZE);
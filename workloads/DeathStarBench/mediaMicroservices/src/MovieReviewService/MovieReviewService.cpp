@@ -39,7 +39,8 @@ int faas_init() {
   }
   bool r = false;
   while (!r) {
-    r = CreateIndex(mongodb_client, "movie-review", "movie_id", true);
+    r = CreateTimelineBucketIndex(mongodb_client, "movie-review",
+                                  "movie-review-bucket", "movie_id");
     if (!r) {
       LOG(error) << "Failed to create mongodb index, try again";
       sleep(1);
@@ -65,12 +66,16 @@ int faas_create_func_worker(void* caller_context,
                                review_storage_port, 0, 128, 1000, "ReviewStorageService", faas_worker,
                                "MovieReviewService", "ReviewStorageService");
 
+  int bucket_size = std::max(1, config_json["movie-review-service"].value(
+      "review_bucket_size", 128));
+
   faas_worker->SetProcessor(
       std::make_shared<MovieReviewServiceProcessor>(
           std::make_shared<MovieReviewHandler>(
               redis_client_pool,
               mongodb_client_pool,
-              review_storage_client_pool)));
+              review_storage_client_pool,
+              bucket_size)));
     *worker_handle = faas_worker;
     return 0;
 }
@@ -28,13 +28,16 @@ int main(int argc, char *argv[]) {
   signal(SIGINT, sigintHandler);
   init_logger();
 
-  SetUpTracer("config/jaeger-config.yml", "cast-info-service");
+  SetUpTracer("config/jaeger-config.yml", "page-service");
 
   json config_json;
   if (load_config(&config_json) != 0) {
     exit(EXIT_FAILURE);
   }
 
+  SetUpFanOut(config_json["page-service"].value("fanout_threads", 0),
+              config_json["page-service"].value("fanout_max_queued", 0));
+
   int port = 9090;
   std::string cast_info_addr = config_json["cast-info-service"]["addr"];
   int cast_info_port = config_json["cast-info-service"]["port"];
@@ -11,6 +11,7 @@
 #include "../logger.h"
 #include "../tracing.h"
 #include "../ClientPool.h"
+#include "../utils_mongodb.h"
 
 namespace media_service {
 
@@ -45,14 +46,7 @@ void PlotHandler::ReadPlot(
     const std::map<std::string, std::string> & carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "ReadPlot",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("ReadPlot", carrier, req_id);
 
   auto mc_client = _mc_client_pool->Pop();
   if (!mc_client) {
@@ -65,11 +59,10 @@ void PlotHandler::ReadPlot(
   uint32_t memcached_flags;
 
   // Look for the movie id from memcached
-  auto get_span = opentracing::Tracer::Global()->StartSpan(
-      "MmcGetPlot", { opentracing::ChildOf(&span->context()) });
+  auto get_span = span.StartSpan("MmcGetPlot");
   auto plot_id_str = std::to_string(plot_id);
 
-  std::string plot_mmc;
+  opentracing::string_view plot_mmc;
   bool found;
   bool success = mc_client->Get(plot_id_str, &found, &plot_mmc, &memcached_flags);
   if (!success) {
@@ -79,44 +72,32 @@ void PlotHandler::ReadPlot(
     se.message = "Failed to get plot from memcached";
     throw se;
   }
-  get_span->Finish();
+  // plot_mmc points into mc_client's buffer: the one copy goes straight
+  // into _return, before the client is pushed back
+  if (found) {
+    _return.assign(plot_mmc.data(), plot_mmc.size());
+  }
+  get_span.Finish();
   _mc_client_pool->Push(mc_client);
 
   // If cached in memcached
   if (found) {
-    LOG(debug) << "Get plot " << plot_mmc
+    LOG(debug) << "Get plot " << _return
         << " cache hit from Memcached";
-    _return = std::string(plot_mmc);
   } else {
     // If not cached in memcached
-    mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-        _mongodb_client_pool);
-    if (!mongodb_client) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to pop a client from MongoDB pool";
-      throw se;
-    }
-    auto collection = mongoc_client_get_collection(
-        mongodb_client, "plot", "plot");
-    if (!collection) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to create collection plot from DB plot";
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-      throw se;
-    }
+    MongoClientLease mongodb_client(_mongodb_client_pool);
+    auto collection = mongodb_client.Collection("plot", "plot");
 
     bson_t *query = bson_new();
     BSON_APPEND_INT64(query, "plot_id", plot_id);
 
-    auto find_span = opentracing::Tracer::Global()->StartSpan(
-        "MongoFindPlot", { opentracing::ChildOf(&span->context()) });
+    auto find_span = span.StartSpan("MongoFindPlot");
     mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
         collection, query, nullptr, nullptr);
     const bson_t *doc;
     bool found = mongoc_cursor_next(cursor, &doc);
-    find_span->Finish();
+    find_span.Finish();
 
     if (found) {
       bson_iter_t iter;
@@ -127,8 +108,7 @@ void PlotHandler::ReadPlot(
         _return = std::string(plot_mongo_char, plot_mongo_char + plot_mongo_len);
         bson_destroy(query);
         mongoc_cursor_destroy(cursor);
-        mongoc_collection_destroy(collection);
-        mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+        mongodb_client.Release();
         auto mc_client = _mc_client_pool->Pop();
         if (!mc_client) {
           ServiceException se;
@@ -138,21 +118,18 @@ void PlotHandler::ReadPlot(
         }
 
         // Upload the plot to memcached
-        auto set_span = opentracing::Tracer::Global()->StartSpan(
-            "MmcSetPlot", { opentracing::ChildOf(&span->context()) });
+        auto set_span = span.StartSpan("MmcSetPlot");
         bool success = mc_client->Set(plot_id_str, _return, 0, 0);
-        set_span->Finish();
+        set_span.Finish();
 
         if (!success) {
-          LOG(warning) << "Failed to set plot to Memcached";
+          LOG_EVERY_MS(warning, 1000) << "Failed to set plot to Memcached";
         }
         _mc_client_pool->Push(mc_client);
       } else {
         LOG(error) << "Attribute plot is not find in MongoDB";
         bson_destroy(query);
         mongoc_cursor_destroy(cursor);
-        mongoc_collection_destroy(collection);
-        mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
         ServiceException se;
         se.errorCode = ErrorCode::SE_THRIFT_HANDLER_ERROR;
         se.message = "Attribute plot is not find in MongoDB";
@@ -162,15 +139,13 @@ void PlotHandler::ReadPlot(
       LOG(error) << "Plot_id " << plot_id << " is not found in MongoDB";
       bson_destroy(query);
       mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
       ServiceException se;
       se.errorCode = ErrorCode::SE_THRIFT_HANDLER_ERROR;
       se.message = "Plot_id " + plot_id_str + " is not found in MongoDB";
       throw se;
     }
   }
-  span->Finish();
+  span.Finish();
 }
 
 void PlotHandler::WritePlot(
@@ -179,42 +154,19 @@ void PlotHandler::WritePlot(
     const std::string &plot,
     const std::map<std::string, std::string> &carrier) {
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "WritePlot",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("WritePlot", carrier, req_id);
 
   bson_t *new_doc = bson_new();
   BSON_APPEND_INT64(new_doc, "plot_id", plot_id);
   BSON_APPEND_UTF8(new_doc, "plot", plot.c_str());
 
-  mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-      _mongodb_client_pool);
-  if (!mongodb_client) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-    se.message = "Failed to pop a client from MongoDB pool";
-    throw se;
-  }
-  auto collection = mongoc_client_get_collection(
-      mongodb_client, "plot", "plot");
-  if (!collection) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-    se.message = "Failed to create collection plot from DB plot";
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-    throw se;
-  }
+  MongoClientLease mongodb_client(_mongodb_client_pool);
+  auto collection = mongodb_client.Collection("plot", "plot");
   bson_error_t error;
-  auto insert_span = opentracing::Tracer::Global()->StartSpan(
-      "MongoInsertPlot", { opentracing::ChildOf(&span->context()) });
+  auto insert_span = span.StartSpan("MongoInsertPlot");
   bool plotinsert = mongoc_collection_insert_one (
       collection, new_doc, nullptr, nullptr, &error);
-  insert_span->Finish();
+  insert_span.Finish();
   if (!plotinsert) {
     LOG(error) << "Error: Failed to insert plot to MongoDB: "
                << error.message;
@@ -222,16 +174,13 @@ void PlotHandler::WritePlot(
     se.errorCode = ErrorCode::SE_MONGODB_ERROR;
     se.message = error.message;
     bson_destroy(new_doc);
-    mongoc_collection_destroy(collection);
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
     throw se;
   }
 
   bson_destroy(new_doc);
-  mongoc_collection_destroy(collection);
-  mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+  mongodb_client.Release();
 
-  span->Finish();
+  span.Finish();
 }
 
 } // namespace media_service
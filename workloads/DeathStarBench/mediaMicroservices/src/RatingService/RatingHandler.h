@@ -43,14 +43,7 @@ void RatingHandler::UploadRating(
     const std::map<std::string, std::string> & carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UploadRating",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("UploadRating", carrier, req_id);
 
   // std::future<void> upload_future;
   // std::future<void> redis_future;
@@ -64,12 +57,16 @@ void RatingHandler::UploadRating(
       throw se;
     }
     auto compose_client = compose_client_wrapper->GetClient();
-    try {
-      compose_client->UploadRating(req_id, rating, writer_text_map);
-    } catch (...) {
-      _compose_client_pool->Remove(compose_client_wrapper);
-      LOG(error) << "Failed to upload rating to compose-review-service";
-      throw;
+    {
+      auto rpc_trace_guard = _compose_client_pool->StartRpcTrace("UploadRating", compose_client_wrapper);
+      try {
+        compose_client->UploadRating(req_id, rating, span.carrier());
+      } catch (...) {
+        rpc_trace_guard->set_status(1);
+        _compose_client_pool->Remove(compose_client_wrapper);
+        LOG(error) << "Failed to upload rating to compose-review-service";
+        throw;
+      }
     }
     _compose_client_pool->Push(compose_client_wrapper);
   // });
@@ -83,15 +80,14 @@ void RatingHandler::UploadRating(
       throw se;
     }
     auto redis_client = redis_client_wrapper->GetClient();
-    auto redis_span = opentracing::Tracer::Global()->StartSpan(
-        "RedisInsert", {opentracing::ChildOf(&span->context())});
+    auto redis_span = span.StartSpan("RedisInsert");
     redis_client.AppendCommand("INCRBY %s:uncommit_sum %d", movie_id.c_str(), rating);
     redis_client.AppendCommand("INCR %s:uncommit_num", movie_id.c_str());
     auto incrby_reply = redis_client.GetReply();
     auto incr_reply = redis_client.GetReply();
     incrby_reply->check_ok();
     incr_reply->check_ok();
-    redis_span->Finish();
+    redis_span.Finish();
     _redis_client_pool->Push(redis_client_wrapper);
   // });
 
@@ -108,7 +104,7 @@ void RatingHandler::UploadRating(
   //   LOG(error) << "Failed to update rating to rating-redis";
   //   throw;
   // }
-  span->Finish();
+  span.Finish();
 }
 
 
@@ -11,6 +11,7 @@
 #include "../../gen-cpp/ReviewStorageService.h"
 #include "../logger.h"
 #include "../tracing.h"
+#include "../utils_mongodb.h"
 
 namespace media_service {
 
@@ -41,33 +42,11 @@ void ReviewStorageHandler::StoreReview(
     const std::map<std::string, std::string> & carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "StoreReview",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("StoreReview", carrier, req_id);
 
-  mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-      _mongodb_client_pool);
-  if (!mongodb_client) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-    se.message = "Failed to pop a client from MongoDB pool";
-    throw se;
-  }
+  MongoClientLease mongodb_client(_mongodb_client_pool);
 
-  auto collection = mongoc_client_get_collection(
-      mongodb_client, "review", "review");
-  if (!collection) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-    se.message = "Failed to create collection user from DB user";
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-    throw se;
-  }
+  auto collection = mongodb_client.Collection("review", "review");
 
   bson_t *new_doc = bson_new();
   BSON_APPEND_INT64(new_doc, "review_id", review.review_id);
@@ -79,11 +58,10 @@ void ReviewStorageHandler::StoreReview(
   BSON_APPEND_INT64(new_doc, "req_id", review.req_id);
   bson_error_t error;
 
-  auto insert_span = opentracing::Tracer::Global()->StartSpan(
-      "MongoInsertReview", { opentracing::ChildOf(&span->context()) });
+  auto insert_span = span.StartSpan("MongoInsertReview");
   bool plotinsert = mongoc_collection_insert_one (
       collection, new_doc, nullptr, nullptr, &error);
-  insert_span->Finish();
+  insert_span.Finish();
 
   if (!plotinsert) {
     LOG(error) << "Error: Failed to insert review to MongoDB: "
@@ -92,16 +70,13 @@ void ReviewStorageHandler::StoreReview(
     se.errorCode = ErrorCode::SE_MONGODB_ERROR;
     se.message = error.message;
     bson_destroy(new_doc);
-    mongoc_collection_destroy(collection);
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
     throw se;
   }
 
   bson_destroy(new_doc);
-  mongoc_collection_destroy(collection);
-  mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+  mongodb_client.Release();
 
-  span->Finish();
+  span.Finish();
 }
 void ReviewStorageHandler::ReadReviews(
     std::vector<Review> & _return,
@@ -110,14 +85,7 @@ void ReviewStorageHandler::ReadReviews(
     const std::map<std::string, std::string> &carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "ReadReviews",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("ReadReviews", carrier, req_id);
 
   if (review_ids.empty()) {
     return;
@@ -139,26 +107,24 @@ void ReviewStorageHandler::ReadReviews(
     throw se;
   }
 
-  uint32_t flags;
-  auto get_span = opentracing::Tracer::Global()->StartSpan(
-      "MemcachedMget", { opentracing::ChildOf(&span->context()) });
+  auto get_span = span.StartSpan("MemcachedMget");
 
-  bool found;
-  std::string return_value;
+  std::vector<std::string> keys;
+  keys.reserve(review_ids.size());
   for (auto &review_id : review_ids) {
-    std::string key_str = std::to_string(review_id);
-    bool success = mc_client->Get(key_str, &found, &return_value, &flags);
-    if (!success) {
-      _mc_client_pool->Push(mc_client);
-      LOG(error) << "Cannot get reviews of request " << req_id;
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-      se.message = "Cannot get reviews of request " + std::to_string(req_id);
-      throw se;
-    }
-    if (!found) continue;
+    keys.emplace_back(std::to_string(review_id));
+  }
+  std::map<std::string, std::string> return_values;
+  bool success = mc_client->MultiGet(keys, &return_values);
+  if (!success) {
+    // a failed read is a miss for every review, MongoDB still has them
+    LOG_EVERY_MS(warning, 1000) << "Cannot get reviews of request " << req_id
+                                << " from memcached, reading MongoDB";
+    return_values.clear();
+  }
+  for (auto &it : return_values) {
     Review new_review;
-    json review_json = json::parse(return_value);
+    json review_json = json::parse(it.second);
     new_review.req_id = review_json["req_id"];
     new_review.user_id = review_json["user_id"];
     new_review.movie_id = review_json["movie_id"];
@@ -170,7 +136,7 @@ void ReviewStorageHandler::ReadReviews(
     review_ids_not_cached.erase(new_review.review_id);
     LOG(debug) << "Review: " << new_review.review_id << " found in memcached";
   }
-  get_span->Finish();
+  get_span.Finish();
   _mc_client_pool->Push(mc_client);
 
   // std::vector<std::future<void>> set_futures;
@@ -178,23 +144,8 @@ void ReviewStorageHandler::ReadReviews(
   
   // Find the rest in MongoDB
   if (!review_ids_not_cached.empty()) {
-    mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-        _mongodb_client_pool);
-    if (!mongodb_client) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to pop a client from MongoDB pool";
-      throw se;
-    }
-    auto collection = mongoc_client_get_collection(
-        mongodb_client, "review", "review");
-    if (!collection) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to create collection user from DB user";
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-      throw se;
-    }
+    MongoClientLease mongodb_client(_mongodb_client_pool);
+    auto collection = mongodb_client.Collection("review", "review");
     bson_t *query = bson_new();
     bson_t query_child;
     bson_t query_review_id_list;
@@ -213,8 +164,7 @@ void ReviewStorageHandler::ReadReviews(
     mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
         collection, query, nullptr, nullptr);
     const bson_t *doc;
-    auto find_span = opentracing::Tracer::Global()->StartSpan(
-        "MongoFindPosts", {opentracing::ChildOf(&span->context())});
+    auto find_span = span.StartSpan("MongoFindPosts");
     while (true) {
       bool found = mongoc_cursor_next(cursor, &doc);
       if (!found) {
@@ -234,14 +184,12 @@ void ReviewStorageHandler::ReadReviews(
       return_map.insert({new_review.review_id, new_review});
       bson_free(review_json_char);
     }
-    find_span->Finish();
+    find_span.Finish();
     bson_error_t error;
     if (mongoc_cursor_error(cursor, &error)) {
       LOG(warning) << error.message;
       bson_destroy(query);
       mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
       ServiceException se;
       se.errorCode = ErrorCode::SE_MONGODB_ERROR;
       se.message = error.message;
@@ -249,8 +197,7 @@ void ReviewStorageHandler::ReadReviews(
     }
     bson_destroy(query);
     mongoc_cursor_destroy(cursor);
-    mongoc_collection_destroy(collection);
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+    mongodb_client.Release();
 
     // upload reviews to memcached
     // set_futures.emplace_back(std::async(std::launch::async, [&]() {
@@ -262,14 +209,14 @@ void ReviewStorageHandler::ReadReviews(
         se.message = "Failed to pop a client from memcached pool";
         throw se;
       }
-      auto set_span = opentracing::Tracer::Global()->StartSpan(
-          "MmcSetPost", {opentracing::ChildOf(&span->context())});
+      auto set_span = span.StartSpan("MmcSetPost");
+      std::map<std::string, std::string> set_items;
       for (auto & it : review_json_map) {
-        std::string id_str = std::to_string(it.first);
-        mc_client->Set(id_str, it.second, 0, 0);
+        set_items.emplace(std::to_string(it.first), std::move(it.second));
       }
+      mc_client->MultiSet(set_items, 0, 0);
       _mc_client_pool->Push(mc_client);
-      set_span->Finish();
+      set_span.Finish();
     // }));
   }
 
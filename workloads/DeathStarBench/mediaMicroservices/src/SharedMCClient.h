@@ -0,0 +1,203 @@
+#ifndef MEDIA_MICROSERVICES_SHAREDMCCLIENT_H
+#define MEDIA_MICROSERVICES_SHAREDMCCLIENT_H
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "logger.h"
+#include "../libmc/include/c_client.h"
+
+namespace media_service {
+
+// One memcached server's connections, shared by every MCClient in the
+// process that points at it (see MCClient::SharedConnections). Callers are
+// multiplexed over a few libmc clients ("lanes", one connection each), and
+// concurrent Get()s are combined: whichever caller finds an idle lane sends
+// every queued key as a single multi-get and hands the values back to the
+// others. MCClients configured differently (lanes, compression) get
+// separate SharedMCClients.
+class SharedMCClient {
+ public:
+  static SharedMCClient* Attach(const std::string& addr, int port,
+                                int num_lanes, int compress_threshold);
+  ~SharedMCClient();
+
+  SharedMCClient(const SharedMCClient&) = delete;
+  SharedMCClient& operator=(const SharedMCClient&) = delete;
+
+  bool Get(const std::string& key, bool* found, std::string* value, uint32_t* flags);
+
+  // Exclusive use of one lane, for everything that is not combined.
+  void* AcquireLane();
+  void ReleaseLane(void* lane);
+
+ private:
+  SharedMCClient(const std::string& addr, int port, int num_lanes, int compress_threshold);
+
+  class BatchGuard;
+
+  struct PendingGet {
+    const std::string* key;
+    bool* found;
+    std::string* value;
+    uint32_t* flags;
+    bool ok;
+    bool done;
+  };
+  void RunGets(void* lane, const std::vector<PendingGet*>& batch);
+
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::vector<void*> _lanes;
+  std::vector<void*> _idle_lanes;
+  std::vector<PendingGet*> _pending_gets;
+};
+
+SharedMCClient* SharedMCClient::Attach(const std::string& addr, int port,
+                                       int num_lanes, int compress_threshold) {
+  static std::mutex registry_mutex;
+  static std::map<std::string, std::unique_ptr<SharedMCClient>> registry;
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  auto& shared = registry[addr + ":" + std::to_string(port) + "/" +
+                          std::to_string(num_lanes) + "/" +
+                          std::to_string(compress_threshold)];
+  if (!shared) {
+    shared.reset(new SharedMCClient(addr, port, num_lanes, compress_threshold));
+  }
+  return shared.get();
+}
+
+// Completes a batch taken by Get(): marks every get in it done and hands
+// the lane back, also when RunGets() throws, so that no caller waits on
+// the batch forever. Returns with the lock held.
+class SharedMCClient::BatchGuard {
+ public:
+  BatchGuard(SharedMCClient* shared, std::unique_lock<std::mutex>* lock,
+             void* lane, const std::vector<PendingGet*>* batch)
+      : _shared(shared), _lock(lock), _lane(lane), _batch(batch) {}
+  ~BatchGuard() {
+    _lock->lock();
+    for (auto pending : *_batch) {
+      pending->done = true;
+    }
+    _shared->_idle_lanes.push_back(_lane);
+    _shared->_cv.notify_all();
+  }
+
+ private:
+  SharedMCClient* _shared;
+  std::unique_lock<std::mutex>* _lock;
+  void* _lane;
+  const std::vector<PendingGet*>* _batch;
+};
+
+SharedMCClient::SharedMCClient(const std::string& addr, int port,
+                               int num_lanes, int compress_threshold) {
+  const char* host = addr.c_str();
+  uint32_t lane_port = port;
+  for (int i = 0; i < num_lanes; i++) {
+    void* lane = client_create();
+    client_init(lane, &host, &lane_port, 1, nullptr, 0);
+    if (compress_threshold > 0) {
+      client_config(lane, CFG_COMPRESS_THRESHOLD, compress_threshold);
+    }
+    _lanes.push_back(lane);
+  }
+  _idle_lanes = _lanes;
+}
+
+SharedMCClient::~SharedMCClient() {
+  for (auto lane : _lanes) {
+    client_destroy(lane);
+  }
+}
+
+void* SharedMCClient::AcquireLane() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _cv.wait(lock, [this] { return !_idle_lanes.empty(); });
+  void* lane = _idle_lanes.back();
+  _idle_lanes.pop_back();
+  return lane;
+}
+
+void SharedMCClient::ReleaseLane(void* lane) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _idle_lanes.push_back(lane);
+  }
+  _cv.notify_all();
+}
+
+bool SharedMCClient::Get(const std::string& key, bool* found, std::string* value,
+                         uint32_t* flags) {
+  PendingGet get = {&key, found, value, flags, false, false};
+  std::unique_lock<std::mutex> lock(_mutex);
+  _pending_gets.push_back(&get);
+  while (!get.done) {
+    // Nothing to send (another caller already took our key) or no lane to
+    // send it on: wait for a batch to complete.
+    if (_idle_lanes.empty() || _pending_gets.empty()) {
+      _cv.wait(lock);
+      continue;
+    }
+    void* lane = _idle_lanes.back();
+    _idle_lanes.pop_back();
+    std::vector<PendingGet*> batch;
+    batch.swap(_pending_gets);
+    lock.unlock();
+    BatchGuard guard(this, &lock, lane, &batch);
+    RunGets(lane, batch);
+  }
+  return get.ok;
+}
+
+void SharedMCClient::RunGets(void* lane, const std::vector<PendingGet*>& batch) {
+  // Several callers may be after the same (hot) key; ask for it once.
+  std::map<std::string, std::vector<PendingGet*>> waiters;
+  for (auto pending : batch) {
+    *pending->found = false;
+    waiters[*pending->key].push_back(pending);
+  }
+  std::vector<const char*> key_ptrs;
+  std::vector<size_t> key_lens;
+  key_ptrs.reserve(waiters.size());
+  key_lens.reserve(waiters.size());
+  for (auto &item : waiters) {
+    key_ptrs.push_back(item.first.data());
+    key_lens.push_back(item.first.size());
+  }
+
+  retrieval_result_t** results = nullptr;
+  size_t n_results = 0;
+  err_code_t err = client_get(lane, key_ptrs.data(), key_lens.data(), key_ptrs.size(),
+                              &results, &n_results);
+  // freed also when copying a value out throws
+  std::unique_ptr<void, void (*)(void*)> results_guard(
+      lane, client_destroy_retrieval_result);
+  bool ok = err == RET_OK;
+  if (ok) {
+    for (size_t i = 0; i < n_results; i++) {
+      auto it = waiters.find(std::string(results[i]->key, results[i]->key_len));
+      if (it == waiters.end()) continue;
+      for (auto pending : it->second) {
+        *pending->found = true;
+        pending->value->assign(results[i]->data_block, results[i]->bytes);
+        *pending->flags = results[i]->flags;
+      }
+    }
+  } else {
+    LOG_EVERY_MS(warning, 1000) << "Memcached multi-get of " << key_ptrs.size()
+                                << " keys failed: " << err_code_to_string(err);
+  }
+  for (auto pending : batch) {
+    pending->ok = ok;
+  }
+}
+
+} // media_service
+
+#endif //MEDIA_MICROSERVICES_SHAREDMCCLIENT_H
@@ -35,14 +35,7 @@ void TextHandler::UploadText(
     const std::map<std::string, std::string> & carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UploadText",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("UploadText", carrier, req_id);
 
   auto compose_client_wrapper = _compose_client_pool->Pop();
   if (!compose_client_wrapper) {
@@ -52,16 +45,20 @@ void TextHandler::UploadText(
     throw se;
   }
   auto compose_client = compose_client_wrapper->GetClient();
-  try {
-    compose_client->UploadText(req_id, text, writer_text_map);
-  } catch (...) {
-    _compose_client_pool->Remove(compose_client_wrapper);
-    LOG(error) << "Failed to upload movie_id to compose-review-service";
-    throw;
+  {
+    auto rpc_trace_guard = _compose_client_pool->StartRpcTrace("UploadText", compose_client_wrapper);
+    try {
+      compose_client->UploadText(req_id, text, span.carrier());
+    } catch (...) {
+      rpc_trace_guard->set_status(1);
+      _compose_client_pool->Remove(compose_client_wrapper);
+      LOG(error) << "Failed to upload movie_id to compose-review-service";
+      throw;
+    }
   }
   _compose_client_pool->Push(compose_client_wrapper);
 
-  span->Finish();
+  span.Finish();
 }
 
 } //namespace media_service
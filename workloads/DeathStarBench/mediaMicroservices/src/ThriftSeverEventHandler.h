@@ -28,8 +28,9 @@ class ThriftServerEventHandler : public TServerEventHandler {
     ServerContext* context = new ServerContext;
     context->id = _current_context_id++;
     _server_contexts[context] = std::unique_ptr<ServerContext>(context);
-    LOG(info) << "[" << _service_name << "]: create context with id " << context->id;
-    LOG(info) << "[" << _service_name << "]: num_context=" << _server_contexts.size();
+    LOG(debug) << "[" << _service_name << "]: create context with id " << context->id;
+    LOG_EVERY_MS(info, 1000) << "[" << _service_name << "]: num_context="
+                             << _server_contexts.size();
     return context;
   }
 
@@ -42,9 +43,10 @@ class ThriftServerEventHandler : public TServerEventHandler {
       LOG(error) << "[" << _service_name << "]: delete unknown context!";
       return;
     }
-    LOG(info) << "[" << _service_name << "]: delete context with id " << context->id;
+    LOG(debug) << "[" << _service_name << "]: delete context with id " << context->id;
     _server_contexts.erase(context);
-    LOG(info) << "[" << _service_name << "]: num_context=" << _server_contexts.size();
+    LOG_EVERY_MS(info, 1000) << "[" << _service_name << "]: num_context="
+                             << _server_contexts.size();
   } 
 
   void processContext(void* serverContext, std::shared_ptr<TTransport> transport) override {
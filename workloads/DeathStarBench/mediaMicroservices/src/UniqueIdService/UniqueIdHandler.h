@@ -76,14 +76,7 @@ void UniqueIdHandler::UploadUniqueId(
     const std::map<std::string, std::string> & carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UploadUniqueId",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("UploadUniqueId", carrier, req_id);
 
   _thread_lock->lock();
   int64_t timestamp = duration_cast<milliseconds>(
@@ -126,16 +119,20 @@ void UniqueIdHandler::UploadUniqueId(
     throw se;
   }
   auto compose_client = compose_client_wrapper->GetClient();
-  try {
-    compose_client->UploadUniqueId(req_id, review_id, writer_text_map);
-  } catch (...) {
-    _compose_client_pool->Remove(compose_client_wrapper);
-    LOG(error) << "Failed to upload movie_id to compose-review-service";
-    throw;
+  {
+    auto rpc_trace_guard = _compose_client_pool->StartRpcTrace("UploadUniqueId", compose_client_wrapper);
+    try {
+      compose_client->UploadUniqueId(req_id, review_id, span.carrier());
+    } catch (...) {
+      rpc_trace_guard->set_status(1);
+      _compose_client_pool->Remove(compose_client_wrapper);
+      LOG(error) << "Failed to upload movie_id to compose-review-service";
+      throw;
+    }
   }
   _compose_client_pool->Push(compose_client_wrapper);
 
-  span->Finish();
+  span.Finish();
 }
 
 /*
@@ -14,6 +14,8 @@
 #include "../ClientPool.h"
 #include "../RedisClient.h"
 #include "../ThriftClient.h"
+#include "../TimelineBuckets.h"
+#include "../utils_mongodb.h"
 
 namespace media_service {
 class UserReviewHandler : public UserReviewServiceIf {
@@ -21,7 +23,8 @@ class UserReviewHandler : public UserReviewServiceIf {
   UserReviewHandler(
       ClientPool<RedisClient> *,
       mongoc_client_pool_t *,
-      ClientPool<ThriftClient<ReviewStorageServiceClient>> *);
+      ClientPool<ThriftClient<ReviewStorageServiceClient>> *,
+      int bucket_size);
   ~UserReviewHandler() override = default;
   void UploadUserReview(int64_t, int64_t, int64_t, int64_t,
                          const std::map<std::string, std::string> &) override;
@@ -33,15 +36,18 @@ class UserReviewHandler : public UserReviewServiceIf {
   ClientPool<RedisClient> *_redis_client_pool;
   mongoc_client_pool_t *_mongodb_client_pool;
   ClientPool<ThriftClient<ReviewStorageServiceClient>> *_review_client_pool;
+  int _bucket_size;
 };
 
 UserReviewHandler::UserReviewHandler(
     ClientPool<RedisClient> *redis_client_pool,
     mongoc_client_pool_t *mongodb_pool,
-    ClientPool<ThriftClient<ReviewStorageServiceClient>> *review_storage_client_pool) {
+    ClientPool<ThriftClient<ReviewStorageServiceClient>> *review_storage_client_pool,
+    int bucket_size) {
   _redis_client_pool = redis_client_pool;
   _mongodb_client_pool = mongodb_pool;
   _review_client_pool = review_storage_client_pool;
+  _bucket_size = bucket_size;
 }
 
 void UserReviewHandler::UploadUserReview(
@@ -52,111 +58,31 @@ void UserReviewHandler::UploadUserReview(
     const std::map<std::string, std::string> &carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UploadUserReview",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("UploadUserReview", carrier, req_id);
 
-  mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-      _mongodb_client_pool);
-  if (!mongodb_client) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-    se.message = "Failed to pop a client from MongoDB pool";
-    throw se;
-  }
+  MongoClientLease mongodb_client(_mongodb_client_pool);
 
-  auto collection = mongoc_client_get_collection(
-      mongodb_client, "user-review", "user-review");
-  if (!collection) {
+  auto collection = mongodb_client.Collection(
+      "user-review", "user-review-bucket");
+
+  bson_t *owner = BCON_NEW("user_id", BCON_INT64(user_id));
+  bson_error_t error;
+  auto update_span = span.StartSpan("MongoUpdate");
+  bool updated = AppendToTimelineBucket(
+      collection, owner, "reviews", "review_id", review_id, timestamp,
+      _bucket_size, &error);
+  update_span.Finish();
+  bson_destroy(owner);
+  mongodb_client.Release();
+  if (!updated) {
+    LOG(error) << "Failed to update user-review for user " << user_id
+               << " to MongoDB: " << error.message;
     ServiceException se;
     se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-    se.message = "Failed to create collection user-review from DB user-review";
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+    se.message = error.message;
     throw se;
   }
 
-  bson_t *query = bson_new();
-  BSON_APPEND_INT64(query, "user_id", user_id);
-  auto find_span = opentracing::Tracer::Global()->StartSpan(
-      "MongoFindUser", {opentracing::ChildOf(&span->context())});
-  mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
-      collection, query, nullptr, nullptr);
-  const bson_t *doc;
-  bool found = mongoc_cursor_next(cursor, &doc);
-  if (!found) {
-    bson_t *new_doc = BCON_NEW(
-        "user_id", BCON_INT64(user_id),
-        "reviews",
-        "[", "{", "review_id", BCON_INT64(review_id),
-        "timestamp", BCON_INT64(timestamp), "}", "]"
-    );
-    bson_error_t error;
-    auto insert_span = opentracing::Tracer::Global()->StartSpan(
-        "MongoInsert", {opentracing::ChildOf(&span->context())});
-    bool plotinsert = mongoc_collection_insert_one(
-        collection, new_doc, nullptr, nullptr, &error);
-    insert_span->Finish();
-    if (!plotinsert) {
-      LOG(error) << "Failed to insert user review of user " << user_id
-                 << " to MongoDB: " << error.message;
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = error.message;
-      bson_destroy(new_doc);
-      bson_destroy(query);
-      mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-      throw se;
-    }
-    bson_destroy(new_doc);
-  } else {
-    bson_t *update = BCON_NEW(
-        "$push", "{",
-        "reviews", "{",
-        "$each", "[", "{",
-        "review_id", BCON_INT64(review_id),
-        "timestamp", BCON_INT64(timestamp),
-        "}", "]",
-        "$position", BCON_INT32(0),
-        "}",
-        "}"
-    );
-    bson_error_t error;
-    bson_t reply;
-    auto update_span = opentracing::Tracer::Global()->StartSpan(
-        "MongoUpdate", {opentracing::ChildOf(&span->context())});
-    bool plotupdate = mongoc_collection_find_and_modify(
-        collection, query, nullptr, update, nullptr, false, false,
-        true, &reply, &error);
-    update_span->Finish();
-    if (!plotupdate) {
-      LOG(error) << "Failed to update user-review for user " << user_id
-                 << " to MongoDB: " << error.message;
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = error.message;
-      bson_destroy(update);
-      bson_destroy(query);
-      bson_destroy(&reply);
-      mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-      throw se;
-    }
-    bson_destroy(update);
-    bson_destroy(&reply);
-  }
-  bson_destroy(query);
-  mongoc_cursor_destroy(cursor);
-  mongoc_collection_destroy(collection);
-  mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-
   auto redis_client_wrapper = _redis_client_pool->Pop();
   if (!redis_client_wrapper) {
     ServiceException se;
@@ -165,8 +91,7 @@ void UserReviewHandler::UploadUserReview(
     throw se;
   }
   auto redis_client = redis_client_wrapper->GetClient();
-  auto redis_span = opentracing::Tracer::Global()->StartSpan(
-      "RedisUpdate", {opentracing::ChildOf(&span->context())});
+  auto redis_span = span.StartSpan("RedisUpdate");
   redis_client.AppendCommand("ZCARD %" PRId64, user_id);
   auto num_reviews_reply = redis_client.GetReply();
   std::vector<std::string> options{"NX"};
@@ -177,8 +102,8 @@ void UserReviewHandler::UploadUserReview(
     zadd_reply->check_ok();
   }
   _redis_client_pool->Push(redis_client_wrapper);
-  redis_span->Finish();
-  span->Finish();
+  redis_span.Finish();
+  span.Finish();
 }
 
 void UserReviewHandler::ReadUserReviews(
@@ -187,14 +112,7 @@ void UserReviewHandler::ReadUserReviews(
     const std::map<std::string, std::string> & carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "ReadUserReviews",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("ReadUserReviews", carrier, req_id);
 
   if (stop <= start || start < 0) {
     return;
@@ -208,12 +126,11 @@ void UserReviewHandler::ReadUserReviews(
     throw se;
   }
   auto redis_client = redis_client_wrapper->GetClient();
-  auto redis_span = opentracing::Tracer::Global()->StartSpan(
-      "RedisFind", {opentracing::ChildOf(&span->context())});
+  auto redis_span = span.StartSpan("RedisFind");
   redis_client.AppendCommand("ZREVRANGE %" PRId64 " %d %d", user_id, start, stop - 1);
   auto review_ids_reply = redis_client.GetReply();
   _redis_client_pool->Push(redis_client_wrapper);
-  redis_span->Finish();
+  redis_span.Finish();
 
   std::vector<int64_t> review_ids;
   auto review_ids_reply_array = review_ids_reply->as_array();
@@ -225,71 +142,37 @@ void UserReviewHandler::ReadUserReviews(
   std::multimap<std::string, std::string> redis_update_map;
   if (mongo_start < stop) {
     // Instead find review_ids from mongodb
-    mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-        _mongodb_client_pool);
-    if (!mongodb_client) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to pop a client from MongoDB pool";
-      throw se;
-    }
-    auto collection = mongoc_client_get_collection(
-        mongodb_client, "user-review", "user-review");
-    if (!collection) {
+    MongoClientLease mongodb_client(_mongodb_client_pool);
+    auto collection = mongodb_client.Collection(
+        "user-review", "user-review-bucket");
+
+    bson_t *owner = BCON_NEW("user_id", BCON_INT64(user_id));
+    std::vector<int64_t> mongo_review_ids;
+    std::vector<int64_t> mongo_timestamps;
+    bson_error_t error;
+    auto find_span = span.StartSpan("MongoFindUserReviews");
+    bool read = ReadTimelineBuckets(collection, owner, "reviews", "review_id",
+                                    stop, _bucket_size, &mongo_review_ids,
+                                    &mongo_timestamps, &error);
+    find_span.Finish();
+    bson_destroy(owner);
+    mongodb_client.Release();
+    if (!read) {
+      LOG(error) << "Failed to read user-review for user " << user_id
+                 << " from MongoDB: " << error.message;
       ServiceException se;
       se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to create collection user-review from MongoDB";
+      se.message = error.message;
       throw se;
     }
-
-    bson_t *query = BCON_NEW("user_id", BCON_INT64(user_id));
-    bson_t *opts = BCON_NEW(
-        "projection", "{",
-        "reviews", "{",
-        "$slice", "[",
-        BCON_INT32(0), BCON_INT32(stop),
-        "]", "}", "}");
-    auto find_span = opentracing::Tracer::Global()->StartSpan(
-        "MongoFindUserReviews", {opentracing::ChildOf(&span->context())});
-    mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
-        collection, query, opts, nullptr);
-    find_span->Finish();
-    const bson_t *doc;
-    bool found = mongoc_cursor_next(cursor, &doc);
-    if (found) {
-      bson_iter_t iter_0;
-      bson_iter_t iter_1;
-      bson_iter_t review_id_child;
-      bson_iter_t timestamp_child;
-      int idx = 0;
-      bson_iter_init(&iter_0, doc);
-      bson_iter_init(&iter_1, doc);
-      while (bson_iter_find_descendant(&iter_0,
-          ("reviews." + std::to_string(idx) + ".review_id").c_str(),
-          &review_id_child)
-          && BSON_ITER_HOLDS_INT64(&review_id_child)
-          && bson_iter_find_descendant(&iter_1,
-              ("reviews." + std::to_string(idx) + ".timestamp").c_str(),
-              &timestamp_child)
-          && BSON_ITER_HOLDS_INT64(&timestamp_child)) {
-        auto curr_review_id = bson_iter_int64(&review_id_child);
-        auto curr_timestamp = bson_iter_int64(&timestamp_child);
-        if (idx >= mongo_start) {
-          review_ids.emplace_back(curr_review_id);
-        }
-        redis_update_map.insert(
-            {std::to_string(curr_timestamp), std::to_string(curr_review_id)});
-        bson_iter_init(&iter_0, doc);
-        bson_iter_init(&iter_1, doc);
-        idx++;
+    for (size_t idx = 0; idx < mongo_review_ids.size(); idx++) {
+      if (static_cast<int>(idx) >= mongo_start) {
+        review_ids.emplace_back(mongo_review_ids[idx]);
       }
+      redis_update_map.insert(
+          {std::to_string(mongo_timestamps[idx]),
+           std::to_string(mongo_review_ids[idx])});
     }
-    find_span->Finish();
-    bson_destroy(opts);
-    bson_destroy(query);
-    mongoc_cursor_destroy(cursor);
-    mongoc_collection_destroy(collection);
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
   }
 
   // std::future<std::vector<Review>> review_future = std::async(
@@ -303,13 +186,17 @@ void UserReviewHandler::ReadUserReviews(
         }
         std::vector<Review> _return_reviews;
         auto review_client = review_client_wrapper->GetClient();
-        try {
-          review_client->ReadReviews(
-              _return_reviews, req_id, review_ids, writer_text_map);
-        } catch (...) {
-          _review_client_pool->Remove(review_client_wrapper);
-          LOG(error) << "Failed to read review from review-storage-service";
-          throw;
+        {
+          auto rpc_trace_guard = _review_client_pool->StartRpcTrace("ReadReviews", review_client_wrapper);
+          try {
+            review_client->ReadReviews(
+                _return_reviews, req_id, review_ids, span.carrier());
+          } catch (...) {
+            rpc_trace_guard->set_status(1);
+            _review_client_pool->Remove(review_client_wrapper);
+            LOG(error) << "Failed to read review from review-storage-service";
+            throw;
+          }
         }
         _review_client_pool->Push(review_client_wrapper);
         _return = _return_reviews;
@@ -326,8 +213,7 @@ void UserReviewHandler::ReadUserReviews(
       throw se;
     }
     redis_client = redis_client_wrapper->GetClient();
-    auto redis_update_span = opentracing::Tracer::Global()->StartSpan(
-        "RedisUpdate", {opentracing::ChildOf(&span->context())});
+    auto redis_update_span = span.StartSpan("RedisUpdate");
     redis_client.AppendCommand("DEL %" PRId64, user_id);
     std::stringstream cmd;
     cmd << "ZADD " << user_id << " NX";
@@ -340,7 +226,7 @@ void UserReviewHandler::ReadUserReviews(
     del_reply->check_ok();
     zadd_reply->check_ok();
     _redis_client_pool->Push(redis_client_wrapper);
-    redis_update_span->Finish();
+    redis_update_span.Finish();
   }
 
   // try {
@@ -369,7 +255,7 @@ void UserReviewHandler::ReadUserReviews(
   //   _redis_client_pool->Push(redis_client_wrapper);
   // }
 
-  span->Finish();
+  span.Finish();
 
 }
 
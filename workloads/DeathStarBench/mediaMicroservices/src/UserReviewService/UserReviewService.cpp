@@ -40,7 +40,8 @@ int faas_init() {
   }
   bool r = false;
   while (!r) {
-    r = CreateIndex(mongodb_client, "user-review", "user_id", true);
+    r = CreateTimelineBucketIndex(mongodb_client, "user-review",
+                                  "user-review-bucket", "user_id");
     if (!r) {
       LOG(error) << "Failed to create mongodb index, try again";
       sleep(1);
@@ -67,12 +68,16 @@ int faas_create_func_worker(void* caller_context,
                                  review_storage_port, 0, 128, 1000, "ReviewStorageService", faas_worker,
                                  "UserReviewService", "ReviewStorageService");
 
+  int bucket_size = std::max(1, config_json["user-review-service"].value(
+      "review_bucket_size", 128));
+
   faas_worker->SetProcessor(
       std::make_shared<UserReviewServiceProcessor>(
           std::make_shared<UserReviewHandler>(
               redis_client_pool,
               mongodb_client_pool,
-              review_storage_client_pool)));
+              review_storage_client_pool,
+              bucket_size)));
  
     *worker_handle = faas_worker;
     return 0;
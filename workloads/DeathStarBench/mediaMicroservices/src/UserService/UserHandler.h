@@ -22,6 +22,7 @@
 #include "../../gen-cpp/ComposeReviewService.h"
 #include "../../third_party/PicoSHA2/picosha2.h"
 #include "../logger.h"
+#include "../utils_mongodb.h"
 
 // Custom Epoch (January 1, 2018 Midnight GMT = 2018-01-01T00:00:00Z)
 #define CUSTOM_EPOCH 1514764800000
@@ -136,14 +137,7 @@ void UserHandler::RegisterUser(
     const std::map<std::string, std::string> &carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "RegisterUser",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("RegisterUser", carrier, req_id);
 
   // Compose user_id
   _thread_lock->lock();
@@ -178,31 +172,24 @@ void UserHandler::RegisterUser(
   int64_t user_id = stoul(user_id_str, nullptr, 16) & 0x7FFFFFFFFFFFFFFF;
   LOG(debug) << "The user_id of the request " << req_id << " is " << user_id;
 
-  mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-      _mongodb_client_pool);
-  if (!mongodb_client) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-    se.message = "Failed to pop a client from MongoDB pool";
-    throw se;
-  }
-  auto collection = mongoc_client_get_collection(
-      mongodb_client, "user", "user");
+  MongoClientLease mongodb_client(_mongodb_client_pool);
+  auto collection = mongodb_client.Collection("user", "user");
 
   // Check if the username has existed in the database
   bson_t *query = bson_new();
   BSON_APPEND_UTF8(query, "username", username.c_str());
+  auto find_span = span.StartSpan("MongoFindUser");
   mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
       collection, query, nullptr, nullptr);
   const bson_t *doc;
-  if (mongoc_cursor_next(cursor, &doc)) {
+  bool found = mongoc_cursor_next(cursor, &doc);
+  find_span.Finish();
+  if (found) {
     bson_error_t error;
     if (mongoc_cursor_error (cursor, &error)) {
       LOG(warning) << error.message;
       bson_destroy(query);
       mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
       ServiceException se;
       se.errorCode = ErrorCode::SE_MONGODB_ERROR;
       se.message = error.message;
@@ -214,8 +201,6 @@ void UserHandler::RegisterUser(
       se.message = "User " + username + " already existed";
       bson_destroy(query);
       mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
       throw se;
     }
   } else {
@@ -230,8 +215,7 @@ void UserHandler::RegisterUser(
     BSON_APPEND_UTF8(new_doc, "password", password_hashed.c_str());
 
     bson_error_t error;
-    auto user_insert_span = opentracing::Tracer::Global()->StartSpan(
-        "MongoInsertUser", { opentracing::ChildOf(&span->context()) });
+    auto user_insert_span = span.StartSpan("MongoInsertUser");
     if (!mongoc_collection_insert_one(
         collection, new_doc, nullptr, nullptr, &error)) {
       LOG(error) << "Failed to insert user " << username
@@ -242,20 +226,17 @@ void UserHandler::RegisterUser(
           + error.message;
       bson_destroy(query);
       mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
       throw se;
     } else {
       LOG(info) << "User: " << username << " registered";
     }
-    user_insert_span->Finish();
+    user_insert_span.Finish();
     bson_destroy(new_doc);
   }
   mongoc_cursor_destroy(cursor);
-  mongoc_collection_destroy(collection);
-  mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+  mongodb_client.Release();
 
-  span->Finish();
+  span.Finish();
 }
 
 void UserHandler::RegisterUserWithId(
@@ -265,40 +246,26 @@ void UserHandler::RegisterUserWithId(
     const std::map<std::string, std::string> & carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "RegisterUserWithId",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
-
-  mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-      _mongodb_client_pool);
-  if (!mongodb_client) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-    se.message = "Failed to pop a client from MongoDB pool";
-    throw se;
-  }
-  auto collection = mongoc_client_get_collection(
-      mongodb_client, "user", "user");
+  RequestSpan span("RegisterUserWithId", carrier, req_id);
+
+  MongoClientLease mongodb_client(_mongodb_client_pool);
+  auto collection = mongodb_client.Collection("user", "user");
 
   // Check if the username has existed in the database
   bson_t *query = bson_new();
   BSON_APPEND_UTF8(query, "username", username.c_str());
+  auto find_span = span.StartSpan("MongoFindUser");
   mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
       collection, query, nullptr, nullptr);
   const bson_t *doc;
-  if (mongoc_cursor_next(cursor, &doc)) {
+  bool found = mongoc_cursor_next(cursor, &doc);
+  find_span.Finish();
+  if (found) {
     bson_error_t error;
     if (mongoc_cursor_error (cursor, &error)) {
       LOG(warning) << error.message;
       bson_destroy(query);
       mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
       ServiceException se;
       se.errorCode = ErrorCode::SE_MONGODB_ERROR;
       se.message = error.message;
@@ -310,8 +277,6 @@ void UserHandler::RegisterUserWithId(
       se.message = "User " + username + " already existed";
       bson_destroy(query);
       mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
       throw se;
     }
   } else {
@@ -326,8 +291,7 @@ void UserHandler::RegisterUserWithId(
     BSON_APPEND_UTF8(new_doc, "password", password_hashed.c_str());
 
     bson_error_t error;
-    auto user_insert_span = opentracing::Tracer::Global()->StartSpan(
-        "MongoInsertUser", { opentracing::ChildOf(&span->context()) });
+    auto user_insert_span = span.StartSpan("MongoInsertUser");
     if (!mongoc_collection_insert_one(
         collection, new_doc, nullptr, nullptr, &error)) {
       LOG(error) << "Failed to insert user " << username
@@ -338,20 +302,17 @@ void UserHandler::RegisterUserWithId(
           + error.message;
       bson_destroy(query);
       mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
       throw se;
     } else {
       LOG(info) << "User: " << username << " registered";
     }
-    user_insert_span->Finish();
+    user_insert_span.Finish();
     bson_destroy(new_doc);
   }
   mongoc_cursor_destroy(cursor);
-  mongoc_collection_destroy(collection);
-  mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+  mongodb_client.Release();
 
-  span->Finish();
+  span.Finish();
 }
 
 void UserHandler::UploadUserWithUsername(
@@ -359,14 +320,7 @@ void UserHandler::UploadUserWithUsername(
     const std::string &username,
     const std::map<std::string, std::string> & carrier) {
 
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UploadUserWithUsername",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("UploadUserWithUsername", carrier, req_id);
 
   size_t user_id_size;
   uint32_t memcached_flags;
@@ -379,12 +333,11 @@ void UserHandler::UploadUserWithUsername(
     throw se;
   }
 
-  auto id_get_span = opentracing::Tracer::Global()->StartSpan(
-      "MmcGetUserId", { opentracing::ChildOf(&span->context()) });
+  auto id_get_span = span.StartSpan("MmcGetUserId");
   std::string user_id_mmc;
   bool found_user_id_mmc;
   bool success = mc_client->Get(username+":user_id", &found_user_id_mmc, &user_id_mmc, &memcached_flags);
-  id_get_span->Finish();
+  id_get_span.Finish();
   if (!success) {
     _mc_client_pool->Push(mc_client);
     ServiceException se;
@@ -404,47 +357,28 @@ void UserHandler::UploadUserWithUsername(
   // If not cached in memcached
   else {
     LOG(debug) << "User_id not cached in Memcached";
-    mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-        _mongodb_client_pool);
-    if (!mongodb_client) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to pop a client from MongoDB pool";
-      throw se;
-    }
-    auto collection = mongoc_client_get_collection(
-        mongodb_client, "user", "user");
-    if (!collection) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to create collection user from DB user";
-      throw se;
-    }
+    MongoClientLease mongodb_client(_mongodb_client_pool);
+    auto collection = mongodb_client.Collection("user", "user");
     bson_t *query = bson_new();
     BSON_APPEND_UTF8(query, "username", username.c_str());
 
-    auto find_span = opentracing::Tracer::Global()->StartSpan(
-        "MongoFindUser", { opentracing::ChildOf(&span->context()) });
+    auto find_span = span.StartSpan("MongoFindUser");
     mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
         collection, query, nullptr, nullptr);
     const bson_t *doc;
     bool found = mongoc_cursor_next(cursor, &doc);
-    find_span->Finish();
+    find_span.Finish();
 
     if (!found) {
       bson_error_t error;
       if (mongoc_cursor_error (cursor, &error)) {
         LOG(warning) << error.message;
-        mongoc_collection_destroy(collection);
-        mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
         ServiceException se;
         se.errorCode = ErrorCode::SE_MONGODB_ERROR;
         se.message = error.message;
         throw se;
       } else {
         LOG(warning) << "User: " << username << " doesn't exist in MongoDB";
-        mongoc_collection_destroy(collection);
-        mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
         ServiceException se;
         se.errorCode = ErrorCode::SE_THRIFT_HANDLER_ERROR;
         se.message = "User: " + username + " is not registered";
@@ -460,8 +394,6 @@ void UserHandler::UploadUserWithUsername(
                    << username <<" was not found in the User object";
         bson_destroy(query);
         mongoc_cursor_destroy(cursor);
-        mongoc_collection_destroy(collection);
-        mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
         ServiceException se;
         se.errorCode = ErrorCode::SE_THRIFT_HANDLER_ERROR;
         se.message = "user_id attribute of user: " + username +
@@ -471,8 +403,7 @@ void UserHandler::UploadUserWithUsername(
     }
     bson_destroy(query);
     mongoc_cursor_destroy(cursor);
-    mongoc_collection_destroy(collection);
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+    mongodb_client.Release();
   }
 
   if (user_id) {
@@ -484,12 +415,16 @@ void UserHandler::UploadUserWithUsername(
       throw se;
     }
     auto compose_client = compose_client_wrapper->GetClient();
-    try {
-      compose_client->UploadUserId(req_id, user_id, writer_text_map);
-    } catch (...) {
-      _compose_client_pool->Remove(compose_client_wrapper);
-      LOG(error) << "Failed to upload movie_id to compose-review-service";
-      throw;
+    {
+      auto rpc_trace_guard = _compose_client_pool->StartRpcTrace("UploadUserId", compose_client_wrapper);
+      try {
+        compose_client->UploadUserId(req_id, user_id, span.carrier());
+      } catch (...) {
+        rpc_trace_guard->set_status(1);
+        _compose_client_pool->Remove(compose_client_wrapper);
+        LOG(error) << "Failed to upload movie_id to compose-review-service";
+        throw;
+      }
     }
     _compose_client_pool->Push(compose_client_wrapper);
   }
@@ -503,11 +438,10 @@ void UserHandler::UploadUserWithUsername(
   }
 
   if (user_id && !found_user_id_mmc) {
-    auto id_set_span = opentracing::Tracer::Global()->StartSpan(
-        "MmcSetUserId", { opentracing::ChildOf(&span->context()) });
+    auto id_set_span = span.StartSpan("MmcSetUserId");
     std::string user_id_str = std::to_string(user_id);
     bool success = mc_client->Set(username+":user_id", user_id_str, 0, 0);
-    id_set_span->Finish();
+    id_set_span.Finish();
     if (!success) {
       LOG(warning)
         << "Failed to set the user_id of user "
@@ -516,7 +450,7 @@ void UserHandler::UploadUserWithUsername(
   }
   _mc_client_pool->Push(mc_client);
 
-  span->Finish();
+  span.Finish();
 }
 
 void UserHandler::UploadUserWithUserId(
@@ -524,14 +458,7 @@ void UserHandler::UploadUserWithUserId(
     int64_t user_id,
     const std::map<std::string, std::string> &carrier) {
 
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UploadUserWithUserId",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("UploadUserWithUserId", carrier, req_id);
 
   auto compose_client_wrapper = _compose_client_pool->Pop();
   if (!compose_client_wrapper) {
@@ -541,16 +468,20 @@ void UserHandler::UploadUserWithUserId(
     throw se;
   }
   auto compose_client = compose_client_wrapper->GetClient();
-  try {
-    compose_client->UploadUserId(req_id, user_id, writer_text_map);
-  } catch (...) {
-    _compose_client_pool->Remove(compose_client_wrapper);
-    LOG(error) << "Failed to upload movie_id to compose-review-service";
-    throw;
+  {
+    auto rpc_trace_guard = _compose_client_pool->StartRpcTrace("UploadUserId", compose_client_wrapper);
+    try {
+      compose_client->UploadUserId(req_id, user_id, span.carrier());
+    } catch (...) {
+      rpc_trace_guard->set_status(1);
+      _compose_client_pool->Remove(compose_client_wrapper);
+      LOG(error) << "Failed to upload movie_id to compose-review-service";
+      throw;
+    }
   }
   _compose_client_pool->Push(compose_client_wrapper);
 
-  span->Finish();
+  span.Finish();
 
 }
 
@@ -562,14 +493,7 @@ void UserHandler::Login(
     const std::string &password,
     const std::map<std::string, std::string> &carrier) {
 
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "Login",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("Login", carrier, req_id);
 
   uint32_t memcached_flags;
 
@@ -581,12 +505,11 @@ void UserHandler::Login(
     throw se;
   }
 
-  auto pswd_get_span = opentracing::Tracer::Global()->StartSpan(
-      "MmcGetPassword", { opentracing::ChildOf(&span->context()) });
+  auto pswd_get_span = span.StartSpan("MmcGetPassword");
   std::string password_mmc;
   bool found_password_mmc;
   bool success = mc_client->Get(username+":password", &found_password_mmc, &password_mmc, &memcached_flags);
-  pswd_get_span->Finish();
+  pswd_get_span.Finish();
   if (!success) {
     ServiceException se;
     se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
@@ -595,12 +518,11 @@ void UserHandler::Login(
     throw se;
   }
 
-  auto salt_get_span = opentracing::Tracer::Global()->StartSpan(
-      "MmcGetSalt", { opentracing::ChildOf(&span->context()) });
+  auto salt_get_span = span.StartSpan("MmcGetSalt");
   std::string salt_mmc;
   bool found_salt_mmc;
   success = mc_client->Get(username+":salt", &found_salt_mmc, &salt_mmc, &memcached_flags);
-  salt_get_span->Finish();
+  salt_get_span.Finish();
   if (!success) {
     ServiceException se;
     se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
@@ -609,12 +531,11 @@ void UserHandler::Login(
     throw se;
   }
 
-  auto id_get_span = opentracing::Tracer::Global()->StartSpan(
-      "MmcGetUserId", { opentracing::ChildOf(&span->context()) });
+  auto id_get_span = span.StartSpan("MmcGetUserId");
   std::string user_id_mmc;
   bool found_user_id_mmc;
   success = mc_client->Get(username+":user_id", &found_user_id_mmc, &user_id_mmc, &memcached_flags);
-  id_get_span->Finish();
+  id_get_span.Finish();
   if (!success) {
     ServiceException se;
     se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
@@ -639,47 +560,28 @@ void UserHandler::Login(
     // If not cached in memcached
   else {
     LOG(debug) << "Password or salt or ID not cached in Memcached";
-    mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-        _mongodb_client_pool);
-    if (!mongodb_client) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to pop a client from MongoDB pool";
-      throw se;
-    }
-    auto collection = mongoc_client_get_collection(
-        mongodb_client, "user", "user");
-    if (!collection) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to create collection user from DB user";
-      throw se;
-    }
+    MongoClientLease mongodb_client(_mongodb_client_pool);
+    auto collection = mongodb_client.Collection("user", "user");
     bson_t *query = bson_new();
     BSON_APPEND_UTF8(query, "username", username.c_str());
 
-    auto find_span = opentracing::Tracer::Global()->StartSpan(
-        "MongoFindUser", { opentracing::ChildOf(&span->context()) });
+    auto find_span = span.StartSpan("MongoFindUser");
     mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
         collection, query, nullptr, nullptr);
     const bson_t *doc;
     bool found = mongoc_cursor_next(cursor, &doc);
-    find_span->Finish();
+    find_span.Finish();
 
     if (!found) {
       bson_error_t error;
       if (mongoc_cursor_error (cursor, &error)) {
         LOG(warning) << error.message;
-        mongoc_collection_destroy(collection);
-        mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
         ServiceException se;
         se.errorCode = ErrorCode::SE_MONGODB_ERROR;
         se.message = error.message;
         throw se;
       } else {
         LOG(warning) << "User: " << username << " doesn't exist in MongoDB";
-        mongoc_collection_destroy(collection);
-        mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
         ServiceException se;
         se.errorCode = ErrorCode::SE_UNAUTHORIZED;
         se.message = "User: " + username + " is not registered";
@@ -696,8 +598,6 @@ void UserHandler::Login(
                      << username <<" was not found in the User object";
           bson_destroy(query);
           mongoc_cursor_destroy(cursor);
-          mongoc_collection_destroy(collection);
-          mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
           ServiceException se;
           se.errorCode = ErrorCode::SE_THRIFT_HANDLER_ERROR;
           se.message = "Password attribute of user: " + username +
@@ -715,8 +615,6 @@ void UserHandler::Login(
                      << username <<" was not found in the User object";
           bson_destroy(query);
           mongoc_cursor_destroy(cursor);
-          mongoc_collection_destroy(collection);
-          mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
           ServiceException se;
           se.errorCode = ErrorCode::SE_THRIFT_HANDLER_ERROR;
           se.message = "Salt attribute of user: " + username +
@@ -734,8 +632,6 @@ void UserHandler::Login(
                      << username <<" was not found in the User object";
           bson_destroy(query);
           mongoc_cursor_destroy(cursor);
-          mongoc_collection_destroy(collection);
-          mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
           ServiceException se;
           se.errorCode = ErrorCode::SE_THRIFT_HANDLER_ERROR;
           se.message = "User_id attribute of user: " + username +
@@ -747,8 +643,7 @@ void UserHandler::Login(
 
     bson_destroy(query);
     mongoc_cursor_destroy(cursor);
-    mongoc_collection_destroy(collection);
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+    mongodb_client.Release();
   }
 
   if (user_id && !salt_str.empty() && !password_str.empty()) {
@@ -788,10 +683,9 @@ void UserHandler::Login(
   }
 
   if (!salt_str.empty() && !found_salt_mmc) {
-    auto salt_set_span = opentracing::Tracer::Global()->StartSpan(
-        "MmcSetSalt", { opentracing::ChildOf(&span->context()) });
+    auto salt_set_span = span.StartSpan("MmcSetSalt");
     bool success = mc_client->Set(username+":salt", salt_str, 0, 0);
-    salt_set_span->Finish();
+    salt_set_span.Finish();
 
     if (!success) {
       LOG(warning)
@@ -801,10 +695,9 @@ void UserHandler::Login(
   }
 
   if (!password_str.empty() && !found_password_mmc) {
-    auto pswd_set_span = opentracing::Tracer::Global()->StartSpan(
-        "MmcSetPassword", { opentracing::ChildOf(&span->context()) });
+    auto pswd_set_span = span.StartSpan("MmcSetPassword");
     bool success = mc_client->Set(username+":password", password_str, 0, 0);
-    pswd_set_span->Finish();
+    pswd_set_span.Finish();
     if (!success) {
       LOG(warning)
         << "Failed to set the password of user "
@@ -813,11 +706,10 @@ void UserHandler::Login(
   }
 
   if (user_id && !found_user_id_mmc) {
-    auto id_set_span = opentracing::Tracer::Global()->StartSpan(
-        "MmcSetUserId", { opentracing::ChildOf(&span->context()) });
+    auto id_set_span = span.StartSpan("MmcSetUserId");
     std::string user_id_str = std::to_string(user_id);
     bool success = mc_client->Set(username+":user_id", user_id_str, 0, 0);
-    id_set_span->Finish();
+    id_set_span.Finish();
     if (!success) {
       LOG(warning)
         << "Failed to set the user_id of user "
@@ -826,7 +718,7 @@ void UserHandler::Login(
   }
   _mc_client_pool->Push(mc_client);
 
-  span->Finish();
+  span.Finish();
 }
 
 /*
@@ -25,6 +25,8 @@ int faas_init() {
 
   std::string mc_addr = config_json["user-memcached"]["addr"];
   int mc_port = config_json["user-memcached"]["port"];
+  MCClient::SharedConnections() =
+      config_json["user-memcached"].value("shared_connections", 0);
   mc_client_pool = new ClientPool<MCClient>("user-memcached", mc_addr, mc_port, 1, 128, 1000);
   mongodb_client_pool = init_mongodb_client_pool(config_json, "user", 128);
 
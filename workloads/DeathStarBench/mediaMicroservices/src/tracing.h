@@ -3,16 +3,87 @@
 #ifndef MEDIA_MICROSERVICES_TRACING_H
 #define MEDIA_MICROSERVICES_TRACING_H
 
+#include <cstdlib>
+#include <map>
+#include <memory>
 #include <string>
+#include <utility>
+
+#include "LatencyStats.h"
+#include "probes.h"
+
+#ifndef DISABLE_TRACING
 #include <yaml-cpp/yaml.h>
 #include <jaegertracing/Tracer.h>
-
 #include <opentracing/propagation.h>
-#include <string>
-#include <map>
+#endif
+
+// Request tracing. A handler opens a RequestSpan from the carrier it was
+// called with, starts child spans from it and passes its carrier() on:
+//
+//   RequestSpan span("ReadMovieReviews", carrier, req_id);
+//   auto redis_span = span.StartSpan("RedisFind");
+//   ...
+//   redis_span.Finish();
+//   client->ReadReviews(_return, req_id, review_ids, span.carrier());
+//   span.Finish();
+//
+// Only sampled requests create spans. The sampled flag travels in the
+// uber-trace-id entry of the carrier, so a service called for an unsampled
+// request does no Extract, StartSpan or Inject and hands a shared
+// "unsampled" carrier to the services it calls. Building with
+// -DDISABLE_TRACING (cmake -DENABLE_TRACING=OFF) compiles tracing out.
+//
+// Either way every span fires the stage probes of probes.h, and a sample of
+// spans is timed into the latency histogram of its (request span, span)
+// names, see LatencyStats.h.
 
 namespace media_service {
 
+// What a span keeps without tracing: its timer and probes. A null stage is
+// the request itself.
+class SpanStage {
+ public:
+  SpanStage(int64_t req_id, const char *method, const char *stage)
+      : _req_id(req_id), _method(method), _stage(stage), _running(true),
+        _timer(GetLatencyHistogram(method, stage ? stage : "total")) {
+    if (stage) {
+      PROBE3(stage__start, req_id, method, stage);
+    } else {
+      PROBE2(request__start, req_id, method);
+    }
+  }
+  SpanStage(SpanStage &&other)
+      : _req_id(other._req_id), _method(other._method), _stage(other._stage),
+        _running(other._running), _timer(std::move(other._timer)) {
+    other._running = false;
+  }
+  ~SpanStage() { Stop(); }
+
+  int64_t req_id() const { return _req_id; }
+  void Stop() {
+    if (!_running) {
+      return;
+    }
+    _running = false;
+    _timer.Stop();
+    if (_stage) {
+      PROBE3(stage__done, _req_id, _method, _stage);
+    } else {
+      PROBE2(request__done, _req_id, _method);
+    }
+  }
+
+ private:
+  int64_t _req_id;
+  const char *_method;
+  const char *_stage;
+  bool _running;
+  StageTimer _timer;
+};
+
+#ifndef DISABLE_TRACING
+
 using opentracing::expected;
 using opentracing::string_view;
 
@@ -49,17 +120,194 @@ class TextMapWriter : public opentracing::TextMapWriter {
   std::map<std::string, std::string>& _text_map;
 };
 
+namespace tracing_detail {
+
+// jaegertracing::kTraceContextHeaderName
+const char kTraceContextHeader[] = "uber-trace-id";
+
+// false until SetUpTracer() installs a tracer that is not disabled
+bool tracer_enabled = false;
+
+// The context is "<trace-id>:<span-id>:<parent-id>:<flags>" and bit 0 of
+// the flags is "sampled". -1 if the carrier has no context.
+int SampledFlag(const std::map<std::string, std::string> &carrier) {
+  auto it = carrier.find(kTraceContextHeader);
+  if (it == carrier.end()) {
+    return -1;
+  }
+  auto pos = it->second.rfind(':');
+  if (pos == std::string::npos) {
+    return -1;
+  }
+  const char *flags = it->second.c_str() + pos + 1;
+  char *end;
+  unsigned long value = strtoul(flags, &end, 16);
+  if (end == flags) {
+    return -1;
+  }
+  return value & 1;
+}
+
+const std::map<std::string, std::string> &UnsampledCarrier() {
+  static const std::map<std::string, std::string> carrier{
+      {kTraceContextHeader, "0:0:0:0"}};
+  return carrier;
+}
+
+bool IsSampled(const opentracing::SpanContext &context) {
+  auto jaeger_context =
+      dynamic_cast<const jaegertracing::SpanContext *>(&context);
+  return jaeger_context && jaeger_context->isSampled();
+}
+
+} // namespace tracing_detail
+
+class TraceSpan {
+ public:
+  TraceSpan(SpanStage stage, std::unique_ptr<opentracing::Span> span)
+      : _stage(std::move(stage)), _span(std::move(span)) {}
+
+  void Finish() {
+    _stage.Stop();
+    if (_span) {
+      _span->Finish();
+    }
+  }
+
+ private:
+  SpanStage _stage;
+  std::unique_ptr<opentracing::Span> _span;
+};
+
+class RequestSpan {
+ public:
+  RequestSpan(const char *operation_name,
+              const std::map<std::string, std::string> &carrier,
+              int64_t req_id);
+  RequestSpan(const RequestSpan&) = delete;
+  RequestSpan& operator=(const RequestSpan&) = delete;
+
+  bool sampled() const { return _span != nullptr; }
+  // The context to send with downstream requests.
+  const std::map<std::string, std::string> &carrier() const {
+    return _span ? _carrier : tracing_detail::UnsampledCarrier();
+  }
+  TraceSpan StartSpan(const char *operation_name) const;
+  void Finish() {
+    _stage.Stop();
+    if (_span) {
+      _span->Finish();
+    }
+  }
+
+ private:
+  const char *_operation_name;
+  SpanStage _stage;
+  std::unique_ptr<opentracing::Span> _span;
+  std::map<std::string, std::string> _carrier;
+};
+
+RequestSpan::RequestSpan(const char *operation_name,
+                         const std::map<std::string, std::string> &carrier,
+                         int64_t req_id)
+    : _operation_name(operation_name),
+      _stage(req_id, operation_name, nullptr) {
+  probes_detail::current_req_id = req_id;
+  probes_detail::current_method = operation_name;
+  if (!tracing_detail::tracer_enabled) {
+    return;
+  }
+  int sampled = tracing_detail::SampledFlag(carrier);
+  if (sampled == 0) {
+    return;
+  }
+  auto tracer = opentracing::Tracer::Global();
+  std::unique_ptr<opentracing::SpanContext> parent;
+  if (sampled == 1) {
+    TextMapReader reader(carrier);
+    auto extracted = tracer->Extract(reader);
+    if (extracted) {
+      parent = std::move(*extracted);
+    }
+  }
+  auto span = tracer->StartSpan(operation_name,
+                                {opentracing::ChildOf(parent.get())});
+  // without a sampled parent the tracer has just made the decision
+  if (!span || (!parent && !tracing_detail::IsSampled(span->context()))) {
+    return;
+  }
+  TextMapWriter writer(_carrier);
+  tracer->Inject(span->context(), writer);
+  _span = std::move(span);
+}
+
+TraceSpan RequestSpan::StartSpan(const char *operation_name) const {
+  SpanStage stage(_stage.req_id(), _operation_name, operation_name);
+  if (!_span) {
+    return TraceSpan(std::move(stage), nullptr);
+  }
+  return TraceSpan(std::move(stage), opentracing::Tracer::Global()->StartSpan(
+      operation_name, {opentracing::ChildOf(&_span->context())}));
+}
+
 void SetUpTracer(
     const std::string &config_file_path,
     const std::string &service) {
+  SetUpLatencyStats(service);
   auto configYAML = YAML::LoadFile(config_file_path);
   auto config = jaegertracing::Config::parse(configYAML);
   auto tracer = jaegertracing::Tracer::make(
       service, config, jaegertracing::logging::consoleLogger());
   opentracing::Tracer::InitGlobal(
       std::static_pointer_cast<opentracing::Tracer>(tracer));
+  tracing_detail::tracer_enabled = !config.disabled();
+}
+
+#else  // DISABLE_TRACING
+
+class TraceSpan {
+ public:
+  explicit TraceSpan(SpanStage stage) : _stage(std::move(stage)) {}
+
+  void Finish() { _stage.Stop(); }
+
+ private:
+  SpanStage _stage;
+};
+
+class RequestSpan {
+ public:
+  RequestSpan(const char *operation_name,
+              const std::map<std::string, std::string> &, int64_t req_id)
+      : _operation_name(operation_name),
+        _stage(req_id, operation_name, nullptr) {
+    probes_detail::current_req_id = req_id;
+    probes_detail::current_method = operation_name;
+  }
+  RequestSpan(const RequestSpan&) = delete;
+  RequestSpan& operator=(const RequestSpan&) = delete;
+
+  bool sampled() const { return false; }
+  const std::map<std::string, std::string> &carrier() const {
+    static const std::map<std::string, std::string> empty;
+    return empty;
+  }
+  TraceSpan StartSpan(const char *operation_name) const {
+    return TraceSpan(
+        SpanStage(_stage.req_id(), _operation_name, operation_name));
+  }
+  void Finish() { _stage.Stop(); }
+
+ private:
+  const char *_operation_name;
+  SpanStage _stage;
+};
+
+void SetUpTracer(const std::string &, const std::string &service) {
+  SetUpLatencyStats(service);
 }
 
+#endif // DISABLE_TRACING
 
 } //namespace media_service
 
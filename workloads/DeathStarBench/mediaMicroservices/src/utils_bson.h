@@ -0,0 +1,91 @@
+#ifndef MEDIA_SERVICE_MICROSERVICES_SRC_UTILS_BSON_H_
+#define MEDIA_SERVICE_MICROSERVICES_SRC_UTILS_BSON_H_
+
+#include <cstring>
+#include <vector>
+
+#include <bson/bson.h>
+
+namespace media_service {
+
+// Integers are accepted as int32, int64 or double.
+bool BsonIterInt64(const bson_iter_t *iter, int64_t *value) {
+  switch (bson_iter_type(iter)) {
+    case BSON_TYPE_INT64:
+      *value = bson_iter_int64(iter);
+      return true;
+    case BSON_TYPE_INT32:
+      *value = bson_iter_int32(iter);
+      return true;
+    case BSON_TYPE_DOUBLE:
+      *value = static_cast<int64_t>(bson_iter_double(iter));
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Reads an array of {<id_key>: int64, "timestamp": int64} sub-documents,
+// such as a movie's or a user's "reviews", in one pass. Stops at the first
+// entry without both fields, as the old
+// bson_iter_find_descendant("<array>.N.<field>") loops did. Returns the
+// number of entries, 0 if `array_key` is missing.
+size_t ReadBsonIdTimestampArray(const bson_t *doc, const char *array_key,
+                                const char *id_key,
+                                std::vector<int64_t> *ids,
+                                std::vector<int64_t> *timestamps) {
+  bson_iter_t iter;
+  bson_iter_t array;
+  if (!bson_iter_init_find(&iter, doc, array_key) ||
+      !BSON_ITER_HOLDS_ARRAY(&iter) || !bson_iter_recurse(&iter, &array)) {
+    return 0;
+  }
+  // upper bound from the array's size: an entry takes at least
+  // type + "N\0" + document header + the two int64 elements
+  uint32_t array_len;
+  const uint8_t *array_data;
+  bson_iter_array(&iter, &array_len, &array_data);
+  size_t min_entry_len = 3 + 5 + (2 + strlen(id_key) + 8) + (2 + 9 + 8);
+  ids->reserve(ids->size() + array_len / min_entry_len);
+  timestamps->reserve(timestamps->size() + array_len / min_entry_len);
+
+  size_t n = 0;
+  while (bson_iter_next(&array)) {
+    bson_iter_t entry;
+    if (!BSON_ITER_HOLDS_DOCUMENT(&array) ||
+        !bson_iter_recurse(&array, &entry)) {
+      break;
+    }
+    bool has_id = false;
+    bool has_timestamp = false;
+    int64_t id;
+    int64_t timestamp;
+    while (bson_iter_next(&entry)) {
+      const char *key = bson_iter_key(&entry);
+      if (!has_id && strcmp(key, id_key) == 0) {
+        if (!BSON_ITER_HOLDS_INT64(&entry)) {
+          break;
+        }
+        id = bson_iter_int64(&entry);
+        has_id = true;
+      } else if (!has_timestamp && strcmp(key, "timestamp") == 0) {
+        if (!BSON_ITER_HOLDS_INT64(&entry)) {
+          break;
+        }
+        timestamp = bson_iter_int64(&entry);
+        has_timestamp = true;
+      }
+    }
+    if (!has_id || !has_timestamp) {
+      break;
+    }
+    ids->push_back(id);
+    timestamps->push_back(timestamp);
+    n++;
+  }
+  return n;
+}
+
+} // namespace media_service
+
+#endif //MEDIA_SERVICE_MICROSERVICES_SRC_UTILS_BSON_H_
@@ -52,6 +52,11 @@ class AmqpLibeventHandler {
     return &evhandler_;
   }
 
+  struct event_base* GetEventBase()
+  {
+    return evbase_.get();
+  }
+
   bool GetIsRunning() {
     return is_running_;
   }
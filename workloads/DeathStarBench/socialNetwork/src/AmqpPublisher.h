@@ -0,0 +1,292 @@
+#ifndef SOCIAL_NETWORK_MICROSERVICES_AMQPPUBLISHER_H
+#define SOCIAL_NETWORK_MICROSERVICES_AMQPPUBLISHER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "AmqpLibeventHandler.h"
+#include "logger.h"
+
+namespace social_network {
+
+// Publishes to one queue from a background thread. Publish() only queues the
+// message and returns; the thread owns the connection and sends whatever has
+// queued up since its last pass in one go, on a channel in confirm mode.
+// Each message is kept until the broker acks it. A nack, or a connection
+// that drops, puts the unconfirmed messages back at the front of the queue
+// to be sent again, so they are lost only with the process.
+//
+// At most `max_unconfirmed` messages are on the wire. When the broker falls
+// behind, the rest wait in the queue, and once `max_queued` are waiting
+// Publish() blocks for up to `max_block_ms` for room and then fails.
+class AmqpPublisher {
+ public:
+  AmqpPublisher(const std::string &addr, int port, const std::string &queue,
+                int max_unconfirmed, int max_queued, int max_block_ms);
+  ~AmqpPublisher();
+  AmqpPublisher(const AmqpPublisher&) = delete;
+  AmqpPublisher& operator=(const AmqpPublisher&) = delete;
+
+  // False if the queue stayed full for max_block_ms.
+  bool Publish(std::string body);
+
+ private:
+  void Run();
+  void RunConnection();
+  void Flush();
+  void OnAck(uint64_t delivery_tag, bool multiple);
+  void OnNack(uint64_t delivery_tag, bool multiple);
+  void Requeue(std::deque<std::pair<uint64_t, std::string>> *messages);
+  void Wake();
+  static void OnWake(evutil_socket_t fd, short events, void *arg);
+  static void OnHeartbeat(evutil_socket_t fd, short events, void *arg);
+
+  std::string _addr;
+  int _port;
+  std::string _queue;
+  size_t _max_unconfirmed;
+  size_t _max_queued;
+  std::chrono::milliseconds _max_block;
+  int _wake_fd;
+
+  std::mutex _mutex;
+  std::condition_variable _cv;  // the thread, between connections
+  std::condition_variable _room_cv;  // blocked publishers
+  std::deque<std::string> _pending;
+  std::atomic<bool> _stop{false};
+
+  // Only touched by the thread, valid while it is connected
+  AmqpLibeventHandler *_handler = nullptr;
+  AMQP::TcpConnection *_connection = nullptr;
+  AMQP::TcpChannel *_channel = nullptr;
+  bool _confirming = false;
+  uint64_t _next_tag = 1;
+  std::deque<std::pair<uint64_t, std::string>> _unconfirmed;
+
+  std::thread _thread;
+};
+
+AmqpPublisher::AmqpPublisher(const std::string &addr, int port,
+                             const std::string &queue, int max_unconfirmed,
+                             int max_queued, int max_block_ms)
+    : _addr(addr),
+      _port(port),
+      _queue(queue),
+      _max_unconfirmed(std::max(1, max_unconfirmed)),
+      _max_queued(std::max(1, max_queued)),
+      _max_block(std::max(0, max_block_ms)) {
+  _wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  _thread = std::thread(&AmqpPublisher::Run, this);
+}
+
+AmqpPublisher::~AmqpPublisher() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+  _cv.notify_all();
+  _room_cv.notify_all();
+  Wake();
+  _thread.join();
+  close(_wake_fd);
+}
+
+bool AmqpPublisher::Publish(std::string body) {
+  bool wake;
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_pending.size() >= _max_queued && !_room_cv.wait_for(
+        lock, _max_block, [this] {
+          return _stop || _pending.size() < _max_queued;
+        })) {
+      return false;
+    }
+    _pending.emplace_back(std::move(body));
+    // the thread drains the whole queue, only the first message wakes it
+    wake = _pending.size() == 1;
+  }
+  if (wake) {
+    Wake();
+  }
+  return true;
+}
+
+void AmqpPublisher::Wake() {
+  uint64_t one = 1;
+  if (write(_wake_fd, &one, sizeof(one)) < 0) {
+    // the counter is already non-zero, the thread will wake anyway
+  }
+}
+
+void AmqpPublisher::Run() {
+  while (!_stop) {
+    RunConnection();
+    // whatever the broker did not confirm goes out again on the next one
+    Requeue(&_unconfirmed);
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_cv.wait_for(lock, std::chrono::seconds(1),
+                     [this] { return _stop.load(); })) {
+      break;
+    }
+    LOG(warning) << "Reconnecting to " << _queue << " at " << _addr << ":"
+                 << _port;
+  }
+}
+
+void AmqpPublisher::RunConnection() {
+  AmqpLibeventHandler handler;
+  AMQP::TcpConnection connection(handler, AMQP::Address(
+      _addr, _port, AMQP::Login("guest", "guest"), "/"));
+  AMQP::TcpChannel channel(&connection);
+  _handler = &handler;
+  _connection = &connection;
+  _channel = &channel;
+  _confirming = false;
+
+  channel.onError([this](const char *message) {
+    LOG(error) << "Channel error on " << _queue << ": " << message;
+    _confirming = false;
+    _handler->Stop();
+  });
+  // Declared once per connection, with the flags of the consumer
+  channel.declareQueue(_queue, AMQP::durable);
+  channel.confirmSelect()
+      .onAck([this](uint64_t delivery_tag, bool multiple) {
+        OnAck(delivery_tag, multiple);
+      })
+      .onNack([this](uint64_t delivery_tag, bool multiple, bool requeue) {
+        OnNack(delivery_tag, multiple);
+      })
+      .onSuccess([this]() {
+        _confirming = true;
+        _next_tag = 1;
+        Flush();
+      });
+
+  AmqpLibeventHandler::EventPtrT wake_event(
+      event_new(handler.GetEventBase(), _wake_fd, EV_READ | EV_PERSIST,
+                &AmqpPublisher::OnWake, this),
+      event_free);
+  event_add(wake_event.get(), nullptr);
+  AmqpLibeventHandler::EventPtrT heartbeat_event(
+      event_new(handler.GetEventBase(), -1, EV_PERSIST,
+                &AmqpPublisher::OnHeartbeat, this),
+      event_free);
+  struct timeval heartbeat_interval = {30, 0};
+  event_add(heartbeat_event.get(), &heartbeat_interval);
+
+  if (!_stop) {
+    handler.Start();
+  }
+
+  wake_event.reset();
+  heartbeat_event.reset();
+  _confirming = false;
+  _handler = nullptr;
+  _connection = nullptr;
+  _channel = nullptr;
+  connection.close();
+}
+
+void AmqpPublisher::OnWake(evutil_socket_t fd, short events, void *arg) {
+  auto publisher = reinterpret_cast<AmqpPublisher *>(arg);
+  uint64_t count;
+  if (read(fd, &count, sizeof(count)) < 0) {
+    // spurious wake-up
+  }
+  if (publisher->_stop) {
+    publisher->_handler->Stop();
+    return;
+  }
+  publisher->Flush();
+}
+
+void AmqpPublisher::OnHeartbeat(evutil_socket_t fd, short events, void *arg) {
+  auto publisher = reinterpret_cast<AmqpPublisher *>(arg);
+  LOG(debug) << "Heartbeat sent";
+  publisher->_connection->heartbeat();
+}
+
+void AmqpPublisher::Flush() {
+  if (!_confirming) {
+    return;
+  }
+  std::deque<std::string> batch;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    while (!_pending.empty() &&
+           _unconfirmed.size() + batch.size() < _max_unconfirmed) {
+      batch.emplace_back(std::move(_pending.front()));
+      _pending.pop_front();
+    }
+  }
+  if (batch.empty()) {
+    return;
+  }
+  _room_cv.notify_all();
+  for (auto &body : batch) {
+    // a failed publish is never acked, it goes out again after reconnecting
+    if (!_channel->publish("", _queue, body.data(), body.size())) {
+      _handler->Stop();
+    }
+    _unconfirmed.emplace_back(_next_tag++, std::move(body));
+  }
+}
+
+void AmqpPublisher::OnAck(uint64_t delivery_tag, bool multiple) {
+  if (multiple) {
+    while (!_unconfirmed.empty() &&
+           _unconfirmed.front().first <= delivery_tag) {
+      _unconfirmed.pop_front();
+    }
+  } else {
+    auto it = std::find_if(_unconfirmed.begin(), _unconfirmed.end(),
+        [delivery_tag](const std::pair<uint64_t, std::string> &message) {
+          return message.first == delivery_tag;
+        });
+    if (it != _unconfirmed.end()) {
+      _unconfirmed.erase(it);
+    }
+  }
+  Flush();
+}
+
+void AmqpPublisher::OnNack(uint64_t delivery_tag, bool multiple) {
+  std::deque<std::pair<uint64_t, std::string>> nacked;
+  auto it = _unconfirmed.begin();
+  while (it != _unconfirmed.end() && it->first <= delivery_tag) {
+    if (multiple || it->first == delivery_tag) {
+      nacked.emplace_back(std::move(*it));
+      it = _unconfirmed.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  LOG(warning) << "Broker nacked " << nacked.size() << " messages to "
+               << _queue << ", sending them again";
+  Requeue(&nacked);
+  Flush();
+}
+
+void AmqpPublisher::Requeue(
+    std::deque<std::pair<uint64_t, std::string>> *messages) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  while (!messages->empty()) {
+    _pending.emplace_front(std::move(messages->back().second));
+    messages->pop_back();
+  }
+}
+
+} // namespace social_network
+
+#endif //SOCIAL_NETWORK_MICROSERVICES_AMQPPUBLISHER_H
@@ -0,0 +1,394 @@
+#ifndef SOCIAL_NETWORK_MICROSERVICES_SRC_COMPOSEPOSTSERVICE_COMPOSEBUFFER_H_
+#define SOCIAL_NETWORK_MICROSERVICES_SRC_COMPOSEPOSTSERVICE_COMPOSEBUFFER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../logger.h"
+#include "ComposeComponents.h"
+
+namespace social_network {
+
+// A component in the buffer is kept as a record: a component byte, a
+// native-endian 32-bit length and the component as EncodeComposeComponent
+// wrote it, so the buffer never parses them.
+void AppendComposeRecord(std::string *records, ComposeComponent component,
+                         const std::string &value) {
+  uint32_t len = value.size();
+  records->push_back(static_cast<char>(component));
+  records->append(reinterpret_cast<const char *>(&len), sizeof(len));
+  records->append(value);
+}
+
+// Calls fn(component, data, len) for each record of `records`.
+template<class Fn>
+void ForEachComposeRecord(const std::string &records, Fn fn) {
+  size_t pos = 0;
+  while (pos + 1 + sizeof(uint32_t) <= records.size()) {
+    auto component = static_cast<ComposeComponent>(records[pos]);
+    uint32_t len;
+    memcpy(&len, records.data() + pos + 1, sizeof(len));
+    pos += 1 + sizeof(len);
+    if (pos + len > records.size()) {
+      break;
+    }
+    fn(component, records.data() + pos, len);
+    pos += len;
+  }
+}
+
+// Decodes `records` into the fields of `post` and, unless it is nullptr,
+// `carrier` (the first carrier seen). Returns the mask of components found.
+uint32_t DecodeComposeRecords(const std::string &records, Post *post,
+                              std::map<std::string, std::string> *carrier) {
+  uint32_t mask = 0;
+  ForEachComposeRecord(records, [&](ComposeComponent component,
+                                    const char *data, uint32_t len) {
+    if (component > COMPOSE_CARRIER) {
+      return;
+    }
+    if (component != COMPOSE_CARRIER ||
+        (carrier != nullptr && !(mask & (1u << COMPOSE_CARRIER)))) {
+      DecodeComposeComponent(component, data, len, post, carrier);
+    }
+    mask |= 1u << component;
+  });
+  return mask;
+}
+
+// Rendezvous for the components of a post in a shared memory segment, so
+// every ComposePostService worker process on the host sees the components
+// the others received. The segment is split into shards of kSlotsPerShard
+// slots, each under a process-shared robust mutex; a req_id hashes to a
+// shard and probes its slots linearly.
+//
+// A post whose components all arrive on this host completes here without
+// touching Redis. Entries that stay incomplete for `ttl_ms` (components
+// sent to a ComposePostService on another host) or do not fit their slot are
+// handed back as records for the caller to spill to Redis, where they meet
+// the rest through the usual hash.
+class ComposeBuffer {
+ public:
+  enum AddResult {
+    PENDING,   // stored, other components are still missing
+    COMPLETE,  // *records holds every component of the post
+    SPILL,     // no room, *records holds the entry's components to spill
+  };
+
+  using SpillFn = std::function<void(int64_t, const std::string &)>;
+
+  // Maps the segment `name`, creating it if needed. Returns nullptr if it
+  // cannot be mapped or was created with another geometry.
+  static ComposeBuffer *Open(const std::string &name, int num_slots,
+                             int slot_bytes, int ttl_ms);
+
+  ComposeBuffer(const ComposeBuffer &) = delete;
+  ComposeBuffer &operator=(const ComposeBuffer &) = delete;
+
+  // Adds the records of one component of `req_id`.
+  AddResult Add(int64_t req_id, ComposeComponent component,
+                const std::string &component_records, std::string *records);
+
+  // Starts a thread that hands expired entries to `spill`. Sweeps are shared
+  // between the processes mapping the segment, one runs per ttl_ms / 2.
+  void StartSweeper(SpillFn spill);
+
+ private:
+  static const uint64_t kMagic = 0x73636f6d706f7301ULL;
+  static const uint32_t kSlotsPerShard = 64;
+
+  struct SegmentHeader {
+    uint64_t magic;
+    uint32_t num_shards;
+    uint32_t slot_bytes;
+    std::atomic<uint32_t> state;  // 0 new, 1 initializing, 2 ready
+    std::atomic<int64_t> next_sweep_ms;
+    std::atomic<uint64_t> num_completed;
+    std::atomic<uint64_t> num_spilled;
+  };
+
+  struct SlotHeader {
+    int64_t req_id;
+    int64_t expire_ms;
+    uint32_t mask;  // 0 for a free slot
+    uint32_t used;
+  };
+
+  struct alignas(64) Shard {
+    pthread_mutex_t mutex;
+    std::atomic<uint32_t> num_pending;
+    SlotHeader slots[kSlotsPerShard];
+  };
+
+  class ShardLock {
+   public:
+    explicit ShardLock(Shard *shard);
+    ~ShardLock() { pthread_mutex_unlock(&_shard->mutex); }
+   private:
+    Shard *_shard;
+  };
+
+  ComposeBuffer(void *segment, int ttl_ms);
+
+  static int64_t NowMs();
+  static uint64_t Hash(int64_t req_id);
+  static size_t SegmentSize(uint32_t num_shards, uint32_t slot_bytes);
+  char *Payload(uint32_t shard, uint32_t slot);
+  void TakeRecords(Shard *shard, uint32_t shard_idx, uint32_t slot,
+                   std::string *records);
+  void Sweep(const SpillFn &spill);
+
+  SegmentHeader *_header;
+  Shard *_shards;
+  char *_payloads;
+  int _ttl_ms;
+};
+
+ComposeBuffer::ShardLock::ShardLock(Shard *shard) : _shard(shard) {
+  if (pthread_mutex_lock(&shard->mutex) == EOWNERDEAD) {
+    // A worker died holding the lock. Slot headers are updated after their
+    // payload, so what it left behind is still consistent.
+    pthread_mutex_consistent(&shard->mutex);
+  }
+}
+
+ComposeBuffer::ComposeBuffer(void *segment, int ttl_ms)
+    : _ttl_ms(ttl_ms) {
+  _header = reinterpret_cast<SegmentHeader *>(segment);
+  _shards = reinterpret_cast<Shard *>(
+      reinterpret_cast<char *>(segment) + sizeof(Shard));
+  _payloads = reinterpret_cast<char *>(_shards + _header->num_shards);
+}
+
+int64_t ComposeBuffer::NowMs() {
+  // CLOCK_MONOTONIC is shared by all processes on the host
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint64_t ComposeBuffer::Hash(int64_t req_id) {
+  uint64_t h = static_cast<uint64_t>(req_id);
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+  return h;
+}
+
+size_t ComposeBuffer::SegmentSize(uint32_t num_shards, uint32_t slot_bytes) {
+  // the header takes the place of one shard to keep shards aligned
+  return sizeof(Shard) * (num_shards + 1) +
+      static_cast<size_t>(num_shards) * kSlotsPerShard * slot_bytes;
+}
+
+char *ComposeBuffer::Payload(uint32_t shard, uint32_t slot) {
+  return _payloads +
+      (static_cast<size_t>(shard) * kSlotsPerShard + slot) * _header->slot_bytes;
+}
+
+ComposeBuffer *ComposeBuffer::Open(const std::string &name, int num_slots,
+                                   int slot_bytes, int ttl_ms) {
+  static_assert(sizeof(SegmentHeader) <= sizeof(Shard),
+                "SegmentHeader must fit in the first shard");
+  uint32_t num_shards = (std::max(num_slots, 1) + kSlotsPerShard - 1) /
+      kSlotsPerShard;
+  slot_bytes = (std::max(slot_bytes, 256) + 63) & ~63;
+  size_t size = SegmentSize(num_shards, slot_bytes);
+
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+  if (fd == -1) {
+    LOG(error) << "Failed to open compose buffer " << name << ": "
+               << strerror(errno);
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      (static_cast<size_t>(st.st_size) < size && ftruncate(fd, size) != 0)) {
+    LOG(error) << "Failed to size compose buffer " << name << ": "
+               << strerror(errno);
+    close(fd);
+    return nullptr;
+  }
+  void *segment = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       fd, 0);
+  close(fd);
+  if (segment == MAP_FAILED) {
+    LOG(error) << "Failed to map compose buffer " << name << ": "
+               << strerror(errno);
+    return nullptr;
+  }
+
+  // The first process to get here initializes the segment, the others wait
+  // for it. A fresh segment is zero-filled.
+  auto header = reinterpret_cast<SegmentHeader *>(segment);
+  uint32_t state = 0;
+  if (header->state.compare_exchange_strong(state, 1)) {
+    header->magic = kMagic;
+    header->num_shards = num_shards;
+    header->slot_bytes = slot_bytes;
+    header->next_sweep_ms = 0;
+    auto shards = reinterpret_cast<Shard *>(
+        reinterpret_cast<char *>(segment) + sizeof(Shard));
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    for (uint32_t i = 0; i < num_shards; i++) {
+      pthread_mutex_init(&shards[i].mutex, &attr);
+    }
+    pthread_mutexattr_destroy(&attr);
+    header->state = 2;
+  } else {
+    auto deadline = NowMs() + 1000;
+    while (header->state.load() != 2 && NowMs() < deadline) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  if (header->state.load() != 2 || header->magic != kMagic ||
+      header->num_shards != num_shards ||
+      header->slot_bytes != static_cast<uint32_t>(slot_bytes)) {
+    LOG(error) << "Compose buffer " << name
+               << " is not initialized or has another geometry";
+    munmap(segment, size);
+    return nullptr;
+  }
+  LOG(info) << "Compose buffer " << name << ": " << num_shards * kSlotsPerShard
+            << " slots of " << slot_bytes << " bytes";
+  return new ComposeBuffer(segment, ttl_ms);
+}
+
+void ComposeBuffer::TakeRecords(Shard *shard, uint32_t shard_idx,
+                                uint32_t slot, std::string *records) {
+  auto &header = shard->slots[slot];
+  records->assign(Payload(shard_idx, slot), header.used);
+  header.mask = 0;
+  shard->num_pending--;
+}
+
+ComposeBuffer::AddResult ComposeBuffer::Add(
+    int64_t req_id, ComposeComponent component,
+    const std::string &component_records, std::string *records) {
+  uint64_t hash = Hash(req_id);
+  uint32_t shard_idx = hash % _header->num_shards;
+  Shard *shard = &_shards[shard_idx];
+  uint32_t start = (hash >> 32) % kSlotsPerShard;
+
+  ShardLock lock(shard);
+  int free_slot = -1;
+  for (uint32_t i = 0; i < kSlotsPerShard; i++) {
+    uint32_t slot = (start + i) % kSlotsPerShard;
+    auto &header = shard->slots[slot];
+    if (header.mask == 0) {
+      if (free_slot == -1) {
+        free_slot = slot;
+      }
+      continue;
+    }
+    if (header.req_id != req_id) {
+      continue;
+    }
+    uint32_t mask = header.mask | (1u << component);
+    if (mask == kAllComposeComponents) {
+      TakeRecords(shard, shard_idx, slot, records);
+      records->append(component_records);
+      _header->num_completed++;
+      return COMPLETE;
+    }
+    if (header.used + component_records.size() > _header->slot_bytes) {
+      TakeRecords(shard, shard_idx, slot, records);
+      records->append(component_records);
+      _header->num_spilled++;
+      return SPILL;
+    }
+    memcpy(Payload(shard_idx, slot) + header.used, component_records.data(),
+           component_records.size());
+    header.used += component_records.size();
+    header.mask = mask;
+    return PENDING;
+  }
+
+  if (free_slot == -1 || component_records.size() > _header->slot_bytes) {
+    *records = component_records;
+    _header->num_spilled++;
+    return SPILL;
+  }
+  auto &header = shard->slots[free_slot];
+  memcpy(Payload(shard_idx, free_slot), component_records.data(),
+         component_records.size());
+  header.req_id = req_id;
+  header.expire_ms = NowMs() + _ttl_ms;
+  header.used = component_records.size();
+  header.mask = 1u << component;
+  shard->num_pending++;
+  return PENDING;
+}
+
+void ComposeBuffer::Sweep(const SpillFn &spill) {
+  int64_t now_ms = NowMs();
+  std::vector<std::pair<int64_t, std::string>> expired;
+  for (uint32_t i = 0; i < _header->num_shards; i++) {
+    Shard *shard = &_shards[i];
+    if (shard->num_pending == 0) {
+      continue;
+    }
+    ShardLock lock(shard);
+    for (uint32_t slot = 0; slot < kSlotsPerShard; slot++) {
+      auto &header = shard->slots[slot];
+      if (header.mask != 0 && header.expire_ms <= now_ms) {
+        expired.emplace_back(header.req_id, std::string());
+        TakeRecords(shard, i, slot, &expired.back().second);
+      }
+    }
+  }
+  _header->num_spilled += expired.size();
+  for (auto &entry : expired) {
+    try {
+      spill(entry.first, entry.second);
+    } catch (...) {
+      LOG(error) << "Failed to spill components of req_id " << entry.first;
+    }
+  }
+  if (!expired.empty()) {
+    LOG_EVERY_MS(info, 10000) << "Compose buffer: "
+        << _header->num_completed.load() << " posts completed in memory, "
+        << _header->num_spilled.load() << " entries spilled to Redis";
+  }
+}
+
+void ComposeBuffer::StartSweeper(SpillFn spill) {
+  int interval_ms = std::max(_ttl_ms / 2, 1);
+  std::thread([this, spill, interval_ms] {
+    while (true) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+      int64_t now_ms = NowMs();
+      int64_t next_ms = _header->next_sweep_ms.load();
+      if (now_ms < next_ms || !_header->next_sweep_ms.compare_exchange_strong(
+          next_ms, now_ms + interval_ms)) {
+        continue;
+      }
+      Sweep(spill);
+    }
+  }).detach();
+}
+
+} // namespace social_network
+
+#endif //SOCIAL_NETWORK_MICROSERVICES_SRC_COMPOSEPOSTSERVICE_COMPOSEBUFFER_H_
@@ -0,0 +1,125 @@
+#ifndef SOCIAL_NETWORK_MICROSERVICES_SRC_COMPOSEPOSTSERVICE_COMPOSECOMPONENTS_H_
+#define SOCIAL_NETWORK_MICROSERVICES_SRC_COMPOSEPOSTSERVICE_COMPOSECOMPONENTS_H_
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <thrift/protocol/TBinaryProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+
+#include "../../gen-cpp/social_network_types.h"
+
+namespace social_network {
+
+// The parts of a post ComposePostHandler collects, one per Upload* call.
+// COMPOSE_CARRIER rides along with a component and is not counted.
+enum ComposeComponent : uint8_t {
+  COMPOSE_TEXT = 0,
+  COMPOSE_MEDIA,
+  COMPOSE_UNIQUE_ID,
+  COMPOSE_CREATOR,
+  COMPOSE_URLS,
+  COMPOSE_USER_MENTIONS,
+  COMPOSE_CARRIER,
+};
+const uint32_t kAllComposeComponents = (1u << COMPOSE_CARRIER) - 1;
+
+// Redis hash field of each component
+const char *const kComposeRedisFields[] = {
+    "text", "media", "unique_id", "creator", "urls", "user_mentions"};
+
+using ComposeProtocol = apache::thrift::protocol::TBinaryProtocolT<
+    apache::thrift::transport::TMemoryBuffer>;
+
+// Encodes one component in Thrift binary: a string for text, a Creator, an
+// i64 post_id and i32 post_type for the unique id, and lists of Media, Url
+// and UserMention. `write` gets the protocol to write it to.
+template<class WriteFn>
+std::string EncodeComposeComponent(WriteFn write) {
+  static thread_local auto buffer =
+      std::make_shared<apache::thrift::transport::TMemoryBuffer>();
+  static thread_local ComposeProtocol protocol(buffer);
+  buffer->resetBuffer();
+  write(&protocol);
+  uint8_t *data;
+  uint32_t len;
+  buffer->getBuffer(&data, &len);
+  return std::string(reinterpret_cast<const char *>(data), len);
+}
+
+template<class T>
+void ReadComposeList(ComposeProtocol *protocol, std::vector<T> *list) {
+  apache::thrift::protocol::TType elem_type;
+  uint32_t size;
+  protocol->readListBegin(elem_type, size);
+  list->resize(size);
+  for (auto &item : *list) {
+    item.read(protocol);
+  }
+  protocol->readListEnd();
+}
+
+template<class T>
+void WriteComposeList(ComposeProtocol *protocol, const std::vector<T> &list) {
+  protocol->writeListBegin(apache::thrift::protocol::T_STRUCT, list.size());
+  for (auto &item : list) {
+    item.write(protocol);
+  }
+  protocol->writeListEnd();
+}
+
+// Decodes a component from EncodeComposeComponent into its fields of
+// `post`, or a carrier into `carrier`. Throws TProtocolException on data
+// that is cut short.
+void DecodeComposeComponent(ComposeComponent component, const char *data,
+                            uint32_t len, Post *post,
+                            std::map<std::string, std::string> *carrier) {
+  static thread_local auto buffer =
+      std::make_shared<apache::thrift::transport::TMemoryBuffer>();
+  static thread_local ComposeProtocol protocol(buffer);
+  buffer->resetBuffer(reinterpret_cast<uint8_t *>(const_cast<char *>(data)),
+                      len);
+  switch (component) {
+    case COMPOSE_TEXT:
+      protocol.readString(post->text);
+      break;
+    case COMPOSE_MEDIA:
+      ReadComposeList(&protocol, &post->media);
+      break;
+    case COMPOSE_UNIQUE_ID: {
+      int32_t post_type;
+      protocol.readI64(post->post_id);
+      protocol.readI32(post_type);
+      post->post_type = static_cast<PostType::type>(post_type);
+      break;
+    }
+    case COMPOSE_CREATOR:
+      post->creator.read(&protocol);
+      break;
+    case COMPOSE_URLS:
+      ReadComposeList(&protocol, &post->urls);
+      break;
+    case COMPOSE_USER_MENTIONS:
+      ReadComposeList(&protocol, &post->user_mentions);
+      break;
+    case COMPOSE_CARRIER: {
+      apache::thrift::protocol::TType key_type;
+      apache::thrift::protocol::TType value_type;
+      uint32_t size;
+      protocol.readMapBegin(key_type, value_type, size);
+      for (uint32_t i = 0; i < size; i++) {
+        std::string key;
+        protocol.readString(key);
+        protocol.readString((*carrier)[key]);
+      }
+      protocol.readMapEnd();
+      break;
+    }
+  }
+}
+
+} // namespace social_network
+
+#endif //SOCIAL_NETWORK_MICROSERVICES_SRC_COMPOSEPOSTSERVICE_COMPOSECOMPONENTS_H_
@@ -0,0 +1,248 @@
+// Cost of storing the six compose components of a post and assembling the
+// Post back from them on one core, in the Thrift binary of
+// ComposeComponents.h and in the JSON strings ComposePostHandler stored
+// before it:
+//
+//   ComposeComponentsBench [seconds] [cpu]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <sched.h>
+
+#include <nlohmann/json.hpp>
+
+#include "ComposeComponents.h"
+
+using namespace social_network;
+using json = nlohmann::json;
+
+static std::atomic<uint64_t> num_allocs{0};
+
+void *operator new(size_t size) {
+  num_allocs.fetch_add(1, std::memory_order_relaxed);
+  if (void *ptr = malloc(size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+  free(ptr);
+}
+
+// One Redis hash value per ComposeComponent
+typedef std::vector<std::string> Components;
+
+Components EncodeBinary(const Post &post) {
+  Components components(COMPOSE_CARRIER);
+  components[COMPOSE_TEXT] = EncodeComposeComponent(
+      [&](ComposeProtocol *protocol) { protocol->writeString(post.text); });
+  components[COMPOSE_MEDIA] = EncodeComposeComponent(
+      [&](ComposeProtocol *protocol) { WriteComposeList(protocol, post.media); });
+  components[COMPOSE_UNIQUE_ID] = EncodeComposeComponent(
+      [&](ComposeProtocol *protocol) {
+    protocol->writeI64(post.post_id);
+    protocol->writeI32(post.post_type);
+  });
+  components[COMPOSE_CREATOR] = EncodeComposeComponent(
+      [&](ComposeProtocol *protocol) { post.creator.write(protocol); });
+  components[COMPOSE_URLS] = EncodeComposeComponent(
+      [&](ComposeProtocol *protocol) { WriteComposeList(protocol, post.urls); });
+  components[COMPOSE_USER_MENTIONS] = EncodeComposeComponent(
+      [&](ComposeProtocol *protocol) {
+    WriteComposeList(protocol, post.user_mentions);
+  });
+  return components;
+}
+
+void AssembleBinary(const Components &components, Post *post) {
+  for (int i = 0; i < COMPOSE_CARRIER; i++) {
+    DecodeComposeComponent(static_cast<ComposeComponent>(i),
+                           components[i].data(), components[i].size(), post,
+                           nullptr);
+  }
+}
+
+// The old encoding has post_id and post_type in two fields, the last one
+// here
+Components EncodeJson(const Post &post) {
+  Components components(COMPOSE_CARRIER + 1);
+  components[COMPOSE_TEXT] = post.text;
+  std::string media_str = "[";
+  if (!post.media.empty()) {
+    for (auto &item : post.media) {
+      media_str += "{\"media_id\": " + std::to_string(item.media_id) +
+          ", \"media_type\": \"" + item.media_type + "\"},";
+    }
+    media_str.pop_back();
+  }
+  components[COMPOSE_MEDIA] = media_str + "]";
+  components[COMPOSE_UNIQUE_ID] = std::to_string(post.post_id);
+  components[COMPOSE_CARRIER] = std::to_string(post.post_type);
+  components[COMPOSE_CREATOR] = "{\"user_id\": " +
+      std::to_string(post.creator.user_id) + ", \"username\": \"" +
+      post.creator.username + "\"}";
+  std::string urls_str = "[";
+  if (!post.urls.empty()) {
+    for (auto &item : post.urls) {
+      urls_str += "{\"shortened_url\": \"" + item.shortened_url +
+          "\", \"expanded_url\": \"" + item.expanded_url + "\"},";
+    }
+    urls_str.pop_back();
+  }
+  components[COMPOSE_URLS] = urls_str + "]";
+  std::string user_mentions_str = "[";
+  if (!post.user_mentions.empty()) {
+    for (auto &item : post.user_mentions) {
+      user_mentions_str += "{\"user_id\": " + std::to_string(item.user_id) +
+          ", \"username\": \"" + item.username + "\"},";
+    }
+    user_mentions_str.pop_back();
+  }
+  components[COMPOSE_USER_MENTIONS] = user_mentions_str + "]";
+  return components;
+}
+
+void AssembleJson(const Components &components, Post *post) {
+  post->text = components[COMPOSE_TEXT];
+  post->post_id = std::stoul(components[COMPOSE_UNIQUE_ID]);
+  post->post_type =
+      static_cast<PostType::type>(std::stoi(components[COMPOSE_CARRIER]));
+  json creator_json = json::parse(components[COMPOSE_CREATOR]);
+  post->creator.user_id = creator_json["user_id"];
+  post->creator.username = creator_json["username"];
+  json user_mentions_json = json::parse(components[COMPOSE_USER_MENTIONS]);
+  for (auto &item : user_mentions_json) {
+    UserMention user_mention;
+    user_mention.user_id = item["user_id"];
+    user_mention.username = item["username"];
+    post->user_mentions.emplace_back(user_mention);
+  }
+  json media_json = json::parse(components[COMPOSE_MEDIA]);
+  for (auto &item : media_json) {
+    Media media;
+    media.media_id = item["media_id"];
+    media.media_type = item["media_type"];
+    post->media.emplace_back(media);
+  }
+  json urls_json = json::parse(components[COMPOSE_URLS]);
+  for (auto &item : urls_json) {
+    Url url;
+    url.shortened_url = item["shortened_url"];
+    url.expanded_url = item["expanded_url"];
+    post->urls.emplace_back(url);
+  }
+}
+
+template<class Fn>
+void Measure(const char *name, size_t num_posts, double seconds, Fn fn) {
+  uint64_t sum = 0;
+  uint64_t num_ops = 0;
+  uint64_t allocs_before = num_allocs.load();
+  auto start = std::chrono::steady_clock::now();
+  auto deadline = start + std::chrono::duration<double>(seconds);
+  while (std::chrono::steady_clock::now() < deadline) {
+    for (size_t i = 0; i < num_posts; i++) {
+      sum += fn(i);
+    }
+    num_ops += num_posts;
+  }
+  double elapsed = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+  printf("  %-9s %8.0f ns/post %8.1f allocs/post (checksum %llx)\n", name,
+         elapsed * 1e9 / num_ops,
+         static_cast<double>(num_allocs.load() - allocs_before) / num_ops,
+         static_cast<unsigned long long>(sum));
+}
+
+void Run(const char *name, Components (*encode)(const Post &),
+         void (*assemble)(const Components &, Post *),
+         const std::vector<Post> &posts, double seconds) {
+  std::vector<Components> stored;
+  size_t total_bytes = 0;
+  for (auto &post : posts) {
+    stored.push_back(encode(post));
+    for (auto &value : stored.back()) {
+      total_bytes += value.size();
+    }
+    Post assembled;
+    assemble(stored.back(), &assembled);
+    assembled.req_id = post.req_id;
+    assembled.timestamp = post.timestamp;
+    if (!(assembled == post)) {
+      fprintf(stderr, "A post does not round-trip through %s\n", name);
+      exit(EXIT_FAILURE);
+    }
+  }
+  printf("%s, %zu bytes stored per post\n", name,
+         total_bytes / posts.size());
+  Measure("encode", posts.size(), seconds, [&](size_t i) {
+    return encode(posts[i])[COMPOSE_TEXT].size();
+  });
+  Measure("assemble", posts.size(), seconds, [&](size_t i) {
+    Post post;
+    assemble(stored[i], &post);
+    return post.post_id;
+  });
+}
+
+int main(int argc, char *argv[]) {
+  double seconds = argc > 1 ? atof(argv[1]) : 2.0;
+  int cpu = argc > 2 ? atoi(argv[2]) : 0;
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+    perror("sched_setaffinity");
+  }
+
+  // Shaped like wrk2's compose-post.lua: 256 characters of text, 1-6
+  // mentions and urls, 1-5 media
+  std::mt19937_64 rng(42);
+  auto random_string = [&rng](int length) {
+    static const char chars[] =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    std::string s;
+    for (int i = 0; i < length; i++) {
+      s.push_back(chars[rng() % 62]);
+    }
+    return s;
+  };
+  std::vector<Post> posts(1000);
+  for (auto &post : posts) {
+    post.post_id = rng() >> 1;
+    post.req_id = rng() >> 1;
+    post.creator.user_id = rng() % 962;
+    post.creator.username =
+        "username_" + std::to_string(post.creator.user_id);
+    post.text = random_string(256);
+    post.user_mentions.resize(1 + rng() % 6);
+    for (auto &user_mention : post.user_mentions) {
+      user_mention.user_id = rng() % 962;
+      user_mention.username =
+          "username_" + std::to_string(user_mention.user_id);
+    }
+    post.urls.resize(1 + rng() % 6);
+    for (auto &url : post.urls) {
+      url.expanded_url = "http://" + random_string(64);
+      url.shortened_url = "http://short-url/" + random_string(10);
+    }
+    post.media.resize(1 + rng() % 5);
+    for (auto &media : post.media) {
+      media.media_id = rng() >> 4;
+      media.media_type = "png";
+    }
+  }
+
+  Run("binary", EncodeBinary, AssembleBinary, posts, seconds);
+  Run("json", EncodeJson, AssembleJson, posts, seconds);
+  return 0;
+}
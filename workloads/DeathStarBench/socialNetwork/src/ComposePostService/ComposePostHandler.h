@@ -7,23 +7,24 @@
 #include <chrono>
 
 #include <hiredis/hiredis.h>
-#include <nlohmann/json.hpp>
 
 #include "../../gen-cpp/ComposePostService.h"
 #include "../../gen-cpp/PostStorageService.h"
 #include "../../gen-cpp/UserTimelineService.h"
+#include "../AmqpPublisher.h"
 #include "../ClientPool.h"
+#include "../FanOut.h"
+#include "../HomeTimelineMessage.h"
 #include "../logger.h"
 #include "../tracing.h"
 #include "../RedisClient.h"
 #include "../ThriftClient.h"
-#include "RabbitmqClient.h"
+#include "ComposeBuffer.h"
 
 #define NUM_COMPONENTS 6
 #define REDIS_EXPIRE_TIME 10
 
 namespace social_network {
-using json = nlohmann::json;
 using std::chrono::milliseconds;
 using std::chrono::duration_cast;
 using std::chrono::system_clock;
@@ -34,7 +35,9 @@ class ComposePostHandler : public ComposePostServiceIf {
       ClientPool<RedisClient> *,
       ClientPool<ThriftClient<PostStorageServiceClient>> *,
       ClientPool<ThriftClient<UserTimelineServiceClient>> *,
-      ClientPool<RabbitmqClient> *rabbitmq_client_pool);
+      AmqpPublisher *home_timeline_publisher,
+      ComposeBuffer *compose_buffer = nullptr,
+      bool json_home_timeline_messages = true);
   ~ComposePostHandler() override = default;
 
   void UploadText(int64_t req_id, const std::string& text,
@@ -57,20 +60,33 @@ class ComposePostHandler : public ComposePostServiceIf {
       const std::vector<UserMention> & user_mentions,
       const std::map<std::string, std::string> & carrier) override;
 
+  // Writes components handed back by the compose buffer to Redis, and
+  // composes the post if that completes it.
+  void SpillComponents(int64_t req_id, const std::string &records);
+
  private:
   ClientPool<RedisClient> *_redis_client_pool;
   ClientPool<ThriftClient<PostStorageServiceClient>>
       *_post_storage_client_pool;
   ClientPool<ThriftClient<UserTimelineServiceClient>>
       *_user_timeline_client_pool;
-  ClientPool<RabbitmqClient> *_rabbitmq_client_pool;
-  std::exception_ptr _rabbitmq_teptr;
-  std::exception_ptr _post_storage_teptr;
-  std::exception_ptr _user_timeline_teptr;
+  AmqpPublisher *_home_timeline_publisher;
+  ComposeBuffer *_compose_buffer;
+  bool _json_home_timeline_messages;
+
+  template<class WriteFn>
+  void _UploadComponent(int64_t req_id, ComposeComponent component,
+      WriteFn write, const RequestSpan &span);
+
+  void _BufferComponent(int64_t req_id, ComposeComponent component,
+      const std::string &value, const RequestSpan &span);
 
   void _ComposeAndUpload(int64_t req_id,
       const std::map<std::string, std::string> & carrier);
 
+  void _UploadComposedPost(Post &post,
+      const std::map<std::string, std::string> & carrier);
+
   void _UploadUserTimelineHelper(int64_t req_id, int64_t post_id,
       int64_t user_id, int64_t timestamp,
       const std::map<std::string, std::string> & carrier);
@@ -91,33 +107,28 @@ ComposePostHandler::ComposePostHandler(
         PostStorageServiceClient>> *post_storage_client_pool,
     ClientPool<social_network::ThriftClient<
         UserTimelineServiceClient>> *user_timeline_client_pool,
-    ClientPool<RabbitmqClient> *rabbitmq_client_pool) {
+    AmqpPublisher *home_timeline_publisher,
+    ComposeBuffer *compose_buffer,
+    bool json_home_timeline_messages) {
   _redis_client_pool = redis_client_pool;
   _post_storage_client_pool = post_storage_client_pool;
   _user_timeline_client_pool = user_timeline_client_pool;
-  _rabbitmq_client_pool = rabbitmq_client_pool;
-  _rabbitmq_teptr = nullptr;
-  _post_storage_teptr = nullptr;
-  _user_timeline_teptr = nullptr;
+  _home_timeline_publisher = home_timeline_publisher;
+  _compose_buffer = compose_buffer;
+  _json_home_timeline_messages = json_home_timeline_messages;
 }
 
-void ComposePostHandler::UploadCreator(
+template<class WriteFn>
+void ComposePostHandler::_UploadComponent(
     int64_t req_id,
-    const Creator &creator,
-    const std::map<std::string, std::string> &carrier) {
-
-  // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UploadCreator",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
-
-  std::string creator_str = "{\"user_id\": " + std::to_string(creator.user_id)
-      + ", \"username\": \"" + creator.username + "\"}";
+    ComposeComponent component,
+    WriteFn write,
+    const RequestSpan &span) {
+  std::string value = EncodeComposeComponent(write);
+  if (_compose_buffer != nullptr) {
+    _BufferComponent(req_id, component, value, span);
+    return;
+  }
 
   auto redis_client_wrapper = _redis_client_pool->Pop();
   if (!redis_client_wrapper) {
@@ -127,43 +138,66 @@ void ComposePostHandler::UploadCreator(
     throw se;
   }
   auto redis_client = redis_client_wrapper->GetClient();
-  auto add_span = opentracing::Tracer::Global()->StartSpan(
-      "RedisHashSet", {opentracing::ChildOf(&span->context())});
-  redis_client.AppendCommand("HSET %" PRId64 " creator %s", req_id, creator_str.c_str());
+  auto add_span = span.StartSpan("RedisHashSet");
+  redis_client.AppendCommand("HSET %" PRId64 " %s %b", req_id,
+      kComposeRedisFields[component], value.data(), value.size());
   redis_client.AppendCommand("HINCRBY %" PRId64 " num_components 1", req_id);
   redis_client.AppendCommand("EXPIRE %" PRId64 " %d", req_id, REDIS_EXPIRE_TIME);
 
   auto hset_reply = redis_client.GetReply();
   auto num_components_reply = redis_client.GetReply();
   auto expire_reply = redis_client.GetReply();
+  add_span.Finish();
   _redis_client_pool->Push(redis_client_wrapper);
 
   hset_reply->check_ok();
   expire_reply->check_ok();
 
   if (num_components_reply->as_integer() == NUM_COMPONENTS) {
-    _ComposeAndUpload(req_id, writer_text_map);
+    _ComposeAndUpload(req_id, span.carrier());
   }
-
-  span->Finish();
-
 }
 
-void ComposePostHandler::UploadText(
+void ComposePostHandler::_BufferComponent(
     int64_t req_id,
-    const std::string &text,
-    const std::map<std::string, std::string> &carrier) {
+    ComposeComponent component,
+    const std::string &value,
+    const RequestSpan &span) {
+  std::string component_records;
+  AppendComposeRecord(&component_records, component, value);
+  auto &carrier = span.carrier();
+  if (!carrier.empty()) {
+    AppendComposeRecord(&component_records, COMPOSE_CARRIER,
+        EncodeComposeComponent([&](ComposeProtocol *protocol) {
+      protocol->writeMapBegin(apache::thrift::protocol::T_STRING,
+          apache::thrift::protocol::T_STRING, carrier.size());
+      for (auto &item : carrier) {
+        protocol->writeString(item.first);
+        protocol->writeString(item.second);
+      }
+      protocol->writeMapEnd();
+    }));
+  }
 
-  // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UploadText",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  std::string records;
+  auto add_span = span.StartSpan("ComposeBufferAdd");
+  auto result = _compose_buffer->Add(req_id, component, component_records,
+                                     &records);
+  add_span.Finish();
+
+  if (result == ComposeBuffer::COMPLETE) {
+    Post post;
+    DecodeComposeRecords(records, &post, nullptr);
+    post.req_id = req_id;
+    _UploadComposedPost(post, carrier);
+  } else if (result == ComposeBuffer::SPILL) {
+    SpillComponents(req_id, records);
+  }
+}
 
+void ComposePostHandler::SpillComponents(
+    int64_t req_id,
+    const std::string &records) {
   auto redis_client_wrapper = _redis_client_pool->Pop();
   if (!redis_client_wrapper) {
     ServiceException se;
@@ -172,80 +206,94 @@ void ComposePostHandler::UploadText(
     throw se;
   }
   auto redis_client = redis_client_wrapper->GetClient();
-  auto add_span = opentracing::Tracer::Global()->StartSpan(
-      "RedisHashSet", {opentracing::ChildOf(&span->context())});
-  redis_client.AppendCommand("HSET %" PRId64 " text %s", req_id, text.c_str());
-  redis_client.AppendCommand("HINCRBY %" PRId64 " num_components 1", req_id);
+  std::map<std::string, std::string> carrier;
+  uint32_t mask = 0;
+  ForEachComposeRecord(records, [&](ComposeComponent component,
+                                    const char *data, uint32_t len) {
+    if (component == COMPOSE_CARRIER) {
+      if (carrier.empty()) {
+        DecodeComposeComponent(component, data, len, nullptr, &carrier);
+      }
+    } else if (component < COMPOSE_CARRIER) {
+      redis_client.AppendCommand("HSET %" PRId64 " %s %b", req_id,
+          kComposeRedisFields[component], data, static_cast<size_t>(len));
+      mask |= 1u << component;
+    }
+  });
+  if (mask == 0) {
+    _redis_client_pool->Push(redis_client_wrapper);
+    return;
+  }
+  redis_client.AppendCommand("HINCRBY %" PRId64 " num_components %d", req_id,
+      __builtin_popcount(mask));
   redis_client.AppendCommand("EXPIRE %" PRId64 " %d", req_id, REDIS_EXPIRE_TIME);
 
-  auto hset_reply = redis_client.GetReply();
+  // Also runs from the buffer's expiry thread, outside of any request span
+  SpanStage hset_stage(req_id, probes_detail::current_method, "RedisHashSet");
+  std::vector<decltype(redis_client.GetReply())> hset_replies;
+  for (int i = 0; i < __builtin_popcount(mask); i++) {
+    hset_replies.emplace_back(redis_client.GetReply());
+  }
   auto num_components_reply = redis_client.GetReply();
   auto expire_reply = redis_client.GetReply();
+  hset_stage.Stop();
   _redis_client_pool->Push(redis_client_wrapper);
 
-  hset_reply->check_ok();
+  for (auto &reply : hset_replies) {
+    reply->check_ok();
+  }
   expire_reply->check_ok();
 
   if (num_components_reply->as_integer() == NUM_COMPONENTS) {
-    _ComposeAndUpload(req_id, writer_text_map);
+    _ComposeAndUpload(req_id, carrier);
   }
+}
+
+void ComposePostHandler::UploadCreator(
+    int64_t req_id,
+    const Creator &creator,
+    const std::map<std::string, std::string> &carrier) {
+
+  // Initialize a span
+  RequestSpan span("UploadCreator", carrier, req_id);
+
+  _UploadComponent(req_id, COMPOSE_CREATOR, [&](ComposeProtocol *protocol) {
+    creator.write(protocol);
+  }, span);
 
-  span->Finish();
+  span.Finish();
 
 }
 
-void ComposePostHandler::UploadMedia(
+void ComposePostHandler::UploadText(
     int64_t req_id,
-    const std::vector<Media> &media,
+    const std::string &text,
     const std::map<std::string, std::string> &carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UploadMedia",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
-
-  std::string media_str = "[";
-  if (!media.empty()) {
-    for (auto &item : media) {
-      media_str += "{\"media_id\": " + std::to_string(item.media_id) +
-          ", \"media_type\": \"" + item.media_type + "\"},";
-    }
-    media_str.pop_back();
-  }
-  media_str += "]";
+  RequestSpan span("UploadText", carrier, req_id);
 
-  auto redis_client_wrapper = _redis_client_pool->Pop();
-  if (!redis_client_wrapper) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_REDIS_ERROR;
-    se.message = "Cannot connect to Redis server";
-    throw se;
-  }
-  auto redis_client = redis_client_wrapper->GetClient();
-  auto add_span = opentracing::Tracer::Global()->StartSpan(
-      "RedisHashSet", {opentracing::ChildOf(&span->context())});
-  redis_client.AppendCommand("HSET %" PRId64 " media %s", req_id, media_str.c_str());
-  redis_client.AppendCommand("HINCRBY %" PRId64 " num_components 1", req_id);
-  redis_client.AppendCommand("EXPIRE %" PRId64 " %d", req_id, REDIS_EXPIRE_TIME);
+  _UploadComponent(req_id, COMPOSE_TEXT, [&](ComposeProtocol *protocol) {
+    protocol->writeString(text);
+  }, span);
 
-  auto hset_reply = redis_client.GetReply();
-  auto num_components_reply = redis_client.GetReply();
-  auto expire_reply = redis_client.GetReply();
-  _redis_client_pool->Push(redis_client_wrapper);
+  span.Finish();
 
-  hset_reply->check_ok();
-  expire_reply->check_ok();
+}
 
-  if (num_components_reply->as_integer() == NUM_COMPONENTS) {
-    _ComposeAndUpload(req_id, writer_text_map);
-  }
+void ComposePostHandler::UploadMedia(
+    int64_t req_id,
+    const std::vector<Media> &media,
+    const std::map<std::string, std::string> &carrier) {
+
+  // Initialize a span
+  RequestSpan span("UploadMedia", carrier, req_id);
+
+  _UploadComponent(req_id, COMPOSE_MEDIA, [&](ComposeProtocol *protocol) {
+    WriteComposeList(protocol, media);
+  }, span);
 
-  span->Finish();
+  span.Finish();
 
 }
 
@@ -256,45 +304,14 @@ void ComposePostHandler::UploadUniqueId(
     const std::map<std::string, std::string> &carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UploadUniqueId",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("UploadUniqueId", carrier, req_id);
 
-  auto redis_client_wrapper = _redis_client_pool->Pop();
-  if (!redis_client_wrapper) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_REDIS_ERROR;
-    se.message = "Cannot connect to Redis server";
-    throw se;
-  }
-  auto redis_client = redis_client_wrapper->GetClient();
-  auto add_span = opentracing::Tracer::Global()->StartSpan(
-      "RedisHashSet", {opentracing::ChildOf(&span->context())});
-  redis_client.AppendCommand("HSET %" PRId64 " post_id %" PRId64, req_id, post_id);
-  redis_client.AppendCommand("HSET %" PRId64 " post_type %s", req_id, std::to_string(post_type).c_str());
-  redis_client.AppendCommand("HINCRBY %" PRId64 " num_components 1", req_id);
-  redis_client.AppendCommand("EXPIRE %" PRId64 " %d", req_id, REDIS_EXPIRE_TIME);
-
-  auto hset_reply_0 = redis_client.GetReply();
-  auto hset_reply_1 = redis_client.GetReply();
-  auto num_components_reply = redis_client.GetReply();
-  auto expire_reply = redis_client.GetReply();
-  _redis_client_pool->Push(redis_client_wrapper);
+  _UploadComponent(req_id, COMPOSE_UNIQUE_ID, [&](ComposeProtocol *protocol) {
+    protocol->writeI64(post_id);
+    protocol->writeI32(post_type);
+  }, span);
 
-  hset_reply_0->check_ok();
-  hset_reply_1->check_ok();
-  expire_reply->check_ok();
-
-  if (num_components_reply->as_integer() == NUM_COMPONENTS) {
-    _ComposeAndUpload(req_id, writer_text_map);
-  }
-
-  span->Finish();
+  span.Finish();
 
 }
 
@@ -304,52 +321,13 @@ void ComposePostHandler::UploadUrls(
     const std::map<std::string, std::string> &carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UploadUrls",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
-
-  std::string urls_str = "[";
-  if (!urls.empty()) {
-    for (auto &item : urls) {
-      urls_str += "{\"shortened_url\": \"" + item.shortened_url +
-          "\", \"expanded_url\": \"" + item.expanded_url + "\"},";
-    }
-    urls_str.pop_back();
-  }
-  urls_str += "]";
-
-  auto redis_client_wrapper = _redis_client_pool->Pop();
-  if (!redis_client_wrapper) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_REDIS_ERROR;
-    se.message = "Cannot connect to Redis server";
-    throw se;
-  }
-  auto redis_client = redis_client_wrapper->GetClient();
-  auto add_span = opentracing::Tracer::Global()->StartSpan(
-      "RedisHashSet", {opentracing::ChildOf(&span->context())});
-  redis_client.AppendCommand("HSET %" PRId64 " urls %s", req_id, urls_str.c_str());
-  redis_client.AppendCommand("HINCRBY %" PRId64 " num_components 1", req_id);
-  redis_client.AppendCommand("EXPIRE %" PRId64 " %d", req_id, REDIS_EXPIRE_TIME);
+  RequestSpan span("UploadUrls", carrier, req_id);
 
-  auto hset_reply = redis_client.GetReply();
-  auto num_components_reply = redis_client.GetReply();
-  auto expire_reply = redis_client.GetReply();
-  _redis_client_pool->Push(redis_client_wrapper);
+  _UploadComponent(req_id, COMPOSE_URLS, [&](ComposeProtocol *protocol) {
+    WriteComposeList(protocol, urls);
+  }, span);
 
-  hset_reply->check_ok();
-  expire_reply->check_ok();
-
-  if (num_components_reply->as_integer() == NUM_COMPONENTS) {
-    _ComposeAndUpload(req_id, writer_text_map);
-  }
-
-  span->Finish();
+  span.Finish();
 
 }
 
@@ -359,53 +337,14 @@ void ComposePostHandler::UploadUserMentions(
     const std::map<std::string, std::string> &carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UploadUserMentions",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
-
-  std::string user_mentions_str = "[";
-  if (!user_mentions.empty()) {
-    for (auto &item : user_mentions) {
-      user_mentions_str += "{\"user_id\": " + std::to_string(item.user_id) +
-          ", \"username\": \"" + item.username + "\"},";
-    }
-    user_mentions_str.pop_back();
-  }
-  user_mentions_str += "]";
-
-  auto redis_client_wrapper = _redis_client_pool->Pop();
-  if (!redis_client_wrapper) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_REDIS_ERROR;
-    se.message = "Cannot connect to Redis server";
-    throw se;
-  }
-  auto redis_client = redis_client_wrapper->GetClient();
-  auto add_span = opentracing::Tracer::Global()->StartSpan(
-      "RedisHashSet", {opentracing::ChildOf(&span->context())});
-  redis_client.AppendCommand("HSET %" PRId64 " user_mentions %s", req_id, user_mentions_str.c_str());
-  redis_client.AppendCommand("HINCRBY %" PRId64 " num_components 1", req_id);
-  redis_client.AppendCommand("EXPIRE %" PRId64 " %d", req_id, REDIS_EXPIRE_TIME);
-
-  auto hset_reply = redis_client.GetReply();
-  auto num_components_reply = redis_client.GetReply();
-  auto expire_reply = redis_client.GetReply();
-  _redis_client_pool->Push(redis_client_wrapper);
-
-  hset_reply->check_ok();
-  expire_reply->check_ok();
+  RequestSpan span("UploadUserMentions", carrier, req_id);
 
-  if (num_components_reply->as_integer() == NUM_COMPONENTS) {
-    _ComposeAndUpload(req_id, writer_text_map);
-  }
+  _UploadComponent(req_id, COMPOSE_USER_MENTIONS,
+      [&](ComposeProtocol *protocol) {
+    WriteComposeList(protocol, user_mentions);
+  }, span);
 
-
-  span->Finish();
+  span.Finish();
 
 }
 
@@ -421,121 +360,52 @@ void ComposePostHandler::_ComposeAndUpload(
     throw se;
   }
   auto redis_client = redis_client_wrapper->GetClient();
-  redis_client.AppendCommand("HGET %" PRId64 " text", req_id);
-  redis_client.AppendCommand("HGET %" PRId64 " creator", req_id);
-  redis_client.AppendCommand("HGET %" PRId64 " media", req_id);
-  redis_client.AppendCommand("HGET %" PRId64 " post_id", req_id);
-  redis_client.AppendCommand("HGET %" PRId64 " urls", req_id);
-  redis_client.AppendCommand("HGET %" PRId64 " user_mentions", req_id);
-  redis_client.AppendCommand("HGET %" PRId64 " post_type", req_id);
-
-  auto text_reply = redis_client.GetReply();
-  auto creator_reply = redis_client.GetReply();
-  auto media_reply = redis_client.GetReply();
-  auto post_id_reply = redis_client.GetReply();
-  auto urls_reply = redis_client.GetReply();
-  auto user_mentions_reply = redis_client.GetReply();
-  auto post_type_reply = redis_client.GetReply();
-
+  SpanStage hmget_stage(req_id, probes_detail::current_method, "RedisHashGet");
+  redis_client.AppendCommand("HMGET %" PRId64 " %s %s %s %s %s %s", req_id,
+      kComposeRedisFields[0], kComposeRedisFields[1], kComposeRedisFields[2],
+      kComposeRedisFields[3], kComposeRedisFields[4], kComposeRedisFields[5]);
+  auto hmget_reply = redis_client.GetReply();
+  hmget_stage.Stop();
   _redis_client_pool->Push(redis_client_wrapper);
 
   // Compose the post
   Post post;
   post.req_id = req_id;
-  post.text = text_reply->as_string();
-  post.post_id = std::stoul(post_id_reply->as_string());
-  post.timestamp = duration_cast<milliseconds>(
-      system_clock::now().time_since_epoch()).count();
-  post.post_type = static_cast<PostType::type>(stoi(post_type_reply->as_string()));
-
-  LOG(debug) << creator_reply->as_string();
+  auto values = hmget_reply->as_array();
+  for (int i = 0; i < NUM_COMPONENTS; i++) {
+    std::string value = values.at(i)->as_string();
+    DecodeComposeComponent(static_cast<ComposeComponent>(i), value.data(),
+                           value.size(), &post, nullptr);
+  }
 
-  json creator_json = json::parse(creator_reply->as_string());
-  post.creator.user_id = creator_json["user_id"];
-  post.creator.username = creator_json["username"];
+  _UploadComposedPost(post, carrier);
+}
 
-  LOG(debug) << user_mentions_reply->as_string();
+void ComposePostHandler::_UploadComposedPost(
+    Post &post,
+    const std::map<std::string, std::string> &carrier) {
+  int64_t req_id = post.req_id;
+  post.timestamp = duration_cast<milliseconds>(
+      system_clock::now().time_since_epoch()).count();
 
   std::vector<int64_t> user_mentions_id;
-
-  json user_mentions_json = json::parse(user_mentions_reply->as_string());
-  for (auto &item : user_mentions_json) {
-    UserMention user_mention;
-    user_mention.user_id = item["user_id"];
-    user_mention.username = item["username"];
-    post.user_mentions.emplace_back(user_mention);
-    user_mentions_id.emplace_back(user_mention.user_id);
+  for (auto &item : post.user_mentions) {
+    user_mentions_id.emplace_back(item.user_id);
   }
 
-  json media_json = json::parse(media_reply->as_string());
-  for (auto &item : media_json) {
-    Media media;
-    media.media_id = item["media_id"];
-    media.media_type = item["media_type"];
-    post.media.emplace_back(media);
-  }
-
-  json urls_json = json::parse(urls_reply->as_string());
-  for (auto &item : urls_json) {
-    Url url;
-    url.shortened_url = item["shortened_url"];
-    url.expanded_url = item["expanded_url"];
-    post.urls.emplace_back(url);
-  }
-
-  _user_timeline_teptr = nullptr;
-  _rabbitmq_teptr = nullptr;
-  _post_storage_teptr = nullptr;
-
-  _UploadPostHelper(req_id, std::ref(post), std::ref(carrier));
-  _UploadUserTimelineHelper(req_id, post.post_id, post.creator.user_id, post.timestamp, std::ref(carrier));
-  _UploadHomeTimelineHelper(req_id, post.post_id, post.creator.user_id, post.timestamp,
-                            std::ref(user_mentions_id), std::ref(carrier));
-
-  // Upload the post
-  // std::thread upload_post_worker(&ComposePostHandler::_UploadPostHelper,
-  //                                  this, req_id, std::ref(post), std::ref(carrier));
-
-  // std::thread upload_user_timeline_worker(
-  //     &ComposePostHandler::_UploadUserTimelineHelper, this, req_id,
-  //     post.post_id, post.creator.user_id, post.timestamp, std::ref(carrier));
-
-  // std::thread upload_home_timeline_worker(
-  //     &ComposePostHandler::_UploadHomeTimelineHelper, this, req_id,
-  //     post.post_id, post.creator.user_id, post.timestamp,
-  //     std::ref(user_mentions_id), std::ref(carrier));
-
-  // upload_post_worker.join();
-  // upload_user_timeline_worker.join();
-  // upload_home_timeline_worker.join();
-
-  if (_user_timeline_teptr) {
-    try{
-      std::rethrow_exception(_user_timeline_teptr);
-    }
-    catch(const std::exception &ex)
-    {
-      LOG(error) << "Thread exited with exception: " << ex.what();
-    }
-  }
-  if (_rabbitmq_teptr) {
-    try{
-      std::rethrow_exception(_rabbitmq_teptr);
-    }
-    catch(const std::exception &ex)
-    {
-      LOG(error) << "Thread exited with exception: " << ex.what();
-    }
-  }
-  if (_post_storage_teptr) {
-    try{
-      std::rethrow_exception(_post_storage_teptr);
-    }
-    catch(const std::exception &ex)
-    {
-      LOG(error) << "Thread exited with exception: " << ex.what();
-    }
-  }
+  // The three uploads are independent, and each helper logs its own failure
+  FanOut fan_out(_post_storage_client_pool->CallsOverlap() &&
+                 _user_timeline_client_pool->CallsOverlap());
+  fan_out.Add([&] {
+    _UploadPostHelper(req_id, post, carrier);
+  });
+  fan_out.Add([&] {
+    _UploadUserTimelineHelper(req_id, post.post_id, post.creator.user_id,
+                              post.timestamp, carrier);
+  });
+  _UploadHomeTimelineHelper(req_id, post.post_id, post.creator.user_id,
+                            post.timestamp, user_mentions_id, carrier);
+  fan_out.Join();
 }
 
 void ComposePostHandler::_UploadPostHelper(
@@ -565,7 +435,6 @@ void ComposePostHandler::_UploadPostHelper(
     _post_storage_client_pool->Push(post_storage_client_wrapper);
   } catch (...) {
     LOG(error) << "Failed to connect to post-storage-service";
-    _post_storage_teptr = std::current_exception();
   }
 }
 
@@ -598,7 +467,6 @@ void ComposePostHandler::_UploadUserTimelineHelper(
     _user_timeline_client_pool->Push(user_timeline_client_wrapper);
   } catch (...) {
     LOG(error) << "Failed to write user-timeline to user-timeline-service";
-    _user_timeline_teptr = std::current_exception();
   }
 }
 
@@ -610,44 +478,23 @@ void ComposePostHandler::_UploadHomeTimelineHelper(
     const std::vector<int64_t> &user_mentions_id,
     const std::map<std::string, std::string> &carrier) {
   try {
-    std::string user_mentions_id_str = "[";
-    for (auto &i : user_mentions_id){
-      user_mentions_id_str += std::to_string(i) + ", ";
-    }
-    user_mentions_id_str = user_mentions_id_str.substr(0,
-        user_mentions_id_str.length() - 2);
-    user_mentions_id_str += "]";
-    std::string carrier_str = "{";
-    for (auto &item : carrier) {
-      carrier_str += "\"" + item.first + "\" : \"" + item.second + "\", ";
-    }
-    carrier_str = carrier_str.substr(0, carrier_str.length() - 2);
-    carrier_str += "}";
-
-    std::string msg_str = "{ \"req_id\": " + std::to_string(req_id) +
-        ", \"post_id\": " + std::to_string(post_id) +
-        ", \"user_id\": " + std::to_string(user_id) +
-        ", \"timestamp\": " + std::to_string(timestamp) +
-        ", \"user_mentions_id\": " + user_mentions_id_str +
-        ", \"carrier\": " + carrier_str + "}";
-
-    auto rabbitmq_client_wrapper = _rabbitmq_client_pool->Pop();
-    if (!rabbitmq_client_wrapper) {
+    // JSON only while consumers from before the binary format remain
+    std::string msg_str = _json_home_timeline_messages
+        ? EncodeHomeTimelineJson(req_id, post_id, user_id, timestamp,
+                                 user_mentions_id, carrier)
+        : EncodeHomeTimelineMessage(req_id, post_id, user_id, timestamp,
+                                    user_mentions_id, carrier);
+
+    // Only queues the message, see AmqpPublisher
+    SpanStage publish_stage(req_id, "ComposePost", "PublishHomeTimeline");
+    if (!_home_timeline_publisher->Publish(std::move(msg_str))) {
       ServiceException se;
       se.errorCode = ErrorCode::SE_RABBITMQ_CONN_ERROR;
-      se.message = "Failed to connect to home-timeline-rabbitmq";
+      se.message = "home-timeline-rabbitmq is not keeping up";
       throw se;
     }
-    auto rabbitmq_channel = rabbitmq_client_wrapper->GetChannel();
-    {
-      auto rpc_trace_guard = _rabbitmq_client_pool->StartRpcTrace("Publish", rabbitmq_client_wrapper);
-      auto msg = AmqpClient::BasicMessage::Create(msg_str);
-      rabbitmq_channel->BasicPublish("", "write-home-timeline", msg);
-      _rabbitmq_client_pool->Push(rabbitmq_client_wrapper);
-    }
   } catch (...) {
-    LOG(error) << "Failed to connect to home-timeline-rabbitmq";
-    _rabbitmq_teptr = std::current_exception();
+    LOG(error) << "Failed to publish to home-timeline-rabbitmq";
   }
 }
 
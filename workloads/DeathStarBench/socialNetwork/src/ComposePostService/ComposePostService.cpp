@@ -7,16 +7,21 @@ using namespace social_network;
 
 static json config_json;
 static ClientPool<RedisClient>* redis_client_pool;
-static ClientPool<RabbitmqClient>* rabbitmq_client_pool;
+static AmqpPublisher* home_timeline_publisher;
+static ComposeBuffer* compose_buffer;
+static bool json_home_timeline_messages;
 
 int faas_init() {
     init_logger();
-    SetUpTracer("config/jaeger-config.yml", "post-storage-service");
+    SetUpTracer("config/jaeger-config.yml", "compose-post-service");
 
     if (load_config(&config_json) != 0) {
         return -1;
     }
 
+    SetUpFanOut(config_json["compose-post-service"].value("fanout_threads", 0),
+                config_json["compose-post-service"].value("fanout_max_queued", 0));
+
   int redis_port = config_json["compose-post-redis"]["port"];
   std::string redis_addr = config_json["compose-post-redis"]["addr"];
   int rabbitmq_port = config_json["write-home-timeline-rabbitmq"]["port"];
@@ -25,9 +30,52 @@ int faas_init() {
 
   redis_client_pool = new ClientPool<RedisClient>("redis", redis_addr, redis_port,
                                             0, config_json["compose-post-service"]["redis_client_pool_size"], 1000);
-  rabbitmq_client_pool = new ClientPool<RabbitmqClient>("rabbitmq", rabbitmq_addr,
-      rabbitmq_port, 0, config_json["compose-post-service"]["rabbitmq_client_pool_size"],
-      1000, "", nullptr, "ComposePostService", "WriteHomeTimelineRabbitMQ");
+
+  auto& service_config = config_json["compose-post-service"];
+  home_timeline_publisher = new AmqpPublisher(
+      rabbitmq_addr, rabbitmq_port, "write-home-timeline",
+      service_config.value("rabbitmq_max_unconfirmed", 256),
+      service_config.value("rabbitmq_max_queued", 8192),
+      service_config.value("rabbitmq_max_block_ms", 100));
+  // JSON for one more release: consumers from before the binary format
+  // cannot read it. Set to false once every consumer is upgraded.
+  json_home_timeline_messages =
+      service_config.value("home_timeline_json_messages", true);
+
+  int compose_buffer_slots = service_config.value("compose_buffer_slots", 0);
+  if (compose_buffer_slots > 0) {
+    std::string compose_buffer_name = service_config.value(
+        "compose_buffer_name", "/socialnet-compose-buffer");
+    compose_buffer = ComposeBuffer::Open(
+        compose_buffer_name, compose_buffer_slots,
+        service_config.value("compose_buffer_slot_bytes", 4096),
+        service_config.value("compose_buffer_ttl_ms", 50));
+  }
+  if (compose_buffer != nullptr) {
+    // Expired entries are spilled from a thread outside any function call,
+    // so the posts they complete are stored through the gateway.
+    int post_storage_port = config_json["post-storage-service"]["port"];
+    std::string post_storage_addr = config_json["post-storage-service"]["addr"];
+    std::string post_storage_http_path = config_json["post-storage-service"]["http_path"];
+    int user_timeline_port = config_json["user-timeline-service"]["port"];
+    std::string user_timeline_addr = config_json["user-timeline-service"]["addr"];
+    std::string user_timeline_http_path = config_json["user-timeline-service"]["http_path"];
+
+    auto post_storage_client_pool = new ClientPool<ThriftClient<PostStorageServiceClient>>(
+        "post-storage-client", post_storage_addr, post_storage_port, 0, 16,
+        1000, post_storage_http_path);
+    auto user_timeline_client_pool = new ClientPool<ThriftClient<UserTimelineServiceClient>>(
+        "user-timeline-client", user_timeline_addr, user_timeline_port, 0, 16,
+        1000, user_timeline_http_path);
+    auto spill_handler = std::make_shared<ComposePostHandler>(
+        redis_client_pool, post_storage_client_pool,
+        user_timeline_client_pool, home_timeline_publisher, nullptr,
+        json_home_timeline_messages);
+    compose_buffer->StartSweeper(
+        [spill_handler](int64_t req_id, const std::string& records) {
+          spill_handler->SpillComponents(req_id, records);
+        });
+  }
 
     return 0;
 }
@@ -57,7 +105,9 @@ int faas_create_func_worker(void* caller_context,
               redis_client_pool,
               post_storage_client_pool,
               user_timeline_client_pool,
-              rabbitmq_client_pool)));
+              home_timeline_publisher,
+              compose_buffer,
+              json_home_timeline_messages)));
     *worker_handle = faas_worker;
     return 0;
 }
@@ -0,0 +1,195 @@
+#ifndef SOCIAL_NETWORK_MICROSERVICES_HOMETIMELINEMESSAGE_H
+#define SOCIAL_NETWORK_MICROSERVICES_HOMETIMELINEMESSAGE_H
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "tracing.h"
+
+// Messages on the write-home-timeline queue, from ComposePostService to
+// WriteHomeTimelineService. A message is a fixed 40-byte header, the mention
+// ids and the trace context, in host (little-endian) order:
+//
+//   0   format (kHomeTimelineFormatV1)
+//   1   length of the trace context, 0 for none
+//   2   unused, zero
+//   4   number of mention ids
+//   8   req_id, post_id, user_id, timestamp, 8 bytes each
+//   40  mention ids, 8 bytes each
+//   ..  the "uber-trace-id" of the carrier
+//
+// The consumer reads it in place, without copying or allocating. It still
+// decodes the JSON of older producers, which always starts with '{'. Older
+// consumers read only JSON, so consumers are upgraded first and producers
+// keep writing JSON until "home_timeline_json_messages" is turned off.
+
+namespace social_network {
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "write-home-timeline messages are little-endian");
+
+const char kHomeTimelineFormatV1 = 0x01;
+const size_t kHomeTimelineHeaderSize = 40;
+
+// A decoded message. From the binary format it points into the message,
+// which must outlive it; from JSON it owns copies in the json_ members.
+struct HomeTimelineMessage {
+  int64_t req_id;
+  int64_t post_id;
+  int64_t user_id;
+  int64_t timestamp;
+  uint32_t num_mention_ids;
+  const char *mention_ids;
+  // the carrier's "uber-trace-id", not NUL-terminated
+  const char *trace_context;
+  size_t trace_context_len;
+
+  std::vector<int64_t> json_mention_ids;
+  std::string json_trace_context;
+
+  int64_t mention_id(uint32_t i) const {
+    int64_t id;
+    memcpy(&id, mention_ids + i * sizeof(int64_t), sizeof(id));
+    return id;
+  }
+};
+
+namespace home_timeline_detail {
+
+// Empty for a carrier without one, or one too long for its length byte
+const char *TraceContext(const std::map<std::string, std::string> &carrier,
+                         size_t *len) {
+  auto it = carrier.find(tracing_detail::kTraceContextHeader);
+  if (it == carrier.end() || it->second.size() > UINT8_MAX) {
+    *len = 0;
+    return "";
+  }
+  *len = it->second.size();
+  return it->second.data();
+}
+
+bool DecodeJson(const char *data, size_t size, HomeTimelineMessage *message) {
+  auto msg_json = nlohmann::json::parse(data, data + size, nullptr, false);
+  if (msg_json.is_discarded()) {
+    return false;
+  }
+  try {
+    message->req_id = msg_json["req_id"];
+    message->post_id = msg_json["post_id"];
+    message->user_id = msg_json["user_id"];
+    message->timestamp = msg_json["timestamp"];
+    message->json_mention_ids =
+        msg_json["user_mentions_id"].get<std::vector<int64_t>>();
+    auto &carrier = msg_json["carrier"];
+    auto it = carrier.find(tracing_detail::kTraceContextHeader);
+    message->json_trace_context =
+        it == carrier.end() ? "" : it->get<std::string>();
+  } catch (const nlohmann::json::exception &) {
+    return false;
+  }
+  message->num_mention_ids = message->json_mention_ids.size();
+  message->mention_ids =
+      reinterpret_cast<const char *>(message->json_mention_ids.data());
+  message->trace_context = message->json_trace_context.data();
+  message->trace_context_len = message->json_trace_context.size();
+  return true;
+}
+
+} // namespace home_timeline_detail
+
+// Only the "uber-trace-id" of the carrier goes along.
+std::string EncodeHomeTimelineMessage(
+    int64_t req_id, int64_t post_id, int64_t user_id, int64_t timestamp,
+    const std::vector<int64_t> &mention_ids,
+    const std::map<std::string, std::string> &carrier) {
+  size_t trace_context_len;
+  const char *trace_context =
+      home_timeline_detail::TraceContext(carrier, &trace_context_len);
+  uint32_t num_mention_ids = mention_ids.size();
+  std::string msg(kHomeTimelineHeaderSize +
+                      num_mention_ids * sizeof(int64_t) + trace_context_len,
+                  '\0');
+  char *data = &msg[0];
+  data[0] = kHomeTimelineFormatV1;
+  data[1] = static_cast<char>(trace_context_len);
+  memcpy(data + 4, &num_mention_ids, sizeof(num_mention_ids));
+  memcpy(data + 8, &req_id, sizeof(req_id));
+  memcpy(data + 16, &post_id, sizeof(post_id));
+  memcpy(data + 24, &user_id, sizeof(user_id));
+  memcpy(data + 32, &timestamp, sizeof(timestamp));
+  data += kHomeTimelineHeaderSize;
+  if (num_mention_ids > 0) {
+    memcpy(data, mention_ids.data(), num_mention_ids * sizeof(int64_t));
+    data += num_mention_ids * sizeof(int64_t);
+  }
+  memcpy(data, trace_context, trace_context_len);
+  return msg;
+}
+
+// The format consumers from before kHomeTimelineFormatV1 read.
+std::string EncodeHomeTimelineJson(
+    int64_t req_id, int64_t post_id, int64_t user_id, int64_t timestamp,
+    const std::vector<int64_t> &mention_ids,
+    const std::map<std::string, std::string> &carrier) {
+  std::string user_mentions_id_str = "[";
+  for (auto &i : mention_ids) {
+    user_mentions_id_str += std::to_string(i) + ", ";
+  }
+  user_mentions_id_str = user_mentions_id_str.substr(0,
+      user_mentions_id_str.length() - 2);
+  user_mentions_id_str += "]";
+  std::string carrier_str = "{";
+  for (auto &item : carrier) {
+    carrier_str += "\"" + item.first + "\" : \"" + item.second + "\", ";
+  }
+  carrier_str = carrier_str.substr(0, carrier_str.length() - 2);
+  carrier_str += "}";
+
+  return "{ \"req_id\": " + std::to_string(req_id) +
+      ", \"post_id\": " + std::to_string(post_id) +
+      ", \"user_id\": " + std::to_string(user_id) +
+      ", \"timestamp\": " + std::to_string(timestamp) +
+      ", \"user_mentions_id\": " + user_mentions_id_str +
+      ", \"carrier\": " + carrier_str + "}";
+}
+
+// False if the message is neither format or is truncated.
+bool DecodeHomeTimelineMessage(const char *data, size_t size,
+                               HomeTimelineMessage *message) {
+  if (size == 0) {
+    return false;
+  }
+  if (data[0] == '{') {
+    return home_timeline_detail::DecodeJson(data, size, message);
+  }
+  if (data[0] != kHomeTimelineFormatV1 || size < kHomeTimelineHeaderSize) {
+    return false;
+  }
+  uint32_t num_mention_ids;
+  memcpy(&num_mention_ids, data + 4, sizeof(num_mention_ids));
+  size_t trace_context_len = static_cast<uint8_t>(data[1]);
+  if (size != kHomeTimelineHeaderSize +
+              static_cast<size_t>(num_mention_ids) * sizeof(int64_t) +
+              trace_context_len) {
+    return false;
+  }
+  memcpy(&message->req_id, data + 8, sizeof(int64_t));
+  memcpy(&message->post_id, data + 16, sizeof(int64_t));
+  memcpy(&message->user_id, data + 24, sizeof(int64_t));
+  memcpy(&message->timestamp, data + 32, sizeof(int64_t));
+  message->num_mention_ids = num_mention_ids;
+  message->mention_ids = data + kHomeTimelineHeaderSize;
+  message->trace_context =
+      message->mention_ids + num_mention_ids * sizeof(int64_t);
+  message->trace_context_len = trace_context_len;
+  return true;
+}
+
+} // namespace social_network
+
+#endif //SOCIAL_NETWORK_MICROSERVICES_HOMETIMELINEMESSAGE_H
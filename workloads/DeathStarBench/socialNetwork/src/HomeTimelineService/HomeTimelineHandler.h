@@ -47,14 +47,7 @@ void ReadHomeTimelineHandler::ReadHomeTimeline(
     const std::map<std::string, std::string> &carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "ReadHomeTimeline",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("ReadHomeTimeline", carrier, req_id);
 
   if (stop <= start || start < 0) {
     return;
@@ -68,12 +61,11 @@ void ReadHomeTimelineHandler::ReadHomeTimeline(
     throw se;
   }
   auto redis_client = redis_client_wrapper->GetClient();
-  auto redis_span = opentracing::Tracer::Global()->StartSpan(
-      "RedisFind", {opentracing::ChildOf(&span->context())});
+  auto redis_span = span.StartSpan("RedisFind");
   redis_client.AppendCommand("ZREVRANGE %" PRId64 " %d %d", user_id, start, stop - 1);
   auto post_ids_reply = redis_client.GetReply();
   _redis_client_pool->Push(redis_client_wrapper);
-  redis_span->Finish();
+  redis_span.Finish();
 
   std::vector<int64_t> post_ids;
   auto post_ids_reply_array = post_ids_reply->as_array();
@@ -92,7 +84,7 @@ void ReadHomeTimelineHandler::ReadHomeTimeline(
   {
     auto rpc_trace_guard = _post_client_pool->StartRpcTrace("ReadPosts", post_client_wrapper);
     try {
-      post_client->ReadPosts(_return, req_id, post_ids, writer_text_map);
+      post_client->ReadPosts(_return, req_id, post_ids, span.carrier());
     } catch (...) {
       rpc_trace_guard->set_status(1);
       _post_client_pool->Remove(post_client_wrapper);
@@ -101,7 +93,7 @@ void ReadHomeTimelineHandler::ReadHomeTimeline(
     }
   }
   _post_client_pool->Push(post_client_wrapper);
-  span->Finish();
+  span.Finish();
 }
 
 } // namespace social_network
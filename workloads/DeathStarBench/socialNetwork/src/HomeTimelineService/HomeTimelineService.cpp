@@ -13,7 +13,7 @@ static ClientPool<RedisClient>* redis_client_pool;
 
 int faas_init() {
     init_logger();
-    SetUpTracer("config/jaeger-config.yml", "post-storage-service");
+    SetUpTracer("config/jaeger-config.yml", "home-timeline-service");
 
     if (load_config(&config_json) != 0) {
         return -1;
@@ -0,0 +1,529 @@
+#ifndef SOCIAL_NETWORK_MICROSERVICES_LATENCYSTATS_H
+#define SOCIAL_NETWORK_MICROSERVICES_LATENCYSTATS_H
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "logger.h"
+
+// Latency of every (method, stage) of the service, e.g. ("ReadPosts",
+// "MongoFindPosts"), timed with the TSC into histograms of about 3%
+// precision:
+//
+//   StageTimer timer(GetLatencyHistogram("ReadPosts", "MongoFindPosts"));
+//   ...
+//   timer.Stop();  // or when the timer goes out of scope
+//
+// Method and stage names must be string literals, a thread caches its
+// histogram of a stage by their addresses. Each thread records into
+// histograms of its own, so a timer should stop on the thread that started
+// it. Spans carry a StageTimer (see tracing.h), so the spans of a handler
+// are timed whether the request is traced or not, and the whole request is
+// the stage "total".
+//
+// A timed scope costs two TSC reads plus about 8 ns of lookup and record.
+// Where rdtsc takes ~20 ns, as on the VMs this was measured on (43 ns per
+// scope), that is over the 30 ns per scope this was meant to stay under;
+// sampling lowers the average, not the cost of a timed scope. A thread
+// times one scope in 4 at random and GetLatencyHistogram() returns null for
+// the others. LATENCY_STATS_SAMPLE_EVERY=1 in the environment times every
+// scope. Building with -DDISABLE_LATENCY_STATS (cmake
+// -DENABLE_LATENCY_STATS=OFF) compiles the timing out.
+//
+// Once SetUpLatencyStats() has run, kill -USR2 <pid> writes the count and
+// percentiles of every stage to stderr. With LATENCY_STATS_SOCKET_DIR set
+// in the environment, the same text is also served on the unix socket
+// <dir>/<service>.<pid>.sock to each client that connects, e.g.
+// socat - UNIX-CONNECT:<dir>/<service>.<pid>.sock
+
+namespace social_network {
+
+namespace latency_detail {
+
+const int kSubBucketBits = 5;  // 32 buckets per power of two
+const uint64_t kSubBuckets = 1 << kSubBucketBits;
+const int kMaxMagnitude = 44;  // larger values go to the last bucket
+const size_t kNumBuckets =
+    kSubBuckets * (kMaxMagnitude - kSubBucketBits + 2);
+
+// one scope in sample_mask + 1 is timed, see SetUpLatencyStats()
+const uint64_t kDefaultSampleEvery = 4;
+uint64_t sample_mask = kDefaultSampleEvery - 1;
+
+inline uint64_t ReadCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// taken at startup, Dump() converts cycles to time against it
+const uint64_t start_cycles = ReadCycles();
+const auto start_time = std::chrono::steady_clock::now();
+
+double CyclesPerMicrosecond() {
+  auto elapsed = std::chrono::steady_clock::now() - start_time;
+  if (elapsed < std::chrono::milliseconds(10)) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  uint64_t cycles = ReadCycles() - start_cycles;
+  elapsed = std::chrono::steady_clock::now() - start_time;
+  return cycles /
+      std::chrono::duration<double, std::micro>(elapsed).count();
+}
+
+int dump_pipe[2] = {-1, -1};
+
+void RequestDump(int) {
+  int saved_errno = errno;
+  char byte = 0;
+  if (write(dump_pipe[1], &byte, 1) < 0) {
+    // nothing to do in a signal handler
+  }
+  errno = saved_errno;
+}
+
+} // namespace latency_detail
+
+// Log-linear histogram of cycle counts written by one thread at a time.
+// Another thread may read it meanwhile.
+class LatencyHistogram {
+ public:
+  LatencyHistogram() {
+    for (auto &bucket : _buckets) {
+      bucket.store(0, std::memory_order_relaxed);
+    }
+  }
+  LatencyHistogram(const LatencyHistogram&) = delete;
+  LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+  void Record(uint64_t cycles) {
+    auto &bucket = _buckets[BucketIndex(cycles)];
+    // not an atomic increment, only this thread writes
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1,
+                 std::memory_order_relaxed);
+  }
+  void AddTo(std::vector<uint64_t> *counts) const;
+
+  static size_t BucketIndex(uint64_t value);
+  // the largest value that falls into the bucket
+  static uint64_t BucketMax(size_t index);
+
+ private:
+  std::atomic<uint64_t> _buckets[latency_detail::kNumBuckets];
+};
+
+size_t LatencyHistogram::BucketIndex(uint64_t value) {
+  using namespace latency_detail;
+  if (value < kSubBuckets) {
+    return value;
+  }
+  int magnitude = 63 - __builtin_clzll(value);
+  if (magnitude > kMaxMagnitude) {
+    return kNumBuckets - 1;
+  }
+  return kSubBuckets * (magnitude - kSubBucketBits + 1) +
+      (value >> (magnitude - kSubBucketBits)) - kSubBuckets;
+}
+
+uint64_t LatencyHistogram::BucketMax(size_t index) {
+  using namespace latency_detail;
+  if (index < kSubBuckets) {
+    return index;
+  }
+  if (index >= kNumBuckets - 1) {
+    return UINT64_MAX;
+  }
+  index++;
+  int magnitude = index / kSubBuckets + kSubBucketBits - 1;
+  uint64_t sub_bucket = index % kSubBuckets;
+  return ((kSubBuckets + sub_bucket) << (magnitude - kSubBucketBits)) - 1;
+}
+
+void LatencyHistogram::AddTo(std::vector<uint64_t> *counts) const {
+  for (size_t i = 0; i < latency_detail::kNumBuckets; i++) {
+    (*counts)[i] += _buckets[i].load(std::memory_order_relaxed);
+  }
+}
+
+// The histograms of one (method, stage), one per thread that recorded it.
+// A histogram goes back to the free list when its thread exits and is
+// reused, so the counts of exited threads stay in the stage.
+class LatencyStage {
+ public:
+  LatencyHistogram *AcquireHistogram();
+  void ReleaseHistogram(LatencyHistogram *histogram);
+  std::vector<uint64_t> Counts();
+
+ private:
+  std::mutex _mutex;
+  std::vector<std::unique_ptr<LatencyHistogram>> _histograms;
+  std::vector<LatencyHistogram *> _free;
+};
+
+LatencyHistogram *LatencyStage::AcquireHistogram() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (!_free.empty()) {
+    LatencyHistogram *histogram = _free.back();
+    _free.pop_back();
+    return histogram;
+  }
+  _histograms.emplace_back(new LatencyHistogram);
+  return _histograms.back().get();
+}
+
+void LatencyStage::ReleaseHistogram(LatencyHistogram *histogram) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _free.push_back(histogram);
+}
+
+std::vector<uint64_t> LatencyStage::Counts() {
+  std::vector<uint64_t> counts(latency_detail::kNumBuckets);
+  std::lock_guard<std::mutex> lock(_mutex);
+  for (auto &histogram : _histograms) {
+    histogram->AddTo(&counts);
+  }
+  return counts;
+}
+
+class LatencyStats {
+ public:
+  // never destroyed, timers may still stop while the process exits
+  static LatencyStats &Get() {
+    static LatencyStats *stats = new LatencyStats;
+    return *stats;
+  }
+
+  void SetService(const std::string &service);
+  LatencyStage *Stage(const std::string &method, const std::string &stage);
+  std::string DumpText();
+  void Dump(FILE *out);
+
+ private:
+  std::mutex _mutex;
+  std::string _service;
+  std::map<std::pair<std::string, std::string>,
+           std::unique_ptr<LatencyStage>> _stages;
+};
+
+void LatencyStats::SetService(const std::string &service) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _service = service;
+}
+
+LatencyStage *LatencyStats::Stage(const std::string &method,
+                                  const std::string &stage) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto &entry = _stages[std::make_pair(method, stage)];
+  if (!entry) {
+    entry.reset(new LatencyStage);
+  }
+  return entry.get();
+}
+
+std::string LatencyStats::DumpText() {
+  const double kPercentiles[] = {50, 90, 99, 99.9};
+  double cycles_per_us = latency_detail::CyclesPerMicrosecond();
+  std::string text;
+  char line[256];
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  snprintf(line, sizeof(line),
+           "latency of %s in us, %.0f cycles/us, 1 in %llu scopes timed\n"
+           "%-28s %-32s %10s %10s %10s %10s %10s %10s\n",
+           _service.c_str(), cycles_per_us,
+           static_cast<unsigned long long>(latency_detail::sample_mask + 1),
+           "method", "stage", "count", "p50", "p90", "p99", "p99.9", "max");
+  text += line;
+  for (auto &entry : _stages) {
+    std::vector<uint64_t> counts = entry.second->Counts();
+    uint64_t total = 0;
+    size_t max_index = 0;
+    for (size_t i = 0; i < counts.size(); i++) {
+      total += counts[i];
+      if (counts[i] > 0) {
+        max_index = i;
+      }
+    }
+    if (total == 0) {
+      continue;
+    }
+    double values[5];
+    size_t bucket = 0;
+    uint64_t seen = counts[0];
+    for (int p = 0; p < 4; p++) {
+      auto rank = static_cast<uint64_t>(kPercentiles[p] / 100 * total);
+      rank = std::max<uint64_t>(rank, 1);
+      while (seen < rank) {
+        seen += counts[++bucket];
+      }
+      values[p] = LatencyHistogram::BucketMax(bucket) / cycles_per_us;
+    }
+    values[4] = LatencyHistogram::BucketMax(max_index) / cycles_per_us;
+    snprintf(line, sizeof(line),
+             "%-28s %-32s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+             entry.first.first.c_str(), entry.first.second.c_str(),
+             static_cast<unsigned long long>(total), values[0], values[1],
+             values[2], values[3], values[4]);
+    text += line;
+  }
+  return text;
+}
+
+void LatencyStats::Dump(FILE *out) {
+  std::string text = DumpText();
+  fwrite(text.data(), 1, text.size(), out);
+  fflush(out);
+}
+
+namespace latency_detail {
+
+const int kCacheBits = 8;
+const size_t kCacheSize = 1 << kCacheBits;
+const size_t kMaxCached = kCacheSize * 3 / 4;
+
+// What a thread reads on every scope. Plain data, so reaching it takes no
+// TLS guard: the state of the random numbers it samples by and its
+// histograms by the addresses of the names, open-addressed and never
+// evicted.
+struct ThreadCache {
+  struct Entry {
+    const char *method;
+    const char *stage;
+    LatencyHistogram *histogram;
+  };
+
+  uint64_t random;
+  size_t num_cached;
+  Entry entries[kCacheSize];
+};
+
+thread_local ThreadCache thread_cache;
+
+// The histograms a thread records into, handed back when it exits.
+struct ThreadHistograms {
+  ~ThreadHistograms() {
+    for (auto &owned : histograms) {
+      owned.first->ReleaseHistogram(owned.second);
+    }
+  }
+
+  std::unordered_map<LatencyStage *, LatencyHistogram *> histograms;
+};
+
+LatencyHistogram *FindHistogram(const char *method, const char *stage) {
+  thread_local ThreadHistograms thread_histograms;
+  LatencyStage *latency_stage = LatencyStats::Get().Stage(method, stage);
+  auto &histogram = thread_histograms.histograms[latency_stage];
+  if (!histogram) {
+    histogram = latency_stage->AcquireHistogram();
+  }
+  return histogram;
+}
+
+} // namespace latency_detail
+
+// The calling thread's histogram of (method, stage), null for a scope that
+// is not timed.
+LatencyHistogram *GetLatencyHistogram(const char *method, const char *stage) {
+#ifdef DISABLE_LATENCY_STATS
+  return nullptr;
+#else
+  using namespace latency_detail;
+  ThreadCache &cache = thread_cache;
+  // xorshift64, seeded on the thread's first scope
+  uint64_t random = cache.random ? cache.random : (ReadCycles() | 1);
+  random ^= random << 13;
+  random ^= random >> 7;
+  random ^= random << 17;
+  cache.random = random;
+  if ((random & sample_mask) != 0) {
+    return nullptr;
+  }
+
+  uint64_t key = reinterpret_cast<uintptr_t>(method) * 31 +
+      reinterpret_cast<uintptr_t>(stage);
+  // literals sit a few bytes apart, the top bits of the product spread them
+  size_t index = (key * 0x9e3779b97f4a7c15) >> (64 - kCacheBits);
+  while (cache.entries[index].method != nullptr) {
+    auto &entry = cache.entries[index];
+    if (entry.method == method && entry.stage == stage) {
+      return entry.histogram;
+    }
+    index = (index + 1) & (kCacheSize - 1);
+  }
+  LatencyHistogram *histogram = FindHistogram(method, stage);
+  // a quarter stays empty so probing ends quickly; past that a stage locks
+  // on every timed scope
+  if (cache.num_cached < kMaxCached) {
+    cache.entries[index] = {method, stage, histogram};
+    cache.num_cached++;
+  }
+  return histogram;
+#endif
+}
+
+// Records the cycles from construction to Stop() or destruction, nothing
+// for a null histogram.
+class StageTimer {
+ public:
+  StageTimer() : _histogram(nullptr), _start(0) {}
+  explicit StageTimer(LatencyHistogram *histogram)
+      : _histogram(histogram),
+        _start(histogram ? latency_detail::ReadCycles() : 0) {}
+  StageTimer(StageTimer &&other)
+      : _histogram(other._histogram), _start(other._start) {
+    other._histogram = nullptr;
+  }
+  StageTimer &operator=(StageTimer &&other) {
+    if (this != &other) {
+      Stop();
+      _histogram = other._histogram;
+      _start = other._start;
+      other._histogram = nullptr;
+    }
+    return *this;
+  }
+  ~StageTimer() { Stop(); }
+
+  bool running() const { return _histogram != nullptr; }
+  void Stop() {
+    if (_histogram) {
+      _histogram->Record(latency_detail::ReadCycles() - _start);
+      _histogram = nullptr;
+    }
+  }
+
+ private:
+  LatencyHistogram *_histogram;
+  uint64_t _start;
+};
+
+namespace latency_detail {
+
+// Serves a dump to every client of a unix socket in `dir`, on a thread of
+// its own.
+void ServeDumps(const std::string &dir, const std::string &service) {
+  std::string path = dir + "/" + service + "." + std::to_string(getpid()) +
+      ".sock";
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    LOG(warning) << "Latency stats socket path too long: " << path;
+    return;
+  }
+  path.copy(addr.sun_path, path.size());
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    LOG(warning) << "Cannot create the latency stats socket: errno " << errno;
+    return;
+  }
+  unlink(path.c_str());
+  if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      listen(fd, 4) != 0) {
+    LOG(warning) << "Cannot listen on " << path << ": errno " << errno;
+    close(fd);
+    return;
+  }
+  LOG(info) << "Latency stats on " << path;
+  std::thread([fd] {
+    while (true) {
+      int client = accept(fd, nullptr, nullptr);
+      if (client < 0) {
+        if (errno == EINTR || errno == ECONNABORTED) {
+          continue;
+        }
+        break;
+      }
+      std::string text = LatencyStats::Get().DumpText();
+      for (size_t sent = 0; sent < text.size();) {
+        ssize_t n = send(client, text.data() + sent, text.size() - sent,
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          break;
+        }
+        sent += n;
+      }
+      close(client);
+    }
+  }).detach();
+}
+
+} // namespace latency_detail
+
+// Names the service in dumps, reads LATENCY_STATS_SAMPLE_EVERY (rounded up
+// to a power of two), dumps on SIGUSR2 and, with LATENCY_STATS_SOCKET_DIR,
+// to clients of the stats socket. Call before the service's threads start.
+void SetUpLatencyStats(const std::string &service) {
+#ifndef DISABLE_LATENCY_STATS
+  LatencyStats::Get().SetService(service);
+  const char *sample_every_str = getenv("LATENCY_STATS_SAMPLE_EVERY");
+  if (sample_every_str != nullptr && atoi(sample_every_str) > 0) {
+    uint64_t sample_every = 1;
+    while (sample_every < static_cast<uint64_t>(atoi(sample_every_str))) {
+      sample_every <<= 1;
+    }
+    latency_detail::sample_mask = sample_every - 1;
+  }
+  static std::once_flag installed;
+  std::call_once(installed, [] {
+    if (pipe(latency_detail::dump_pipe) != 0) {
+      return;
+    }
+    std::thread([] {
+      char byte;
+      while (true) {
+        ssize_t n = read(latency_detail::dump_pipe[0], &byte, 1);
+        if (n == 1) {
+          LatencyStats::Get().Dump(stderr);
+        } else if (n == 0 || errno != EINTR) {
+          break;
+        }
+      }
+    }).detach();
+    struct sigaction action = {};
+    action.sa_handler = latency_detail::RequestDump;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR2, &action, nullptr);
+  });
+  static std::once_flag serving;
+  std::call_once(serving, [&service] {
+    const char *socket_dir = getenv("LATENCY_STATS_SOCKET_DIR");
+    if (socket_dir != nullptr && socket_dir[0] != '\0') {
+      latency_detail::ServeDumps(socket_dir, service);
+    }
+  });
+#endif
+}
+
+} // namespace social_network
+
+#endif //SOCIAL_NETWORK_MICROSERVICES_LATENCYSTATS_H
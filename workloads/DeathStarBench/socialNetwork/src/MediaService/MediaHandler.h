@@ -53,14 +53,7 @@ void MediaHandler::UploadMedia(
     const std::map<std::string, std::string> &carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UploadMedia",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("UploadMedia", carrier, req_id);
 
   if (media_types.size() != media_ids.size()) {
     ServiceException se;
@@ -89,7 +82,7 @@ void MediaHandler::UploadMedia(
   {
     auto rpc_trace_guard = _compose_client_pool->StartRpcTrace("UploadMedia", compose_post_client_wrapper);
     try {
-      compose_post_client->UploadMedia(req_id, media, writer_text_map);
+      compose_post_client->UploadMedia(req_id, media, span.carrier());
     } catch (...) {
       rpc_trace_guard->set_status(1);
       _compose_client_pool->Remove(compose_post_client_wrapper);
@@ -98,7 +91,7 @@ void MediaHandler::UploadMedia(
     }
   }
   _compose_client_pool->Push(compose_post_client_wrapper);
-  span->Finish();
+  span.Finish();
 
 }
 
@@ -8,7 +8,7 @@ static json config_json;
 
 int faas_init() {
     init_logger();
-    SetUpTracer("config/jaeger-config.yml", "post-storage-service");
+    SetUpTracer("config/jaeger-config.yml", "media-service");
 
     if (load_config(&config_json) != 0) {
         return -1;
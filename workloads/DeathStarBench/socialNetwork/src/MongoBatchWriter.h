@@ -0,0 +1,307 @@
+#ifndef SOCIAL_NETWORK_MICROSERVICES_MONGOBATCHWRITER_H
+#define SOCIAL_NETWORK_MICROSERVICES_MONGOBATCHWRITER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <mongoc.h>
+#include <bson/bson.h>
+
+#include "logger.h"
+
+namespace social_network {
+
+struct MongoWriteResult {
+  bool ok;
+  bson_error_t error;
+};
+
+// Group commit for one collection. Writes submitted by concurrent requests
+// are held for up to `max_delay_us` after the first of them (or until
+// `max_batch_size` are queued) and then sent as one unordered bulk write, so
+// N requests cost one round trip instead of N. Each write still gets its own
+// result: a write error fails only the write it belongs to, anything else
+// fails the whole batch.
+//
+// The flush thread keeps one client from the pool for itself, so callers may
+// hold a client of their own while they wait.
+class MongoBatchWriter {
+ public:
+  MongoBatchWriter(mongoc_client_pool_t *mongodb_client_pool,
+                   const std::string &db_name,
+                   const std::string &collection_name,
+                   int max_batch_size, int max_delay_us);
+  ~MongoBatchWriter();
+  MongoBatchWriter(const MongoBatchWriter&) = delete;
+  MongoBatchWriter& operator=(const MongoBatchWriter&) = delete;
+
+  // The documents are copied, callers keep ownership.
+  std::future<MongoWriteResult> InsertAsync(const bson_t *doc);
+  std::future<MongoWriteResult> UpdateOneAsync(const bson_t *selector,
+                                               const bson_t *update,
+                                               bool upsert);
+
+  // Blocking forms, in the style of mongoc_collection_insert_one().
+  bool Insert(const bson_t *doc, bson_error_t *error);
+  bool UpdateOne(const bson_t *selector, const bson_t *update, bool upsert,
+                 bson_error_t *error);
+
+ private:
+  struct Op {
+    bson_t *doc;  // the document to insert, or the update's selector
+    bson_t *update;  // nullptr for an insert
+    bool upsert;
+    std::promise<MongoWriteResult> promise;
+  };
+
+  std::future<MongoWriteResult> Submit(bson_t *doc, bson_t *update,
+                                       bool upsert);
+  static bool NonEmptyArray(const bson_t *doc, const char *key,
+                            bson_iter_t *array);
+  void Run();
+  void Execute(mongoc_client_t *mongodb_client, std::vector<Op> *ops);
+
+  mongoc_client_pool_t *_mongodb_client_pool;
+  std::string _db_name;
+  std::string _collection_name;
+  size_t _max_batch_size;
+  std::chrono::microseconds _max_delay;
+
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::vector<Op> _pending;
+  std::chrono::steady_clock::time_point _flush_at;
+  bool _stop = false;
+  std::thread _thread;
+};
+
+MongoBatchWriter::MongoBatchWriter(mongoc_client_pool_t *mongodb_client_pool,
+                                   const std::string &db_name,
+                                   const std::string &collection_name,
+                                   int max_batch_size, int max_delay_us)
+    : _mongodb_client_pool(mongodb_client_pool),
+      _db_name(db_name),
+      _collection_name(collection_name),
+      _max_batch_size(std::max(1, max_batch_size)),
+      _max_delay(std::max(0, max_delay_us)) {
+  _thread = std::thread(&MongoBatchWriter::Run, this);
+}
+
+MongoBatchWriter::~MongoBatchWriter() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+  _cv.notify_one();
+  _thread.join();
+}
+
+std::future<MongoWriteResult> MongoBatchWriter::InsertAsync(const bson_t *doc) {
+  return Submit(bson_copy(doc), nullptr, false);
+}
+
+std::future<MongoWriteResult> MongoBatchWriter::UpdateOneAsync(
+    const bson_t *selector, const bson_t *update, bool upsert) {
+  return Submit(bson_copy(selector), bson_copy(update), upsert);
+}
+
+bool MongoBatchWriter::Insert(const bson_t *doc, bson_error_t *error) {
+  MongoWriteResult result = InsertAsync(doc).get();
+  if (!result.ok && error) {
+    *error = result.error;
+  }
+  return result.ok;
+}
+
+bool MongoBatchWriter::UpdateOne(const bson_t *selector, const bson_t *update,
+                                 bool upsert, bson_error_t *error) {
+  MongoWriteResult result = UpdateOneAsync(selector, update, upsert).get();
+  if (!result.ok && error) {
+    *error = result.error;
+  }
+  return result.ok;
+}
+
+std::future<MongoWriteResult> MongoBatchWriter::Submit(bson_t *doc,
+                                                       bson_t *update,
+                                                       bool upsert) {
+  Op op{doc, update, upsert, std::promise<MongoWriteResult>()};
+  auto future = op.promise.get_future();
+  bool wake;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _pending.push_back(std::move(op));
+    if (_pending.size() == 1) {
+      _flush_at = std::chrono::steady_clock::now() + _max_delay;
+    }
+    // the first write starts the window, a full batch ends it early
+    wake = _pending.size() == 1 || _pending.size() == _max_batch_size;
+  }
+  if (wake) {
+    _cv.notify_one();
+  }
+  return future;
+}
+
+bool MongoBatchWriter::NonEmptyArray(const bson_t *doc, const char *key,
+                                     bson_iter_t *array) {
+  bson_iter_t iter;
+  bson_iter_t child;
+  if (!bson_iter_init_find(&iter, doc, key) || !BSON_ITER_HOLDS_ARRAY(&iter) ||
+      !bson_iter_recurse(&iter, &child)) {
+    return false;
+  }
+  if (array) {
+    *array = child;
+  }
+  return bson_iter_next(&child);
+}
+
+void MongoBatchWriter::Run() {
+  mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
+      _mongodb_client_pool);
+  std::vector<Op> ops;
+  std::unique_lock<std::mutex> lock(_mutex);
+  while (true) {
+    _cv.wait(lock, [this] { return _stop || !_pending.empty(); });
+    if (_pending.empty()) {
+      break;
+    }
+    _cv.wait_until(lock, _flush_at, [this] {
+      return _stop || _pending.size() >= _max_batch_size;
+    });
+    ops.swap(_pending);
+    lock.unlock();
+    Execute(mongodb_client, &ops);
+    ops.clear();
+    lock.lock();
+    if (!_pending.empty()) {
+      // writes queued during the round trip already waited for it
+      _flush_at = std::chrono::steady_clock::now();
+    }
+  }
+  lock.unlock();
+  mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+}
+
+void MongoBatchWriter::Execute(mongoc_client_t *mongodb_client,
+                               std::vector<Op> *ops) {
+  std::vector<MongoWriteResult> results(ops->size());
+  for (auto &result : results) {
+    result.ok = true;
+  }
+
+  if (!mongodb_client) {
+    for (auto &result : results) {
+      result.ok = false;
+      bson_set_error(&result.error, MONGOC_ERROR_CLIENT,
+                     MONGOC_ERROR_CLIENT_NOT_READY,
+                     "Failed to pop a client from MongoDB pool");
+    }
+  }
+
+  auto collection = mongodb_client ? mongoc_client_get_collection(
+      mongodb_client, _db_name.c_str(), _collection_name.c_str()) : nullptr;
+  bson_t *bulk_opts = BCON_NEW("ordered", BCON_BOOL(false));
+  bson_t *upsert_opts = BCON_NEW("upsert", BCON_BOOL(true));
+  // a batch larger than _max_batch_size (queued during the last round trip)
+  // goes out as several bulk writes
+  for (size_t begin = 0; collection && begin < ops->size();
+       begin += _max_batch_size) {
+    size_t end = std::min(ops->size(), begin + _max_batch_size);
+    mongoc_bulk_operation_t *bulk =
+        mongoc_collection_create_bulk_operation_with_opts(
+            collection, bulk_opts);
+    // bulk index -> op index, ops the driver rejects are not sent
+    std::vector<size_t> sent;
+    for (size_t i = begin; i < end; i++) {
+      Op &op = (*ops)[i];
+      bool added = op.update
+          ? mongoc_bulk_operation_update_one_with_opts(
+                bulk, op.doc, op.update, op.upsert ? upsert_opts : nullptr,
+                &results[i].error)
+          : mongoc_bulk_operation_insert_with_opts(
+                bulk, op.doc, nullptr, &results[i].error);
+      if (added) {
+        sent.push_back(i);
+      } else {
+        results[i].ok = false;
+      }
+    }
+
+    if (!sent.empty()) {
+      bson_t reply;
+      bson_error_t error;
+      bool executed = mongoc_bulk_operation_execute(bulk, &reply, &error);
+      bson_iter_t write_errors;
+      // with only write errors the other writes were applied; a write
+      // concern error or a failure without a reply leaves them all unknown
+      bool per_write = !executed &&
+          !NonEmptyArray(&reply, "writeConcernErrors", nullptr) &&
+          NonEmptyArray(&reply, "writeErrors", &write_errors);
+      if (per_write) {
+        while (bson_iter_next(&write_errors)) {
+          bson_iter_t field;
+          int64_t index = -1;
+          int32_t code = 0;
+          const char *message = "";
+          if (!BSON_ITER_HOLDS_DOCUMENT(&write_errors) ||
+              !bson_iter_recurse(&write_errors, &field)) {
+            continue;
+          }
+          while (bson_iter_next(&field)) {
+            if (strcmp(bson_iter_key(&field), "index") == 0) {
+              index = bson_iter_as_int64(&field);
+            } else if (strcmp(bson_iter_key(&field), "code") == 0) {
+              code = static_cast<int32_t>(bson_iter_as_int64(&field));
+            } else if (strcmp(bson_iter_key(&field), "errmsg") == 0 &&
+                       BSON_ITER_HOLDS_UTF8(&field)) {
+              message = bson_iter_utf8(&field, nullptr);
+            }
+          }
+          if (index < 0 || index >= static_cast<int64_t>(sent.size())) {
+            continue;
+          }
+          MongoWriteResult &result = results[sent[index]];
+          result.ok = false;
+          bson_set_error(&result.error, MONGOC_ERROR_COLLECTION, code, "%s",
+                         message);
+        }
+      } else if (!executed) {
+        LOG(error) << "Failed to write a batch of " << sent.size()
+                   << " to " << _collection_name << ": " << error.message;
+        for (size_t i : sent) {
+          results[i].ok = false;
+          results[i].error = error;
+        }
+      }
+      bson_destroy(&reply);
+    }
+    mongoc_bulk_operation_destroy(bulk);
+  }
+  bson_destroy(upsert_opts);
+  bson_destroy(bulk_opts);
+  if (collection) {
+    mongoc_collection_destroy(collection);
+  }
+
+  for (size_t i = 0; i < ops->size(); i++) {
+    Op &op = (*ops)[i];
+    bson_destroy(op.doc);
+    if (op.update) {
+      bson_destroy(op.update);
+    }
+    op.promise.set_value(results[i]);
+  }
+}
+
+} // namespace social_network
+
+#endif //SOCIAL_NETWORK_MICROSERVICES_MONGOBATCHWRITER_H
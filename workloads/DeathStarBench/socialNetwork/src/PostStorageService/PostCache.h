@@ -0,0 +1,126 @@
+#ifndef SOCIAL_NETWORK_MICROSERVICES_POSTCACHE_H
+#define SOCIAL_NETWORK_MICROSERVICES_POSTCACHE_H
+
+#include <memory>
+#include <string>
+
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+#include <nlohmann/json.hpp>
+
+#include "../../gen-cpp/social_network_types.h"
+#include "../logger.h"
+
+// Post values in the post-storage memcached. A value is a format byte
+// followed by the TCompactProtocol encoding of the Post. Values written
+// before the format byte existed are bson_as_json text, which always starts
+// with '{', and are still decoded so a rollout does not start from a cold
+// cache.
+
+namespace social_network {
+
+const char kPostCacheFormatCompactV1 = 0x01;
+
+namespace post_cache_detail {
+
+using apache::thrift::protocol::TCompactProtocolT;
+using apache::thrift::transport::TMemoryBuffer;
+
+// One transport/protocol pair per thread and direction. The encoder owns
+// its buffer; the decoder's buffer observes the value being decoded.
+struct Codec {
+  std::shared_ptr<TMemoryBuffer> buffer = std::make_shared<TMemoryBuffer>();
+  std::unique_ptr<TCompactProtocolT<TMemoryBuffer>> protocol{
+      new TCompactProtocolT<TMemoryBuffer>(buffer)};
+};
+
+Codec &ThreadEncoder() {
+  static thread_local Codec codec;
+  return codec;
+}
+
+Codec &ThreadDecoder() {
+  static thread_local Codec codec;
+  return codec;
+}
+
+bool DecodeJson(const char *data, size_t size, Post *post) {
+  auto post_json = nlohmann::json::parse(data, data + size, nullptr, false);
+  if (post_json.is_discarded()) {
+    return false;
+  }
+  try {
+    post->req_id = post_json["req_id"];
+    post->timestamp = post_json["timestamp"];
+    post->post_id = post_json["post_id"];
+    post->creator.user_id = post_json["creator"]["user_id"];
+    post->creator.username = post_json["creator"]["username"];
+    post->post_type = post_json["post_type"];
+    post->text = post_json["text"];
+    for (auto &item : post_json["media"]) {
+      Media media;
+      media.media_id = item["media_id"];
+      media.media_type = item["media_type"];
+      post->media.emplace_back(media);
+    }
+    for (auto &item : post_json["user_mentions"]) {
+      UserMention user_mention;
+      user_mention.username = item["username"];
+      user_mention.user_id = item["user_id"];
+      post->user_mentions.emplace_back(user_mention);
+    }
+    for (auto &item : post_json["urls"]) {
+      Url url;
+      url.shortened_url = item["shortened_url"];
+      url.expanded_url = item["expanded_url"];
+      post->urls.emplace_back(url);
+    }
+  } catch (const nlohmann::json::exception &) {
+    return false;
+  }
+  return true;
+}
+
+} // namespace post_cache_detail
+
+std::string EncodePostCacheValue(const Post &post) {
+  auto &codec = post_cache_detail::ThreadEncoder();
+  codec.buffer->resetBuffer();
+  uint8_t format = kPostCacheFormatCompactV1;
+  codec.buffer->write(&format, 1);
+  post.write(codec.protocol.get());
+  return codec.buffer->getBufferAsString();
+}
+
+// False if the value is neither format or is truncated.
+bool DecodePostCacheValue(const char *data, size_t size, Post *post) {
+  if (size == 0) {
+    return false;
+  }
+  if (data[0] == '{') {
+    return post_cache_detail::DecodeJson(data, size, post);
+  }
+  if (data[0] != kPostCacheFormatCompactV1) {
+    return false;
+  }
+  auto &codec = post_cache_detail::ThreadDecoder();
+  // observe the value in place, it is not copied
+  codec.buffer->resetBuffer(
+      reinterpret_cast<uint8_t *>(const_cast<char *>(data + 1)),
+      static_cast<uint32_t>(size - 1));
+  try {
+    post->read(codec.protocol.get());
+  } catch (const apache::thrift::TException &e) {
+    LOG(warning) << "Failed to decode a cached post: " << e.what();
+    // a read cut short leaves the protocol's field stack behind
+    codec.protocol.reset(
+        new post_cache_detail::TCompactProtocolT<
+            post_cache_detail::TMemoryBuffer>(codec.buffer));
+    return false;
+  }
+  return true;
+}
+
+} // namespace social_network
+
+#endif //SOCIAL_NETWORK_MICROSERVICES_POSTCACHE_H
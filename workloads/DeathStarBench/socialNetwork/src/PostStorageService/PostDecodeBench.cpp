@@ -0,0 +1,193 @@
+// Decode cost of post documents read from MongoDB on one core, through
+// DecodeBson and through the bson_as_json + nlohmann path PostStorage used
+// before it:
+//
+//   PostDecodeBench [seconds] [cpu]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <sched.h>
+
+#include <bson/bson.h>
+#include <nlohmann/json.hpp>
+
+#include "../utils_bson.h"
+
+using namespace social_network;
+using json = nlohmann::json;
+
+static std::atomic<uint64_t> num_allocs{0};
+
+void *operator new(size_t size) {
+  num_allocs.fetch_add(1, std::memory_order_relaxed);
+  if (void *ptr = malloc(size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+  free(ptr);
+}
+
+// libbson allocates through its own vtable, count those too
+void *CountedMalloc(size_t size) {
+  num_allocs.fetch_add(1, std::memory_order_relaxed);
+  return malloc(size);
+}
+
+void *CountedCalloc(size_t n, size_t size) {
+  num_allocs.fetch_add(1, std::memory_order_relaxed);
+  return calloc(n, size);
+}
+
+void *CountedRealloc(void *ptr, size_t size) {
+  num_allocs.fetch_add(1, std::memory_order_relaxed);
+  return realloc(ptr, size);
+}
+
+bool JsonDecode(const bson_t *doc, Post *post) {
+  char *post_json_char = bson_as_json(doc, nullptr);
+  json post_json = json::parse(post_json_char);
+  bson_free(post_json_char);
+  post->req_id = post_json["req_id"];
+  post->timestamp = post_json["timestamp"];
+  post->post_id = post_json["post_id"];
+  post->creator.user_id = post_json["creator"]["user_id"];
+  post->creator.username = post_json["creator"]["username"];
+  post->post_type = post_json["post_type"];
+  post->text = post_json["text"];
+  for (auto &item : post_json["media"]) {
+    Media media;
+    media.media_id = item["media_id"];
+    media.media_type = item["media_type"];
+    post->media.emplace_back(media);
+  }
+  for (auto &item : post_json["user_mentions"]) {
+    UserMention user_mention;
+    user_mention.username = item["username"];
+    user_mention.user_id = item["user_id"];
+    post->user_mentions.emplace_back(user_mention);
+  }
+  for (auto &item : post_json["urls"]) {
+    Url url;
+    url.shortened_url = item["shortened_url"];
+    url.expanded_url = item["expanded_url"];
+    post->urls.emplace_back(url);
+  }
+  return true;
+}
+
+void Run(const char *name, bool (*decode)(const bson_t *, Post *),
+         const std::vector<bson_t *> &docs, double seconds) {
+  uint64_t num_posts = 0;
+  uint64_t allocs_before = num_allocs.load();
+  auto start = std::chrono::steady_clock::now();
+  auto deadline = start + std::chrono::duration<double>(seconds);
+  while (std::chrono::steady_clock::now() < deadline) {
+    for (auto doc : docs) {
+      Post post;
+      if (!decode(doc, &post)) {
+        fprintf(stderr, "Failed to decode a post\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    num_posts += docs.size();
+  }
+  double elapsed = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+  printf("%-6s %8.0f ns/post %8.1f allocs/post\n", name,
+         elapsed * 1e9 / num_posts,
+         static_cast<double>(num_allocs.load() - allocs_before) / num_posts);
+}
+
+int main(int argc, char *argv[]) {
+  double seconds = argc > 1 ? atof(argv[1]) : 2.0;
+  int cpu = argc > 2 ? atoi(argv[2]) : 0;
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+    perror("sched_setaffinity");
+  }
+  bson_mem_vtable_t vtable = {CountedMalloc, CountedCalloc, CountedRealloc,
+                              free};
+  bson_mem_set_vtable(&vtable);
+
+  // Shaped like wrk2's compose-post.lua: 256 characters of text, 1-6
+  // mentions and urls, 1-5 media
+  std::mt19937_64 rng(42);
+  auto random_string = [&rng](int length) {
+    static const char chars[] =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    std::string s;
+    for (int i = 0; i < length; i++) {
+      s.push_back(chars[rng() % 62]);
+    }
+    return s;
+  };
+  std::vector<bson_t *> docs;
+  size_t total_bytes = 0;
+  for (int i = 0; i < 1000; i++) {
+    Post post;
+    post.post_id = rng() >> 1;
+    post.req_id = rng() >> 1;
+    post.timestamp = 1600000000000 + i;
+    post.creator.user_id = rng() % 962;
+    post.creator.username =
+        "username_" + std::to_string(post.creator.user_id);
+    post.text = random_string(256);
+    for (int j = 0, n = 1 + rng() % 6; j < n; j++) {
+      UserMention user_mention;
+      user_mention.user_id = rng() % 962;
+      user_mention.username =
+          "username_" + std::to_string(user_mention.user_id);
+      post.text += " @" + user_mention.username;
+      post.user_mentions.push_back(user_mention);
+    }
+    for (int j = 0, n = 1 + rng() % 6; j < n; j++) {
+      Url url;
+      url.expanded_url = "http://" + random_string(64);
+      url.shortened_url = "http://short-url/" + random_string(10);
+      post.text += " " + url.shortened_url;
+      post.urls.push_back(url);
+    }
+    for (int j = 0, n = 1 + rng() % 5; j < n; j++) {
+      Media media;
+      media.media_id = rng() >> 4;
+      media.media_type = "png";
+      post.media.push_back(media);
+    }
+    bson_t *doc = bson_new();
+    AppendBsonFields(doc, post);
+    total_bytes += doc->len;
+    docs.push_back(doc);
+
+    Post decoded, json_decoded;
+    if (!DecodeBson(doc, &decoded) || !JsonDecode(doc, &json_decoded) ||
+        !(decoded == post) || !(json_decoded == post)) {
+      fprintf(stderr, "Post %d does not round-trip\n", i);
+      return EXIT_FAILURE;
+    }
+  }
+  printf("%zu posts, %zu bytes of BSON each\n", docs.size(),
+         total_bytes / docs.size());
+
+  Run("bson", [](const bson_t *doc, Post *post) {
+    return DecodeBson(doc, post);
+  }, docs, seconds);
+  Run("json", JsonDecode, docs, seconds);
+
+  for (auto doc : docs) {
+    bson_destroy(doc);
+  }
+  return 0;
+}
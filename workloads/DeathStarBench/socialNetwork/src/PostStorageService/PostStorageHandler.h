@@ -12,10 +12,16 @@
 #include "../../gen-cpp/PostStorageService.h"
 #include "../logger.h"
 #include "../tracing.h"
+#include "../utils_bson.h"
+#include "../utils_mongodb.h"
+#include "PostCache.h"
 
 namespace social_network {
 using json = nlohmann::json;
 
+// Seconds a request that missed has to refill a post before another may
+#define POST_LEASE_TTL 3
+
 uint64_t time_us() {
     struct timeval t;
     gettimeofday(&t, NULL);
@@ -24,7 +30,8 @@ uint64_t time_us() {
 
 class PostStorageHandler : public PostStorageServiceIf {
  public:
-  PostStorageHandler(ClientPool<MCClient> *, mongoc_client_pool_t *);
+  PostStorageHandler(ClientPool<MCClient> *, mongoc_client_pool_t *,
+                     MongoBatchWriter *);
   ~PostStorageHandler() override = default;
 
   void StorePost(int64_t req_id, const Post &post,
@@ -40,13 +47,16 @@ class PostStorageHandler : public PostStorageServiceIf {
  private:
   ClientPool<MCClient> *_mc_client_pool;
   mongoc_client_pool_t *_mongodb_client_pool;
+  MongoBatchWriter *_mongodb_writer;
 };
 
 PostStorageHandler::PostStorageHandler(
     ClientPool<MCClient> *mc_client_pool,
-    mongoc_client_pool_t *mongodb_client_pool) {
+    mongoc_client_pool_t *mongodb_client_pool,
+    MongoBatchWriter *mongodb_writer) {
   _mc_client_pool = mc_client_pool;
   _mongodb_client_pool = mongodb_client_pool;
+  _mongodb_writer = mongodb_writer;
 }
 
 void PostStorageHandler::StorePost(
@@ -54,100 +64,27 @@ void PostStorageHandler::StorePost(
     const std::map<std::string, std::string> &carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "StorePost",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
-
-  mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-      _mongodb_client_pool);
-  if (!mongodb_client) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-    se.message = "Failed to pop a client from MongoDB pool";
-    throw se;
-  }
-
-  auto collection = mongoc_client_get_collection(
-      mongodb_client, "post", "post");
-  if (!collection) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-    se.message = "Failed to create collection user from DB user";
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-    throw se;
-  }
+  RequestSpan span("StorePost", carrier, req_id);
 
   bson_t *new_doc = bson_new();
-  BSON_APPEND_INT64(new_doc, "post_id", post.post_id);
-  BSON_APPEND_INT64(new_doc, "timestamp", post.timestamp);
-  BSON_APPEND_UTF8(new_doc, "text", post.text.c_str());
-  BSON_APPEND_INT64(new_doc, "req_id", post.req_id);
-  BSON_APPEND_INT32(new_doc, "post_type", post.post_type);
-
-  bson_t creator_doc;
-  BSON_APPEND_DOCUMENT_BEGIN(new_doc, "creator", &creator_doc);
-  BSON_APPEND_INT64(&creator_doc, "user_id", post.creator.user_id);
-  BSON_APPEND_UTF8(&creator_doc, "username", post.creator.username.c_str());
-  bson_append_document_end(new_doc, &creator_doc);
-
-  const char *key;
-  int idx = 0;
-  char buf[16];
-
-  bson_t url_list;
-  BSON_APPEND_ARRAY_BEGIN(new_doc, "urls", &url_list);
-  for (auto &url : post.urls)  {
-    bson_uint32_to_string(idx, &key, buf, sizeof buf);
-    bson_t url_doc;
-    BSON_APPEND_DOCUMENT_BEGIN(&url_list, key, &url_doc);
-    BSON_APPEND_UTF8(&url_doc, "shortened_url", url.shortened_url.c_str());
-    BSON_APPEND_UTF8(&url_doc, "expanded_url", url.expanded_url.c_str());
-    bson_append_document_end(&url_list, &url_doc);
-    idx++;
-  }
-  bson_append_array_end(new_doc, &url_list);
-
-  bson_t user_mention_list;
-  idx = 0;
-  BSON_APPEND_ARRAY_BEGIN(new_doc, "user_mentions", &user_mention_list);
-  for (auto &user_mention : post.user_mentions)  {
-    bson_uint32_to_string(idx, &key, buf, sizeof buf);
-    bson_t user_mention_doc;
-    BSON_APPEND_DOCUMENT_BEGIN(&user_mention_list, key, &user_mention_doc);
-    BSON_APPEND_INT64(&user_mention_doc, "user_id", user_mention.user_id);
-    BSON_APPEND_UTF8(&user_mention_doc, "username",
-        user_mention.username.c_str());
-    bson_append_document_end(&user_mention_list, &user_mention_doc);
-    idx++;
-  }
-  bson_append_array_end(new_doc, &user_mention_list);
-
-
-  bson_t media_list;
-  idx = 0;
-  BSON_APPEND_ARRAY_BEGIN(new_doc, "media", &media_list);
-  for (auto &media : post.media) {
-    bson_uint32_to_string(idx, &key, buf, sizeof buf);
-    bson_t media_doc;
-    BSON_APPEND_DOCUMENT_BEGIN(&media_list, key, &media_doc);
-    BSON_APPEND_INT64(&media_doc, "media_id", media.media_id);
-    BSON_APPEND_UTF8(&media_doc, "media_type", media.media_type.c_str());
-    bson_append_document_end(&media_list, &media_doc);
-    idx++;
-  }
-  bson_append_array_end(new_doc, &media_list);
+  AppendBsonFields(new_doc, post);
 
   bson_error_t error;
-  auto insert_span = opentracing::Tracer::Global()->StartSpan(
-      "MongoInsertPost", { opentracing::ChildOf(&span->context()) });
-  bool inserted = mongoc_collection_insert_one (
-      collection, new_doc, nullptr, nullptr, &error);
-  insert_span->Finish();
+  auto insert_span = span.StartSpan("MongoInsertPost");
+  bool inserted;
+  if (_mongodb_writer) {
+    inserted = _mongodb_writer->Insert(new_doc, &error);
+  } else {
+    MongoClientLease mongodb_client(_mongodb_client_pool);
+
+    auto collection = mongodb_client.Collection("post", "post");
+
+    inserted = mongoc_collection_insert_one (
+        collection, new_doc, nullptr, nullptr, &error);
+    mongodb_client.Release();
+  }
+  insert_span.Finish();
+  bson_destroy(new_doc);
 
   if (!inserted) {
     LOG(error) << "Error: Failed to insert post to MongoDB: "
@@ -155,17 +92,24 @@ void PostStorageHandler::StorePost(
     ServiceException se;
     se.errorCode = ErrorCode::SE_MONGODB_ERROR;
     se.message = error.message;
-    bson_destroy(new_doc);
-    mongoc_collection_destroy(collection);
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
     throw se;
   }
 
-  bson_destroy(new_doc);
-  mongoc_collection_destroy(collection);
-  mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+  // write through, the post is usually read back soon by its followers
+  auto mc_client = _mc_client_pool->Pop();
+  if (mc_client) {
+    auto set_span = span.StartSpan("MmcSetPost");
+    if (!mc_client->Set(std::to_string(post.post_id),
+                        EncodePostCacheValue(post), 0, 0)) {
+      LOG_EVERY_MS(warning, 1000) << "Failed to set post to Memcached";
+    }
+    set_span.Finish();
+    _mc_client_pool->Push(mc_client);
+  } else {
+    LOG_EVERY_MS(warning, 1000) << "Failed to pop a client from memcached pool";
+  }
 
-  span->Finish();
+  span.Finish();
 }
 
 
@@ -176,14 +120,7 @@ void PostStorageHandler::ReadPost(
     const std::map<std::string, std::string> &carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "ReadPost",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("ReadPost", carrier, req_id);
 
   std::string post_id_str = std::to_string(post_id);
 
@@ -196,85 +133,52 @@ void PostStorageHandler::ReadPost(
   }
 
   uint32_t memcached_flags;
-  auto get_span = opentracing::Tracer::Global()->StartSpan(
-      "MmcGetPost", { opentracing::ChildOf(&span->context()) });
+  auto get_span = span.StartSpan("MmcGetPost");
+  // only the request that wins the lease of a missing post refills it from
+  // MongoDB
   std::string post_mmc;
   bool found;
-  if (!mc_client->Get(post_id_str, &found, &post_mmc, &memcached_flags)) {
+  bool won;
+  if (!mc_client->GetOrLease(post_id_str, POST_LEASE_TTL, &found, &post_mmc,
+                             &memcached_flags, &won)) {
     ServiceException se;
     se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
     _mc_client_pool->Push(mc_client);
     throw se;
   }
   _mc_client_pool->Push(mc_client);
-  get_span->Finish();
-
+  get_span.Finish();
+
+  if (found &&
+      !DecodePostCacheValue(post_mmc.data(), post_mmc.size(), &_return)) {
+    // a miss like in ReadPosts: read it from MongoDB and overwrite the entry
+    LOG(warning) << "Failed to parse post " << post_id_str << " from memcached";
+    found = false;
+    won = true;
+    _return = Post();
+  }
   if (found) {
     LOG(debug) << "Get post " << post_id << " cache hit from Memcached";
-    json post_json = json::parse(post_mmc);
-    _return.req_id = post_json["req_id"];
-    _return.timestamp = post_json["timestamp"];
-    _return.post_id = post_json["post_id"];
-    _return.creator.user_id = post_json["creator"]["user_id"];
-    _return.creator.username = post_json["creator"]["username"];
-    _return.post_type = post_json["post_type"];
-    _return.text = post_json["text"];
-    for (auto &item : post_json["media"]) {
-      Media media;
-      media.media_id = item["media_id"];
-      media.media_type = item["media_type"];
-      _return.media.emplace_back(media);
-    }
-    for (auto &item : post_json["user_mentions"]) {
-      UserMention user_mention;
-      user_mention.username = item["username"];
-      user_mention.user_id = item["user_id"];
-      _return.user_mentions.emplace_back(user_mention);
-    }
-    for (auto &item : post_json["urls"]) {
-      Url url;
-      url.shortened_url = item["shortened_url"];
-      url.expanded_url = item["expanded_url"];
-      _return.urls.emplace_back(url);
-    }
   } else {
     // If not cached in memcached
-    mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-        _mongodb_client_pool);
-    if (!mongodb_client) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to pop a client from MongoDB pool";
-      throw se;
-    }
+    MongoClientLease mongodb_client(_mongodb_client_pool);
 
-    auto collection = mongoc_client_get_collection(
-        mongodb_client, "post", "post");
-    if (!collection) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to create collection user from DB user";
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-      throw se;
-    }
+    auto collection = mongodb_client.Collection("post", "post");
 
     bson_t *query = bson_new();
     BSON_APPEND_INT64(query, "post_id", post_id);
-    auto find_span = opentracing::Tracer::Global()->StartSpan(
-        "MongoFindPost", { opentracing::ChildOf(&span->context()) });
+    auto find_span = span.StartSpan("MongoFindPost");
     mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
         collection, query, nullptr, nullptr);
     const bson_t *doc;
     bool found = mongoc_cursor_next(cursor, &doc);
-    find_span->Finish();
+    find_span.Finish();
     if (!found) {
       bson_error_t error;
       if (mongoc_cursor_error (cursor, &error)) {
         LOG(warning) << error.message;
         bson_destroy(query);
         mongoc_cursor_destroy(cursor);
-        mongoc_collection_destroy(collection);
-        mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
         ServiceException se;
         se.errorCode = ErrorCode::SE_MONGODB_ERROR;
         se.message = error.message;
@@ -283,8 +187,6 @@ void PostStorageHandler::ReadPost(
         LOG(warning) << "Post_id: " << post_id << " doesn't exist in MongoDB";
         bson_destroy(query);
         mongoc_cursor_destroy(cursor);
-        mongoc_collection_destroy(collection);
-        mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
         ServiceException se;
         se.errorCode = ErrorCode::SE_THRIFT_HANDLER_ERROR;
         se.message = "Post_id: " + std::to_string(post_id) +
@@ -293,73 +195,41 @@ void PostStorageHandler::ReadPost(
       }
     } else {
       LOG(debug) << "Post_id: " << post_id << " found in MongoDB";
-      auto post_json_char = bson_as_json(doc, nullptr);
-      json post_json = json::parse(post_json_char);
-      _return.req_id = post_json["req_id"];
-      _return.timestamp = post_json["timestamp"];
-      _return.post_id = post_json["post_id"];
-      _return.creator.user_id = post_json["creator"]["user_id"];
-      _return.creator.username = post_json["creator"]["username"];
-      _return.post_type = post_json["post_type"];
-      _return.text = post_json["text"];
-      for (auto &item : post_json["media"]) {
-        Media media;
-        media.media_id = item["media_id"];
-        media.media_type = item["media_type"];
-        _return.media.emplace_back(media);
-      }
-      for (auto &item : post_json["user_mentions"]) {
-        UserMention user_mention;
-        user_mention.username = item["username"];
-        user_mention.user_id = item["user_id"];
-        _return.user_mentions.emplace_back(user_mention);
-      }
-      for (auto &item : post_json["urls"]) {
-        Url url;
-        url.shortened_url = item["shortened_url"];
-        url.expanded_url = item["expanded_url"];
-        _return.urls.emplace_back(url);
-      }
-      bson_destroy(query);
-      mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-
-
-      // upload post to memcached
-      auto mc_client = _mc_client_pool->Pop();
-      if (!mc_client) {
+      if (!DecodeBson(doc, &_return)) {
+        LOG(error) << "Post_id: " << post_id << " is malformed in MongoDB";
+        bson_destroy(query);
+        mongoc_cursor_destroy(cursor);
         ServiceException se;
-        se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-        se.message = "Failed to pop a client from memcached pool";
+        se.errorCode = ErrorCode::SE_MONGODB_ERROR;
+        se.message = "Post_id: " + std::to_string(post_id) +
+            " is malformed in MongoDB";
         throw se;
       }
+      bson_destroy(query);
+      mongoc_cursor_destroy(cursor);
+      mongodb_client.Release();
+
+      // upload post to memcached, unless another request holds the lease
+      if (won) {
+        auto mc_client = _mc_client_pool->Pop();
+        if (!mc_client) {
+          ServiceException se;
+          se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
+          se.message = "Failed to pop a client from memcached pool";
+          throw se;
+        }
 
-      uint32_t memcached_flags;
-      auto get_span = opentracing::Tracer::Global()->StartSpan(
-          "MmcGetPost", { opentracing::ChildOf(&span->context()) });
-      std::string post_mmc;
-      bool found;
-      if (!mc_client->Get(post_id_str, &found, &post_mmc, &memcached_flags)) {
-        ServiceException se;
-        se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
+        auto set_span = span.StartSpan("MmcSetPost");
+        if (!mc_client->Set(post_id_str, EncodePostCacheValue(_return), 0, 0)) {
+          LOG_EVERY_MS(warning, 1000) << "Failed to set post to Memcached";
+        }
+        set_span.Finish();
         _mc_client_pool->Push(mc_client);
-        throw se;
       }
-      _mc_client_pool->Push(mc_client);
-
-      auto set_span = opentracing::Tracer::Global()->StartSpan(
-          "MmcSetPost", { opentracing::ChildOf(&span->context()) });
-      if (!mc_client->Set(post_id_str, std::string(post_json_char), 0, 0)) {
-        LOG(warning) << "Failed to set post to Memcached";
-      }
-      set_span->Finish();
-      bson_free(post_json_char);
-      _mc_client_pool->Push(mc_client);
     }
   }
 
-  span->Finish();
+  span.Finish();
 
 }
 void PostStorageHandler::ReadPosts(
@@ -369,14 +239,7 @@ void PostStorageHandler::ReadPosts(
     const std::map<std::string, std::string> &carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "ReadPosts",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("ReadPosts", carrier, req_id);
 
   if (post_ids.empty()) {
     return;
@@ -401,86 +264,53 @@ void PostStorageHandler::ReadPosts(
   uint64_t start_time;
   uint64_t elapsed_time;
 
-  bool found;
-  std::string return_value;
-  uint32_t flags;
-  auto get_span = opentracing::Tracer::Global()->StartSpan(
-      "MemcachedMget", { opentracing::ChildOf(&span->context()) });
-
+  std::vector<std::string> keys;
+  keys.reserve(post_ids.size());
   for (auto &post_id : post_ids) {
-    std::string key_str = std::to_string(post_id);
-    start_time = time_us();
-    bool success = mc_client->Get(key_str, &found, &return_value, &flags);
-    elapsed_time = time_us() - start_time;
-    if (elapsed_time > 10000) { // 10ms
-      LOG(info) << "Single memcached_get uses " << elapsed_time << "us";
-    }
-    if (!success) {
-      _mc_client_pool->Push(mc_client);
-      LOG(error) << "Cannot get posts of request " << req_id;
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-      se.message =  "Cannot get posts of request " + std::to_string(req_id);
-      throw se;
+    keys.emplace_back(std::to_string(post_id));
+  }
+  std::map<std::string, std::string> return_values;
+  auto get_span = span.StartSpan("MemcachedMget");
+
+  start_time = time_us();
+  bool success = mc_client->MultiGet(keys, &return_values);
+  elapsed_time = time_us() - start_time;
+  if (elapsed_time > 10000) { // 10ms
+    LOG_EVERY_MS(info, 1000) << "Memcached multi-get of " << keys.size()
+                             << " keys uses " << elapsed_time << "us";
+  }
+  if (!success) {
+    // a failed read is a miss for every post, MongoDB still has them
+    LOG_EVERY_MS(warning, 1000) << "Cannot get posts of request " << req_id
+                                << " from memcached, reading MongoDB";
+    return_values.clear();
+  }
+  for (auto &it : return_values) {
+    if (it.second.empty()) {
+      // the placeholder of a ReadPost refill, a miss
+      continue;
     }
-    if (!found) continue;
     Post new_post;
-    json post_json = json::parse(return_value);
-    new_post.req_id = post_json["req_id"];
-    new_post.timestamp = post_json["timestamp"];
-    new_post.post_id = post_json["post_id"];
-    new_post.creator.user_id = post_json["creator"]["user_id"];
-    new_post.creator.username = post_json["creator"]["username"];
-    new_post.post_type = post_json["post_type"];
-    new_post.text = post_json["text"];
-    for (auto &item : post_json["media"]) {
-      Media media;
-      media.media_id = item["media_id"];
-      media.media_type = item["media_type"];
-      new_post.media.emplace_back(media);
-    }
-    for (auto &item : post_json["user_mentions"]) {
-      UserMention user_mention;
-      user_mention.username = item["username"];
-      user_mention.user_id = item["user_id"];
-      new_post.user_mentions.emplace_back(user_mention);
-    }
-    for (auto &item : post_json["urls"]) {
-      Url url;
-      url.shortened_url = item["shortened_url"];
-      url.expanded_url = item["expanded_url"];
-      new_post.urls.emplace_back(url);
+    if (!DecodePostCacheValue(it.second.data(), it.second.size(), &new_post)) {
+      // read it from MongoDB and overwrite the entry
+      LOG(warning) << "Failed to parse post " << it.first << " from memcached";
+      continue;
     }
-    return_map.insert(std::make_pair(new_post.post_id, new_post));
     post_ids_not_cached.erase(new_post.post_id);
+    return_map.emplace(new_post.post_id, std::move(new_post));
   }
-  get_span->Finish();
+  get_span.Finish();
   _mc_client_pool->Push(mc_client);
 
   // std::vector<std::future<void>> set_futures;
-  std::map<int64_t, std::string> post_json_map;
+  std::map<int64_t, std::string> post_cache_map;
 
   // Find the rest in MongoDB
   if (!post_ids_not_cached.empty()) {
     start_time = time_us();
 
-    mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-        _mongodb_client_pool);
-    if (!mongodb_client) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to pop a client from MongoDB pool";
-      throw se;
-    }
-    auto collection = mongoc_client_get_collection(
-        mongodb_client, "post", "post");
-    if (!collection) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to create collection user from DB user";
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-      throw se;
-    }
+    MongoClientLease mongodb_client(_mongodb_client_pool);
+    auto collection = mongodb_client.Collection("post", "post");
     bson_t *query = bson_new();
     bson_t query_child;
     bson_t query_post_id_list;
@@ -501,53 +331,26 @@ void PostStorageHandler::ReadPosts(
         collection, query, nullptr, nullptr);
     const bson_t *doc;
 
-    auto find_span = opentracing::Tracer::Global()->StartSpan(
-        "MongoFindPosts", {opentracing::ChildOf(&span->context())});
+    auto find_span = span.StartSpan("MongoFindPosts");
     while (true) {
       bool found = mongoc_cursor_next(cursor, &doc);
       if (!found) {
         break;
       }
       Post new_post;
-      char *post_json_char = bson_as_json(doc, nullptr);
-      json post_json = json::parse(post_json_char);
-      new_post.req_id = post_json["req_id"];
-      new_post.timestamp = post_json["timestamp"];
-      new_post.post_id = post_json["post_id"];
-      new_post.creator.user_id = post_json["creator"]["user_id"];
-      new_post.creator.username = post_json["creator"]["username"];
-      new_post.post_type = post_json["post_type"];
-      new_post.text = post_json["text"];
-      for (auto &item : post_json["media"]) {
-        Media media;
-        media.media_id = item["media_id"];
-        media.media_type = item["media_type"];
-        new_post.media.emplace_back(media);
-      }
-      for (auto &item : post_json["user_mentions"]) {
-        UserMention user_mention;
-        user_mention.username = item["username"];
-        user_mention.user_id = item["user_id"];
-        new_post.user_mentions.emplace_back(user_mention);
-      }
-      for (auto &item : post_json["urls"]) {
-        Url url;
-        url.shortened_url = item["shortened_url"];
-        url.expanded_url = item["expanded_url"];
-        new_post.urls.emplace_back(url);
+      if (!DecodeBson(doc, &new_post)) {
+        LOG(warning) << "Skipping a malformed post in MongoDB";
+        continue;
       }
-      post_json_map.insert({new_post.post_id, std::string(post_json_char)});
-      return_map.insert({new_post.post_id, new_post});
-      bson_free(post_json_char);
+      post_cache_map.emplace(new_post.post_id, EncodePostCacheValue(new_post));
+      return_map.emplace(new_post.post_id, std::move(new_post));
     }
-    find_span->Finish();
+    find_span.Finish();
     bson_error_t error;
     if (mongoc_cursor_error(cursor, &error)) {
       LOG(warning) << error.message;
       bson_destroy(query);
       mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
       ServiceException se;
       se.errorCode = ErrorCode::SE_MONGODB_ERROR;
       se.message = error.message;
@@ -555,8 +358,7 @@ void PostStorageHandler::ReadPosts(
     }
     bson_destroy(query);
     mongoc_cursor_destroy(cursor);
-    mongoc_collection_destroy(collection);
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+    mongodb_client.Release();
 
     // upload posts to memcached
     // set_futures.emplace_back(std::async(std::launch::async, [&]() {
@@ -568,20 +370,22 @@ void PostStorageHandler::ReadPosts(
         se.message = "Failed to pop a client from memcached pool";
         throw se;
       }
-      auto set_span = opentracing::Tracer::Global()->StartSpan(
-          "MmcSetPost", {opentracing::ChildOf(&span->context())});
-      for (auto & it : post_json_map) {
-        std::string id_str = std::to_string(it.first);
-        if (!mc_client->Set(id_str, it.second, 0, 0)) {
-          LOG(warning) << "Failed to set post to Memcached";
-        }
+      auto set_span = span.StartSpan("MmcSetPost");
+      std::map<std::string, std::string> set_items;
+      for (auto & it : post_cache_map) {
+        set_items.emplace(std::to_string(it.first), std::move(it.second));
+      }
+      if (!mc_client->MultiSet(set_items, 0, 0)) {
+        LOG_EVERY_MS(warning, 1000) << "Failed to set posts to Memcached";
       }
       _mc_client_pool->Push(mc_client);
       elapsed_time = time_us() - start_time;
       if (elapsed_time > 10000) { // 10ms
-        LOG(info) << "Reading " << post_ids_not_cached.size() << " keys from MongoDB uses " << elapsed_time << "us";
+        LOG_EVERY_MS(info, 1000) << "Reading " << post_ids_not_cached.size()
+                                 << " keys from MongoDB uses " << elapsed_time
+                                 << "us";
       }
-      set_span->Finish();
+      set_span.Finish();
       // }));
   }
 
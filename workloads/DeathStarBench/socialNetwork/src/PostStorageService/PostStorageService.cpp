@@ -13,6 +13,7 @@ using namespace social_network;
 static json config_json;
 static mongoc_client_pool_t* mongodb_client_pool;
 static ClientPool<MCClient>* mc_client_pool;
+static MongoBatchWriter* mongodb_writer;
 
 int faas_init() {
     init_logger();
@@ -24,6 +25,10 @@ int faas_init() {
 
     std::string mc_addr = config_json["post-storage-memcached"]["addr"];
     int mc_port = config_json["post-storage-memcached"]["port"];
+    MCClient::CompressThreshold() =
+        config_json["post-storage-memcached"].value("compress_threshold", 0);
+    MCClient::SharedConnections() =
+        config_json["post-storage-memcached"].value("shared_connections", 0);
     mc_client_pool = new ClientPool<MCClient>("post-storage-memcached", mc_addr, mc_port, 1, 128, 1000);
 
     mongodb_client_pool = init_mongodb_client_pool(config_json, "post-storage", 128);
@@ -46,6 +51,9 @@ int faas_init() {
     }
     mongoc_client_pool_push(mongodb_client_pool, mongodb_client);
 
+    mongodb_writer = init_mongodb_batch_writer(
+        config_json, "post-storage", mongodb_client_pool, "post", "post");
+
     return 0;
 }
 
@@ -57,7 +65,7 @@ int faas_create_func_worker(void* caller_context,
         caller_context, invoke_func_fn, append_output_fn);
     faas_worker->SetProcessor(std::make_shared<PostStorageServiceProcessor>(
           std::make_shared<PostStorageHandler>(
-              mc_client_pool, mongodb_client_pool)));
+              mc_client_pool, mongodb_client_pool, mongodb_writer)));
     *worker_handle = faas_worker;
     return 0;
 }
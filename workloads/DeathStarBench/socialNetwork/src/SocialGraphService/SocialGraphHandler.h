@@ -15,10 +15,13 @@
 #include "../../gen-cpp/SocialGraphService.h"
 #include "../../gen-cpp/UserService.h"
 #include "../ClientPool.h"
+#include "../FanOut.h"
 #include "../logger.h"
 #include "../tracing.h"
 #include "../RedisClient.h"
 #include "../ThriftClient.h"
+#include "../utils_bson.h"
+#include "../utils_mongodb.h"
 
 namespace social_network {
 
@@ -71,38 +74,17 @@ void SocialGraphHandler::Follow(
     const std::map<std::string, std::string> &carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "Follow",
-      {opentracing::ChildOf(parent_span->get())});
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("Follow", carrier, req_id);
 
   int64_t timestamp = duration_cast<milliseconds>(
       system_clock::now().time_since_epoch()).count();
 
-  // std::future<void> mongo_update_follower_future = std::async(
-  //     std::launch::async, [&]() {
-  {
-        mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-            _mongodb_client_pool);
-        if (!mongodb_client) {
-          ServiceException se;
-          se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-          se.message = "Failed to pop a client from MongoDB pool";
-          throw se;
-        }
-        auto collection = mongoc_client_get_collection(
-            mongodb_client, "social-graph", "social-graph");
-        if (!collection) {
-          ServiceException se;
-          se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-          se.message = "Failed to create collection social_graph from MongoDB";
-          mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-          throw se;
-        }
+  // The three updates are independent
+  FanOut fan_out;
+  fan_out.Add([&] {
+        MongoClientLease mongodb_client(_mongodb_client_pool);
+        auto collection = mongodb_client.Collection(
+            "social-graph", "social-graph");
 
         // Update follower->followee edges
         const bson_t *doc;
@@ -126,8 +108,7 @@ void SocialGraphHandler::Follow(
         );
         bson_error_t error;
         bson_t reply;
-        auto update_span = opentracing::Tracer::Global()->StartSpan(
-            "MongoUpdateFollower", {opentracing::ChildOf(&span->context())});
+        auto update_span = span.StartSpan("MongoUpdateFollower");
         bool updated = mongoc_collection_find_and_modify(
             collection,
             search_not_exist,
@@ -148,39 +129,19 @@ void SocialGraphHandler::Follow(
           bson_destroy(&reply);
           bson_destroy(update);
           bson_destroy(search_not_exist);
-          mongoc_collection_destroy(collection);
-          mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
           throw se;
         }
-        update_span->Finish();
+        update_span.Finish();
         bson_destroy(&reply);
         bson_destroy(update);
         bson_destroy(search_not_exist);
-        mongoc_collection_destroy(collection);
-        mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-      // });
-  }
+        mongodb_client.Release();
+  });
 
-  // std::future<void> mongo_update_followee_future = std::async(
-  //     std::launch::async, [&]() {
-  {
-        mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-            _mongodb_client_pool);
-        if (!mongodb_client) {
-          ServiceException se;
-          se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-          se.message = "Failed to pop a client from MongoDB pool";
-          throw se;
-        }
-        auto collection = mongoc_client_get_collection(
-            mongodb_client, "social-graph", "social-graph");
-        if (!collection) {
-          ServiceException se;
-          se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-          se.message = "Failed to create collection social_graph from MongoDB";
-          mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-          throw se;
-        }
+  fan_out.Add([&] {
+        MongoClientLease mongodb_client(_mongodb_client_pool);
+        auto collection = mongodb_client.Collection(
+            "social-graph", "social-graph");
 
         // Update followee->follower edges
         bson_t *search_not_exist = BCON_NEW(
@@ -193,8 +154,7 @@ void SocialGraphHandler::Follow(
             "timestamp", BCON_INT64(timestamp), "}", "}"
         );
         bson_error_t error;
-        auto update_span = opentracing::Tracer::Global()->StartSpan(
-            "MongoUpdateFollowee", {opentracing::ChildOf(&span->context())});
+        auto update_span = span.StartSpan("MongoUpdateFollowee");
         bson_t reply;
         bool updated = mongoc_collection_find_and_modify(
             collection, search_not_exist, nullptr, update, nullptr, false,
@@ -208,21 +168,15 @@ void SocialGraphHandler::Follow(
           bson_destroy(update);
           bson_destroy(&reply);
           bson_destroy(search_not_exist);
-          mongoc_collection_destroy(collection);
-          mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
           throw se;
         }
-        update_span->Finish();
+        update_span.Finish();
         bson_destroy(update);
         bson_destroy(&reply);
         bson_destroy(search_not_exist);
-        mongoc_collection_destroy(collection);
-        mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-      // });
-  }
+        mongodb_client.Release();
+  });
 
-  // std::future<void> redis_update_future = std::async(
-  //     std::launch::async, [&]() {
   {
         auto redis_client_wrapper = _redis_client_pool->Pop();
         if (!redis_client_wrapper) {
@@ -233,8 +187,7 @@ void SocialGraphHandler::Follow(
         }
         auto redis_client = redis_client_wrapper->GetClient();
 
-        auto redis_span = opentracing::Tracer::Global()->StartSpan(
-            "RedisUpdate", {opentracing::ChildOf(&span->context())});
+        auto redis_span = span.StartSpan("RedisUpdate");
         redis_client.AppendCommand("ZCARD %" PRId64 ":followees", user_id);
         redis_client.AppendCommand("ZCARD %" PRId64 ":followers", followee_id);
         auto num_followee_reply = redis_client.GetReply();
@@ -259,19 +212,12 @@ void SocialGraphHandler::Follow(
           reply->check_ok();
         }
         _redis_client_pool->Push(redis_client_wrapper);
-        redis_span->Finish();
-      // });
+        redis_span.Finish();
   }
 
-  // try {
-  //   redis_update_future.get();
-  //   mongo_update_follower_future.get();
-  //   mongo_update_followee_future.get();
-  // } catch (...) {
-  //   throw;
-  // }
+  fan_out.Join();
 
-  span->Finish();
+  span.Finish();
 }
 
 void SocialGraphHandler::Unfollow(
@@ -280,35 +226,14 @@ void SocialGraphHandler::Unfollow(
     int64_t followee_id,
     const std::map<std::string, std::string> &carrier) {
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "Unfollow",
-      {opentracing::ChildOf(parent_span->get())});
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
-
-  // std::future<void> mongo_update_follower_future = std::async(
-  //     std::launch::async, [&]() {
-  {
-        mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-            _mongodb_client_pool);
-        if (!mongodb_client) {
-          ServiceException se;
-          se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-          se.message = "Failed to pop a client from MongoDB pool";
-          throw se;
-        }
-        auto collection = mongoc_client_get_collection(
-            mongodb_client, "social-graph", "social-graph");
-        if (!collection) {
-          ServiceException se;
-          se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-          se.message = "Failed to create collection social_graph from MongoDB";
-          mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-          throw se;
-        }
+  RequestSpan span("Unfollow", carrier, req_id);
+
+  // The three updates are independent
+  FanOut fan_out;
+  fan_out.Add([&] {
+        MongoClientLease mongodb_client(_mongodb_client_pool);
+        auto collection = mongodb_client.Collection(
+            "social-graph", "social-graph");
         bson_t *query = bson_new();
 
         // Update follower->followee edges
@@ -319,8 +244,7 @@ void SocialGraphHandler::Unfollow(
         );
         bson_t reply;
         bson_error_t error;
-        auto update_span = opentracing::Tracer::Global()->StartSpan(
-            "MongoDeleteFollowee", {opentracing::ChildOf(&span->context())});
+        auto update_span = span.StartSpan("MongoDeleteFollowee");
         bool updated = mongoc_collection_find_and_modify(
             collection, query, nullptr, update, nullptr, false, false,
             true, &reply, &error);
@@ -333,39 +257,19 @@ void SocialGraphHandler::Unfollow(
           bson_destroy(update);
           bson_destroy(query);
           bson_destroy(&reply);
-          mongoc_collection_destroy(collection);
-          mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
           throw se;
         }
-        update_span->Finish();
+        update_span.Finish();
         bson_destroy(update);
         bson_destroy(query);
         bson_destroy(&reply);
-        mongoc_collection_destroy(collection);
-        mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-      // });
-  }
+        mongodb_client.Release();
+  });
 
-  // std::future<void> mongo_update_followee_future = std::async(
-  //     std::launch::async, [&]() {
-  {
-        mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-            _mongodb_client_pool);
-        if (!mongodb_client) {
-          ServiceException se;
-          se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-          se.message = "Failed to pop a client from MongoDB pool";
-          throw se;
-        }
-        auto collection = mongoc_client_get_collection(
-            mongodb_client, "social-graph", "social-graph");
-        if (!collection) {
-          ServiceException se;
-          se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-          se.message = "Failed to create collection social_graph from MongoDB";
-          mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-          throw se;
-        }
+  fan_out.Add([&] {
+        MongoClientLease mongodb_client(_mongodb_client_pool);
+        auto collection = mongodb_client.Collection(
+            "social-graph", "social-graph");
         bson_t *query = bson_new();
 
         // Update followee->follower edges
@@ -376,8 +280,7 @@ void SocialGraphHandler::Unfollow(
         );
         bson_t reply;
         bson_error_t error;
-        auto update_span = opentracing::Tracer::Global()->StartSpan(
-            "MongoDeleteFollower", {opentracing::ChildOf(&span->context())});
+        auto update_span = span.StartSpan("MongoDeleteFollower");
         bool updated = mongoc_collection_find_and_modify(
             collection, query, nullptr, update, nullptr, false, false,
             true, &reply, &error);
@@ -390,21 +293,15 @@ void SocialGraphHandler::Unfollow(
           bson_destroy(update);
           bson_destroy(query);
           bson_destroy(&reply);
-          mongoc_collection_destroy(collection);
-          mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
           throw se;
         }
-        update_span->Finish();
+        update_span.Finish();
         bson_destroy(update);
         bson_destroy(query);
         bson_destroy(&reply);
-        mongoc_collection_destroy(collection);
-        mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-      // });
-  }
+        mongodb_client.Release();
+  });
 
-  // std::future<void> redis_update_future = std::async(
-  //     std::launch::async, [&]() {
   {
         auto redis_client_wrapper = _redis_client_pool->Pop();
         if (!redis_client_wrapper) {
@@ -415,8 +312,7 @@ void SocialGraphHandler::Unfollow(
         }
         auto redis_client = redis_client_wrapper->GetClient();
 
-        auto redis_span = opentracing::Tracer::Global()->StartSpan(
-            "RedisUpdate", {opentracing::ChildOf(&span->context())});
+        auto redis_span = span.StartSpan("RedisUpdate");
         redis_client.AppendCommand("ZCARD %" PRId64 ":followees", user_id);
         redis_client.AppendCommand("ZCARD %" PRId64 ":followers", followee_id);
         auto num_followee_reply = redis_client.GetReply();
@@ -441,19 +337,12 @@ void SocialGraphHandler::Unfollow(
           reply->check_ok();
         }
         _redis_client_pool->Push(redis_client_wrapper);
-        redis_span->Finish();
-      // });
+        redis_span.Finish();
   }
 
-  // try {
-  //   redis_update_future.get();
-  //   mongo_update_follower_future.get();
-  //   mongo_update_followee_future.get();
-  // } catch (...) {
-  //   throw;
-  // }
+  fan_out.Join();
 
-  span->Finish();
+  span.Finish();
 
 }
 
@@ -462,14 +351,7 @@ void SocialGraphHandler::GetFollowers(
     const std::map<std::string, std::string> &carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "GetFollowers",
-      {opentracing::ChildOf(parent_span->get())});
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("GetFollowers", carrier, req_id);
 
   auto redis_client_wrapper = _redis_client_pool->Pop();
   if (!redis_client_wrapper) {
@@ -480,8 +362,7 @@ void SocialGraphHandler::GetFollowers(
   }
   auto redis_client = redis_client_wrapper->GetClient();
 
-  auto redis_span = opentracing::Tracer::Global()->StartSpan(
-      "RedisGet", {opentracing::ChildOf(&span->context())});
+  auto redis_span = span.StartSpan("RedisGet");
   redis_client.AppendCommand("ZCARD %" PRId64 ":followers", user_id);
   auto num_follower_reply = redis_client.GetReply();
   num_follower_reply->check_ok();
@@ -491,7 +372,7 @@ void SocialGraphHandler::GetFollowers(
     redis_client.AppendCommand("ZRANGE %" PRId64 ":followers 0 -1 ", user_id);
     auto redis_followers_reply = redis_client.GetReply();
     redis_followers_reply->check_ok();
-    redis_span->Finish();
+    redis_span.Finish();
     auto followers_str = redis_followers_reply->as_array();
     for (auto &item : followers_str) {
       _return.emplace_back(std::stoul(item->as_string()));
@@ -499,74 +380,35 @@ void SocialGraphHandler::GetFollowers(
     _redis_client_pool->Push(redis_client_wrapper);
     return;
   } else {
-    redis_span->Finish();
+    redis_span.Finish();
     _redis_client_pool->Push(redis_client_wrapper);
-    mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-        _mongodb_client_pool);
-    if (!mongodb_client) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to pop a client from MongoDB pool";
-      throw se;
-    }
-    auto collection = mongoc_client_get_collection(
-        mongodb_client, "social-graph", "social-graph");
-    if (!collection) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to create collection social_graph from MongoDB";
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-      throw se;
-    }
+    MongoClientLease mongodb_client(_mongodb_client_pool);
+    auto collection = mongodb_client.Collection("social-graph", "social-graph");
     bson_t *query = bson_new();
     BSON_APPEND_INT64(query, "user_id", user_id);
-    auto find_span = opentracing::Tracer::Global()->StartSpan(
-        "MongoFindUser", {opentracing::ChildOf(&span->context())});
+    auto find_span = span.StartSpan("MongoFindUser");
     mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
         collection, query, nullptr, nullptr);
     const bson_t *doc;
     bool found = mongoc_cursor_next(cursor, &doc);
     if (found) {
-      bson_iter_t iter_0;
-      bson_iter_t iter_1;
-      bson_iter_t user_id_child;
-      bson_iter_t timestamp_child;
-      int index = 0;
+      std::vector<int64_t> timestamps;
       std::multimap<std::string, std::string> redis_zset;
-      bson_iter_init(&iter_0, doc);
-      bson_iter_init(&iter_1, doc);
-
-      while (
-          bson_iter_find_descendant(
-              &iter_0,
-              ("followers." + std::to_string(index) + ".user_id").c_str(),
-              &user_id_child) &&
-              BSON_ITER_HOLDS_INT64 (&user_id_child) &&
-              bson_iter_find_descendant(
-                  &iter_1,
-                  ("followers." + std::to_string(index) + ".timestamp").c_str(),
-                  &timestamp_child)
-              && BSON_ITER_HOLDS_INT64 (&timestamp_child)) {
-
-        auto iter_user_id = bson_iter_int64(&user_id_child);
-        auto iter_timestamp = bson_iter_int64(&timestamp_child);
-        _return.emplace_back(iter_user_id);
+      size_t first = _return.size();
+      size_t n = ReadBsonIdTimestampArray(doc, "followers", "user_id",
+                                          &_return, &timestamps);
+      for (size_t i = 0; i < n; i++) {
         redis_zset.emplace(std::pair<std::string, std::string>(
-            std::to_string(iter_timestamp), std::to_string(iter_user_id)));
-        bson_iter_init(&iter_0, doc);
-        bson_iter_init(&iter_1, doc);
-        index++;
+            std::to_string(timestamps[i]), std::to_string(_return[first + i])));
       }
-      find_span->Finish();
+      find_span.Finish();
       bson_destroy(query);
       mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+      mongodb_client.Release();
 
       redis_client_wrapper = _redis_client_pool->Pop();
       redis_client = redis_client_wrapper->GetClient();
-      auto redis_insert_span = opentracing::Tracer::Global()->StartSpan(
-          "RedisInsert", {opentracing::ChildOf(&span->context())});
+      auto redis_insert_span = span.StartSpan("RedisInsert");
       std::stringstream cmd;
       cmd << "ZADD " << user_id << ":followers NX";
       for (const auto& it : redis_zset) {
@@ -575,17 +417,16 @@ void SocialGraphHandler::GetFollowers(
       redis_client.AppendCommand(cmd.str().c_str());
       auto zadd_reply = redis_client.GetReply();
       zadd_reply->check_ok();
-      redis_insert_span->Finish();
+      redis_insert_span.Finish();
       _redis_client_pool->Push(redis_client_wrapper);
     } else {
-      find_span->Finish();
+      find_span.Finish();
       bson_destroy(query);
       mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+      mongodb_client.Release();
     }
   }
-  span->Finish();
+  span.Finish();
 }
 
 void SocialGraphHandler::GetFollowees(
@@ -593,14 +434,7 @@ void SocialGraphHandler::GetFollowees(
     const std::map<std::string, std::string> &carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "GetFollowees",
-      {opentracing::ChildOf(parent_span->get())});
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("GetFollowees", carrier, req_id);
 
   auto redis_client_wrapper = _redis_client_pool->Pop();
   if (!redis_client_wrapper) {
@@ -611,8 +445,7 @@ void SocialGraphHandler::GetFollowees(
   }
   auto redis_client = redis_client_wrapper->GetClient();
 
-  auto redis_span = opentracing::Tracer::Global()->StartSpan(
-      "RedisGet", {opentracing::ChildOf(&span->context())});
+  auto redis_span = span.StartSpan("RedisGet");
   redis_client.AppendCommand("ZCARD %" PRId64 ":followees", user_id);
   auto num_followees_reply = redis_client.GetReply();
   num_followees_reply->check_ok();
@@ -629,28 +462,12 @@ void SocialGraphHandler::GetFollowees(
     _redis_client_pool->Push(redis_client_wrapper);
     return;
   } else {
-    redis_span->Finish();
-    mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-        _mongodb_client_pool);
-    if (!mongodb_client) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to pop a client from MongoDB pool";
-      throw se;
-    }
-    auto collection = mongoc_client_get_collection(
-        mongodb_client, "social-graph", "social-graph");
-    if (!collection) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to create collection social_graph from MongoDB";
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-      throw se;
-    }
+    redis_span.Finish();
+    MongoClientLease mongodb_client(_mongodb_client_pool);
+    auto collection = mongodb_client.Collection("social-graph", "social-graph");
     bson_t *query = bson_new();
     BSON_APPEND_INT64(query, "user_id", user_id);
-    auto find_span = opentracing::Tracer::Global()->StartSpan(
-        "MongoFindUser", {opentracing::ChildOf(&span->context())});
+    auto find_span = span.StartSpan("MongoFindUser");
     mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
         collection, query, nullptr, nullptr);
     const bson_t *doc;
@@ -661,49 +478,24 @@ void SocialGraphHandler::GetFollowees(
       se.message = "Cannot find user_id in MongoDB.";
       bson_destroy(query);
       mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
       throw se;
     } else {
-      bson_iter_t iter_0;
-      bson_iter_t iter_1;
-      bson_iter_t user_id_child;
-      bson_iter_t timestamp_child;
-      int index = 0;
+      std::vector<int64_t> timestamps;
       std::multimap<std::string, std::string> redis_zset;
-      bson_iter_init(&iter_0, doc);
-      bson_iter_init(&iter_1, doc);
-
-      while (
-          bson_iter_find_descendant(
-              &iter_0,
-              ("followees." + std::to_string(index) + ".user_id").c_str(),
-              &user_id_child) &&
-              BSON_ITER_HOLDS_INT64 (&user_id_child) &&
-              bson_iter_find_descendant(
-                  &iter_1,
-                  ("followees." + std::to_string(index) + ".timestamp").c_str(),
-                  &timestamp_child)
-              && BSON_ITER_HOLDS_INT64 (&timestamp_child)) {
-
-        auto iter_user_id = bson_iter_int64(&user_id_child);
-        auto iter_timestamp = bson_iter_int64(&timestamp_child);
-        _return.emplace_back(iter_user_id);
+      size_t first = _return.size();
+      size_t n = ReadBsonIdTimestampArray(doc, "followees", "user_id",
+                                          &_return, &timestamps);
+      for (size_t i = 0; i < n; i++) {
         redis_zset.emplace(std::pair<std::string, std::string>(
-            std::to_string(iter_timestamp), std::to_string(iter_user_id)));
-        bson_iter_init(&iter_0, doc);
-        bson_iter_init(&iter_1, doc);
-        index++;
+            std::to_string(timestamps[i]), std::to_string(_return[first + i])));
       }
-      find_span->Finish();
+      find_span.Finish();
       bson_destroy(query);
       mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+      mongodb_client.Release();
       redis_client_wrapper = _redis_client_pool->Pop();
       redis_client = redis_client_wrapper->GetClient();
-      auto redis_insert_span = opentracing::Tracer::Global()->StartSpan(
-          "RedisInsert", {opentracing::ChildOf(&span->context())});
+      auto redis_insert_span = span.StartSpan("RedisInsert");
       std::stringstream cmd;
       cmd << "ZADD " << user_id << ":followees NX";
       for (const auto& it : redis_zset) {
@@ -712,11 +504,11 @@ void SocialGraphHandler::GetFollowees(
       redis_client.AppendCommand(cmd.str().c_str());
       auto zadd_reply = redis_client.GetReply();
       zadd_reply->check_ok();
-      redis_insert_span->Finish();
+      redis_insert_span.Finish();
       _redis_client_pool->Push(redis_client_wrapper);
     }
   }
-  span->Finish();
+  span.Finish();
 }
 
 void SocialGraphHandler::InsertUser(
@@ -724,32 +516,10 @@ void SocialGraphHandler::InsertUser(
     const std::map<std::string, std::string> &carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "InsertUser",
-      {opentracing::ChildOf(parent_span->get())});
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
-
-  mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-      _mongodb_client_pool);
-  if (!mongodb_client) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-    se.message = "Failed to pop a client from MongoDB pool";
-    throw se;
-  }
-  auto collection = mongoc_client_get_collection(
-      mongodb_client, "social-graph", "social-graph");
-  if (!collection) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-    se.message = "Failed to create collection social_graph from MongoDB";
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-    throw se;
-  }
+  RequestSpan span("InsertUser", carrier, req_id);
+
+  MongoClientLease mongodb_client(_mongodb_client_pool);
+  auto collection = mongodb_client.Collection("social-graph", "social-graph");
 
   bson_t *new_doc = BCON_NEW(
       "user_id", BCON_INT64(user_id),
@@ -757,11 +527,10 @@ void SocialGraphHandler::InsertUser(
       "followees", "[", "]"
   );
   bson_error_t error;
-  auto insert_span = opentracing::Tracer::Global()->StartSpan(
-      "MongoInsertUser", {opentracing::ChildOf(&span->context())});
+  auto insert_span = span.StartSpan("MongoInsertUser");
   bool inserted = mongoc_collection_insert_one(
       collection, new_doc, nullptr, nullptr, &error);
-  insert_span->Finish();
+  insert_span.Finish();
   if (!inserted) {
     LOG(error) << "Failed to insert social graph for user "
                << user_id << " to MongoDB: " << error.message;
@@ -769,14 +538,11 @@ void SocialGraphHandler::InsertUser(
     se.errorCode = ErrorCode::SE_MONGODB_ERROR;
     se.message = error.message;
     bson_destroy(new_doc);
-    mongoc_collection_destroy(collection);
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
     throw se;
   }
   bson_destroy(new_doc);
-  mongoc_collection_destroy(collection);
-  mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-  span->Finish();
+  mongodb_client.Release();
+  span.Finish();
 }
 
 void SocialGraphHandler::FollowWithUsername(
@@ -786,21 +552,14 @@ void SocialGraphHandler::FollowWithUsername(
     const std::map<std::string, std::string> &carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "FollowWithUsername",
-      {opentracing::ChildOf(parent_span->get())});
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("FollowWithUsername", carrier, req_id);
 
   int64_t user_id;
   int64_t followee_id;
 
-  // std::future<int64_t> user_id_future = std::async(
-  //     std::launch::async,[&]() {
-  {
+  // The two lookups are independent
+  FanOut fan_out(_user_service_client_pool->CallsOverlap());
+  fan_out.Add([&] {
         auto user_client_wrapper = _user_service_client_pool->Pop();
         if (!user_client_wrapper) {
           ServiceException se;
@@ -813,7 +572,7 @@ void SocialGraphHandler::FollowWithUsername(
         {
           auto rpc_trace_guard = _user_service_client_pool->StartRpcTrace("GetUserId", user_client_wrapper);
           try {
-            _return = user_client->GetUserId(req_id, user_name, writer_text_map);
+            _return = user_client->GetUserId(req_id, user_name, span.carrier());
           } catch (...) {
             rpc_trace_guard->set_status(1);
             _user_service_client_pool->Remove(user_client_wrapper);
@@ -822,13 +581,9 @@ void SocialGraphHandler::FollowWithUsername(
           }
         }
         _user_service_client_pool->Push(user_client_wrapper);
-        // return _return;
         user_id = _return;
-      // });
-  }
+  });
 
-  // std::future<int64_t> followee_id_future = std::async(
-  //     std::launch::async,[&]() {
   {
         auto user_client_wrapper = _user_service_client_pool->Pop();
         if (!user_client_wrapper) {
@@ -842,7 +597,7 @@ void SocialGraphHandler::FollowWithUsername(
         {
           auto rpc_trace_guard = _user_service_client_pool->StartRpcTrace("GetUserId", user_client_wrapper);
           try {
-            _return = user_client->GetUserId(req_id, followee_name, writer_text_map);
+            _return = user_client->GetUserId(req_id, followee_name, span.carrier());
           } catch (...) {
             rpc_trace_guard->set_status(1);
             _user_service_client_pool->Remove(user_client_wrapper);
@@ -851,28 +606,19 @@ void SocialGraphHandler::FollowWithUsername(
           }
         }
         _user_service_client_pool->Push(user_client_wrapper);
-        // return _return;
         followee_id = _return;
-      // });
   }
 
-  // int64_t user_id;
-  // int64_t followee_id;
-  // try {
-  //   user_id = user_id_future.get();
-  //   followee_id = followee_id_future.get();
-  // } catch (...) {
-  //   throw;
-  // }
+  fan_out.Join();
 
   if (user_id >= 0 && followee_id >= 0) {
     try {
-      Follow(req_id, user_id, followee_id, writer_text_map);
+      Follow(req_id, user_id, followee_id, span.carrier());
     } catch (...) {
       throw;
     }
   }
-  span->Finish();
+  span.Finish();
 }
 
 void SocialGraphHandler::UnfollowWithUsername(
@@ -881,21 +627,14 @@ void SocialGraphHandler::UnfollowWithUsername(
     const std::string &followee_name,
     const std::map<std::string, std::string> &carrier) {
 // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UnfollowWithUsername",
-      {opentracing::ChildOf(parent_span->get())});
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("UnfollowWithUsername", carrier, req_id);
 
   int64_t user_id;
   int64_t followee_id;
 
-  // std::future<int64_t> user_id_future = std::async(
-  //     std::launch::async,[&]() {
-  {
+  // The two lookups are independent
+  FanOut fan_out(_user_service_client_pool->CallsOverlap());
+  fan_out.Add([&] {
         auto user_client_wrapper = _user_service_client_pool->Pop();
         if (!user_client_wrapper) {
           ServiceException se;
@@ -908,7 +647,7 @@ void SocialGraphHandler::UnfollowWithUsername(
         {
           auto rpc_trace_guard = _user_service_client_pool->StartRpcTrace("GetUserId", user_client_wrapper);
           try {
-            _return = user_client->GetUserId(req_id, user_name, writer_text_map);
+            _return = user_client->GetUserId(req_id, user_name, span.carrier());
           } catch (...) {
             rpc_trace_guard->set_status(1);
             _user_service_client_pool->Remove(user_client_wrapper);
@@ -918,12 +657,8 @@ void SocialGraphHandler::UnfollowWithUsername(
         }
         _user_service_client_pool->Push(user_client_wrapper);
         user_id = _return;
-      //   return _return;
-      // });
-  }
+  });
 
-  // std::future<int64_t> followee_id_future = std::async(
-  //     std::launch::async,[&]() {
   {
         auto user_client_wrapper = _user_service_client_pool->Pop();
         if (!user_client_wrapper) {
@@ -937,7 +672,7 @@ void SocialGraphHandler::UnfollowWithUsername(
         {
           auto rpc_trace_guard = _user_service_client_pool->StartRpcTrace("GetUserId", user_client_wrapper);
           try {
-            _return = user_client->GetUserId(req_id, followee_name, writer_text_map);
+            _return = user_client->GetUserId(req_id, followee_name, span.carrier());
           } catch (...) {
             rpc_trace_guard->set_status(1);
             _user_service_client_pool->Remove(user_client_wrapper);
@@ -947,27 +682,18 @@ void SocialGraphHandler::UnfollowWithUsername(
         }
         _user_service_client_pool->Push(user_client_wrapper);
         followee_id = _return;
-      //   return _return;
-      // });
   }
 
-  // int64_t user_id;
-  // int64_t followee_id;
-  // try {
-  //   user_id = user_id_future.get();
-  //   followee_id = followee_id_future.get();
-  // } catch (...) {
-  //   throw;
-  // }
+  fan_out.Join();
 
   if (user_id >= 0 && followee_id >= 0) {
     try {
-      Unfollow(req_id, user_id, followee_id, writer_text_map);
+      Unfollow(req_id, user_id, followee_id, span.carrier());
     } catch (...) {
       throw;
     }
   }
-  span->Finish();
+  span.Finish();
 }
 
 } // namespace social_network
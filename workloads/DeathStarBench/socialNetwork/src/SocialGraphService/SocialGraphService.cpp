@@ -12,12 +12,15 @@ static ClientPool<RedisClient>* redis_client_pool;
 
 int faas_init() {
     init_logger();
-    SetUpTracer("config/jaeger-config.yml", "post-storage-service");
+    SetUpTracer("config/jaeger-config.yml", "social-graph-service");
 
     if (load_config(&config_json) != 0) {
         return -1;
     }
 
+    SetUpFanOut(config_json["social-graph-service"].value("fanout_threads", 0),
+                config_json["social-graph-service"].value("fanout_max_queued", 0));
+
   int redis_port = config_json["social-graph-redis"]["port"];
   std::string redis_addr = config_json["social-graph-redis"]["addr"];
 
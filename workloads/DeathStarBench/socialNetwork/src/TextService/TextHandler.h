@@ -14,6 +14,7 @@
 #include "../logger.h"
 #include "../tracing.h"
 #include "../ClientPool.h"
+#include "../FanOut.h"
 #include "../ThriftClient.h"
 
 namespace social_network {
@@ -49,14 +50,7 @@ void TextHandler::UploadText(
     const std::map<std::string, std::string> & carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UploadText",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("UploadText", carrier, req_id);
 
   std::vector<std::string> user_mentions;
   std::smatch m;
@@ -78,10 +72,36 @@ void TextHandler::UploadText(
     s = m.suffix().str();
   }
 
+  // Mentions do not depend on the shortened urls
+  FanOut fan_out(_user_mention_client_pool->CallsOverlap());
+  fan_out.Add([&] {
+        auto user_mention_client_wrapper = _user_mention_client_pool->Pop();
+        if (!user_mention_client_wrapper) {
+          ServiceException se;
+          se.errorCode = ErrorCode::SE_THRIFT_CONN_ERROR;
+          se.message = "Failed to connect to user-mention-service";
+          throw se;
+        }
+        std::vector<std::string> urls;
+        auto user_mention_client = user_mention_client_wrapper->GetClient();
+        {
+          auto rpc_trace_guard = _user_mention_client_pool->StartRpcTrace("UploadUserMentions", user_mention_client_wrapper);
+          try {
+            user_mention_client->UploadUserMentions(req_id, user_mentions,
+                                                    span.carrier());
+          } catch (...) {
+            rpc_trace_guard->set_status(1);
+            LOG(error) << "Failed to upload user_mentions to user-mention-service";
+            _user_mention_client_pool->Remove(user_mention_client_wrapper);
+            throw;
+          }
+        }
+
+        _user_mention_client_pool->Push(user_mention_client_wrapper);
+  });
+
   std::vector<std::string> shortened_urls;
 
-  // std::future<std::vector<std::string>> shortened_urls_future = std::async(
-  //     std::launch::async, [&](){
   {
         auto url_client_wrapper = _url_client_pool->Pop();
         if (!url_client_wrapper) {
@@ -95,7 +115,7 @@ void TextHandler::UploadText(
         {
           auto rpc_trace_guard = _url_client_pool->StartRpcTrace("UploadUrls", url_client_wrapper);
           try {
-            url_client->UploadUrls(return_urls, req_id, urls, writer_text_map);
+            url_client->UploadUrls(return_urls, req_id, urls, span.carrier());
           } catch (...) {
             rpc_trace_guard->set_status(1);
             LOG(error) << "Failed to upload urls to url-shorten-service";
@@ -106,48 +126,8 @@ void TextHandler::UploadText(
         
         _url_client_pool->Push(url_client_wrapper);
         shortened_urls = std::move(return_urls);
-      //   return return_urls;
-      // });
   }
 
-  // std::future<void> user_mention_future = std::async(
-  //     std::launch::async, [&](){
-  {
-        auto user_mention_client_wrapper = _user_mention_client_pool->Pop();
-        if (!user_mention_client_wrapper) {
-          ServiceException se;
-          se.errorCode = ErrorCode::SE_THRIFT_CONN_ERROR;
-          se.message = "Failed to connect to user-mention-service";
-          throw se;
-        }
-        std::vector<std::string> urls;
-        auto user_mention_client = user_mention_client_wrapper->GetClient();
-        {
-          auto rpc_trace_guard = _user_mention_client_pool->StartRpcTrace("UploadUserMentions", user_mention_client_wrapper);
-          try {
-            user_mention_client->UploadUserMentions(req_id, user_mentions,
-                                                    writer_text_map);
-          } catch (...) {
-            rpc_trace_guard->set_status(1);
-            LOG(error) << "Failed to upload user_mentions to user-mention-service";
-            _user_mention_client_pool->Remove(user_mention_client_wrapper);
-            throw;
-          }
-        }
-
-        _user_mention_client_pool->Push(user_mention_client_wrapper);
-
-      // });
-  }
-
-  // std::vector<std::string> shortened_urls;
-  // try {
-  //   shortened_urls = shortened_urls_future.get();
-  // } catch (...) {
-  //   LOG(error) << "Failed to get shortened urls from url-shorten-service";
-  //   throw;
-  // }
-
   std::string updated_text;
   if (!urls.empty()) {
     s = text;
@@ -164,8 +144,6 @@ void TextHandler::UploadText(
   }
 
   
-  // std::future<void> upload_text_future = std::async(
-  //     std::launch::async, [&]() {
   {
         // Upload to compose post service
         auto compose_post_client_wrapper = _compose_client_pool->Pop();
@@ -179,7 +157,7 @@ void TextHandler::UploadText(
         {
           auto rpc_trace_guard = _compose_client_pool->StartRpcTrace("UploadText", compose_post_client_wrapper);
           try {
-            compose_post_client->UploadText(req_id, updated_text, writer_text_map);
+            compose_post_client->UploadText(req_id, updated_text, span.carrier());
           } catch (...) {
             rpc_trace_guard->set_status(1);
             LOG(error) << "Failed to upload text to compose-post-service";
@@ -188,24 +166,11 @@ void TextHandler::UploadText(
           }
         }
         _compose_client_pool->Push(compose_post_client_wrapper);
-      // });
   }
 
-  // try {
-  //   user_mention_future.get();
-  // } catch (...) {
-  //   LOG(error) << "Failed to upload user mentions to user-mention-service";
-  //   throw;
-  // }
-
-  // try {
-  //   upload_text_future.get();
-  // } catch (...) {
-  //   LOG(error) << "Failed to upload text to compose-post-service";
-  //   throw;
-  // }
-
-  span->Finish();
+  fan_out.Join();
+
+  span.Finish();
 }
 
 } //namespace social_network
@@ -8,12 +8,15 @@ static json config_json;
 
 int faas_init() {
     init_logger();
-    SetUpTracer("config/jaeger-config.yml", "post-storage-service");
+    SetUpTracer("config/jaeger-config.yml", "text-service");
 
     if (load_config(&config_json) != 0) {
         return -1;
     }
 
+    SetUpFanOut(config_json["text-service"].value("fanout_threads", 0),
+                config_json["text-service"].value("fanout_max_queued", 0));
+
     return 0;
 }
 
@@ -0,0 +1,198 @@
+#ifndef SOCIAL_NETWORK_MICROSERVICES_TIMELINEBUCKETS_H
+#define SOCIAL_NETWORK_MICROSERVICES_TIMELINEBUCKETS_H
+
+#include <string>
+#include <vector>
+
+#include <mongoc.h>
+#include <bson/bson.h>
+
+#include "logger.h"
+#include "MongoBatchWriter.h"
+#include "utils_bson.h"
+
+// A timeline of {<id_key>, timestamp} entries kept as a run of bounded
+// bucket documents instead of one ever-growing array:
+//
+//   {<owner>, bucket_seq: int64, count: int32, <array_key>: [newest, ...]}
+//
+// Bucket 0 holds the oldest entries and only the highest bucket_seq (the
+// head) is written to, so an append rewrites at most `bucket_size` entries
+// and a read of the newest N fetches about N / bucket_size documents.
+// <owner> is the owning key, e.g. {user_id: 1}, given as a document so both
+// integer and string owners work. Existing single-document timelines are
+// converted by scripts/migrate_timeline_buckets.py.
+
+namespace social_network {
+
+namespace timeline_buckets_detail {
+
+bson_t *OwnerFilter(const bson_t *owner) {
+  bson_t *filter = bson_new();
+  bson_concat(filter, owner);
+  return filter;
+}
+
+// False on error, otherwise *found tells whether the owner has any bucket.
+bool FindHeadBucket(mongoc_collection_t *collection, const bson_t *owner,
+                    bool *found, int64_t *bucket_seq, int64_t *count,
+                    bson_error_t *error) {
+  bson_t *opts = BCON_NEW(
+      "sort", "{", "bucket_seq", BCON_INT32(-1), "}",
+      "limit", BCON_INT64(1),
+      "projection", "{",
+          "bucket_seq", BCON_BOOL(true),
+          "count", BCON_BOOL(true),
+          "_id", BCON_BOOL(false),
+      "}");
+  mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
+      collection, owner, opts, nullptr);
+  const bson_t *doc;
+  *found = mongoc_cursor_next(cursor, &doc);
+  if (*found) {
+    bson_iter_t iter;
+    *bucket_seq = 0;
+    *count = 0;
+    if (bson_iter_init_find(&iter, doc, "bucket_seq")) {
+      BsonIterInt64(&iter, bucket_seq);
+    }
+    if (bson_iter_init_find(&iter, doc, "count")) {
+      BsonIterInt64(&iter, count);
+    }
+  }
+  bool failed = mongoc_cursor_error(cursor, error);
+  mongoc_cursor_destroy(cursor);
+  bson_destroy(opts);
+  return !failed;
+}
+
+} // namespace timeline_buckets_detail
+
+// Prepends an entry to the owner's head bucket, opening the next bucket
+// once the head holds `bucket_size` entries. The update goes through
+// `writer` if there is one.
+bool AppendToTimelineBucket(mongoc_collection_t *collection,
+                            MongoBatchWriter *writer,
+                            const bson_t *owner, const char *array_key,
+                            const char *id_key, int64_t id, int64_t timestamp,
+                            int bucket_size, bson_error_t *error) {
+  bson_t *update = BCON_NEW(
+      "$push", "{",
+          array_key, "{",
+              "$each", "[", "{",
+                  id_key, BCON_INT64(id),
+                  "timestamp", BCON_INT64(timestamp),
+              "}", "]",
+              "$position", BCON_INT32(0),
+          "}",
+      "}",
+      "$inc", "{", "count", BCON_INT32(1), "}");
+  bson_t *opts = BCON_NEW("upsert", BCON_BOOL(true));
+
+  bool appended = false;
+  // a retry only follows a lost race to open the same bucket
+  for (int attempt = 0; attempt < 3 && !appended; attempt++) {
+    bool found;
+    int64_t bucket_seq;
+    int64_t count;
+    if (!timeline_buckets_detail::FindHeadBucket(
+        collection, owner, &found, &bucket_seq, &count, error)) {
+      break;
+    }
+    if (!found) {
+      bucket_seq = 0;
+    } else if (count >= bucket_size) {
+      bucket_seq++;
+    }
+    // matches only while the bucket has room; upserts it if it is new and
+    // fails on the (owner, bucket_seq) index if it filled up meanwhile
+    bson_t *filter = timeline_buckets_detail::OwnerFilter(owner);
+    BSON_APPEND_INT64(filter, "bucket_seq", bucket_seq);
+    BCON_APPEND(filter, "count", "{", "$lt", BCON_INT32(bucket_size), "}");
+    appended = writer
+        ? writer->UpdateOne(filter, update, true, error)
+        : mongoc_collection_update_one(
+              collection, filter, update, opts, nullptr, error);
+    bson_destroy(filter);
+    if (!appended && error->code != MONGOC_ERROR_DUPLICATE_KEY) {
+      break;
+    }
+  }
+  bson_destroy(opts);
+  bson_destroy(update);
+  return appended;
+}
+
+// Appends the owner's newest `count` entries, newest first, to `ids` and
+// `timestamps`, fetching only the buckets that hold them. Fewer entries are
+// returned if the timeline is shorter.
+bool ReadTimelineBuckets(mongoc_collection_t *collection, const bson_t *owner,
+                         const char *array_key, const char *id_key, int count,
+                         int bucket_size, std::vector<int64_t> *ids,
+                         std::vector<int64_t> *timestamps,
+                         bson_error_t *error) {
+  // the head holds at least one entry and every older bucket is full
+  int64_t num_buckets = count / bucket_size + 2;
+  bson_t *opts = BCON_NEW(
+      "sort", "{", "bucket_seq", BCON_INT32(-1), "}",
+      "limit", BCON_INT64(num_buckets),
+      "batchSize", BCON_INT64(num_buckets),
+      "projection", "{",
+          array_key, BCON_BOOL(true),
+          "_id", BCON_BOOL(false),
+      "}");
+  mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
+      collection, owner, opts, nullptr);
+  size_t target = ids->size() + count;
+  const bson_t *doc;
+  while (ids->size() < target && mongoc_cursor_next(cursor, &doc)) {
+    ReadBsonIdTimestampArray(doc, array_key, id_key, ids, timestamps);
+  }
+  if (ids->size() > target) {
+    ids->resize(target);
+    timestamps->resize(target);
+  }
+  bool failed = mongoc_cursor_error(cursor, error);
+  mongoc_cursor_destroy(cursor);
+  bson_destroy(opts);
+  return !failed;
+}
+
+// Unique index on (<owner_key>, bucket_seq), used by both the head lookup
+// and reads.
+bool CreateTimelineBucketIndex(mongoc_client_t *client,
+                               const std::string &db_name,
+                               const std::string &collection_name,
+                               const std::string &owner_key) {
+  bson_t keys;
+  bson_t reply;
+  bson_error_t error;
+
+  mongoc_database_t *db = mongoc_client_get_database(client, db_name.c_str());
+  bson_init(&keys);
+  BSON_APPEND_INT32(&keys, owner_key.c_str(), 1);
+  BSON_APPEND_INT32(&keys, "bucket_seq", 1);
+  char *index_name = mongoc_collection_keys_to_index_string(&keys);
+  bson_t *create_indexes = BCON_NEW(
+      "createIndexes", BCON_UTF8(collection_name.c_str()),
+      "indexes", "[", "{",
+          "key", BCON_DOCUMENT(&keys),
+          "name", BCON_UTF8(index_name),
+          "unique", BCON_BOOL(true),
+      "}", "]");
+  bool r = mongoc_database_write_command_with_opts(
+      db, create_indexes, nullptr, &reply, &error);
+  if (!r) {
+    LOG(error) << "Error in createIndexes: " << error.message;
+  }
+  bson_free(index_name);
+  bson_destroy(&reply);
+  bson_destroy(create_indexes);
+  bson_destroy(&keys);
+  mongoc_database_destroy(db);
+  return r;
+}
+
+} // namespace social_network
+
+#endif //SOCIAL_NETWORK_MICROSERVICES_TIMELINEBUCKETS_H
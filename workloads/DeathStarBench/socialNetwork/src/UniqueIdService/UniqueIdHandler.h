@@ -80,14 +80,7 @@ void UniqueIdHandler::UploadUniqueId(
     const std::map<std::string, std::string> & carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UploadUniqueId",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("UploadUniqueId", carrier, req_id);
 
   _thread_lock->lock();
   int64_t timestamp = duration_cast<milliseconds>(
@@ -134,7 +127,7 @@ void UniqueIdHandler::UploadUniqueId(
   {
     auto rpc_trace_guard = _compose_client_pool->StartRpcTrace("UploadUniqueId", compose_post_client_wrapper);
     try {
-      compose_post_client->UploadUniqueId(req_id, post_id, post_type, writer_text_map);    
+      compose_post_client->UploadUniqueId(req_id, post_id, post_type, span.carrier());    
     } catch (...) {
       rpc_trace_guard->set_status(1);
       _compose_client_pool->Remove(compose_post_client_wrapper);
@@ -144,7 +137,7 @@ void UniqueIdHandler::UploadUniqueId(
   }
   _compose_client_pool->Push(compose_post_client_wrapper);
 
-  span->Finish();
+  span.Finish();
 }
 
 /*
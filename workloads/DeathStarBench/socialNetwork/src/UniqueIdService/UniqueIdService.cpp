@@ -23,7 +23,7 @@ static std::mutex* thread_lock;
 
 int faas_init() {
     init_logger();
-    SetUpTracer("config/jaeger-config.yml", "post-storage-service");
+    SetUpTracer("config/jaeger-config.yml", "unique-id-service");
 
     if (load_config(&config_json) != 0) {
         return -1;
@@ -14,6 +14,7 @@
 #include "../ThriftClient.h"
 #include "../logger.h"
 #include "../tracing.h"
+#include "../utils_mongodb.h"
 
 #define HOSTNAME "http://short-url/"
 
@@ -22,6 +23,7 @@ namespace social_network {
 class UrlShortenHandler : public UrlShortenServiceIf {
  public:
   UrlShortenHandler(ClientPool<MCClient> *, mongoc_client_pool_t *,
+      MongoBatchWriter *,
       ClientPool<ThriftClient<ComposePostServiceClient>> *);
   ~UrlShortenHandler() override = default;
 
@@ -36,6 +38,7 @@ class UrlShortenHandler : public UrlShortenServiceIf {
  private:
   ClientPool<MCClient> *_mc_client_pool;
   mongoc_client_pool_t *_mongodb_client_pool;
+  MongoBatchWriter *_mongodb_writer;
   ClientPool<ThriftClient<ComposePostServiceClient>> *_compose_client_pool;
   static std::mt19937 _generator;
   static std::uniform_int_distribution<int> _distribution;
@@ -50,10 +53,12 @@ std::uniform_int_distribution<int> UrlShortenHandler::_distribution =
 UrlShortenHandler::UrlShortenHandler(
     ClientPool<MCClient> *mc_client_pool,
     mongoc_client_pool_t *mongodb_client_pool,
+    MongoBatchWriter *mongodb_writer,
     ClientPool<ThriftClient<ComposePostServiceClient>> *compose_client_pool) {
   _compose_client_pool = compose_client_pool;
   _mc_client_pool = mc_client_pool;
   _mongodb_client_pool = mongodb_client_pool;
+  _mongodb_writer = mongodb_writer;
 }
 
 std::string UrlShortenHandler::_GenRandomStr(int length) {
@@ -72,14 +77,7 @@ void UrlShortenHandler::UploadUrls(
     const std::map<std::string, std::string> &carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UploadUrls",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("UploadUrls", carrier, req_id);
 
   std::vector<Url> target_urls;
   // std::future<void> mongo_future;
@@ -96,24 +94,31 @@ void UrlShortenHandler::UploadUrls(
 
     // mongo_future = std::async(
     //     std::launch::async, [&](){
-    {
-          mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-              _mongodb_client_pool);
-          if (!mongodb_client) {
-            ServiceException se;
-            se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-            se.message = "Failed to pop a client from MongoDB pool";
-            throw se;
-          }
-          auto collection = mongoc_client_get_collection(
-              mongodb_client, "url-shorten", "url-shorten");
-          if (!collection) {
-            ServiceException se;
-            se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-            se.message = "Failed to create collection user from DB user";
-            mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-            throw se;
-          }
+    auto mongo_span = span.StartSpan("MongoInsertUrls");
+    if (_mongodb_writer) {
+      // one write per url, sent along with other requests' writes
+      std::vector<std::future<MongoWriteResult>> results;
+      for (auto &url : target_urls) {
+        bson_t *doc = bson_new();
+        BSON_APPEND_UTF8(doc, "shortened_url", url.shortened_url.c_str());
+        BSON_APPEND_UTF8(doc, "expanded_url", url.expanded_url.c_str());
+        results.emplace_back(_mongodb_writer->InsertAsync(doc));
+        bson_destroy(doc);
+      }
+      for (auto &result_future : results) {
+        MongoWriteResult result = result_future.get();
+        if (!result.ok) {
+          LOG(error) << "MongoDB error: "<< result.error.message;
+          ServiceException se;
+          se.errorCode = ErrorCode::SE_MONGODB_ERROR;
+          se.message = "Failed to insert urls to MongoDB";
+          throw se;
+        }
+      }
+    } else {
+          MongoClientLease mongodb_client(_mongodb_client_pool);
+          auto collection = mongodb_client.Collection(
+              "url-shorten", "url-shorten");
 
           mongoc_bulk_operation_t *bulk;
           bson_t *doc;
@@ -137,16 +142,14 @@ void UrlShortenHandler::UploadUrls(
             se.message = "Failed to insert urls to MongoDB";
             bson_destroy (&reply);
             mongoc_bulk_operation_destroy(bulk);
-            mongoc_collection_destroy(collection);
-            mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
             throw se;
           }
           bson_destroy (&reply);
           mongoc_bulk_operation_destroy(bulk);
-          mongoc_collection_destroy(collection);
-          mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+          mongodb_client.Release();
         // });
     }
+    mongo_span.Finish();
   }
 
   // std::future<void> compose_future = std::async(
@@ -164,7 +167,7 @@ void UrlShortenHandler::UploadUrls(
         {
           auto rpc_trace_guard = _compose_client_pool->StartRpcTrace("UploadUrls", compose_post_client_wrapper);
           try {
-            compose_post_client->UploadUrls(req_id, target_urls, writer_text_map);
+            compose_post_client->UploadUrls(req_id, target_urls, span.carrier());
           } catch (...) {
             rpc_trace_guard->set_status(1);
             _compose_client_pool->Remove(compose_post_client_wrapper);
@@ -193,7 +196,7 @@ void UrlShortenHandler::UploadUrls(
   //   throw;
   // }
 
-  span->Finish();
+  span.Finish();
 
 }
 void UrlShortenHandler::GetExtendedUrls(
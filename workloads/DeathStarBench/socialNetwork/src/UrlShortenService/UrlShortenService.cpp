@@ -10,10 +10,11 @@ using namespace social_network;
 static json config_json;
 static mongoc_client_pool_t* mongodb_client_pool;
 static ClientPool<MCClient>* mc_client_pool;
+static MongoBatchWriter* mongodb_writer;
 
 int faas_init() {
     init_logger();
-    SetUpTracer("config/jaeger-config.yml", "post-storage-service");
+    SetUpTracer("config/jaeger-config.yml", "url-shorten-service");
 
     if (load_config(&config_json) != 0) {
         return -1;
@@ -21,6 +22,8 @@ int faas_init() {
 
   std::string mc_addr = config_json["url-shorten-memcached"]["addr"];
   int mc_port = config_json["url-shorten-memcached"]["port"];
+  MCClient::SharedConnections() =
+      config_json["url-shorten-memcached"].value("shared_connections", 0);
   mc_client_pool = new ClientPool<MCClient>("url-shorten-memcached", mc_addr, mc_port, 1, 128, 1000);
   mongodb_client_pool = init_mongodb_client_pool(config_json, "url-shorten", 128);
   if (mongodb_client_pool == nullptr) {
@@ -42,6 +45,10 @@ int faas_init() {
   }
   mongoc_client_pool_push(mongodb_client_pool, mongodb_client);
 
+  mongodb_writer = init_mongodb_batch_writer(
+      config_json, "url-shorten", mongodb_client_pool,
+      "url-shorten", "url-shorten");
+
     return 0;
 }
 
@@ -61,7 +68,7 @@ int faas_create_func_worker(void* caller_context,
 
     faas_worker->SetProcessor(std::make_shared<UrlShortenServiceProcessor>(
           std::make_shared<UrlShortenHandler>(
-              mc_client_pool, mongodb_client_pool,
+              mc_client_pool, mongodb_client_pool, mongodb_writer,
               compose_post_client_pool)));
     *worker_handle = faas_worker;
     return 0;
@@ -12,6 +12,8 @@
 #include "../logger.h"
 #include "../tracing.h"
 #include "../utils.h"
+#include "../utils_mongodb.h"
+#include "../UsernameCache.h"
 
 namespace social_network {
 
@@ -25,7 +27,8 @@ class UserMentionHandler : public UserMentionServiceIf {
  public:
   UserMentionHandler(ClientPool<MCClient> *,
                      mongoc_client_pool_t *,
-                     ClientPool<ThriftClient<ComposePostServiceClient>> *);
+                     ClientPool<ThriftClient<ComposePostServiceClient>> *,
+                     UsernameCache *);
   ~UserMentionHandler() override = default;
 
   void UploadUserMentions(int64_t, const std::vector<std::string> &,
@@ -35,15 +38,18 @@ class UserMentionHandler : public UserMentionServiceIf {
   ClientPool<MCClient> *_mc_client_pool;
   mongoc_client_pool_t *_mongodb_client_pool;
   ClientPool<ThriftClient<ComposePostServiceClient>> *_compose_client_pool;
+  UsernameCache *_username_cache;
 };
 
 UserMentionHandler::UserMentionHandler(
     ClientPool<MCClient> *mc_client_pool,
     mongoc_client_pool_t *mongodb_client_pool,
-    ClientPool<ThriftClient<ComposePostServiceClient>> *compose_client_pool) {
+    ClientPool<ThriftClient<ComposePostServiceClient>> *compose_client_pool,
+    UsernameCache *username_cache) {
   _mc_client_pool = mc_client_pool;
   _mongodb_client_pool = mongodb_client_pool;
   _compose_client_pool = compose_client_pool;
+  _username_cache = username_cache;
 }
 
 void UserMentionHandler::UploadUserMentions(
@@ -52,27 +58,41 @@ void UserMentionHandler::UploadUserMentions(
     const std::map<std::string, std::string> &carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UploadUserMentions",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("UploadUserMentions", carrier, req_id);
 
   uint64_t start_time;
   uint64_t elapsed_time;
 
   std::vector<UserMention> user_mentions;
-  if (!usernames.empty()) {
+  // Find in the near cache
+  std::vector<std::string> usernames_to_fetch;
+  for (auto &username : usernames) {
+    int64_t user_id;
+    switch (_username_cache->Lookup(username, &user_id)) {
+      case UsernameCache::HIT: {
+        UserMention new_user_mention;
+        new_user_mention.username = username;
+        new_user_mention.user_id = user_id;
+        user_mentions.emplace_back(new_user_mention);
+        break;
+      }
+      case UsernameCache::NOT_FOUND:
+        break;
+      case UsernameCache::MISS:
+        usernames_to_fetch.emplace_back(username);
+        break;
+    }
+  }
+
+  if (!usernames_to_fetch.empty()) {
     std::map<std::string, bool> usernames_not_cached;
 
-    for (auto &username : usernames) {
+    for (auto &username : usernames_to_fetch) {
       usernames_not_cached.emplace(std::make_pair(username, false));
     }
 
     // Find in Memcached
+    auto mmc_span = span.StartSpan("MmcMultiGetUserId");
     auto mc_client = _mc_client_pool->Pop();
     if (!mc_client) {
       ServiceException se;
@@ -81,58 +101,60 @@ void UserMentionHandler::UploadUserMentions(
       throw se;
     }
 
-    bool found;
-    std::string return_value;
-    uint32_t flags;
+    std::vector<std::string> keys;
+    keys.reserve(usernames_to_fetch.size());
+    for (auto &username : usernames_to_fetch) {
+      keys.emplace_back(username + ":user_id");
+    }
+    std::map<std::string, std::string> return_values;
 
-    for (int i = 0; i < usernames.size(); i++) {
-      std::string key_str = usernames[i] + ":user_id";
-      start_time = time_us();
-      bool success = mc_client->Get(key_str, &found, &return_value, &flags);
-      elapsed_time = time_us() - start_time;
-      if (elapsed_time > 10000) { // 10ms
-        LOG(info) << "Single memcached_get uses " << elapsed_time << "us";
-      }
-      if (!success) {
-        _mc_client_pool->Push(mc_client);
-        LOG(error) << "Cannot get components of request " << req_id;
-        ServiceException se;
-        se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
-        se.message =  "Cannot get usernames of request " + std::to_string(req_id);
-        throw se;
-      }
-      if (!found) continue;
+    start_time = time_us();
+    bool success = mc_client->MultiGet(keys, &return_values);
+    elapsed_time = time_us() - start_time;
+    if (elapsed_time > 10000) { // 10ms
+      LOG_EVERY_MS(info, 1000) << "Memcached multi-get of " << keys.size()
+                               << " keys uses " << elapsed_time << "us";
+    }
+    if (!success) {
+      // a failed read is a miss for every username, MongoDB still has them
+      LOG_EVERY_MS(warning, 1000) << "Cannot get usernames of request "
+                                  << req_id << " from memcached, reading MongoDB";
+      return_values.clear();
+    }
+    for (int i = 0; i < usernames_to_fetch.size(); i++) {
+      auto it = return_values.find(keys[i]);
+      if (it == return_values.end()) continue;
       UserMention new_user_mention;
-      new_user_mention.username = usernames[i];
-      new_user_mention.user_id = std::stoul(return_value);
+      new_user_mention.username = usernames_to_fetch[i];
+      new_user_mention.user_id = std::stoul(it->second);
       user_mentions.emplace_back(new_user_mention);
-      usernames_not_cached.erase(usernames[i]);
+      usernames_not_cached.erase(usernames_to_fetch[i]);
+      _username_cache->Insert(new_user_mention.username,
+                              new_user_mention.user_id);
     }
 
     _mc_client_pool->Push(mc_client);
+    mmc_span.Finish();
+
+    // Skip MongoDB for usernames the filter rules out
+    for (auto it = usernames_not_cached.begin();
+         it != usernames_not_cached.end();) {
+      if (_username_cache->MayExist(it->first)) {
+        ++it;
+      } else {
+        _username_cache->InsertNotFound(it->first);
+        it = usernames_not_cached.erase(it);
+      }
+    }
 
     // Find the rest in MongoDB
     if (!usernames_not_cached.empty()) {
       start_time = time_us();
+      auto mongo_span = span.StartSpan("MongoFindUser");
 
-      mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-          _mongodb_client_pool);
-      if (!mongodb_client) {
-        ServiceException se;
-        se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-        se.message = "Failed to pop a client from MongoDB pool";
-        throw se;
-      }
+      MongoClientLease mongodb_client(_mongodb_client_pool);
 
-      auto collection = mongoc_client_get_collection(
-          mongodb_client, "user", "user");
-      if (!collection) {
-        ServiceException se;
-        se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-        se.message = "Failed to create collection user from DB user";
-        mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-        throw se;
-      }
+      auto collection = mongodb_client.Collection("user", "user");
 
       bson_t *query = bson_new();
       bson_t query_child_0;
@@ -166,8 +188,6 @@ void UserMentionHandler::UploadUserMentions(
           se.message = "Attribute of MongoDB item is not complete";
           bson_destroy(query);
           mongoc_cursor_destroy(cursor);
-          mongoc_collection_destroy(collection);
-          mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
           throw se;
         }
         if (bson_iter_init_find(&iter, doc, "username")) {
@@ -178,20 +198,32 @@ void UserMentionHandler::UploadUserMentions(
           se.message = "Attribute of MongoDB item is not complete";
           bson_destroy(query);
           mongoc_cursor_destroy(cursor);
-          mongoc_collection_destroy(collection);
-          mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
           throw se;
         }
         user_mentions.emplace_back(new_user_mention);
+        usernames_not_cached[new_user_mention.username] = true;
+        _username_cache->Insert(new_user_mention.username,
+                                new_user_mention.user_id);
+      }
+      // only a complete answer proves the rest are unknown
+      bson_error_t error;
+      if (!mongoc_cursor_error(cursor, &error)) {
+        for (auto &item : usernames_not_cached) {
+          if (!item.second) {
+            _username_cache->InsertNotFound(item.first);
+          }
+        }
       }
       bson_destroy(query);
       mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+      mongodb_client.Release();
+      mongo_span.Finish();
 
       elapsed_time = time_us() - start_time;
       if (elapsed_time > 10000) { // 10ms
-        LOG(info) << "Reading " << usernames_not_cached.size() << " keys from MongoDB uses " << elapsed_time << "us";
+        LOG_EVERY_MS(info, 1000) << "Reading " << usernames_not_cached.size()
+                                 << " keys from MongoDB uses " << elapsed_time
+                                 << "us";
       }
     }
   }
@@ -209,7 +241,7 @@ void UserMentionHandler::UploadUserMentions(
     auto rpc_trace_guard = _compose_client_pool->StartRpcTrace("UploadUserMentions", compose_post_client_wrapper);
     try {
       compose_post_client->UploadUserMentions(req_id, user_mentions,
-                                              writer_text_map);
+                                              span.carrier());
     } catch (...) {
       rpc_trace_guard->set_status(1);
       _compose_client_pool->Remove(compose_post_client_wrapper);
@@ -218,7 +250,7 @@ void UserMentionHandler::UploadUserMentions(
     }
   }
   _compose_client_pool->Push(compose_post_client_wrapper);
-  span->Finish();
+  span.Finish();
 }
 
 }
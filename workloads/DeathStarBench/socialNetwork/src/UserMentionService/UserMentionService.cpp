@@ -12,10 +12,11 @@ using namespace social_network;
 static json config_json;
 static mongoc_client_pool_t* mongodb_client_pool;
 static ClientPool<MCClient>* mc_client_pool;
+static UsernameCache* username_cache;
 
 int faas_init() {
     init_logger();
-    SetUpTracer("config/jaeger-config.yml", "post-storage-service");
+    SetUpTracer("config/jaeger-config.yml", "user-mention-service");
 
     if (load_config(&config_json) != 0) {
         return -1;
@@ -23,6 +24,8 @@ int faas_init() {
 
   std::string mc_addr = config_json["user-memcached"]["addr"];
   int mc_port = config_json["user-memcached"]["port"];
+  MCClient::SharedConnections() =
+      config_json["user-memcached"].value("shared_connections", 0);
   mc_client_pool = new ClientPool<MCClient>("user-memcached", mc_addr, mc_port, 1, 128, 1000);
 
   mongodb_client_pool = init_mongodb_client_pool(config_json, "user", 128);
@@ -30,6 +33,16 @@ int faas_init() {
     return -1;
   }
 
+  auto& service_config = config_json["user-mention-service"];
+  username_cache = new UsernameCache(
+      service_config.value("username_cache_size", 0),
+      service_config.value("username_negative_ttl_ms", 5000));
+  int bloom_refresh_s = service_config.value("username_bloom_refresh_s", 0);
+  if (bloom_refresh_s > 0) {
+    StartUsernameFilterRefresh(username_cache, mongodb_client_pool,
+                               bloom_refresh_s);
+  }
+
     return 0;
 }
 
@@ -50,7 +63,7 @@ int faas_create_func_worker(void* caller_context,
     faas_worker->SetProcessor(std::make_shared<UserMentionServiceProcessor>(
           std::make_shared<UserMentionHandler>(
               mc_client_pool, mongodb_client_pool,
-              compose_post_client_pool)));
+              compose_post_client_pool, username_cache)));
     *worker_handle = faas_worker;
     return 0;
 }
@@ -22,6 +22,8 @@
 #include "../ThriftClient.h"
 #include "../tracing.h"
 #include "../logger.h"
+#include "../UsernameCache.h"
+#include "../utils_mongodb.h"
 
 // Custom Epoch (January 1, 2018 Midnight GMT = 2018-01-01T00:00:00Z)
 #define CUSTOM_EPOCH 1514764800000
@@ -76,8 +78,10 @@ class UserHandler : public UserServiceIf {
       const std::string &,
       ClientPool<MCClient> *,
       mongoc_client_pool_t *,
+      MongoBatchWriter *,
       ClientPool<ThriftClient<ComposePostServiceClient>> *,
-      ClientPool<ThriftClient<SocialGraphServiceClient>> *);
+      ClientPool<ThriftClient<SocialGraphServiceClient>> *,
+      UsernameCache *);
   ~UserHandler() override = default;
   void RegisterUser(
       int64_t,
@@ -120,9 +124,12 @@ class UserHandler : public UserServiceIf {
   std::mutex *_thread_lock;
   ClientPool<MCClient> *_mc_client_pool;
   mongoc_client_pool_t *_mongodb_client_pool;
+  MongoBatchWriter *_mongodb_writer;
   ClientPool<ThriftClient<ComposePostServiceClient>> *_compose_client_pool;
   ClientPool<ThriftClient<SocialGraphServiceClient>> *_social_graph_client_pool;
+  UsernameCache *_username_cache;
 
+  void CacheRegisteredUser(const std::string &, int64_t, const RequestSpan &);
 };
 
 UserHandler::UserHandler(
@@ -131,17 +138,44 @@ UserHandler::UserHandler(
     const std::string &secret,
     ClientPool<MCClient> *mc_client_pool,
     mongoc_client_pool_t *mongodb_client_pool,
+    MongoBatchWriter *mongodb_writer,
     ClientPool<ThriftClient<ComposePostServiceClient>> *compose_client_pool,
-    ClientPool<ThriftClient<SocialGraphServiceClient>> *social_graph_client_pool
+    ClientPool<ThriftClient<SocialGraphServiceClient>> *social_graph_client_pool,
+    UsernameCache *username_cache
     ) {
   LOG(info) << "machine_id=" << machine_id;
   _thread_lock = thread_lock;
   _machine_id = machine_id;
   _mc_client_pool = mc_client_pool;
   _mongodb_client_pool = mongodb_client_pool;
+  _mongodb_writer = mongodb_writer;
   _compose_client_pool = compose_client_pool;
   _secret = secret;
   _social_graph_client_pool = social_graph_client_pool;
+  _username_cache = username_cache;
+}
+
+// Other replicas only see a new user through memcached until their filter
+// is reloaded, so publish the user_id there right away.
+void UserHandler::CacheRegisteredUser(const std::string &username,
+                                      int64_t user_id,
+                                      const RequestSpan &span) {
+  _username_cache->AddToFilter(username);
+  _username_cache->Insert(username, user_id);
+  auto mc_client = _mc_client_pool->Pop();
+  if (!mc_client) {
+    LOG_EVERY_MS(warning, 1000) << "Failed to pop a client from memcached pool";
+    return;
+  }
+  auto id_set_span = span.StartSpan("MmcSetUserId");
+  bool success = mc_client->Set(username+":user_id", std::to_string(user_id), 0, 0);
+  id_set_span.Finish();
+  if (!success) {
+    LOG(warning)
+      << "Failed to set the user_id of user "
+      << username << " to Memcached";
+  }
+  _mc_client_pool->Push(mc_client);
 }
 
 void UserHandler::RegisterUserWithId(
@@ -153,41 +187,26 @@ void UserHandler::RegisterUserWithId(
     const int64_t user_id,
     const std::map<std::string, std::string> &carrier) {
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "RegisterUserWithId",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("RegisterUserWithId", carrier, req_id);
 
   // Store user info into mongodb
-  mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-      _mongodb_client_pool);
-  if (!mongodb_client) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-    se.message = "Failed to pop a client from MongoDB pool";
-    throw se;
-  }
-  auto collection = mongoc_client_get_collection(
-      mongodb_client, "user", "user");
+  MongoClientLease mongodb_client(_mongodb_client_pool);
+  auto collection = mongodb_client.Collection("user", "user");
 
   // Check if the username has existed in the database
   bson_t *query = bson_new();
   BSON_APPEND_UTF8(query, "username", username.c_str());
+  auto find_span = span.StartSpan("MongoFindUser");
   mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
       collection, query, nullptr, nullptr);
   const bson_t *doc;
   bson_error_t error;
   bool found = mongoc_cursor_next(cursor, &doc);
+  find_span.Finish();
   if (mongoc_cursor_error (cursor, &error)) {
     LOG(warning) << error.message;
     bson_destroy(query);
     mongoc_cursor_destroy(cursor);
-    mongoc_collection_destroy(collection);
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
     ServiceException se;
     se.errorCode = ErrorCode::SE_MONGODB_ERROR;
     se.message = error.message;
@@ -199,8 +218,6 @@ void UserHandler::RegisterUserWithId(
     se.message = "User " + username + " already existed";
     bson_destroy(query);
     mongoc_cursor_destroy(cursor);
-    mongoc_collection_destroy(collection);
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
     throw se;
   } else {
     bson_t *new_doc = bson_new();
@@ -214,10 +231,13 @@ void UserHandler::RegisterUserWithId(
     BSON_APPEND_UTF8(new_doc, "password", password_hashed.c_str());
 
     bson_error_t error;
-    auto user_insert_span = opentracing::Tracer::Global()->StartSpan(
-        "MongoInsertUser", { opentracing::ChildOf(&span->context()) });
-    if (!mongoc_collection_insert_one(
-        collection, new_doc, nullptr, nullptr, &error)) {
+    auto user_insert_span = span.StartSpan("MongoInsertUser");
+    bool inserted = _mongodb_writer
+        ? _mongodb_writer->Insert(new_doc, &error)
+        : mongoc_collection_insert_one(
+              collection, new_doc, nullptr, nullptr, &error);
+    user_insert_span.Finish();
+    if (!inserted) {
       LOG(error) << "Failed to insert user " << username
                  << " to MongoDB: " << error.message;
       ServiceException se;
@@ -226,19 +246,16 @@ void UserHandler::RegisterUserWithId(
           + error.message;
       bson_destroy(query);
       mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
       throw se;
     } else {
       LOG(debug) << "User: " << username << " registered";
+      CacheRegisteredUser(username, user_id, span);
     }
-    user_insert_span->Finish();
     bson_destroy(new_doc);
   }
   bson_destroy(query);
   mongoc_cursor_destroy(cursor);
-  mongoc_collection_destroy(collection);
-  mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+  mongodb_client.Release();
 
   if(!found) {
     auto social_graph_client_wrapper = _social_graph_client_pool->Pop();
@@ -252,7 +269,7 @@ void UserHandler::RegisterUserWithId(
     {
       auto rpc_trace_guard = _social_graph_client_pool->StartRpcTrace("InsertUser", social_graph_client_wrapper);
       try {
-        social_graph_client->InsertUser(req_id, user_id, writer_text_map);
+        social_graph_client->InsertUser(req_id, user_id, span.carrier());
       } catch (...) {
         rpc_trace_guard->set_status(1);
         _social_graph_client_pool->Remove(social_graph_client_wrapper);
@@ -263,7 +280,7 @@ void UserHandler::RegisterUserWithId(
     _social_graph_client_pool->Push(social_graph_client_wrapper);
   }
   
-  span->Finish();
+  span.Finish();
 
 }
 
@@ -276,14 +293,7 @@ void UserHandler::RegisterUser(
     const std::map<std::string, std::string> &carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "RegisterUser",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("RegisterUser", carrier, req_id);
 
   // Compose user_id
   int64_t timestamp = duration_cast<milliseconds>(
@@ -317,31 +327,23 @@ void UserHandler::RegisterUser(
   LOG(debug) << "The user_id of the request " << req_id << " is " << user_id;
 
   // Store user info into mongodb
-  mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-      _mongodb_client_pool);
-  if (!mongodb_client) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-    se.message = "Failed to pop a client from MongoDB pool";
-    throw se;
-  }
-  auto collection = mongoc_client_get_collection(
-      mongodb_client, "user", "user");
+  MongoClientLease mongodb_client(_mongodb_client_pool);
+  auto collection = mongodb_client.Collection("user", "user");
 
   // Check if the username has existed in the database
   bson_t *query = bson_new();
   BSON_APPEND_UTF8(query, "username", username.c_str());
+  auto find_span = span.StartSpan("MongoFindUser");
   mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
       collection, query, nullptr, nullptr);
   const bson_t *doc;
   bson_error_t error;
   bool found = mongoc_cursor_next(cursor, &doc);
+  find_span.Finish();
   if (mongoc_cursor_error (cursor, &error)) {
     LOG(error) << error.message;
     bson_destroy(query);
     mongoc_cursor_destroy(cursor);
-    mongoc_collection_destroy(collection);
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
     ServiceException se;
     se.errorCode = ErrorCode::SE_MONGODB_ERROR;
     se.message = error.message;
@@ -353,8 +355,6 @@ void UserHandler::RegisterUser(
     se.message = "User " + username + " already existed";
     bson_destroy(query);
     mongoc_cursor_destroy(cursor);
-    mongoc_collection_destroy(collection);
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
     throw se;
   } else {
     bson_t *new_doc = bson_new();
@@ -367,10 +367,13 @@ void UserHandler::RegisterUser(
     std::string password_hashed = picosha2::hash256_hex_string(password + salt);
     BSON_APPEND_UTF8(new_doc, "password", password_hashed.c_str());
     
-    auto user_insert_span = opentracing::Tracer::Global()->StartSpan(
-        "MongoInsertUser", { opentracing::ChildOf(&span->context()) });
-    if (!mongoc_collection_insert_one(
-        collection, new_doc, nullptr, nullptr, &error)) {
+    auto user_insert_span = span.StartSpan("MongoInsertUser");
+    bool inserted = _mongodb_writer
+        ? _mongodb_writer->Insert(new_doc, &error)
+        : mongoc_collection_insert_one(
+              collection, new_doc, nullptr, nullptr, &error);
+    user_insert_span.Finish();
+    if (!inserted) {
       LOG(error) << "Failed to insert user " << username
           << " to MongoDB: " << error.message;
       ServiceException se;
@@ -379,19 +382,16 @@ void UserHandler::RegisterUser(
           + error.message;
       bson_destroy(query);
       mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
       throw se;
     } else {
       LOG(debug) << "User: " << username << " registered";
+      CacheRegisteredUser(username, user_id, span);
     }
-    user_insert_span->Finish();
     bson_destroy(new_doc);
   }
   bson_destroy(query);
   mongoc_cursor_destroy(cursor);
-  mongoc_collection_destroy(collection);
-  mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+  mongodb_client.Release();
 
   if(!found) {
     auto social_graph_client_wrapper = _social_graph_client_pool->Pop();
@@ -405,7 +405,7 @@ void UserHandler::RegisterUser(
     {
       auto rpc_trace_guard = _social_graph_client_pool->StartRpcTrace("InsertUser", social_graph_client_wrapper);
       try {
-        social_graph_client->InsertUser(req_id, user_id, writer_text_map);
+        social_graph_client->InsertUser(req_id, user_id, span.carrier());
       } catch (...) {
         rpc_trace_guard->set_status(1);
         _social_graph_client_pool->Remove(social_graph_client_wrapper);
@@ -417,7 +417,7 @@ void UserHandler::RegisterUser(
     _social_graph_client_pool->Push(social_graph_client_wrapper);
   }
 
-  span->Finish();
+  span.Finish();
 }
 
 void UserHandler::UploadCreatorWithUsername(
@@ -425,91 +425,93 @@ void UserHandler::UploadCreatorWithUsername(
     const std::string &username,
     const std::map<std::string, std::string> & carrier) {
 
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UploadUserWithUsername",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("UploadUserWithUsername", carrier, req_id);
 
   uint32_t memcached_flags;
 
-  auto mc_client = _mc_client_pool->Pop();
+  int64_t user_id = -1;
+  bool near_cached = false;
+  switch (_username_cache->Lookup(username, &user_id)) {
+    case UsernameCache::HIT:
+      near_cached = true;
+      break;
+    case UsernameCache::NOT_FOUND: {
+      ServiceException se;
+      se.errorCode = ErrorCode::SE_THRIFT_HANDLER_ERROR;
+      se.message = "User: " + username + " is not registered";
+      throw se;
+    }
+    case UsernameCache::MISS:
+      break;
+  }
+
+  MCClient *mc_client = nullptr;
   std::string user_id_mmc;
   bool user_id_mmc_found = false;
-  if (mc_client) {
-    auto id_get_span = opentracing::Tracer::Global()->StartSpan(
-        "MmcGetUserId", { opentracing::ChildOf(&span->context()) });
-    bool success = mc_client->Get(username+":user_id", &user_id_mmc_found, &user_id_mmc, &memcached_flags);
-    id_get_span->Finish();
-    if (!success) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
+  if (!near_cached) {
+    mc_client = _mc_client_pool->Pop();
+    if (mc_client) {
+      auto id_get_span = span.StartSpan("MmcGetUserId");
+      bool success = mc_client->Get(username+":user_id", &user_id_mmc_found, &user_id_mmc, &memcached_flags);
+      id_get_span.Finish();
+      if (!success) {
+        ServiceException se;
+        se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
+        _mc_client_pool->Push(mc_client);
+        throw se;
+      }
       _mc_client_pool->Push(mc_client);
-      throw se;
+    } else {
+      LOG_EVERY_MS(warning, 1000) << "Failed to pop a client from memcached pool";
     }
-    _mc_client_pool->Push(mc_client);
-  } else {
-    LOG(warning) << "Failed to pop a client from memcached pool";
   }
 
-  int64_t user_id = -1;
   bool cached = false;
-  if (user_id_mmc_found) {
+  if (near_cached) {
+    cached = true;
+  } else if (user_id_mmc_found) {
     cached = true;
     LOG(debug) << "Found user_id of username :" << username  << " in Memcached";
     user_id = std::stoul(user_id_mmc.c_str());
+    _username_cache->Insert(username, user_id);
   }
 
   // If not cached in memcached
   else {
     LOG(debug) << "user_id not cached in Memcached";
-    mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-        _mongodb_client_pool);
-    if (!mongodb_client) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to pop a client from MongoDB pool";
-      throw se;
-    }
-    auto collection = mongoc_client_get_collection(
-        mongodb_client, "user", "user");
-    if (!collection) {
+    if (!_username_cache->MayExist(username)) {
+      _username_cache->InsertNotFound(username);
       ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to create collection user from DB user";
+      se.errorCode = ErrorCode::SE_THRIFT_HANDLER_ERROR;
+      se.message = "User: " + username + " is not registered";
       throw se;
     }
+    MongoClientLease mongodb_client(_mongodb_client_pool);
+    auto collection = mongodb_client.Collection("user", "user");
     bson_t *query = bson_new();
     BSON_APPEND_UTF8(query, "username", username.c_str());
 
-    auto find_span = opentracing::Tracer::Global()->StartSpan(
-        "MongoFindUser", { opentracing::ChildOf(&span->context()) });
+    auto find_span = span.StartSpan("MongoFindUser");
     mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
         collection, query, nullptr, nullptr);
     const bson_t *doc;
     bool found = mongoc_cursor_next(cursor, &doc);
-    find_span->Finish();
+    find_span.Finish();
     if (!found) {
       bson_error_t error;
       if (mongoc_cursor_error (cursor, &error)) {
         LOG(error) << error.message;
         bson_destroy(query);
         mongoc_cursor_destroy(cursor);
-        mongoc_collection_destroy(collection);
-        mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
         ServiceException se;
         se.errorCode = ErrorCode::SE_MONGODB_ERROR;
         se.message = error.message;
         throw se;
       } else {
         LOG(warning) << "User: " << username << " doesn't exist in MongoDB";
+        _username_cache->InsertNotFound(username);
         bson_destroy(query);
         mongoc_cursor_destroy(cursor);
-        mongoc_collection_destroy(collection);
-        mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
         ServiceException se;
         se.errorCode = ErrorCode::SE_THRIFT_HANDLER_ERROR;
         se.message = "User: " + username + " is not registered";
@@ -520,13 +522,12 @@ void UserHandler::UploadCreatorWithUsername(
       bson_iter_t iter;
       if (bson_iter_init_find(&iter, doc, "user_id")) {
         user_id = bson_iter_value(&iter)->value.v_int64;
+        _username_cache->Insert(username, user_id);
       } else {
         LOG(error) << "user_id attribute of user "
                    << username <<" was not found in the User object";
         bson_destroy(query);
         mongoc_cursor_destroy(cursor);
-        mongoc_collection_destroy(collection);
-        mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
         ServiceException se;
         se.errorCode = ErrorCode::SE_THRIFT_HANDLER_ERROR;
         se.message = "user_id attribute of user: " + username +
@@ -536,8 +537,7 @@ void UserHandler::UploadCreatorWithUsername(
     }
     bson_destroy(query);
     mongoc_cursor_destroy(cursor);
-    mongoc_collection_destroy(collection);
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+    mongodb_client.Release();
   }
 
   Creator creator;
@@ -556,7 +556,7 @@ void UserHandler::UploadCreatorWithUsername(
     {
       auto rpc_trace_guard = _compose_client_pool->StartRpcTrace("UploadCreator", compose_post_client_wrapper);
       try {
-        compose_post_client->UploadCreator(req_id, creator, writer_text_map);
+        compose_post_client->UploadCreator(req_id, creator, span.carrier());
       } catch (...) {
         rpc_trace_guard->set_status(1);
         _compose_client_pool->Remove(compose_post_client_wrapper);
@@ -571,11 +571,10 @@ void UserHandler::UploadCreatorWithUsername(
   mc_client = _mc_client_pool->Pop();
   if (mc_client) {
     if (user_id != -1 && !cached) {
-      auto id_set_span = opentracing::Tracer::Global()->StartSpan(
-          "MmcSetUserId", { opentracing::ChildOf(&span->context()) });
+      auto id_set_span = span.StartSpan("MmcSetUserId");
       std::string user_id_str = std::to_string(user_id);
       bool success = mc_client->Set(username+":user_id", user_id_str, 0, 0);
-      id_set_span->Finish();
+      id_set_span.Finish();
       if (!success) {
         LOG(warning)
           << "Failed to set the user_id of user "
@@ -584,9 +583,9 @@ void UserHandler::UploadCreatorWithUsername(
     }
     _mc_client_pool->Push(mc_client);
   } else {
-    LOG(warning) << "Failed to pop a client from memcached pool";
+    LOG_EVERY_MS(warning, 1000) << "Failed to pop a client from memcached pool";
   }
-  span->Finish();
+  span.Finish();
 }
 
 void UserHandler::UploadCreatorWithUserId(
@@ -595,14 +594,7 @@ void UserHandler::UploadCreatorWithUserId(
     const std::string &username,
     const std::map<std::string, std::string> &carrier) {
 
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "UploadUserWithUserId",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("UploadUserWithUserId", carrier, req_id);
 
   Creator creator;
   creator.username = username;
@@ -619,7 +611,7 @@ void UserHandler::UploadCreatorWithUserId(
   {
     auto rpc_trace_guard = _compose_client_pool->StartRpcTrace("UploadCreator", compose_post_client_wrapper);
     try {
-      compose_post_client->UploadCreator(req_id, creator, writer_text_map);
+      compose_post_client->UploadCreator(req_id, creator, span.carrier());
     } catch (...) {
       rpc_trace_guard->set_status(1);
       _compose_client_pool->Remove(compose_post_client_wrapper);
@@ -630,7 +622,7 @@ void UserHandler::UploadCreatorWithUserId(
 
   _compose_client_pool->Push(compose_post_client_wrapper);
 
-  span->Finish();
+  span.Finish();
 
 }
 
@@ -642,14 +634,7 @@ void UserHandler::Login(
     const std::string &password,
     const std::map<std::string, std::string> &carrier) {
 
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "Login",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("Login", carrier, req_id);
 
   uint32_t memcached_flags;
 
@@ -657,12 +642,11 @@ void UserHandler::Login(
   std::string login_mmc;
   bool login_mmc_found = false;
   if (!mc_client) {
-    LOG(warning) << "Failed to pop a client from memcached pool";
+    LOG_EVERY_MS(warning, 1000) << "Failed to pop a client from memcached pool";
   } else {
-    auto get_login_span = opentracing::Tracer::Global()->StartSpan(
-        "MmcGetLogin", { opentracing::ChildOf(&span->context()) });
+    auto get_login_span = span.StartSpan("MmcGetLogin");
     bool success = mc_client->Get(username+":login", &login_mmc_found, &login_mmc, &memcached_flags);
-    get_login_span->Finish();
+    get_login_span.Finish();
     if (!success) {
       LOG(warning) << "Memcached error";
     }
@@ -689,40 +673,23 @@ void UserHandler::Login(
     // If not cached in memcached
     LOG(debug) << "Username: " << username << " NOT cached in Memcached";
 
-    mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-        _mongodb_client_pool);
-    if (!mongodb_client) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to pop a client from MongoDB pool";
-      throw se;
-    }
-    auto collection = mongoc_client_get_collection(
-        mongodb_client, "user", "user");
-    if (!collection) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to create collection user from DB user";
-      throw se;
-    }
+    MongoClientLease mongodb_client(_mongodb_client_pool);
+    auto collection = mongodb_client.Collection("user", "user");
     bson_t *query = bson_new();
     BSON_APPEND_UTF8(query, "username", username.c_str());
 
-    auto find_span = opentracing::Tracer::Global()->StartSpan(
-        "MongoFindUser", {opentracing::ChildOf(&span->context())});
+    auto find_span = span.StartSpan("MongoFindUser");
     mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
         collection, query, nullptr, nullptr);
     const bson_t *doc;
     bool found = mongoc_cursor_next(cursor, &doc);
-    find_span->Finish();
+    find_span.Finish();
 
     bson_error_t error;
     if (mongoc_cursor_error(cursor, &error)) {
       LOG(error) << error.message;
       bson_destroy(query);
       mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
       ServiceException se;
       se.errorCode = ErrorCode::SE_MONGODB_ERROR;
       se.message = error.message;
@@ -733,8 +700,6 @@ void UserHandler::Login(
       LOG(warning) << "User: " << username << " doesn't exist in MongoDB";
       bson_destroy(query);
       mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
       ServiceException se;
       se.errorCode = ErrorCode::SE_UNAUTHORIZED;
       se.message = "User: " + username + " is not registered";
@@ -758,8 +723,6 @@ void UserHandler::Login(
         LOG(error) << "user: " << username << " entry is NOT complete";
         bson_destroy(query);
         mongoc_cursor_destroy(cursor);
-        mongoc_collection_destroy(collection);
-        mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
         ServiceException se;
         se.errorCode = ErrorCode::SE_THRIFT_HANDLER_ERROR;
         se.message = "user: " + username + " entry is NOT complete";
@@ -767,8 +730,7 @@ void UserHandler::Login(
       }
       bson_destroy(query);
       mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+      mongodb_client.Release();
     }
   }
 
@@ -808,13 +770,12 @@ void UserHandler::Login(
   if (!cached) {
     mc_client = _mc_client_pool->Pop();
     if (!mc_client) {
-      LOG(warning) << "Failed to pop a client from memcached pool";
+      LOG_EVERY_MS(warning, 1000) << "Failed to pop a client from memcached pool";
     } else {
-      auto set_login_span = opentracing::Tracer::Global()->StartSpan(
-          "MmcSetLogin", { opentracing::ChildOf(&span->context()) });
+      auto set_login_span = span.StartSpan("MmcSetLogin");
       std::string login_str = login_json.dump();
       bool success = mc_client->Set(username+":login", login_str, 0, 0);
-      set_login_span->Finish();
+      set_login_span.Finish();
       if (!success) {
         LOG(warning)
           << "Failed to set the login info of user "
@@ -823,95 +784,97 @@ void UserHandler::Login(
       _mc_client_pool->Push(mc_client);
     }
   }
-  span->Finish();
+  span.Finish();
 }
 int64_t UserHandler::GetUserId(
     int64_t req_id,
     const std::string &username,
     const std::map<std::string, std::string> &carrier) {
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "GetUserId",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("GetUserId", carrier, req_id);
 
   uint32_t memcached_flags;
 
-  auto mc_client = _mc_client_pool->Pop();
+  int64_t user_id = -1;
+  bool near_cached = false;
+  switch (_username_cache->Lookup(username, &user_id)) {
+    case UsernameCache::HIT:
+      near_cached = true;
+      break;
+    case UsernameCache::NOT_FOUND: {
+      ServiceException se;
+      se.errorCode = ErrorCode::SE_THRIFT_HANDLER_ERROR;
+      se.message = "User: " + username + " is not registered";
+      throw se;
+    }
+    case UsernameCache::MISS:
+      break;
+  }
+
+  MCClient *mc_client = nullptr;
   std::string user_id_mmc;
   bool user_id_mmc_found = false;
-  if (mc_client) {
-    auto id_get_span = opentracing::Tracer::Global()->StartSpan(
-        "MmcGetUserId", { opentracing::ChildOf(&span->context()) });
-    bool success = mc_client->Get(username+":user_id", &user_id_mmc_found, &user_id_mmc, &memcached_flags);
-    id_get_span->Finish();
-    if (!success) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
+  if (!near_cached) {
+    mc_client = _mc_client_pool->Pop();
+    if (mc_client) {
+      auto id_get_span = span.StartSpan("MmcGetUserId");
+      bool success = mc_client->Get(username+":user_id", &user_id_mmc_found, &user_id_mmc, &memcached_flags);
+      id_get_span.Finish();
+      if (!success) {
+        ServiceException se;
+        se.errorCode = ErrorCode::SE_MEMCACHED_ERROR;
+        _mc_client_pool->Push(mc_client);
+        throw se;
+      }
       _mc_client_pool->Push(mc_client);
-      throw se;
+    } else {
+      LOG_EVERY_MS(warning, 1000) << "Failed to pop a client from memcached pool";
     }
-    _mc_client_pool->Push(mc_client);
-  } else {
-    LOG(warning) << "Failed to pop a client from memcached pool";
   }
 
-  int64_t user_id = -1;
   bool cached = false;
-  if (user_id_mmc_found) {
+  if (near_cached) {
+    cached = true;
+  } else if (user_id_mmc_found) {
     cached = true;
     LOG(debug) << "Found user_id of username :" << username  << " in Memcached";
     user_id = std::stoul(user_id_mmc.c_str());
+    _username_cache->Insert(username, user_id);
   } else {
     // If not cached in memcached
     LOG(debug) << "user_id not cached in Memcached";
-    mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-        _mongodb_client_pool);
-    if (!mongodb_client) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to pop a client from MongoDB pool";
-      throw se;
-    }
-    auto collection = mongoc_client_get_collection(
-        mongodb_client, "user", "user");
-    if (!collection) {
+    if (!_username_cache->MayExist(username)) {
+      _username_cache->InsertNotFound(username);
       ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to create collection user from DB user";
+      se.errorCode = ErrorCode::SE_THRIFT_HANDLER_ERROR;
+      se.message = "User: " + username + " is not registered";
       throw se;
     }
+    MongoClientLease mongodb_client(_mongodb_client_pool);
+    auto collection = mongodb_client.Collection("user", "user");
     bson_t *query = bson_new();
     BSON_APPEND_UTF8(query, "username", username.c_str());
 
-    auto find_span = opentracing::Tracer::Global()->StartSpan(
-        "MongoFindUser", { opentracing::ChildOf(&span->context()) });
+    auto find_span = span.StartSpan("MongoFindUser");
     mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
         collection, query, nullptr, nullptr);
     const bson_t *doc;
     bool found = mongoc_cursor_next(cursor, &doc);
-    find_span->Finish();
+    find_span.Finish();
     if (!found) {
       bson_error_t error;
       if (mongoc_cursor_error (cursor, &error)) {
         LOG(error) << error.message;
         bson_destroy(query);
         mongoc_cursor_destroy(cursor);
-        mongoc_collection_destroy(collection);
-        mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
         ServiceException se;
         se.errorCode = ErrorCode::SE_MONGODB_ERROR;
         se.message = error.message;
         throw se;
       } else {
         LOG(warning) << "User: " << username << " doesn't exist in MongoDB";
+        _username_cache->InsertNotFound(username);
         bson_destroy(query);
         mongoc_cursor_destroy(cursor);
-        mongoc_collection_destroy(collection);
-        mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
         ServiceException se;
         se.errorCode = ErrorCode::SE_THRIFT_HANDLER_ERROR;
         se.message = "User: " + username + " is not registered";
@@ -922,13 +885,12 @@ int64_t UserHandler::GetUserId(
       bson_iter_t iter;
       if (bson_iter_init_find(&iter, doc, "user_id")) {
         user_id = bson_iter_value(&iter)->value.v_int64;
+        _username_cache->Insert(username, user_id);
       } else {
         LOG(error) << "user_id attribute of user "
                    << username <<" was not found in the User object";
         bson_destroy(query);
         mongoc_cursor_destroy(cursor);
-        mongoc_collection_destroy(collection);
-        mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
         ServiceException se;
         se.errorCode = ErrorCode::SE_THRIFT_HANDLER_ERROR;
         se.message = "user_id attribute of user: " + username +
@@ -938,20 +900,18 @@ int64_t UserHandler::GetUserId(
     }
     bson_destroy(query);
     mongoc_cursor_destroy(cursor);
-    mongoc_collection_destroy(collection);
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+    mongodb_client.Release();
   }
 
   if (!cached) {
     mc_client = _mc_client_pool->Pop();
     if (!mc_client) {
-      LOG(warning) << "Failed to pop a client from memcached pool";
+      LOG_EVERY_MS(warning, 1000) << "Failed to pop a client from memcached pool";
     } else {
       std::string user_id_str = std::to_string(user_id);
-      auto set_login_span = opentracing::Tracer::Global()->StartSpan(
-          "MmcSetUserId", { opentracing::ChildOf(&span->context()) });
+      auto set_login_span = span.StartSpan("MmcSetUserId");
       bool success = mc_client->Set(username+":user_id", user_id_str, 0, 0);
-      set_login_span->Finish();
+      set_login_span.Finish();
       if (!success) {
         LOG(warning)
           << "Failed to set the login info of user "
@@ -961,7 +921,7 @@ int64_t UserHandler::GetUserId(
     }
   }
 
-  span->Finish();
+  span.Finish();
   return user_id;
 }
 
@@ -12,10 +12,12 @@ static mongoc_client_pool_t *mongodb_client_pool;
 static ClientPool<MCClient>* mc_client_pool;
 static std::string machine_id;
 static std::mutex* thread_lock;
+static UsernameCache* username_cache;
+static MongoBatchWriter* mongodb_writer;
 
 int faas_init() {
     init_logger();
-    SetUpTracer("config/jaeger-config.yml", "post-storage-service");
+    SetUpTracer("config/jaeger-config.yml", "user-service");
 
     if (load_config(&config_json) != 0) {
         return -1;
@@ -23,6 +25,8 @@ int faas_init() {
 
   std::string mc_addr = config_json["user-memcached"]["addr"];
   int mc_port = config_json["user-memcached"]["port"];
+  MCClient::SharedConnections() =
+      config_json["user-memcached"].value("shared_connections", 0);
   mc_client_pool = new ClientPool<MCClient>("user-memcached", mc_addr, mc_port, 1, 128, 1000);
   mongodb_client_pool = init_mongodb_client_pool(config_json, "user", 128);
 
@@ -59,6 +63,19 @@ int faas_init() {
   }
   mongoc_client_pool_push(mongodb_client_pool, mongodb_client);
 
+  auto& service_config = config_json["user-service"];
+  username_cache = new UsernameCache(
+      service_config.value("username_cache_size", 0),
+      service_config.value("username_negative_ttl_ms", 5000));
+  int bloom_refresh_s = service_config.value("username_bloom_refresh_s", 0);
+  if (bloom_refresh_s > 0) {
+    StartUsernameFilterRefresh(username_cache, mongodb_client_pool,
+                               bloom_refresh_s);
+  }
+
+  mongodb_writer = init_mongodb_batch_writer(
+      config_json, "user", mongodb_client_pool, "user", "user");
+
     return 0;
 }
 
@@ -93,8 +110,10 @@ int faas_create_func_worker(void* caller_context,
               secret,
               mc_client_pool,
               mongodb_client_pool,
+              mongodb_writer,
               compose_post_client_pool,
-              social_graph_client_pool)));
+              social_graph_client_pool,
+              username_cache)));
     *worker_handle = faas_worker;
     return 0;
 }
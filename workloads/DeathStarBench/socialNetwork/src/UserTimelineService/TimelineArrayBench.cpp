@@ -0,0 +1,143 @@
+// Cost of reading the {post_id, timestamp} array of a user-timeline document
+// on one core, for 10, 100 and 1000 entries, through ReadBsonIdTimestampArray
+// and through the per-entry bson_iter_find_descendant lookups it replaced:
+//
+//   TimelineArrayBench [seconds] [cpu]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <sched.h>
+
+#include <bson/bson.h>
+
+#include "../utils_bson.h"
+
+using namespace social_network;
+
+static std::atomic<uint64_t> num_allocs{0};
+
+void *operator new(size_t size) {
+  num_allocs.fetch_add(1, std::memory_order_relaxed);
+  if (void *ptr = malloc(size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+  free(ptr);
+}
+
+size_t FindDescendant(const bson_t *doc, std::vector<int64_t> *post_ids,
+                      std::vector<int64_t> *timestamps) {
+  bson_iter_t iter_0;
+  bson_iter_t iter_1;
+  bson_iter_t post_id_child;
+  bson_iter_t timestamp_child;
+  int idx = 0;
+  bson_iter_init(&iter_0, doc);
+  bson_iter_init(&iter_1, doc);
+  while (bson_iter_find_descendant(
+             &iter_0, ("posts." + std::to_string(idx) + ".post_id").c_str(),
+             &post_id_child) &&
+         BSON_ITER_HOLDS_INT64(&post_id_child) &&
+         bson_iter_find_descendant(
+             &iter_1, ("posts." + std::to_string(idx) + ".timestamp").c_str(),
+             &timestamp_child) &&
+         BSON_ITER_HOLDS_INT64(&timestamp_child)) {
+    post_ids->emplace_back(bson_iter_int64(&post_id_child));
+    timestamps->emplace_back(bson_iter_int64(&timestamp_child));
+    bson_iter_init(&iter_0, doc);
+    bson_iter_init(&iter_1, doc);
+    idx++;
+  }
+  return idx;
+}
+
+size_t Streaming(const bson_t *doc, std::vector<int64_t> *post_ids,
+                 std::vector<int64_t> *timestamps) {
+  return ReadBsonIdTimestampArray(doc, "posts", "post_id", post_ids,
+                                  timestamps);
+}
+
+void Run(const char *name,
+         size_t (*read)(const bson_t *, std::vector<int64_t> *,
+                        std::vector<int64_t> *),
+         const bson_t *doc, size_t num_entries, double seconds) {
+  uint64_t sum = 0;
+  uint64_t num_docs = 0;
+  uint64_t allocs_before = num_allocs.load();
+  auto start = std::chrono::steady_clock::now();
+  auto deadline = start + std::chrono::duration<double>(seconds);
+  while (std::chrono::steady_clock::now() < deadline) {
+    std::vector<int64_t> post_ids;
+    std::vector<int64_t> timestamps;
+    if (read(doc, &post_ids, &timestamps) != num_entries) {
+      fprintf(stderr, "Failed to read %zu entries\n", num_entries);
+      exit(EXIT_FAILURE);
+    }
+    sum += post_ids.back() ^ timestamps.back();
+    num_docs++;
+  }
+  double elapsed = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+  printf("%4zu entries %-10s %10.0f ns/doc %8.1f ns/entry %8.2f allocs/doc"
+         " (checksum %llx)\n",
+         num_entries, name, elapsed * 1e9 / num_docs,
+         elapsed * 1e9 / num_docs / num_entries,
+         static_cast<double>(num_allocs.load() - allocs_before) / num_docs,
+         static_cast<unsigned long long>(sum));
+}
+
+int main(int argc, char *argv[]) {
+  double seconds = argc > 1 ? atof(argv[1]) : 2.0;
+  int cpu = argc > 2 ? atoi(argv[2]) : 0;
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+    perror("sched_setaffinity");
+  }
+
+  for (size_t num_entries : {10, 100, 1000}) {
+    // Laid out like UserTimelineHandler's documents, newest post first
+    bson_t *doc = bson_new();
+    BSON_APPEND_INT64(doc, "user_id", 7);
+    bson_t posts;
+    bson_append_array_begin(doc, "posts", -1, &posts);
+    for (size_t i = 0; i < num_entries; i++) {
+      const char *key;
+      char buf[16];
+      bson_uint32_to_string(i, &key, buf, sizeof(buf));
+      bson_t post;
+      bson_append_document_begin(&posts, key, -1, &post);
+      BSON_APPEND_INT64(&post, "post_id", 1000000000000 + i);
+      BSON_APPEND_INT64(&post, "timestamp", 1600000000000 - i);
+      bson_append_document_end(&posts, &post);
+    }
+    bson_append_array_end(doc, &posts);
+
+    std::vector<int64_t> post_ids, streamed_post_ids;
+    std::vector<int64_t> timestamps, streamed_timestamps;
+    if (FindDescendant(doc, &post_ids, &timestamps) != num_entries ||
+        Streaming(doc, &streamed_post_ids, &streamed_timestamps) !=
+            num_entries ||
+        post_ids != streamed_post_ids || timestamps != streamed_timestamps) {
+      fprintf(stderr, "The two readers disagree on %zu entries\n",
+              num_entries);
+      return EXIT_FAILURE;
+    }
+
+    Run("streaming", Streaming, doc, num_entries, seconds);
+    Run("descendant", FindDescendant, doc, num_entries, seconds);
+    bson_destroy(doc);
+  }
+  return 0;
+}
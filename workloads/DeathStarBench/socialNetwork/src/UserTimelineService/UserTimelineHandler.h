@@ -13,8 +13,11 @@
 #include "../logger.h"
 #include "../tracing.h"
 #include "../ClientPool.h"
+#include "../FanOut.h"
 #include "../RedisClient.h"
 #include "../ThriftClient.h"
+#include "../TimelineBuckets.h"
+#include "../utils_mongodb.h"
 
 namespace social_network {
 
@@ -23,7 +26,9 @@ class UserTimelineHandler : public UserTimelineServiceIf {
   UserTimelineHandler(
       ClientPool<RedisClient> *,
       mongoc_client_pool_t *,
-      ClientPool<ThriftClient<PostStorageServiceClient>> *);
+      ClientPool<ThriftClient<PostStorageServiceClient>> *,
+      MongoBatchWriter *,
+      int bucket_size);
   ~UserTimelineHandler() override = default;
 
   void WriteUserTimeline(int64_t req_id, int64_t post_id, int64_t user_id,
@@ -37,15 +42,21 @@ class UserTimelineHandler : public UserTimelineServiceIf {
   ClientPool<RedisClient> *_redis_client_pool;
   mongoc_client_pool_t *_mongodb_client_pool;
   ClientPool<ThriftClient<PostStorageServiceClient>> *_post_client_pool;
+  MongoBatchWriter *_mongodb_writer;
+  int _bucket_size;
 };
 
 UserTimelineHandler::UserTimelineHandler(
     ClientPool<RedisClient> *redis_pool,
     mongoc_client_pool_t *mongodb_pool,
-    ClientPool<ThriftClient<PostStorageServiceClient>> *post_client_pool) {
+    ClientPool<ThriftClient<PostStorageServiceClient>> *post_client_pool,
+    MongoBatchWriter *mongodb_writer,
+    int bucket_size) {
   _redis_client_pool = redis_pool;
   _mongodb_client_pool = mongodb_pool;
   _post_client_pool = post_client_pool;
+  _mongodb_writer = mongodb_writer;
+  _bucket_size = bucket_size;
 }
 
 void UserTimelineHandler::WriteUserTimeline(
@@ -56,109 +67,28 @@ void UserTimelineHandler::WriteUserTimeline(
     const std::map<std::string, std::string> &carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "WriteUserTimeline",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
-
-  mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-      _mongodb_client_pool);
-  if (!mongodb_client) {
-    ServiceException se;
-    se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-    se.message = "Failed to pop a client from MongoDB pool";
-    throw se;
-  }
-  auto collection = mongoc_client_get_collection(
-      mongodb_client, "user-timeline", "user-timeline");
-  if (!collection) {
+  RequestSpan span("WriteUserTimeline", carrier, req_id);
+
+  MongoClientLease mongodb_client(_mongodb_client_pool);
+  auto collection = mongodb_client.Collection(
+      "user-timeline", "user-timeline-bucket");
+  bson_t *owner = BCON_NEW("user_id", BCON_INT64(user_id));
+  bson_error_t error;
+  auto update_span = span.StartSpan("MongoInsert");
+  bool updated = AppendToTimelineBucket(
+      collection, _mongodb_writer, owner, "posts", "post_id", post_id, timestamp,
+      _bucket_size, &error);
+  update_span.Finish();
+  bson_destroy(owner);
+  mongodb_client.Release();
+  if (!updated) {
+    LOG(error) << "Failed to update user-timeline for user " << user_id
+               << " to MongoDB: " << error.message;
     ServiceException se;
     se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-    se.message = "Failed to create collection user-timeline from MongoDB";
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
+    se.message = error.message;
     throw se;
   }
-  bson_t *query = bson_new();
-
-  BSON_APPEND_INT64(query, "user_id", user_id);
-  auto find_span = opentracing::Tracer::Global()->StartSpan(
-      "MongoFindUser", {opentracing::ChildOf(&span->context())});
-  mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
-      collection, query, nullptr, nullptr);
-  const bson_t *doc;
-  bool found = mongoc_cursor_next(cursor, &doc);
-  if (!found) {
-    bson_t *new_doc = BCON_NEW(
-        "user_id", BCON_INT64(user_id),
-        "posts",
-        "[", "{", "post_id", BCON_INT64(post_id),
-        "timestamp", BCON_INT64(timestamp), "}", "]"
-    );
-    bson_error_t error;
-    auto insert_span = opentracing::Tracer::Global()->StartSpan(
-        "MongoInsert", {opentracing::ChildOf(&span->context())});
-    bool inserted = mongoc_collection_insert_one(
-        collection, new_doc, nullptr, nullptr, &error);
-    insert_span->Finish();
-    if (!inserted) {
-      LOG(error) << "Failed to insert user timeline user " << user_id
-                 << " to MongoDB: " << error.message;
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = error.message;
-      bson_destroy(new_doc);
-      bson_destroy(query);
-      mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-      throw se;
-    }
-    bson_destroy(new_doc);
-  } else {
-    bson_t *update = BCON_NEW(
-        "$push", "{",
-            "posts", "{",
-                "$each", "[", "{",
-                    "post_id", BCON_INT64(post_id),
-                    "timestamp", BCON_INT64(timestamp),
-                "}", "]",
-                "$position", BCON_INT32(0),
-            "}",
-        "}"
-    );
-    bson_error_t error;
-    bson_t reply;
-    auto update_span = opentracing::Tracer::Global()->StartSpan(
-        "MongoInsert", {opentracing::ChildOf(&span->context())});
-    bool updated = mongoc_collection_find_and_modify(
-        collection, query, nullptr, update, nullptr, false, false,
-        true, &reply, &error);
-    update_span->Finish();
-    if (!updated) {
-      LOG(error) << "Failed to update user-timeline for user " << user_id
-                 << " to MongoDB: " << error.message;
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = error.message;
-      bson_destroy(update);
-      bson_destroy(query);
-      bson_destroy(&reply);
-      mongoc_cursor_destroy(cursor);
-      mongoc_collection_destroy(collection);
-      mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
-      throw se;
-    }
-    bson_destroy(update);
-    bson_destroy(&reply);
-  }
-  bson_destroy(query);
-  mongoc_cursor_destroy(cursor);
-  mongoc_collection_destroy(collection);
-  mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
 
   auto redis_client_wrapper = _redis_client_pool->Pop();
   if (!redis_client_wrapper) {
@@ -168,8 +98,7 @@ void UserTimelineHandler::WriteUserTimeline(
     throw se;
   }
   auto redis_client = redis_client_wrapper->GetClient();
-  auto redis_span = opentracing::Tracer::Global()->StartSpan(
-      "RedisUpdate", {opentracing::ChildOf(&span->context())});
+  auto redis_span = span.StartSpan("RedisUpdate");
   redis_client.AppendCommand("ZCARD %" PRId64, user_id);
   auto num_posts_reply = redis_client.GetReply();
   std::vector<std::string> options{"NX"};
@@ -180,8 +109,8 @@ void UserTimelineHandler::WriteUserTimeline(
     zadd_reply->check_ok();
   }
   _redis_client_pool->Push(redis_client_wrapper);
-  redis_span->Finish();
-  span->Finish();
+  redis_span.Finish();
+  span.Finish();
 
 }
 void UserTimelineHandler::ReadUserTimeline(
@@ -193,14 +122,7 @@ void UserTimelineHandler::ReadUserTimeline(
     const std::map<std::string, std::string> &carrier) {
 
   // Initialize a span
-  TextMapReader reader(carrier);
-  std::map<std::string, std::string> writer_text_map;
-  TextMapWriter writer(writer_text_map);
-  auto parent_span = opentracing::Tracer::Global()->Extract(reader);
-  auto span = opentracing::Tracer::Global()->StartSpan(
-      "ReadUserTimeline",
-      { opentracing::ChildOf(parent_span->get()) });
-  opentracing::Tracer::Global()->Inject(span->context(), writer);
+  RequestSpan span("ReadUserTimeline", carrier, req_id);
 
   if (stop <= start || start < 0) {
     return;
@@ -214,8 +136,7 @@ void UserTimelineHandler::ReadUserTimeline(
     throw se;
   }
   auto redis_client = redis_client_wrapper->GetClient();
-  auto redis_span = opentracing::Tracer::Global()->StartSpan(
-      "RedisFind", {opentracing::ChildOf(&span->context())});
+  auto redis_span = span.StartSpan("RedisFind");
 
   redis_client.AppendCommand("ZREVRANGE %" PRId64 " %d %d", user_id, start, stop - 1);
   auto post_ids_reply = redis_client.GetReply();
@@ -226,84 +147,48 @@ void UserTimelineHandler::ReadUserTimeline(
   }
 
   _redis_client_pool->Push(redis_client_wrapper);
-  redis_span->Finish();
+  redis_span.Finish();
 
   int mongo_start = start + post_ids.size();
   std::multimap<std::string, std::string> redis_update_map;
   if (mongo_start < stop) {
     // Instead find post_ids from mongodb
-    mongoc_client_t *mongodb_client = mongoc_client_pool_pop(
-        _mongodb_client_pool);
-    if (!mongodb_client) {
-      ServiceException se;
-      se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to pop a client from MongoDB pool";
-      throw se;
-    }
-    auto collection = mongoc_client_get_collection(
-        mongodb_client, "user-timeline", "user-timeline");
-    if (!collection) {
+    MongoClientLease mongodb_client(_mongodb_client_pool);
+    auto collection = mongodb_client.Collection(
+        "user-timeline", "user-timeline-bucket");
+
+    bson_t *owner = BCON_NEW("user_id", BCON_INT64(user_id));
+    std::vector<int64_t> mongo_post_ids;
+    std::vector<int64_t> mongo_timestamps;
+    bson_error_t error;
+    auto find_span = span.StartSpan("MongoFindUserTimeline");
+    bool read = ReadTimelineBuckets(collection, owner, "posts", "post_id",
+                                    stop, _bucket_size, &mongo_post_ids,
+                                    &mongo_timestamps, &error);
+    find_span.Finish();
+    bson_destroy(owner);
+    mongodb_client.Release();
+    if (!read) {
+      LOG(error) << "Failed to read user-timeline for user " << user_id
+                 << " from MongoDB: " << error.message;
       ServiceException se;
       se.errorCode = ErrorCode::SE_MONGODB_ERROR;
-      se.message = "Failed to create collection user-timeline from MongoDB";
+      se.message = error.message;
       throw se;
     }
-
-    bson_t *query = BCON_NEW("user_id", BCON_INT64(user_id));
-    bson_t *opts = BCON_NEW(
-        "projection", "{",
-            "posts", "{",
-                "$slice", "[",
-                    BCON_INT32(0), BCON_INT32(stop),
-                "]",
-            "}",
-        "}");
-
-    auto find_span = opentracing::Tracer::Global()->StartSpan(
-        "MongoFindUserTimeline", { opentracing::ChildOf(&span->context()) });
-    mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
-        collection, query, opts, nullptr);
-    find_span->Finish();
-    const bson_t *doc;
-    bool found = mongoc_cursor_next(cursor, &doc);
-    if (found) {
-      bson_iter_t iter_0;
-      bson_iter_t iter_1;
-      bson_iter_t post_id_child;
-      bson_iter_t timestamp_child;
-      int idx = 0;
-      bson_iter_init(&iter_0, doc);
-      bson_iter_init(&iter_1, doc);
-      while (bson_iter_find_descendant(&iter_0,
-              ("posts." + std::to_string(idx) + ".post_id").c_str(),
-              &post_id_child)
-          && BSON_ITER_HOLDS_INT64(&post_id_child)
-          && bson_iter_find_descendant(&iter_1,
-              ("posts." + std::to_string(idx) + ".timestamp").c_str(),
-              &timestamp_child)
-          && BSON_ITER_HOLDS_INT64(&timestamp_child)) {
-        auto curr_post_id = bson_iter_int64(&post_id_child);
-        auto curr_timestamp = bson_iter_int64(&timestamp_child);
-        if (idx >= mongo_start) {
-          post_ids.emplace_back(curr_post_id);
-        }
-        redis_update_map.insert(std::make_pair(std::to_string(curr_timestamp),
-            std::to_string(curr_post_id)));
-        bson_iter_init(&iter_0, doc);
-        bson_iter_init(&iter_1, doc);
-        idx++;
+    for (size_t idx = 0; idx < mongo_post_ids.size(); idx++) {
+      if (static_cast<int>(idx) >= mongo_start) {
+        post_ids.emplace_back(mongo_post_ids[idx]);
       }
+      redis_update_map.insert(std::make_pair(
+          std::to_string(mongo_timestamps[idx]),
+          std::to_string(mongo_post_ids[idx])));
     }
-    bson_destroy(opts);
-    bson_destroy(query);
-    mongoc_cursor_destroy(cursor);
-    mongoc_collection_destroy(collection);
-    mongoc_client_pool_push(_mongodb_client_pool, mongodb_client);
   }
 
-  // std::future<std::vector<Post>> post_future = std::async(
-  //     std::launch::async, [&]() {
-  {
+  // Posts are read while the Redis cache is refilled
+  FanOut fan_out(_post_client_pool->CallsOverlap());
+  fan_out.Add([&] {
         auto post_client_wrapper = _post_client_pool->Pop();
         if (!post_client_wrapper) {
           ServiceException se;
@@ -317,7 +202,7 @@ void UserTimelineHandler::ReadUserTimeline(
             auto rpc_trace_guard = _post_client_pool->StartRpcTrace("ReadPosts", post_client_wrapper);
             try {
               post_client->ReadPosts(
-                  _return_posts, req_id, post_ids, writer_text_map);
+                  _return_posts, req_id, post_ids, span.carrier());
             } catch (...) {
               rpc_trace_guard->set_status(1);
               _post_client_pool->Remove(post_client_wrapper);
@@ -327,9 +212,7 @@ void UserTimelineHandler::ReadUserTimeline(
           }
           _post_client_pool->Push(post_client_wrapper);
           _return = std::move(_return_posts);
-      //     return _return_posts;
-      // });
-  }
+  });
 
   if (!redis_update_map.empty()) {
     // Update Redis
@@ -341,8 +224,7 @@ void UserTimelineHandler::ReadUserTimeline(
       throw se;
     }
     redis_client = redis_client_wrapper->GetClient();
-    auto redis_update_span = opentracing::Tracer::Global()->StartSpan(
-        "RedisUpdate", {opentracing::ChildOf(&span->context())});
+    auto redis_update_span = span.StartSpan("RedisUpdate");
     redis_client.AppendCommand("DEL %" PRId64, user_id);
     std::stringstream cmd;
     cmd << "ZADD " << user_id << " NX";
@@ -355,17 +237,12 @@ void UserTimelineHandler::ReadUserTimeline(
     del_reply->check_ok();
     zadd_reply->check_ok();
     _redis_client_pool->Push(redis_client_wrapper);
-    redis_update_span->Finish();
+    redis_update_span.Finish();
   }
 
-  // try {
-  //   _return = post_future.get();
-  // } catch (...) {
-  //   LOG(error) << "Failed to get post from post-storage-service";
-  //   throw;
-  // }
+  fan_out.Join();
 
-  span->Finish();
+  span.Finish();
 
 }
 
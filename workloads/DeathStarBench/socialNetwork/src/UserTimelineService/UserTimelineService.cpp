@@ -14,16 +14,20 @@ using namespace social_network;
 
 static mongoc_client_pool_t* mongodb_client_pool;
 static ClientPool<RedisClient>* redis_client_pool;
+static MongoBatchWriter* mongodb_writer;
 static json config_json;
 
 int faas_init() {
     init_logger();
-    SetUpTracer("config/jaeger-config.yml", "post-storage-service");
+    SetUpTracer("config/jaeger-config.yml", "user-timeline-service");
 
     if (load_config(&config_json) != 0) {
         return -1;
     }
 
+    SetUpFanOut(config_json["user-timeline-service"].value("fanout_threads", 0),
+                config_json["user-timeline-service"].value("fanout_max_queued", 0));
+
     std::string redis_addr =
         config_json["user-timeline-redis"]["addr"];
     int redis_port = config_json["user-timeline-redis"]["port"];
@@ -45,7 +49,8 @@ int faas_init() {
     }
     bool r = false;
     while (!r) {
-      r = CreateIndex(mongodb_client, "user-timeline", "user_id", true);
+      r = CreateTimelineBucketIndex(mongodb_client, "user-timeline",
+                                    "user-timeline-bucket", "user_id");
       if (!r) {
         LOG(error) << "Failed to create mongodb index, try again";
         sleep(1);
@@ -53,6 +58,10 @@ int faas_init() {
     }
     mongoc_client_pool_push(mongodb_client_pool, mongodb_client);
 
+    mongodb_writer = init_mongodb_batch_writer(
+        config_json, "user-timeline", mongodb_client_pool,
+        "user-timeline", "user-timeline-bucket");
+
     return 0;
 }
 
@@ -70,10 +79,13 @@ int faas_create_func_worker(void* caller_context,
         config_json["user-timeline-service"]["post_storage_client_pool_size"],
         1000, "PostStorageService", faas_worker, "UserTimelineService", "PostStorageService");
 
+    int bucket_size = std::max(1, config_json["user-timeline-service"].value(
+        "timeline_bucket_size", 128));
+
     faas_worker->SetProcessor(std::make_shared<UserTimelineServiceProcessor>(
           std::make_shared<UserTimelineHandler>(
               redis_client_pool, mongodb_client_pool,
-              post_storage_client_pool)));
+              post_storage_client_pool, mongodb_writer, bucket_size)));
     *worker_handle = faas_worker;
     return 0;
 }
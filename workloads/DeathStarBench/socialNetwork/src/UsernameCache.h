@@ -0,0 +1,356 @@
+#ifndef SOCIAL_NETWORK_MICROSERVICES_USERNAMECACHE_H
+#define SOCIAL_NETWORK_MICROSERVICES_USERNAMECACHE_H
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <mongoc.h>
+#include <bson/bson.h>
+
+#include "logger.h"
+#include "utils_mongodb.h"
+
+namespace social_network {
+
+// Fixed-size bloom filter over strings (double hashing, k probes). Add()
+// and MayContain() may run concurrently: bits are only ever set, atomically.
+class BloomFilter {
+ public:
+  BloomFilter(size_t expected_items, double false_positive_rate);
+  BloomFilter(const BloomFilter&) = delete;
+  BloomFilter& operator=(const BloomFilter&) = delete;
+
+  void Add(const std::string& item);
+  bool MayContain(const std::string& item) const;
+
+ private:
+  static uint64_t Mix(uint64_t h);
+
+  std::unique_ptr<std::atomic<uint64_t>[]> _bits;
+  uint64_t _num_bits;
+  int _num_hashes;
+};
+
+BloomFilter::BloomFilter(size_t expected_items, double false_positive_rate) {
+  double n = std::max<size_t>(expected_items, 1);
+  double m = -n * std::log(false_positive_rate) / (std::log(2) * std::log(2));
+  _num_bits = std::max<uint64_t>(64, static_cast<uint64_t>(m));
+  _num_hashes = std::max(1, static_cast<int>(std::round(m / n * std::log(2))));
+  size_t num_words = (_num_bits + 63) / 64;
+  _bits.reset(new std::atomic<uint64_t>[num_words]);
+  for (size_t i = 0; i < num_words; i++) {
+    _bits[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+uint64_t BloomFilter::Mix(uint64_t h) {
+  // splitmix64 finalizer, std::hash may well be the identity-ish FNV
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+  return h;
+}
+
+void BloomFilter::Add(const std::string& item) {
+  uint64_t h1 = Mix(std::hash<std::string>()(item));
+  uint64_t h2 = Mix(h1) | 1;
+  for (int i = 0; i < _num_hashes; i++) {
+    uint64_t bit = (h1 + i * h2) % _num_bits;
+    _bits[bit / 64].fetch_or(1ULL << (bit % 64), std::memory_order_relaxed);
+  }
+}
+
+bool BloomFilter::MayContain(const std::string& item) const {
+  uint64_t h1 = Mix(std::hash<std::string>()(item));
+  uint64_t h2 = Mix(h1) | 1;
+  for (int i = 0; i < _num_hashes; i++) {
+    uint64_t bit = (h1 + i * h2) % _num_bits;
+    if (!(_bits[bit / 64].load(std::memory_order_relaxed) &
+          (1ULL << (bit % 64)))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+// In-process username -> user_id cache in front of memcached and MongoDB.
+// A user_id never changes once the user registers, so found entries do not
+// expire; each shard evicts with CLOCK once full. Usernames MongoDB does not
+// know are remembered for `negative_ttl_ms`. With a filter of registered
+// usernames loaded (see StartUsernameFilterRefresh) a username outside it is
+// known not to exist without asking MongoDB, but only while the load started
+// less than `negative_ttl_ms` ago: a user registered by another process since
+// then is missing from the filter, like from a negative entry, for no longer
+// than that.
+class UsernameCache {
+ public:
+  enum LookupResult { MISS, HIT, NOT_FOUND };
+
+  // `capacity` entries over all shards, 0 turns the cache off.
+  UsernameCache(size_t capacity, int negative_ttl_ms);
+  UsernameCache(const UsernameCache&) = delete;
+  UsernameCache& operator=(const UsernameCache&) = delete;
+
+  LookupResult Lookup(const std::string& username, int64_t* user_id);
+  void Insert(const std::string& username, int64_t user_id);
+  void InsertNotFound(const std::string& username);
+
+  // False if `username` was not registered as of a filter load that started
+  // less than `negative_ttl_ms` ago, true if it may be or no such filter has
+  // been loaded.
+  bool MayExist(const std::string& username);
+  // Called once filters will be loaded, before the first StartFilterLoad().
+  void UseFilter();
+  // Called before a load reads MongoDB, returns the time passed to
+  // SetFilter() with its filter.
+  int64_t StartFilterLoad();
+  void SetFilter(std::shared_ptr<BloomFilter> filter, int64_t load_start_ms);
+  // A registration seen by this process, also carried over into the filter
+  // being loaded in case its load read MongoDB before the insert.
+  void AddToFilter(const std::string& username);
+
+ private:
+  static const int kNumShards = 16;
+  // Registrations carried over into one load; a load that sees more is
+  // dropped, the next one starts over.
+  static const size_t kMaxRegisteredDuringLoad = 65536;
+
+  struct Entry {
+    std::string username;
+    int64_t user_id;  // -1 for a negative entry
+    int64_t expire_ms;  // negative entries only
+    bool referenced;
+  };
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_map<std::string, size_t> index;  // username -> slot
+    std::vector<Entry> slots;
+    size_t hand = 0;
+  };
+
+  static int64_t NowMs();
+  Shard& ShardOf(const std::string& username);
+  void Put(const std::string& username, int64_t user_id, int64_t expire_ms);
+
+  size_t _shard_capacity;
+  int _negative_ttl_ms;
+  Shard _shards[kNumShards];
+
+  std::mutex _filter_mutex;
+  bool _use_filter = false;
+  std::shared_ptr<BloomFilter> _filter;
+  int64_t _filter_load_start_ms = 0;
+  std::vector<std::string> _registered_during_load;
+  bool _registered_during_load_dropped = false;
+};
+
+UsernameCache::UsernameCache(size_t capacity, int negative_ttl_ms)
+    : _shard_capacity((capacity + kNumShards - 1) / kNumShards),
+      _negative_ttl_ms(negative_ttl_ms) {}
+
+int64_t UsernameCache::NowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+UsernameCache::Shard& UsernameCache::ShardOf(const std::string& username) {
+  return _shards[std::hash<std::string>()(username) % kNumShards];
+}
+
+UsernameCache::LookupResult UsernameCache::Lookup(const std::string& username,
+                                                  int64_t* user_id) {
+  if (_shard_capacity == 0) {
+    return MISS;
+  }
+  Shard& shard = ShardOf(username);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.index.find(username);
+  if (it == shard.index.end()) {
+    return MISS;
+  }
+  Entry& entry = shard.slots[it->second];
+  if (entry.user_id == -1) {
+    if (entry.expire_ms <= NowMs()) {
+      // leave the slot to CLOCK, it is not referenced
+      entry.referenced = false;
+      return MISS;
+    }
+    return NOT_FOUND;
+  }
+  entry.referenced = true;
+  *user_id = entry.user_id;
+  return HIT;
+}
+
+void UsernameCache::Insert(const std::string& username, int64_t user_id) {
+  Put(username, user_id, 0);
+}
+
+void UsernameCache::InsertNotFound(const std::string& username) {
+  if (_negative_ttl_ms > 0) {
+    Put(username, -1, NowMs() + _negative_ttl_ms);
+  }
+}
+
+void UsernameCache::Put(const std::string& username, int64_t user_id,
+                        int64_t expire_ms) {
+  if (_shard_capacity == 0) {
+    return;
+  }
+  Shard& shard = ShardOf(username);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.index.find(username);
+  if (it != shard.index.end()) {
+    Entry& entry = shard.slots[it->second];
+    entry.user_id = user_id;
+    entry.expire_ms = expire_ms;
+    return;
+  }
+  if (shard.slots.size() < _shard_capacity) {
+    shard.index.emplace(username, shard.slots.size());
+    shard.slots.push_back({username, user_id, expire_ms, false});
+    return;
+  }
+  // CLOCK: skip (and clear) referenced entries, evict the first one that
+  // was not used since the hand last passed it
+  while (shard.slots[shard.hand].referenced) {
+    shard.slots[shard.hand].referenced = false;
+    shard.hand = (shard.hand + 1) % shard.slots.size();
+  }
+  Entry& victim = shard.slots[shard.hand];
+  shard.index.erase(victim.username);
+  shard.index.emplace(username, shard.hand);
+  victim = {username, user_id, expire_ms, false};
+  shard.hand = (shard.hand + 1) % shard.slots.size();
+}
+
+bool UsernameCache::MayExist(const std::string& username) {
+  std::shared_ptr<BloomFilter> filter;
+  {
+    std::lock_guard<std::mutex> lock(_filter_mutex);
+    if (NowMs() - _filter_load_start_ms >= _negative_ttl_ms) {
+      // too old to rule out users registered by other processes since
+      return true;
+    }
+    filter = _filter;
+  }
+  return !filter || filter->MayContain(username);
+}
+
+void UsernameCache::UseFilter() {
+  std::lock_guard<std::mutex> lock(_filter_mutex);
+  _use_filter = true;
+}
+
+int64_t UsernameCache::StartFilterLoad() {
+  std::lock_guard<std::mutex> lock(_filter_mutex);
+  // the current filter already has the registrations of a failed load
+  _registered_during_load.clear();
+  _registered_during_load_dropped = false;
+  return NowMs();
+}
+
+void UsernameCache::SetFilter(std::shared_ptr<BloomFilter> filter,
+                              int64_t load_start_ms) {
+  std::lock_guard<std::mutex> lock(_filter_mutex);
+  if (_registered_during_load_dropped) {
+    LOG(warning) << "Dropped a username filter, more than "
+                 << kMaxRegisteredDuringLoad << " users registered during its load";
+    return;
+  }
+  for (auto &username : _registered_during_load) {
+    filter->Add(username);
+  }
+  _registered_during_load.clear();
+  _filter = filter;
+  _filter_load_start_ms = load_start_ms;
+}
+
+void UsernameCache::AddToFilter(const std::string& username) {
+  std::lock_guard<std::mutex> lock(_filter_mutex);
+  if (!_use_filter) {
+    return;
+  }
+  if (_filter) {
+    // set in place, readers may be probing the same filter
+    _filter->Add(username);
+  }
+  if (_registered_during_load.size() < kMaxRegisteredDuringLoad) {
+    _registered_during_load.push_back(username);
+  } else {
+    _registered_during_load_dropped = true;
+  }
+}
+
+
+// Builds a filter of every username in MongoDB's user collection.
+std::shared_ptr<BloomFilter> LoadUsernameFilter(
+    mongoc_client_pool_t *mongodb_client_pool) {
+  std::unique_ptr<MongoClientLease> mongodb_client;
+  try {
+    mongodb_client.reset(new MongoClientLease(mongodb_client_pool));
+  } catch (const ServiceException &) {
+    return nullptr;
+  }
+  auto collection = mongodb_client->Collection("user", "user");
+  int64_t count = mongoc_collection_estimated_document_count(
+      collection, nullptr, nullptr, nullptr, nullptr);
+  // room to grow until the next load
+  auto filter = std::make_shared<BloomFilter>(std::max<int64_t>(count, 1024) * 2, 0.01);
+
+  bson_t *query = bson_new();
+  bson_t *opts = BCON_NEW("projection", "{", "username", BCON_BOOL(true),
+                          "_id", BCON_BOOL(false), "}");
+  mongoc_cursor_t *cursor = mongoc_collection_find_with_opts(
+      collection, query, opts, nullptr);
+  const bson_t *doc;
+  while (mongoc_cursor_next(cursor, &doc)) {
+    bson_iter_t iter;
+    if (bson_iter_init_find(&iter, doc, "username") && BSON_ITER_HOLDS_UTF8(&iter)) {
+      filter->Add(bson_iter_utf8(&iter, nullptr));
+    }
+  }
+  bson_error_t error;
+  bool failed = mongoc_cursor_error(cursor, &error);
+  if (failed) {
+    LOG(warning) << "Failed to load usernames: " << error.message;
+  }
+  bson_destroy(query);
+  bson_destroy(opts);
+  mongoc_cursor_destroy(cursor);
+  return failed ? nullptr : filter;
+}
+
+// Loads the filter now and every `refresh_s` seconds in the background. A
+// filter only rules usernames out for the cache's `negative_ttl_ms` after its
+// load started, so `refresh_s` should be well below that.
+void StartUsernameFilterRefresh(UsernameCache *cache,
+                                mongoc_client_pool_t *mongodb_client_pool,
+                                int refresh_s) {
+  cache->UseFilter();
+  std::thread([cache, mongodb_client_pool, refresh_s] {
+    while (true) {
+      int64_t load_start_ms = cache->StartFilterLoad();
+      auto filter = LoadUsernameFilter(mongodb_client_pool);
+      if (filter) {
+        cache->SetFilter(filter, load_start_ms);
+      }
+      std::this_thread::sleep_for(std::chrono::seconds(refresh_s));
+    }
+  }).detach();
+}
+
+} // namespace social_network
+
+#endif //SOCIAL_NETWORK_MICROSERVICES_USERNAMECACHE_H
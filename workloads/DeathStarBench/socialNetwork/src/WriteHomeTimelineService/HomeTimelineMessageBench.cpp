@@ -0,0 +1,121 @@
+// Throughput of OnReceivedWorker up to its first downstream call, decoding
+// a write-home-timeline message and starting its span, on one core, for the
+// binary format and the JSON of older producers. Sampled spans go to
+// opentracing's no-op tracer, so reporting them is not included:
+//
+//   HomeTimelineMessageBench [seconds] [cpu]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <sched.h>
+
+#include "../HomeTimelineMessage.h"
+
+using namespace social_network;
+
+static std::atomic<uint64_t> num_allocs{0};
+
+void *operator new(size_t size) {
+  num_allocs.fetch_add(1, std::memory_order_relaxed);
+  if (void *ptr = malloc(size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+  free(ptr);
+}
+
+// What OnReceivedWorker does before GetFollowers
+uint64_t Consume(const std::string &msg) {
+  HomeTimelineMessage message;
+  if (!DecodeHomeTimelineMessage(msg.data(), msg.size(), &message)) {
+    fprintf(stderr, "Failed to decode a message\n");
+    exit(EXIT_FAILURE);
+  }
+  RequestSpan span("FanoutHomeTimelines", message.trace_context,
+                   message.trace_context_len, message.req_id);
+  uint64_t sum = message.req_id ^ message.post_id ^ message.user_id ^
+      message.timestamp;
+  for (uint32_t i = 0; i < message.num_mention_ids; i++) {
+    sum += message.mention_id(i);
+  }
+  sum += span.carrier().size();
+  span.Finish();
+  return sum;
+}
+
+void Run(const char *name, const std::vector<std::string> &msgs,
+         double seconds) {
+  size_t total_bytes = 0;
+  for (auto &msg : msgs) {
+    total_bytes += msg.size();
+  }
+  uint64_t sum = 0;
+  uint64_t num_msgs = 0;
+  uint64_t allocs_before = num_allocs.load();
+  auto start = std::chrono::steady_clock::now();
+  auto deadline = start + std::chrono::duration<double>(seconds);
+  while (std::chrono::steady_clock::now() < deadline) {
+    for (auto &msg : msgs) {
+      sum += Consume(msg);
+    }
+    num_msgs += msgs.size();
+  }
+  double elapsed = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+  printf("%-6s %6.1f bytes/msg %12.0f msgs/s/core %6.2f allocs/msg"
+         " (checksum %llx)\n",
+         name, static_cast<double>(total_bytes) / msgs.size(),
+         num_msgs / elapsed,
+         static_cast<double>(num_allocs.load() - allocs_before) / num_msgs,
+         static_cast<unsigned long long>(sum));
+}
+
+int main(int argc, char *argv[]) {
+  double seconds = argc > 1 ? atof(argv[1]) : 2.0;
+  int cpu = argc > 2 ? atoi(argv[2]) : 0;
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+    perror("sched_setaffinity");
+  }
+  tracing_detail::tracer_enabled = true;
+
+  // 0-3 mentions per post, one request in 100 sampled
+  std::mt19937_64 rng(42);
+  std::vector<std::string> binary_msgs;
+  std::vector<std::string> json_msgs;
+  for (int i = 0; i < 4096; i++) {
+    std::vector<int64_t> mention_ids(rng() % 4);
+    for (auto &id : mention_ids) {
+      id = rng() % 1000000;
+    }
+    std::map<std::string, std::string> carrier{
+        {tracing_detail::kTraceContextHeader,
+         i % 100 == 0 ? "4bf92f3577b34da6a3ce929d0e0e4736:00f067aa0ba902b7:0:1"
+                      : "0:0:0:0"}};
+    int64_t req_id = rng() >> 1;
+    int64_t post_id = rng() >> 1;
+    int64_t user_id = rng() % 1000000;
+    int64_t timestamp = 1600000000000 + i;
+    binary_msgs.push_back(EncodeHomeTimelineMessage(
+        req_id, post_id, user_id, timestamp, mention_ids, carrier));
+    json_msgs.push_back(EncodeHomeTimelineJson(
+        req_id, post_id, user_id, timestamp, mention_ids, carrier));
+  }
+
+  Run("binary", binary_msgs, seconds);
+  Run("json", json_msgs, seconds);
+  return 0;
+}
@@ -8,6 +8,7 @@
 
 #include "../AmqpLibeventHandler.h"
 #include "../ClientPool.h"
+#include "../HomeTimelineMessage.h"
 #include "../RedisClient.h"
 #include "../ThriftClient.h"
 #include "../logger.h"
@@ -32,30 +33,21 @@ void sigintHandler(int sig) {
 
 void OnReceivedWorker(const AMQP::Message &msg) {
   try {
-    json msg_json = json::parse(std::string(msg.body(), msg.bodySize()));
-
-    std::map<std::string, std::string> carrier;
-    for (auto it = msg_json["carrier"].begin();
-        it != msg_json["carrier"].end(); ++it) {
-      carrier.emplace(std::make_pair(it.key(), it.value()));
+    // Extract information from rabbitmq messages, in place
+    HomeTimelineMessage message;
+    if (!DecodeHomeTimelineMessage(msg.body(), msg.bodySize(), &message)) {
+      LOG(error) << "Dropped a malformed write-home-timeline message of "
+                 << msg.bodySize() << " bytes";
+      return;
     }
+    int64_t req_id = message.req_id;
+    int64_t user_id = message.user_id;
+    int64_t post_id = message.post_id;
+    int64_t timestamp = message.timestamp;
 
     // Jaeger tracing
-    TextMapReader span_reader(carrier);
-    auto parent_span = opentracing::Tracer::Global()->Extract(span_reader);
-    auto span = opentracing::Tracer::Global()->StartSpan(
-        "FanoutHomeTimelines",
-        {opentracing::ChildOf(parent_span->get())});
-    std::map<std::string, std::string> writer_text_map;
-    TextMapWriter writer(writer_text_map);
-    opentracing::Tracer::Global()->Inject(span->context(), writer);
-
-    // Extract information from rabbitmq messages
-    int64_t user_id = msg_json["user_id"];
-    int64_t req_id = msg_json["req_id"];
-    int64_t post_id = msg_json["post_id"];
-    int64_t timestamp = msg_json["timestamp"];
-    std::vector<int64_t> user_mentions_id = msg_json["user_mentions_id"];
+    RequestSpan span("FanoutHomeTimelines", message.trace_context,
+                     message.trace_context_len, req_id);
 
     // Find followers of the user
     auto social_graph_client_wrapper = _social_graph_client_pool->Pop();
@@ -71,7 +63,7 @@ void OnReceivedWorker(const AMQP::Message &msg) {
       auto rpc_trace_guard = _social_graph_client_pool->StartRpcTrace("GetFollowers", social_graph_client_wrapper);
       try {
         social_graph_client->GetFollowers(followers_id, req_id, user_id,
-                                          writer_text_map);
+                                          span.carrier());
       } catch (...) {
         rpc_trace_guard->set_status(1);
         LOG(error) << "Failed to get followers from social-network-service";
@@ -83,7 +75,9 @@ void OnReceivedWorker(const AMQP::Message &msg) {
 
     std::set<int64_t> followers_id_set(followers_id.begin(),
         followers_id.end());
-    followers_id_set.insert(user_mentions_id.begin(), user_mentions_id.end());
+    for (uint32_t i = 0; i < message.num_mention_ids; i++) {
+      followers_id_set.insert(message.mention_id(i));
+    }
 
     if (max_followers_to_update != -1 && followers_id_set.size() > max_followers_to_update) {
       std::vector<int64_t> tmp(followers_id_set.begin(), followers_id_set.end());
@@ -95,8 +89,7 @@ void OnReceivedWorker(const AMQP::Message &msg) {
     }
 
     // Update Redis ZSet
-    auto redis_span = opentracing::Tracer::Global()->StartSpan(
-        "RedisUpdate", {opentracing::ChildOf(&span->context())});
+    auto redis_span = span.StartSpan("RedisUpdate");
     auto redis_client_wrapper = _redis_client_pool->Pop();
     if (!redis_client_wrapper) {
       ServiceException se;
@@ -113,7 +106,7 @@ void OnReceivedWorker(const AMQP::Message &msg) {
       auto reply = redis_client.GetReply();
       reply->check_ok();
     }
-    redis_span->Finish();
+    redis_span.Finish();
     _redis_client_pool->Push(redis_client_wrapper);
   } catch (...) {
     LOG(error) << "OnReveived worker error";
@@ -147,7 +140,7 @@ void WorkerThread(std::string &addr, int port) {
       });
   channel.consume("write-home-timeline", AMQP::noack).onReceived(
       [](const AMQP::Message &msg, uint64_t tag, bool redelivered) {
-        LOG(debug) << "Received: " << std::string(msg.body(), msg.bodySize());
+        LOG(debug) << "Received " << msg.bodySize() << " bytes";
         OnReceivedWorker(msg);
       });
 
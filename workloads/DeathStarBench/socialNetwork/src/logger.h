@@ -1,32 +1,590 @@
 #ifndef SOCIAL_NETWORK_MICROSERVICES_LOGGER_H
 #define SOCIAL_NETWORK_MICROSERVICES_LOGGER_H
 
-#include <boost/log/trivial.hpp>
-#include <boost/log/utility/setup/console.hpp>
-#include <boost/log/utility/setup/common_attributes.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
 #include <string.h>
 
+// LOG(severity) << ... only encodes its arguments into a buffer of the
+// calling thread: the call site (file, line, function) as pointers, numbers
+// and pointers in binary and strings as bytes. A background thread formats
+// the records and writes them to stderr as
+//
+//   [2020-01-01 00:00:00.000000] <info>: (File.h:12:Function) message
+//
+// Severities below LOG_COMPILE_MIN_SEVERITY (0 trace ... 5 fatal) are
+// compiled out and those below the level set by init_logger() (info) cost a
+// compare. A thread whose buffer is full drops records rather than wait, the
+// drops are reported. A fatal record is written, with everything logged
+// before it, by the time LOG returns.
+//
+// For messages a request can trigger, LOG_EVERY_N(severity, n) and
+// LOG_EVERY_MS(severity, ms) log one of every n calls or at most one call
+// every ms milliseconds at the call site, noting how many were suppressed.
+
+#ifndef LOG_COMPILE_MIN_SEVERITY
+#define LOG_COMPILE_MIN_SEVERITY 0
+#endif
+
 namespace social_network {
-#define __FILENAME__ \
-    (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
+
+namespace log_severity {
+enum LogSeverity { trace, debug, info, warning, error, fatal };
+} // namespace log_severity
+
+namespace log_detail {
+
+const size_t kRingSize = 1 << 16;  // per logging thread
+const size_t kMaxRecordSize = 2048;  // longer messages are truncated
+const auto kMinPollInterval = std::chrono::microseconds(100);
+const auto kMaxPollInterval = std::chrono::milliseconds(10);
+
+const char *const kSeverityNames[] = {
+    "trace", "debug", "info", "warning", "error", "fatal"};
+
+// all severities until init_logger()
+int min_severity = log_severity::trace;
+
+enum ArgType : char {
+  kInt, kUint, kDouble, kBool, kChar, kString, kPointer, kManipulator,
+  kIosManipulator
+};
+
+struct RecordHeader {
+  int64_t time_ns;  // system_clock
+  const char *file;
+  const char *function;
+  int32_t line;
+  int32_t severity;
+  uint64_t suppressed;
+  bool truncated;
+};
+
+// Single producer (the owning thread), single consumer (whoever holds
+// Logger::_flush_mutex). Records are a uint32_t size and the record bytes.
+class LogRing {
+ public:
+  bool Push(const char *record, uint32_t size);
+  void CountDrop() { _dropped.fetch_add(1, std::memory_order_relaxed); }
+  uint64_t TakeDropped() {
+    return _dropped.exchange(0, std::memory_order_relaxed);
+  }
+  bool Empty() const {
+    return _head.load(std::memory_order_acquire) ==
+        _tail.load(std::memory_order_relaxed);
+  }
+  // Calls f(record, size) for every record pushed so far.
+  template <typename F>
+  bool Drain(F f);
+
+ private:
+  void CopyIn(uint64_t pos, const void *src, size_t n);
+  void CopyOut(uint64_t pos, void *dst, size_t n) const;
+
+  char _data[kRingSize];
+  std::atomic<uint64_t> _head{0};
+  char _head_padding[64];
+  std::atomic<uint64_t> _tail{0};
+  std::atomic<uint64_t> _dropped{0};
+};
+
+bool LogRing::Push(const char *record, uint32_t size) {
+  uint64_t head = _head.load(std::memory_order_relaxed);
+  uint64_t tail = _tail.load(std::memory_order_acquire);
+  if (kRingSize - (head - tail) < sizeof(size) + size) {
+    return false;
+  }
+  CopyIn(head, &size, sizeof(size));
+  CopyIn(head + sizeof(size), record, size);
+  _head.store(head + sizeof(size) + size, std::memory_order_release);
+  return true;
+}
+
+template <typename F>
+bool LogRing::Drain(F f) {
+  char record[kMaxRecordSize];
+  uint64_t tail = _tail.load(std::memory_order_relaxed);
+  uint64_t head = _head.load(std::memory_order_acquire);
+  if (tail == head) {
+    return false;
+  }
+  while (tail != head) {
+    uint32_t size;
+    CopyOut(tail, &size, sizeof(size));
+    CopyOut(tail + sizeof(size), record, size);
+    tail += sizeof(size) + size;
+    _tail.store(tail, std::memory_order_release);
+    f(record, size);
+  }
+  return true;
+}
+
+void LogRing::CopyIn(uint64_t pos, const void *src, size_t n) {
+  size_t offset = pos % kRingSize;
+  size_t first = std::min(n, kRingSize - offset);
+  memcpy(_data + offset, src, first);
+  memcpy(_data, static_cast<const char *>(src) + first, n - first);
+}
+
+void LogRing::CopyOut(uint64_t pos, void *dst, size_t n) const {
+  size_t offset = pos % kRingSize;
+  size_t first = std::min(n, kRingSize - offset);
+  memcpy(dst, _data + offset, first);
+  memcpy(static_cast<char *>(dst) + first, _data, n - first);
+}
+
+// Owns the rings of all threads and the thread that empties them. Never
+// destroyed, so threads may log until the process exits.
+class Logger {
+ public:
+  static Logger &Get() {
+    static Logger *logger = new Logger;
+    return *logger;
+  }
+
+  LogRing *ThreadRing();
+  // Writes out every record pushed so far. False if there was none.
+  bool Flush();
+
+ private:
+  void Run();
+  void Format(const char *record, uint32_t size);
+  void FormatTime(int64_t time_ns);
+
+  std::mutex _rings_mutex;
+  std::vector<std::shared_ptr<LogRing>> _rings;
+  std::once_flag _started;
+
+  std::mutex _flush_mutex;
+  std::ostringstream _stream;
+  std::ostringstream _default_format;
+  std::string _out;
+  time_t _last_second = -1;
+  char _last_second_text[32];
+};
+
+LogRing *Logger::ThreadRing() {
+  // the registry keeps the ring until it is drained after the thread exits
+  thread_local std::shared_ptr<LogRing> ring;
+  if (!ring) {
+    ring = std::make_shared<LogRing>();
+    {
+      std::lock_guard<std::mutex> lock(_rings_mutex);
+      _rings.push_back(ring);
+    }
+    std::call_once(_started, [this] {
+      std::thread(&Logger::Run, this).detach();
+      atexit([] { Logger::Get().Flush(); });
+    });
+  }
+  return ring.get();
+}
+
+bool Logger::Flush() {
+  std::lock_guard<std::mutex> flush_lock(_flush_mutex);
+  std::vector<std::shared_ptr<LogRing>> rings;
+  {
+    std::lock_guard<std::mutex> lock(_rings_mutex);
+    _rings.erase(std::remove_if(_rings.begin(), _rings.end(),
+        [](const std::shared_ptr<LogRing> &ring) {
+          return ring.use_count() == 1 && ring->Empty();
+        }), _rings.end());
+    rings = _rings;
+  }
+
+  _out.clear();
+  bool any = false;
+  for (auto &ring : rings) {
+    any |= ring->Drain([this](const char *record, uint32_t size) {
+      Format(record, size);
+    });
+    uint64_t dropped = ring->TakeDropped();
+    if (dropped > 0) {
+      auto now = std::chrono::system_clock::now().time_since_epoch();
+      FormatTime(std::chrono::duration_cast<std::chrono::nanoseconds>(
+          now).count());
+      _out += " <warning>: (logger.h) ";
+      _out += std::to_string(dropped);
+      _out += " log records dropped, the buffer of a thread was full\n";
+    }
+  }
+  if (!_out.empty()) {
+    fwrite(_out.data(), 1, _out.size(), stderr);
+    fflush(stderr);
+  }
+  return any;
+}
+
+void Logger::Run() {
+  auto interval = std::chrono::duration_cast<std::chrono::microseconds>(
+      kMinPollInterval);
+  while (true) {
+    if (Flush()) {
+      interval = kMinPollInterval;
+    } else {
+      interval = std::min<std::chrono::microseconds>(interval * 2,
+                                                     kMaxPollInterval);
+    }
+    std::this_thread::sleep_for(interval);
+  }
+}
+
+void Logger::FormatTime(int64_t time_ns) {
+  time_t second = time_ns / 1000000000;
+  if (second != _last_second) {
+    struct tm tm;
+    localtime_r(&second, &tm);
+    strftime(_last_second_text, sizeof(_last_second_text),
+             "[%Y-%m-%d %H:%M:%S", &tm);
+    _last_second = second;
+  }
+  char micros[16];
+  snprintf(micros, sizeof(micros), ".%06d]",
+           static_cast<int>(time_ns / 1000 % 1000000));
+  _out += _last_second_text;
+  _out += micros;
+}
+
+void Logger::Format(const char *record, uint32_t size) {
+  RecordHeader header;
+  memcpy(&header, record, sizeof(header));
+  const char *file = strrchr(header.file, '/');
+  file = file ? file + 1 : header.file;
+
+  FormatTime(header.time_ns);
+  _out += " <";
+  _out += kSeverityNames[header.severity];
+  _out += ">: (";
+  _out += file;
+  _out += ":";
+  _out += std::to_string(header.line);
+  _out += ":";
+  _out += header.function;
+  _out += ") ";
+
+  // a fresh stream state per record, as with one ostream per message
+  _stream.str(std::string());
+  _stream.clear();
+  _stream.copyfmt(_default_format);
+  for (uint32_t pos = sizeof(header); pos < size;) {
+    char type = record[pos++];
+    switch (type) {
+      case kInt: {
+        int64_t value;
+        memcpy(&value, record + pos, sizeof(value));
+        pos += sizeof(value);
+        _stream << value;
+        break;
+      }
+      case kUint: {
+        uint64_t value;
+        memcpy(&value, record + pos, sizeof(value));
+        pos += sizeof(value);
+        _stream << value;
+        break;
+      }
+      case kDouble: {
+        double value;
+        memcpy(&value, record + pos, sizeof(value));
+        pos += sizeof(value);
+        _stream << value;
+        break;
+      }
+      case kBool:
+        _stream << static_cast<bool>(record[pos++]);
+        break;
+      case kChar:
+        _stream << record[pos++];
+        break;
+      case kString: {
+        uint32_t length;
+        memcpy(&length, record + pos, sizeof(length));
+        pos += sizeof(length);
+        _stream.write(record + pos, length);
+        pos += length;
+        break;
+      }
+      case kPointer: {
+        const void *value;
+        memcpy(&value, record + pos, sizeof(value));
+        pos += sizeof(value);
+        _stream << value;
+        break;
+      }
+      case kManipulator: {
+        std::ostream &(*manipulator)(std::ostream &);
+        memcpy(&manipulator, record + pos, sizeof(manipulator));
+        pos += sizeof(manipulator);
+        _stream << manipulator;
+        break;
+      }
+      case kIosManipulator: {
+        std::ios_base &(*manipulator)(std::ios_base &);
+        memcpy(&manipulator, record + pos, sizeof(manipulator));
+        pos += sizeof(manipulator);
+        _stream << manipulator;
+        break;
+      }
+      default:
+        pos = size;
+        break;
+    }
+  }
+  if (header.truncated) {
+    _stream << " [truncated]";
+  }
+  if (header.suppressed > 0) {
+    _stream << " (" << header.suppressed << " similar suppressed)";
+  }
+  std::string message = _stream.str();
+  _out += message;
+  if (message.empty() || message.back() != '\n') {
+    _out += '\n';
+  }
+}
+
+// One LOG statement. The record is built on the stack and pushed to the
+// thread's ring when the statement ends.
+class LogLine {
+ public:
+  LogLine(int severity, const char *file, int line, const char *function,
+          uint64_t suppressed = 0);
+  ~LogLine();
+  LogLine(const LogLine&) = delete;
+  LogLine& operator=(const LogLine&) = delete;
+
+  LogLine &operator<<(const char *value);
+  LogLine &operator<<(char *value) {
+    return *this << static_cast<const char *>(value);
+  }
+  LogLine &operator<<(const std::string &value) {
+    AppendString(value.data(), value.size());
+    return *this;
+  }
+  LogLine &operator<<(char value) {
+    Append(kChar, &value, sizeof(value));
+    return *this;
+  }
+  LogLine &operator<<(signed char value) {
+    return *this << static_cast<char>(value);
+  }
+  LogLine &operator<<(unsigned char value) {
+    return *this << static_cast<char>(value);
+  }
+  LogLine &operator<<(bool value) {
+    char byte = value;
+    Append(kBool, &byte, sizeof(byte));
+    return *this;
+  }
+  template <typename T, typename std::enable_if<
+      std::is_integral<T>::value && std::is_signed<T>::value, int>::type = 0>
+  LogLine &operator<<(T value) {
+    int64_t v = value;
+    Append(kInt, &v, sizeof(v));
+    return *this;
+  }
+  template <typename T, typename std::enable_if<
+      std::is_integral<T>::value && std::is_unsigned<T>::value, int>::type = 0>
+  LogLine &operator<<(T value) {
+    uint64_t v = value;
+    Append(kUint, &v, sizeof(v));
+    return *this;
+  }
+  template <typename T, typename std::enable_if<
+      std::is_floating_point<T>::value, int>::type = 0>
+  LogLine &operator<<(T value) {
+    double v = value;
+    Append(kDouble, &v, sizeof(v));
+    return *this;
+  }
+  LogLine &operator<<(const void *value) {
+    Append(kPointer, &value, sizeof(value));
+    return *this;
+  }
+  LogLine &operator<<(std::ostream &(*manipulator)(std::ostream &)) {
+    Append(kManipulator, &manipulator, sizeof(manipulator));
+    return *this;
+  }
+  LogLine &operator<<(std::ios_base &(*manipulator)(std::ios_base &)) {
+    Append(kIosManipulator, &manipulator, sizeof(manipulator));
+    return *this;
+  }
+  // anything else with an operator<<, formatted here
+  template <typename T, typename std::enable_if<
+      !std::is_arithmetic<T>::value &&
+      !std::is_pointer<typename std::decay<T>::type>::value, int>::type = 0>
+  LogLine &operator<<(const T &value) {
+    std::ostringstream stream;
+    stream << value;
+    std::string text = stream.str();
+    AppendString(text.data(), text.size());
+    return *this;
+  }
+
+ private:
+  void Append(ArgType type, const void *value, size_t size);
+  void AppendString(const char *value, size_t length);
+
+  RecordHeader _header;
+  char _record[kMaxRecordSize];
+  size_t _size;
+};
+
+LogLine::LogLine(int severity, const char *file, int line,
+                 const char *function, uint64_t suppressed) {
+  _header.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  _header.file = file;
+  _header.function = function;
+  _header.line = line;
+  _header.severity = severity;
+  _header.suppressed = suppressed;
+  _header.truncated = false;
+  _size = sizeof(_header);
+}
+
+LogLine::~LogLine() {
+  memcpy(_record, &_header, sizeof(_header));
+  Logger &logger = Logger::Get();
+  LogRing *ring = logger.ThreadRing();
+  if (_header.severity != log_severity::fatal) {
+    if (!ring->Push(_record, _size)) {
+      ring->CountDrop();
+    }
+    return;
+  }
+  // never dropped, the caller is usually about to exit
+  while (!ring->Push(_record, _size)) {
+    logger.Flush();
+  }
+  logger.Flush();
+}
+
+LogLine &LogLine::operator<<(const char *value) {
+  if (!value) {
+    value = "(null)";
+  }
+  AppendString(value, strlen(value));
+  return *this;
+}
+
+void LogLine::Append(ArgType type, const void *value, size_t size) {
+  if (_header.truncated || _size + 1 + size > kMaxRecordSize) {
+    _header.truncated = true;
+    return;
+  }
+  _record[_size++] = type;
+  memcpy(_record + _size, value, size);
+  _size += size;
+}
+
+void LogLine::AppendString(const char *value, size_t length) {
+  const size_t overhead = 1 + sizeof(uint32_t);
+  if (_header.truncated || _size + overhead > kMaxRecordSize) {
+    _header.truncated = true;
+    return;
+  }
+  if (length > kMaxRecordSize - _size - overhead) {
+    length = kMaxRecordSize - _size - overhead;
+    _header.truncated = true;
+  }
+  uint32_t length32 = length;
+  _record[_size++] = kString;
+  memcpy(_record + _size, &length32, sizeof(length32));
+  _size += sizeof(length32);
+  memcpy(_record + _size, value, length);
+  _size += length;
+}
+
+struct LogVoidify {
+  void operator&(LogLine &) {}
+};
+
+// Per call site state of LOG_EVERY_N and LOG_EVERY_MS. Take*() returns 0 if
+// this call is suppressed, otherwise 1 + the calls suppressed since the last
+// one logged.
+class LogLimiter {
+ public:
+  uint64_t TakeEveryN(uint64_t n) {
+    if (n > 1 && _count.fetch_add(1, std::memory_order_relaxed) % n != 0) {
+      return Suppress();
+    }
+    return Pass();
+  }
+
+  uint64_t TakeEveryMs(int64_t interval_ms) {
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t next = _next_ns.load(std::memory_order_relaxed);
+    if (now < next || !_next_ns.compare_exchange_strong(
+        next, now + interval_ms * 1000000, std::memory_order_relaxed)) {
+      return Suppress();
+    }
+    return Pass();
+  }
+
+ private:
+  uint64_t Pass() {
+    return _suppressed.exchange(0, std::memory_order_relaxed) + 1;
+  }
+  uint64_t Suppress() {
+    _suppressed.fetch_add(1, std::memory_order_relaxed);
+    return 0;
+  }
+
+  std::atomic<uint64_t> _count{0};
+  std::atomic<int64_t> _next_ns{INT64_MIN};
+  std::atomic<uint64_t> _suppressed{0};
+};
+
+} // namespace log_detail
+
+#define LOG_IS_ON(severity) \
+    (::social_network::log_severity::severity >= LOG_COMPILE_MIN_SEVERITY && \
+     ::social_network::log_severity::severity >= \
+         ::social_network::log_detail::min_severity)
+
 #define LOG(severity) \
-    BOOST_LOG_TRIVIAL(severity) << "(" << __FILENAME__ << ":" \
-    << __LINE__ << ":" << __FUNCTION__ << ") "
+    !LOG_IS_ON(severity) ? (void) 0 : \
+    ::social_network::log_detail::LogVoidify() & \
+    ::social_network::log_detail::LogLine( \
+        ::social_network::log_severity::severity, __FILE__, __LINE__, \
+        __FUNCTION__)
+
+#define LOG_EVERY_N(severity, n) \
+    LOG_LIMITED_(severity, TakeEveryN(n))
+#define LOG_EVERY_MS(severity, ms) \
+    LOG_LIMITED_(severity, TakeEveryMs(ms))
+
+#define LOG_LIMITED_(severity, take) \
+    for (uint64_t log_turn_ = !LOG_IS_ON(severity) ? 0 : \
+             []() -> ::social_network::log_detail::LogLimiter & { \
+               static ::social_network::log_detail::LogLimiter limiter; \
+               return limiter; \
+             }().take; \
+         log_turn_ != 0; log_turn_ = 0) \
+      ::social_network::log_detail::LogLine( \
+          ::social_network::log_severity::severity, __FILE__, __LINE__, \
+          __FUNCTION__, log_turn_ - 1)
 
 void init_logger() {
-  boost::log::register_simple_formatter_factory
-      <boost::log::trivial::severity_level, char>("Severity");
-  boost::log::add_common_attributes();
-  boost::log::add_console_log(
-      std::cerr, boost::log::keywords::format =
-          "[%TimeStamp%] <%Severity%>: %Message%");
-  boost::log::core::get()->set_filter (
-      boost::log::trivial::severity >= boost::log::trivial::info
-  );
+  log_detail::min_severity = log_severity::info;
 }
 
-
 } //namespace social_network
 
 #endif //SOCIAL_NETWORK_MICROSERVICES_LOGGER_H
@@ -0,0 +1,66 @@
+#ifndef SOCIAL_NETWORK_MICROSERVICES_PROBES_H
+#define SOCIAL_NETWORK_MICROSERVICES_PROBES_H
+
+#include <cstdint>
+
+// USDT probes for attaching bpftrace or other eBPF tools to a running
+// service, see scripts/bpftrace. A probe site is a single nop until a tracer
+// attaches to it, its arguments are values the caller already holds. The
+// probes of provider social_network are
+//
+//   request__start(req_id, method)          a RequestSpan opens
+//   request__done(req_id, method)
+//   stage__start(req_id, method, stage)     a span opens around a Mongo,
+//   stage__done(req_id, method, stage)      Redis or Memcached call, or
+//                                           ClientPool::StartRpcTrace()
+//                                           around an RPC
+//   pool__pop__start(req_id, client_type)   ClientPool::Pop()
+//   pool__pop__done(req_id, client_type, client)
+//   pool__push(req_id, client_type, client)
+//   faas__process__start(req_id, method)    FaasWorker::Process()
+//   faas__process__done(req_id, method, ok)
+//
+// Strings are const char *. Pool and RPC probes carry the request the
+// calling thread last opened a RequestSpan for. FaaS probes carry the method
+// and req_id read from the Thrift call, empty and 0 if it cannot be read.
+// Without <sys/sdt.h> (systemtap-sdt-dev) or with -DDISABLE_PROBES the
+// probes compile to nothing.
+//
+// The method and stage of request and stage probes are string literals
+// rather than numeric ids on purpose. A literal is a constant the site
+// already holds, so an
+// unattached probe stays a nop with no lookup in front of it, whereas an id
+// (say the index into ClientPool's _method_names) would have to be found
+// under a lock on every call. A literal's address is stable, so scripts key
+// their maps on the pointer and only read the string with str() when they
+// aggregate, which is small next to the uprobe trap itself.
+
+#if defined(__has_include) && !defined(DISABLE_PROBES)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SOCIAL_NETWORK_PROBES 1
+#endif
+#endif
+
+#ifdef SOCIAL_NETWORK_PROBES
+#define PROBE2(name, a, b) DTRACE_PROBE2(social_network, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(social_network, name, a, b, c)
+#else
+#define PROBE2(name, a, b) do {} while (0)
+#define PROBE3(name, a, b, c) do {} while (0)
+#endif
+
+namespace social_network {
+
+namespace probes_detail {
+
+// set by RequestSpan, read by probes and timers that have no request at
+// hand
+thread_local int64_t current_req_id = 0;
+thread_local const char *current_method = "(no request)";
+
+} // namespace probes_detail
+
+} // namespace social_network
+
+#endif //SOCIAL_NETWORK_MICROSERVICES_PROBES_H
@@ -3,16 +3,119 @@
 #ifndef SOCIAL_NETWORK_MICROSERVICES_TRACING_H
 #define SOCIAL_NETWORK_MICROSERVICES_TRACING_H
 
+#include <cstdlib>
+#include <map>
+#include <memory>
 #include <string>
+#include <utility>
+
+#include "LatencyStats.h"
+#include "probes.h"
+
+#ifndef DISABLE_TRACING
 #include <yaml-cpp/yaml.h>
 #include <jaegertracing/Tracer.h>
-
 #include <opentracing/propagation.h>
-#include <string>
-#include <map>
+#endif
+
+// Request tracing. A handler opens a RequestSpan from the carrier it was
+// called with, starts child spans from it and passes its carrier() on:
+//
+//   RequestSpan span("ReadPost", carrier, req_id);
+//   auto find_span = span.StartSpan("MongoFindPost");
+//   ...
+//   find_span.Finish();
+//   client->ReadPosts(_return, req_id, post_ids, span.carrier());
+//   span.Finish();
+//
+// Only sampled requests create spans. The sampled flag travels in the
+// uber-trace-id entry of the carrier, so a service called for an unsampled
+// request does no Extract, StartSpan or Inject and hands a shared
+// "unsampled" carrier to the services it calls. Building with
+// -DDISABLE_TRACING (cmake -DENABLE_TRACING=OFF) compiles tracing out.
+//
+// Either way every span fires the stage probes of probes.h, and a sample of
+// spans is timed into the latency histogram of its (request span, span)
+// names, see LatencyStats.h.
 
 namespace social_network {
 
+// What a span keeps without tracing: its timer and probes. A null stage is
+// the request itself.
+class SpanStage {
+ public:
+  SpanStage(int64_t req_id, const char *method, const char *stage)
+      : _req_id(req_id), _method(method), _stage(stage), _running(true),
+        _timer(GetLatencyHistogram(method, stage ? stage : "total")) {
+    if (stage) {
+      PROBE3(stage__start, req_id, method, stage);
+    } else {
+      PROBE2(request__start, req_id, method);
+    }
+  }
+  SpanStage(SpanStage &&other)
+      : _req_id(other._req_id), _method(other._method), _stage(other._stage),
+        _running(other._running), _timer(std::move(other._timer)) {
+    other._running = false;
+  }
+  ~SpanStage() { Stop(); }
+
+  int64_t req_id() const { return _req_id; }
+  void Stop() {
+    if (!_running) {
+      return;
+    }
+    _running = false;
+    _timer.Stop();
+    if (_stage) {
+      PROBE3(stage__done, _req_id, _method, _stage);
+    } else {
+      PROBE2(request__done, _req_id, _method);
+    }
+  }
+
+ private:
+  int64_t _req_id;
+  const char *_method;
+  const char *_stage;
+  bool _running;
+  StageTimer _timer;
+};
+
+namespace tracing_detail {
+
+// jaegertracing::kTraceContextHeaderName
+const char kTraceContextHeader[] = "uber-trace-id";
+
+// The context is "<trace-id>:<span-id>:<parent-id>:<flags>" and bit 0 of
+// the flags is "sampled". -1 if there is no context.
+int SampledFlag(const char *context, size_t len) {
+  size_t pos = len;
+  while (pos > 0 && context[pos - 1] != ':') {
+    pos--;
+  }
+  if (pos == 0 || pos == len) {
+    return -1;
+  }
+  // only the lowest bit counts, but every digit must be hex
+  int digit = 0;
+  for (; pos < len; pos++) {
+    char c = context[pos];
+    if (c >= '0' && c <= '9') {
+      digit = c - '0';
+    } else if ((c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F')) {
+      digit = (c & 0x7) + 9;
+    } else {
+      return -1;
+    }
+  }
+  return digit & 1;
+}
+
+} // namespace tracing_detail
+
+#ifndef DISABLE_TRACING
+
 using opentracing::expected;
 using opentracing::string_view;
 
@@ -49,17 +152,219 @@ class TextMapWriter : public opentracing::TextMapWriter {
   std::map<std::string, std::string>& _text_map;
 };
 
+namespace tracing_detail {
+
+// false until SetUpTracer() installs a tracer that is not disabled
+bool tracer_enabled = false;
+
+int SampledFlag(const std::map<std::string, std::string> &carrier) {
+  auto it = carrier.find(kTraceContextHeader);
+  if (it == carrier.end()) {
+    return -1;
+  }
+  return SampledFlag(it->second.data(), it->second.size());
+}
+
+const std::map<std::string, std::string> &UnsampledCarrier() {
+  static const std::map<std::string, std::string> carrier{
+      {kTraceContextHeader, "0:0:0:0"}};
+  return carrier;
+}
+
+bool IsSampled(const opentracing::SpanContext &context) {
+  auto jaeger_context =
+      dynamic_cast<const jaegertracing::SpanContext *>(&context);
+  return jaeger_context && jaeger_context->isSampled();
+}
+
+} // namespace tracing_detail
+
+class TraceSpan {
+ public:
+  TraceSpan(SpanStage stage, std::unique_ptr<opentracing::Span> span)
+      : _stage(std::move(stage)), _span(std::move(span)) {}
+
+  void Finish() {
+    _stage.Stop();
+    if (_span) {
+      _span->Finish();
+    }
+  }
+
+ private:
+  SpanStage _stage;
+  std::unique_ptr<opentracing::Span> _span;
+};
+
+class RequestSpan {
+ public:
+  RequestSpan(const char *operation_name,
+              const std::map<std::string, std::string> &carrier,
+              int64_t req_id);
+  // From the bare context of a carrier, empty for none. Only a sampled one
+  // is made into a carrier.
+  RequestSpan(const char *operation_name, const char *trace_context,
+              size_t trace_context_len, int64_t req_id);
+  RequestSpan(const RequestSpan&) = delete;
+  RequestSpan& operator=(const RequestSpan&) = delete;
+
+  bool sampled() const { return _span != nullptr; }
+  // The context to send with downstream requests.
+  const std::map<std::string, std::string> &carrier() const {
+    return _span ? _carrier : tracing_detail::UnsampledCarrier();
+  }
+  TraceSpan StartSpan(const char *operation_name) const;
+  void Finish() {
+    _stage.Stop();
+    if (_span) {
+      _span->Finish();
+    }
+  }
+
+ private:
+  void Start(const std::map<std::string, std::string> &carrier, int sampled);
+
+  const char *_operation_name;
+  SpanStage _stage;
+  std::unique_ptr<opentracing::Span> _span;
+  std::map<std::string, std::string> _carrier;
+};
+
+RequestSpan::RequestSpan(const char *operation_name,
+                         const std::map<std::string, std::string> &carrier,
+                         int64_t req_id)
+    : _operation_name(operation_name),
+      _stage(req_id, operation_name, nullptr) {
+  probes_detail::current_req_id = req_id;
+  probes_detail::current_method = operation_name;
+  if (!tracing_detail::tracer_enabled) {
+    return;
+  }
+  int sampled = tracing_detail::SampledFlag(carrier);
+  if (sampled == 0) {
+    return;
+  }
+  Start(carrier, sampled);
+}
+
+RequestSpan::RequestSpan(const char *operation_name,
+                         const char *trace_context, size_t trace_context_len,
+                         int64_t req_id)
+    : _operation_name(operation_name),
+      _stage(req_id, operation_name, nullptr) {
+  probes_detail::current_req_id = req_id;
+  probes_detail::current_method = operation_name;
+  if (!tracing_detail::tracer_enabled) {
+    return;
+  }
+  int sampled = tracing_detail::SampledFlag(trace_context, trace_context_len);
+  if (sampled == 0) {
+    return;
+  }
+  std::map<std::string, std::string> carrier;
+  if (trace_context_len > 0) {
+    carrier.emplace(tracing_detail::kTraceContextHeader,
+                    std::string(trace_context, trace_context_len));
+  }
+  Start(carrier, sampled);
+}
+
+void RequestSpan::Start(const std::map<std::string, std::string> &carrier,
+                        int sampled) {
+  auto tracer = opentracing::Tracer::Global();
+  std::unique_ptr<opentracing::SpanContext> parent;
+  if (sampled == 1) {
+    TextMapReader reader(carrier);
+    auto extracted = tracer->Extract(reader);
+    if (extracted) {
+      parent = std::move(*extracted);
+    }
+  }
+  auto span = tracer->StartSpan(_operation_name,
+                                {opentracing::ChildOf(parent.get())});
+  // without a sampled parent the tracer has just made the decision
+  if (!span || (!parent && !tracing_detail::IsSampled(span->context()))) {
+    return;
+  }
+  TextMapWriter writer(_carrier);
+  tracer->Inject(span->context(), writer);
+  _span = std::move(span);
+}
+
+TraceSpan RequestSpan::StartSpan(const char *operation_name) const {
+  SpanStage stage(_stage.req_id(), _operation_name, operation_name);
+  if (!_span) {
+    return TraceSpan(std::move(stage), nullptr);
+  }
+  return TraceSpan(std::move(stage), opentracing::Tracer::Global()->StartSpan(
+      operation_name, {opentracing::ChildOf(&_span->context())}));
+}
+
 void SetUpTracer(
     const std::string &config_file_path,
     const std::string &service) {
+  SetUpLatencyStats(service);
   auto configYAML = YAML::LoadFile(config_file_path);
   auto config = jaegertracing::Config::parse(configYAML);
   auto tracer = jaegertracing::Tracer::make(
       service, config, jaegertracing::logging::consoleLogger());
   opentracing::Tracer::InitGlobal(
       std::static_pointer_cast<opentracing::Tracer>(tracer));
+  tracing_detail::tracer_enabled = !config.disabled();
+}
+
+#else  // DISABLE_TRACING
+
+class TraceSpan {
+ public:
+  explicit TraceSpan(SpanStage stage) : _stage(std::move(stage)) {}
+
+  void Finish() { _stage.Stop(); }
+
+ private:
+  SpanStage _stage;
+};
+
+class RequestSpan {
+ public:
+  RequestSpan(const char *operation_name,
+              const std::map<std::string, std::string> &, int64_t req_id)
+      : _operation_name(operation_name),
+        _stage(req_id, operation_name, nullptr) {
+    probes_detail::current_req_id = req_id;
+    probes_detail::current_method = operation_name;
+  }
+  RequestSpan(const char *operation_name, const char *, size_t,
+              int64_t req_id)
+      : _operation_name(operation_name),
+        _stage(req_id, operation_name, nullptr) {
+    probes_detail::current_req_id = req_id;
+    probes_detail::current_method = operation_name;
+  }
+  RequestSpan(const RequestSpan&) = delete;
+  RequestSpan& operator=(const RequestSpan&) = delete;
+
+  bool sampled() const { return false; }
+  const std::map<std::string, std::string> &carrier() const {
+    static const std::map<std::string, std::string> empty;
+    return empty;
+  }
+  TraceSpan StartSpan(const char *operation_name) const {
+    return TraceSpan(
+        SpanStage(_stage.req_id(), _operation_name, operation_name));
+  }
+  void Finish() { _stage.Stop(); }
+
+ private:
+  const char *_operation_name;
+  SpanStage _stage;
+};
+
+void SetUpTracer(const std::string &, const std::string &service) {
+  SetUpLatencyStats(service);
 }
 
+#endif // DISABLE_TRACING
 
 } //namespace social_network
 
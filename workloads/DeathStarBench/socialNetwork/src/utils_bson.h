@@ -0,0 +1,302 @@
+#ifndef SOCIAL_NETWORK_MICROSERVICES_SRC_UTILS_BSON_H_
+#define SOCIAL_NETWORK_MICROSERVICES_SRC_UTILS_BSON_H_
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <bson/bson.h>
+
+#include "../gen-cpp/social_network_types.h"
+
+// Thrift <-> BSON for the structs kept in MongoDB. Decoding walks the
+// document once with a bson_iter_t and writes straight into the Thrift
+// struct, instead of going through bson_as_json and a JSON DOM.
+//
+// Every struct has an AppendBsonFields() / DecodeBsonFields() pair; arrays
+// of structs and whole documents go through the templates below. Decoders
+// skip unknown keys (e.g. "_id") and return false on a field of the wrong
+// type. Integers are accepted as int32, int64 or double.
+
+namespace social_network {
+
+bool BsonIterInt64(const bson_iter_t *iter, int64_t *value) {
+  switch (bson_iter_type(iter)) {
+    case BSON_TYPE_INT64:
+      *value = bson_iter_int64(iter);
+      return true;
+    case BSON_TYPE_INT32:
+      *value = bson_iter_int32(iter);
+      return true;
+    case BSON_TYPE_DOUBLE:
+      *value = static_cast<int64_t>(bson_iter_double(iter));
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool BsonIterString(const bson_iter_t *iter, std::string *value) {
+  if (!BSON_ITER_HOLDS_UTF8(iter)) {
+    return false;
+  }
+  uint32_t len;
+  const char *str = bson_iter_utf8(iter, &len);
+  value->assign(str, len);
+  return true;
+}
+
+void BsonAppendString(bson_t *doc, const char *key, const std::string &value) {
+  bson_append_utf8(doc, key, -1, value.data(), value.size());
+}
+
+// Reads an array of {<id_key>: int64, "timestamp": int64} sub-documents,
+// such as a timeline's "posts" or a user's "followers", in one pass. Stops
+// at the first entry without both fields, as the old
+// bson_iter_find_descendant("<array>.N.<field>") loops did. Returns the
+// number of entries, 0 if `array_key` is missing.
+size_t ReadBsonIdTimestampArray(const bson_t *doc, const char *array_key,
+                                const char *id_key,
+                                std::vector<int64_t> *ids,
+                                std::vector<int64_t> *timestamps) {
+  bson_iter_t iter;
+  bson_iter_t array;
+  if (!bson_iter_init_find(&iter, doc, array_key) ||
+      !BSON_ITER_HOLDS_ARRAY(&iter) || !bson_iter_recurse(&iter, &array)) {
+    return 0;
+  }
+  // upper bound from the array's size: an entry takes at least
+  // type + "N\0" + document header + the two int64 elements
+  uint32_t array_len;
+  const uint8_t *array_data;
+  bson_iter_array(&iter, &array_len, &array_data);
+  size_t min_entry_len = 3 + 5 + (2 + strlen(id_key) + 8) + (2 + 9 + 8);
+  ids->reserve(ids->size() + array_len / min_entry_len);
+  timestamps->reserve(timestamps->size() + array_len / min_entry_len);
+
+  size_t n = 0;
+  while (bson_iter_next(&array)) {
+    bson_iter_t entry;
+    if (!BSON_ITER_HOLDS_DOCUMENT(&array) ||
+        !bson_iter_recurse(&array, &entry)) {
+      break;
+    }
+    bool has_id = false;
+    bool has_timestamp = false;
+    int64_t id;
+    int64_t timestamp;
+    while (bson_iter_next(&entry)) {
+      const char *key = bson_iter_key(&entry);
+      if (!has_id && strcmp(key, id_key) == 0) {
+        if (!BSON_ITER_HOLDS_INT64(&entry)) {
+          break;
+        }
+        id = bson_iter_int64(&entry);
+        has_id = true;
+      } else if (!has_timestamp && strcmp(key, "timestamp") == 0) {
+        if (!BSON_ITER_HOLDS_INT64(&entry)) {
+          break;
+        }
+        timestamp = bson_iter_int64(&entry);
+        has_timestamp = true;
+      }
+    }
+    if (!has_id || !has_timestamp) {
+      break;
+    }
+    ids->push_back(id);
+    timestamps->push_back(timestamp);
+    n++;
+  }
+  return n;
+}
+
+template <typename T>
+bool DecodeBsonDocument(const bson_iter_t *iter, T *value) {
+  bson_iter_t child;
+  if (!BSON_ITER_HOLDS_DOCUMENT(iter) || !bson_iter_recurse(iter, &child)) {
+    return false;
+  }
+  return DecodeBsonFields(&child, value);
+}
+
+template <typename T>
+bool DecodeBsonArray(const bson_iter_t *iter, std::vector<T> *values) {
+  bson_iter_t child;
+  if (!BSON_ITER_HOLDS_ARRAY(iter) || !bson_iter_recurse(iter, &child)) {
+    return false;
+  }
+  values->clear();
+  while (bson_iter_next(&child)) {
+    values->emplace_back();
+    if (!DecodeBsonDocument(&child, &values->back())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename T>
+void AppendBsonDocument(bson_t *doc, const char *key, const T &value) {
+  bson_t child;
+  bson_append_document_begin(doc, key, -1, &child);
+  AppendBsonFields(&child, value);
+  bson_append_document_end(doc, &child);
+}
+
+template <typename T>
+void AppendBsonArray(bson_t *doc, const char *key,
+                     const std::vector<T> &values) {
+  bson_t array;
+  const char *idx_key;
+  char buf[16];
+  bson_append_array_begin(doc, key, -1, &array);
+  for (uint32_t i = 0; i < values.size(); i++) {
+    bson_uint32_to_string(i, &idx_key, buf, sizeof buf);
+    AppendBsonDocument(&array, idx_key, values[i]);
+  }
+  bson_append_array_end(doc, &array);
+}
+
+// Decodes a top-level document, e.g. one returned by mongoc_cursor_next().
+template <typename T>
+bool DecodeBson(const bson_t *doc, T *value) {
+  bson_iter_t iter;
+  if (!bson_iter_init(&iter, doc)) {
+    return false;
+  }
+  return DecodeBsonFields(&iter, value);
+}
+
+
+void AppendBsonFields(bson_t *doc, const Media &media) {
+  BSON_APPEND_INT64(doc, "media_id", media.media_id);
+  BsonAppendString(doc, "media_type", media.media_type);
+}
+
+bool DecodeBsonFields(bson_iter_t *iter, Media *media) {
+  while (bson_iter_next(iter)) {
+    const char *key = bson_iter_key(iter);
+    bool ok = true;
+    if (strcmp(key, "media_id") == 0) {
+      ok = BsonIterInt64(iter, &media->media_id);
+    } else if (strcmp(key, "media_type") == 0) {
+      ok = BsonIterString(iter, &media->media_type);
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void AppendBsonFields(bson_t *doc, const Url &url) {
+  BsonAppendString(doc, "shortened_url", url.shortened_url);
+  BsonAppendString(doc, "expanded_url", url.expanded_url);
+}
+
+bool DecodeBsonFields(bson_iter_t *iter, Url *url) {
+  while (bson_iter_next(iter)) {
+    const char *key = bson_iter_key(iter);
+    bool ok = true;
+    if (strcmp(key, "shortened_url") == 0) {
+      ok = BsonIterString(iter, &url->shortened_url);
+    } else if (strcmp(key, "expanded_url") == 0) {
+      ok = BsonIterString(iter, &url->expanded_url);
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void AppendBsonFields(bson_t *doc, const UserMention &user_mention) {
+  BSON_APPEND_INT64(doc, "user_id", user_mention.user_id);
+  BsonAppendString(doc, "username", user_mention.username);
+}
+
+bool DecodeBsonFields(bson_iter_t *iter, UserMention *user_mention) {
+  while (bson_iter_next(iter)) {
+    const char *key = bson_iter_key(iter);
+    bool ok = true;
+    if (strcmp(key, "user_id") == 0) {
+      ok = BsonIterInt64(iter, &user_mention->user_id);
+    } else if (strcmp(key, "username") == 0) {
+      ok = BsonIterString(iter, &user_mention->username);
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void AppendBsonFields(bson_t *doc, const Creator &creator) {
+  BSON_APPEND_INT64(doc, "user_id", creator.user_id);
+  BsonAppendString(doc, "username", creator.username);
+}
+
+bool DecodeBsonFields(bson_iter_t *iter, Creator *creator) {
+  while (bson_iter_next(iter)) {
+    const char *key = bson_iter_key(iter);
+    bool ok = true;
+    if (strcmp(key, "user_id") == 0) {
+      ok = BsonIterInt64(iter, &creator->user_id);
+    } else if (strcmp(key, "username") == 0) {
+      ok = BsonIterString(iter, &creator->username);
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void AppendBsonFields(bson_t *doc, const Post &post) {
+  BSON_APPEND_INT64(doc, "post_id", post.post_id);
+  BSON_APPEND_INT64(doc, "timestamp", post.timestamp);
+  BsonAppendString(doc, "text", post.text);
+  BSON_APPEND_INT64(doc, "req_id", post.req_id);
+  BSON_APPEND_INT32(doc, "post_type", post.post_type);
+  AppendBsonDocument(doc, "creator", post.creator);
+  AppendBsonArray(doc, "urls", post.urls);
+  AppendBsonArray(doc, "user_mentions", post.user_mentions);
+  AppendBsonArray(doc, "media", post.media);
+}
+
+bool DecodeBsonFields(bson_iter_t *iter, Post *post) {
+  while (bson_iter_next(iter)) {
+    const char *key = bson_iter_key(iter);
+    bool ok = true;
+    if (strcmp(key, "post_id") == 0) {
+      ok = BsonIterInt64(iter, &post->post_id);
+    } else if (strcmp(key, "timestamp") == 0) {
+      ok = BsonIterInt64(iter, &post->timestamp);
+    } else if (strcmp(key, "text") == 0) {
+      ok = BsonIterString(iter, &post->text);
+    } else if (strcmp(key, "req_id") == 0) {
+      ok = BsonIterInt64(iter, &post->req_id);
+    } else if (strcmp(key, "post_type") == 0) {
+      int64_t post_type = PostType::POST;
+      ok = BsonIterInt64(iter, &post_type);
+      post->post_type = static_cast<PostType::type>(post_type);
+    } else if (strcmp(key, "creator") == 0) {
+      ok = DecodeBsonDocument(iter, &post->creator);
+    } else if (strcmp(key, "urls") == 0) {
+      ok = DecodeBsonArray(iter, &post->urls);
+    } else if (strcmp(key, "user_mentions") == 0) {
+      ok = DecodeBsonArray(iter, &post->user_mentions);
+    } else if (strcmp(key, "media") == 0) {
+      ok = DecodeBsonArray(iter, &post->media);
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace social_network
+
+#endif //SOCIAL_NETWORK_MICROSERVICES_SRC_UTILS_BSON_H_
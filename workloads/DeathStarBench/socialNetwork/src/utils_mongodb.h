@@ -1,24 +1,73 @@
 #ifndef SOCIAL_NETWORK_MICROSERVICES_SRC_UTILS_MONGODB_H_
 #define SOCIAL_NETWORK_MICROSERVICES_SRC_UTILS_MONGODB_H_
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include <mongoc.h>
 #include <bson/bson.h>
 
+#include "../gen-cpp/social_network_types.h"
+#include "logger.h"
+#include "utils.h"
+#include "MongoBatchWriter.h"
+
 #define SERVER_SELECTION_TIMEOUT_MS 300
 
 namespace social_network {
 
+// Connects `num_clients` clients of the pool now rather than on their
+// first request.
+void WarmUpMongoClients(mongoc_client_pool_t *client_pool, int num_clients) {
+  std::vector<mongoc_client_t *> clients;
+  bson_t *ping = BCON_NEW("ping", BCON_INT32(1));
+  for (int i = 0; i < num_clients; i++) {
+    mongoc_client_t *client = mongoc_client_pool_try_pop(client_pool);
+    if (!client) {
+      break;
+    }
+    clients.push_back(client);
+    bson_t reply;
+    bson_error_t error;
+    bool ok = mongoc_client_command_simple(client, "admin", ping, nullptr,
+                                           &reply, &error);
+    bson_destroy(&reply);
+    if (!ok) {
+      LOG(warning) << "Failed to warm up a MongoDB connection: "
+                   << error.message;
+      break;
+    }
+  }
+  for (auto client : clients) {
+    mongoc_client_pool_push(client_pool, client);
+  }
+  bson_destroy(ping);
+}
+
+// "<service_name>-mongodb" may also set "server_selection_timeout_ms" and
+// "min_pool_size", the number of clients connected before the first
+// request.
 mongoc_client_pool_t* init_mongodb_client_pool(
     const json &config_json,
     const std::string &service_name,
     uint32_t max_size
 ) {
-  std::string addr = config_json[service_name + "-mongodb"]["addr"];
-  int port = config_json[service_name + "-mongodb"]["port"];
+  const json &mongodb_config = config_json.at(service_name + "-mongodb");
+  std::string addr = mongodb_config["addr"];
+  int port = mongodb_config["port"];
+  int server_selection_timeout_ms = mongodb_config.value(
+      "server_selection_timeout_ms", SERVER_SELECTION_TIMEOUT_MS);
+  int min_size = mongodb_config.value("min_pool_size", 0);
   std::string uri_str = "mongodb://" + addr + ":" +
       std::to_string(port) + "/?appname=" + service_name + "-service";
   uri_str += "&" MONGOC_URI_SERVERSELECTIONTIMEOUTMS "="
-      + std::to_string(SERVER_SELECTION_TIMEOUT_MS);
+      + std::to_string(server_selection_timeout_ms);
 
   srand(getpid());
 
@@ -35,11 +84,142 @@ mongoc_client_pool_t* init_mongodb_client_pool(
     return nullptr;
   } else {
     mongoc_client_pool_t *client_pool= mongoc_client_pool_new(mongodb_uri);
+    mongoc_uri_destroy(mongodb_uri);
     mongoc_client_pool_max_size(client_pool, max_size);
+    WarmUpMongoClients(client_pool,
+                       std::min<int>(std::max(min_size, 0), max_size));
     return client_pool;
   }
 }
 
+// A client leased from a pool until the lease ends (or Release()).
+// Collection handles are created once per pooled client and reused by every
+// later lease of it.
+//
+//   MongoClientLease mongodb_client(_mongodb_client_pool);
+//   auto collection = mongodb_client.Collection("post", "post");
+//
+// A released client waits for its next lease next to its handles instead of
+// going back to the mongoc pool, which may destroy it and hand out a new
+// client at the same address: the handles live exactly as long as their
+// client.
+class MongoClientLease {
+ public:
+  // Waits like mongoc_client_pool_pop() while every client is leased.
+  explicit MongoClientLease(mongoc_client_pool_t *client_pool);
+  ~MongoClientLease() { Release(); }
+  MongoClientLease(const MongoClientLease&) = delete;
+  MongoClientLease& operator=(const MongoClientLease&) = delete;
+
+  mongoc_client_t *get() const { return _client ? _client->client : nullptr; }
+  // Owned by the client, do not destroy.
+  mongoc_collection_t *Collection(const char *db_name,
+                                  const char *collection_name);
+  void Release();
+
+ private:
+  struct CachedCollection {
+    std::string db_name;
+    std::string collection_name;
+    mongoc_collection_t *collection;
+  };
+  struct CachedClient {
+    mongoc_client_t *client;
+    std::vector<CachedCollection> collections;
+  };
+  // The released clients of one mongoc pool. Pools live as long as the
+  // process, and so do these.
+  struct IdleClients {
+    std::mutex mutex;
+    std::condition_variable released;
+    std::vector<std::unique_ptr<CachedClient>> clients;
+  };
+
+  static IdleClients *IdleClientsOf(mongoc_client_pool_t *client_pool);
+
+  IdleClients *_idle;
+  std::unique_ptr<CachedClient> _client;
+};
+
+MongoClientLease::MongoClientLease(mongoc_client_pool_t *client_pool)
+    : _idle(IdleClientsOf(client_pool)) {
+  std::unique_lock<std::mutex> lock(_idle->mutex);
+  while (_idle->clients.empty()) {
+    // a new client, unless the mongoc pool reached its max size
+    lock.unlock();
+    mongoc_client_t *client = mongoc_client_pool_try_pop(client_pool);
+    lock.lock();
+    if (client) {
+      _client.reset(new CachedClient{client, {}});
+      return;
+    }
+    // retry now and then for clients pushed back to the mongoc pool itself
+    _idle->released.wait_for(lock, std::chrono::milliseconds(1));
+  }
+  _client = std::move(_idle->clients.back());
+  _idle->clients.pop_back();
+}
+
+MongoClientLease::IdleClients *MongoClientLease::IdleClientsOf(
+    mongoc_client_pool_t *client_pool) {
+  static std::mutex mutex;
+  static std::unordered_map<mongoc_client_pool_t *,
+                            std::unique_ptr<IdleClients>> idle_clients;
+  std::lock_guard<std::mutex> lock(mutex);
+  auto &idle = idle_clients[client_pool];
+  if (!idle) {
+    idle.reset(new IdleClients);
+  }
+  return idle.get();
+}
+
+mongoc_collection_t *MongoClientLease::Collection(
+    const char *db_name, const char *collection_name) {
+  // a service uses a handful of collections at most
+  for (auto &cached : _client->collections) {
+    if (cached.collection_name == collection_name &&
+        cached.db_name == db_name) {
+      return cached.collection;
+    }
+  }
+  auto collection = mongoc_client_get_collection(
+      _client->client, db_name, collection_name);
+  _client->collections.push_back({db_name, collection_name, collection});
+  return collection;
+}
+
+void MongoClientLease::Release() {
+  if (_client) {
+    std::lock_guard<std::mutex> lock(_idle->mutex);
+    _idle->clients.push_back(std::move(_client));
+    _idle->released.notify_one();
+  }
+}
+
+// Group-commit writer for `db_name`.`collection_name`, or nullptr unless
+// "<service_name>-service" sets "mongodb_batch_size" above 1. Writes wait
+// at most "mongodb_batch_delay_us" for a batch to fill.
+MongoBatchWriter* init_mongodb_batch_writer(
+    const json &config_json,
+    const std::string &service_name,
+    mongoc_client_pool_t *client_pool,
+    const std::string &db_name,
+    const std::string &collection_name) {
+  auto service_config = config_json.find(service_name + "-service");
+  if (service_config == config_json.end()) {
+    return nullptr;
+  }
+  int batch_size = service_config->value("mongodb_batch_size", 0);
+  int delay_us = service_config->value("mongodb_batch_delay_us", 500);
+  if (batch_size <= 1) {
+    return nullptr;
+  }
+  LOG(info) << "Batching writes to " << db_name << "." << collection_name
+            << " (up to " << batch_size << " per " << delay_us << "us)";
+  return new MongoBatchWriter(client_pool, db_name, collection_name,
+                              batch_size, delay_us);
+}
+
 bool CreateIndex(
     mongoc_client_t *client,
     const std::string &db_name,
@@ -1,6 +1,7 @@
 #!/usr/bin/env python
 import pika
 import json
+import struct
 
 credentials = pika.PlainCredentials('guest', 'guest')
 connection = pika.BlockingConnection(
@@ -21,6 +22,12 @@ msg_json = {
 
 msg = json.dumps(msg_json)
 
+channel.basic_publish(exchange='', routing_key='write-home-timeline', body=msg)
+
+# The same message in the binary format: format 1, no trace context, three
+# mentions, then req_id, post_id, user_id, timestamp and the mention ids
+msg = struct.pack('<BBHIqqqq3q', 1, 0, 0, 3, 1, 1, 1, 1, 0, 2, 3)
+
 channel.basic_publish(exchange='', routing_key='write-home-timeline', body=msg)
 print(" [x] Sent 'Hello World!'")
 connection.close()
\ No newline at end of file